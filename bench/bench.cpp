@@ -0,0 +1,2470 @@
+/*
+ * Copyright (c) 2019 Dmytro Shestakov
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "benchmark.h"
+#include "ambient.h"
+#include "animation.h"
+#include "clock_impl.h"
+#include "configwatcher.h"
+#include "display.h"
+#include "frameexport.h"
+#include "graph.h"
+#include "history.h"
+#include "metrics.h"
+#include "pixelkernels.h"
+#include "pushwidget.h"
+#include "reactor.h"
+#include "recorder.h"
+#include "samplestore.h"
+#include "sensors.h"
+#include "softcanvas.h"
+#include "ticker.h"
+#include "warmcache.h"
+
+#include <fcntl.h>
+#include <cmath>
+#include <cstring>
+#include <ctime>
+#include <fstream>
+#include <getopt.h>
+#include <numeric>
+#include <sys/socket.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <random>
+#include <signal.h>
+#include <tuple>
+#include <sys/utsname.h>
+#include <thread>
+#include <unistd.h>
+
+using std::string;
+using std::vector;
+using std::filesystem::path;
+using namespace std::string_literals;
+
+namespace {
+
+    constexpr int PANEL_WIDTH = 192;
+    constexpr int PANEL_HEIGHT = 64;
+
+    struct FakeDevice {
+        const char* name;
+        vector<std::pair<const char*, const char*>> values;
+        vector<std::pair<const char*, const char*>> attributes;
+    };
+
+    const FakeDevice FAKE_DEVICES[] = {
+        { "bh1750", {{ "in_illuminance_raw", "412" }}, {{ "in_illuminance_scale", "0.833333" }} },
+        { "bmp280", {{ "in_pressure_input", "101.325000" }, { "in_temp_input", "23450" }}, {} },
+        { "1-0040", {{ "in_humidityrelative_raw", "27852" }, { "in_temp_raw", "25800" }},
+                    {{ "in_humidityrelative_scale", "1.525878906" }, { "in_temp_scale", "2.517700195" },
+                     { "in_temp_offset", "-15887.515151" }} },
+    };
+
+    // Emulates /sys/bus/iio/devices with the first deviceCount entries of FAKE_DEVICES
+    path CreateSensorsRoot(const path& base, size_t deviceCount)
+    {
+        path root = base / ("iio" + std::to_string(deviceCount));
+        for(size_t i = 0; i < deviceCount; ++i) {
+            path device = root / ("iio:device" + std::to_string(i));
+            std::filesystem::create_directories(device);
+            std::ofstream{device / "name"} << FAKE_DEVICES[i].name << '\n';
+            for(const auto& list : { FAKE_DEVICES[i].values, FAKE_DEVICES[i].attributes }) {
+                for(const auto& [file, value] : list) {
+                    std::ofstream{device / file} << value << '\n';
+                }
+            }
+        }
+        return root;
+    }
+
+    YAML::Node CreateConfig(const path& sensorsRoot)
+    {
+        YAML::Node config = YAML::Load(R"(
+            clock:
+              font: fonts-aux/hoog36.bdf
+              color: [255, 255, 50]
+              format: "%H:%M"
+              position: [67, 0]
+            sensors:
+              font: fonts/6x13B.bdf
+              position: [0, 0]
+              1-0040: [50, 255, 0]
+              bmp280: [255, 0, 255]
+              bh1750: [0, 255, 255]
+        )");
+        config["sensors"]["root"] = sensorsRoot.string();
+        return config;
+    }
+
+    void AddCacheCounters(BenchResult& result, const SpriteCache::Stats& stats)
+    {
+        result.counters["cache_hit_rate"] = double(stats.hits) / double(std::max<uint64_t>(stats.hits + stats.misses, 1));
+        result.counters["cache_bytes"] = double(stats.bytes);
+    }
+
+    void BenchClock(BenchRunner& runner, const Options& options, SoftCanvas& canvas)
+    {
+        MainWidget parent;
+        Clock clock{options, parent};
+        clock.Update();
+        if(BenchResult* result = runner.Run("clock/draw/hoog36", [&] { clock.Draw(&canvas); }); result) {
+            AddCacheCounters(*result, clock.GetCacheStats());
+        }
+        runner.Run("clock/update", [&] { clock.Update(); });
+    }
+
+    void BenchSensorHub(BenchRunner& runner, const path& dataDir, const path& tmpDir, SoftCanvas& canvas)
+    {
+        size_t sensors = 0;
+        for(size_t devices = 1; devices <= std::size(FAKE_DEVICES); ++devices) {
+            sensors += FAKE_DEVICES[devices - 1].values.size();
+            const string name = "sensorhub/draw/sensors_" + std::to_string(sensors);
+            if(!runner.IsEnabled(name)) {
+                continue;
+            }
+            Options options{dataDir, CreateConfig(CreateSensorsRoot(tmpDir, devices))};
+            auto parent = std::make_unique<MainWidget>();
+            auto hub = std::make_unique<SensorHub>(options, *parent);
+            // Stops before the hub goes
+            Reactor reactor;
+            hub->Start(reactor);
+            reactor.Start();
+            // Let the reactor complete the first reading
+            std::this_thread::sleep_for(std::chrono::milliseconds{100});
+            hub->Update();
+            if(BenchResult* result = runner.Run(name, [&] { hub->Draw(&canvas); }); result) {
+                AddCacheCounters(*result, hub->GetCacheStats());
+            }
+        }
+    }
+
+    // Poll path of a raw sensor with scale and offset, the value alternates so it is formatted every time
+    void BenchSensorRead(BenchRunner& runner, const path& tmpDir)
+    {
+        static constexpr size_t READS = 1000;
+        const string name = "sensor/read";
+        if(!runner.IsEnabled(name)) {
+            return;
+        }
+        const path device = CreateSensorsRoot(tmpDir, std::size(FAKE_DEVICES)) / "iio:device2";
+        Sensor sensor{{ "hdc1080", "1-0040", SensorType::TEMPERATURE, "in_temp_raw", device }, {0, 0}, {}, {}};
+        const int fd = open((device / "in_temp_raw").c_str(), O_WRONLY);
+        if(fd < 0) {
+            std::cerr << "Couldn't open the fake sensor" << std::endl;
+            return;
+        }
+        static const char values[][7] = { "25800\n", "25900\n" };
+        size_t n = 0;
+        const auto read = [&] {
+            [[maybe_unused]] auto result = pwrite(fd, values[++n % 2], 6, 0);
+            sensor.ReadValue();
+        };
+        BenchResult* result = runner.Run(name, read);
+        // Measured apart from the runner, which allocates its samples on this thread
+        const uint64_t allocations = GetThreadAllocations();
+        for(size_t i = 0; i < READS; ++i) {
+            read();
+        }
+        const double allocationsPerRead = double(GetThreadAllocations() - allocations) / READS;
+        close(fd);
+        if(result) {
+            // None once the file is open
+            runner.Check(*result, "allocations_per_read", allocationsPerRead);
+            result->counters["value"] = sensor.GetValue();
+        }
+    }
+
+    // Independent cadences: the light sensor is read every 20 ms, the others keep the default period.
+    // A timeout no read can meet stands in for a stuck one, its values have to be dropped
+    void BenchSensorCadence(BenchRunner& runner, const path& dataDir, const path& tmpDir)
+    {
+        const string name = "sensor/poll/cadence";
+        if(!runner.IsEnabled(name)) {
+            return;
+        }
+        YAML::Node config = CreateConfig(CreateSensorsRoot(tmpDir / "cadence", std::size(FAKE_DEVICES)));
+        config["sensors"]["bh1750"] = YAML::Load("{ color: [0, 255, 255], interval: 0.02 }");
+        config["sensors"]["1-0040"] = YAML::Load("{ color: [50, 255, 0], timeout: 1e-9 }");
+        Options options{dataDir, config};
+        auto parent = std::make_unique<MainWidget>();
+        auto hub = std::make_unique<SensorHub>(options, *parent);
+        Reactor reactor;
+        hub->Start(reactor);
+        reactor.Start();
+        std::this_thread::sleep_for(std::chrono::milliseconds{500});
+        reactor.Stop();
+
+        vector<double> latencies;
+        std::map<string, double> counters;
+        for(Sensor& sensor : hub->GetSensors()) {
+            const Sensor::ReadStats stats = sensor.GetReadStats();
+            const string key = string{sensor.GetName()} + "/" + sensor.GetChannel();
+            counters["reads/" + key] = double(stats.reads);
+            counters["timeouts/" + key] = double(stats.timeouts);
+            counters["shown/" + key] = sensor.GetVersion();
+            latencies.push_back(double(stats.totalLatency.count()) / double(std::max<uint64_t>(stats.reads, 1)));
+        }
+        runner.AddSamples(name, latencies).counters = counters;
+    }
+
+    // Decoding failures over hand-made scan samples
+    double CheckScanTypes()
+    {
+        struct Case {
+            const char* type;
+            vector<uint8_t> bytes;
+            int64_t expected;
+        };
+        const Case cases[] = {
+            { "le:s16/16>>0", { 0x00, 0x80 }, -32768 },
+            { "le:u16/16>>0", { 0xCC, 0x6C }, 27852 },
+            { "be:s12/16>>4", { 0xFF, 0xF0 }, -1 },
+            { "be:u12/16>>4", { 0x12, 0x34 }, 0x123 },
+            { "le:s24/32>>8", { 0x00, 0x00, 0x00, 0x80 }, -8388608 },
+            { "be:u8/8>>0", { 0xAB }, 0xAB },
+            { "le:s64/64>>0", { 0xFE, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF }, -2 },
+        };
+        double errors = 0;
+        for(const Case& test : cases) {
+            ScanType type;
+            errors += !ScanType::Parse(test.type, type) || type.Decode(test.bytes.data()) != test.expected;
+        }
+        ScanType type;
+        for(const char* malformed : { "", "xe:s16/16>>0", "le:s16/16", "le:s17/16>>0", "le:u12/12>>0", "le:s8/8>>1" }) {
+            errors += ScanType::Parse(malformed, type);
+        }
+        return errors;
+    }
+
+    // Scan written into a FIFO standing in for /dev/iio:deviceN until SensorHub has a new value
+    void BenchSensorStream(BenchRunner& runner, const path& dataDir, const path& tmpDir)
+    {
+        const string name = "sensor/stream";
+        if(!runner.IsEnabled(name)) {
+            return;
+        }
+        const path root = CreateSensorsRoot(tmpDir / "stream", std::size(FAKE_DEVICES));
+        const path device = root / "iio:device2";
+        std::filesystem::create_directories(device / "scan_elements");
+        std::filesystem::create_directories(device / "buffer");
+        const std::pair<const char*, int> channels[] = { { "in_humidityrelative", 0 }, { "in_temp", 1 } };
+        for(const auto& [channel, index] : channels) {
+            std::ofstream{device / "scan_elements" / (channel + "_type"s)} << "le:u16/16>>0\n";
+            std::ofstream{device / "scan_elements" / (channel + "_index"s)} << index << '\n';
+        }
+        const path devRoot = tmpDir / "dev";
+        std::filesystem::create_directories(devRoot);
+        if(mkfifo((devRoot / "iio:device2").c_str(), 0600)) {
+            std::cerr << "Couldn't create the fake chardev" << std::endl;
+            return;
+        }
+        YAML::Node config = CreateConfig(root);
+        config["sensors"]["stream"] = true;
+        config["sensors"]["dev"] = devRoot.string();
+        Options options{dataDir, config};
+        auto parent = std::make_unique<MainWidget>();
+        auto hub = std::make_unique<SensorHub>(options, *parent);
+        Reactor reactor;
+        hub->Start(reactor);
+        reactor.Start();
+        const int fd = open((devRoot / "iio:device2").c_str(), O_WRONLY);
+        if(fd < 0) {
+            std::cerr << "Couldn't open the fake chardev" << std::endl;
+            return;
+        }
+        // Humidity and two temperatures far enough apart to change the displayed text
+        static const uint8_t scans[][4] = { { 0xCC, 0x6C, 0xC8, 0x64 }, { 0xCC, 0x6C, 0x2C, 0x65 } };
+        size_t n = 0;
+        hub->Update();
+        BenchResult* result = runner.Run(name, [&] {
+            [[maybe_unused]] auto written = write(fd, scans[++n % 2], sizeof(scans[0]));
+            while(!hub->Update()) {
+                std::this_thread::yield();
+            }
+        });
+        close(fd);
+        if(result) {
+            result->counters["scan_type_errors"] = CheckScanTypes();
+        }
+    }
+
+    // One producer thread pushing as fast as it can, the bench thread pops. Items carry a sequence
+    // number in start, any gap or reordering counts as a mismatch
+    void BenchHistoryRing(BenchRunner& runner)
+    {
+        static constexpr size_t ITEMS = 1 << 16;
+        const string name = "history/ring/spsc";
+        if(!runner.IsEnabled(name)) {
+            return;
+        }
+        auto ring = std::make_unique<SensorHistory::Ring>();
+        double mismatches = 0;
+        double fullPushes = 0;
+        BenchResult* result = runner.Run(name, [&] {
+            std::thread producer{[&] {
+                for(size_t i = 0; i < ITEMS; ++i) {
+                    const HistoryBucket bucket{int64_t(i), 0, 0, float(i), 1};
+                    // Yields, a single core machine would spin out the whole time slice otherwise
+                    while(!ring->Push(bucket)) {
+                        ++fullPushes;
+                        std::this_thread::yield();
+                    }
+                }
+            }};
+            HistoryBucket bucket;
+            for(size_t next = 0; next < ITEMS; ) {
+                if(!ring->Pop(bucket)) {
+                    std::this_thread::yield();
+                    continue;
+                }
+                mismatches += bucket.start != int64_t(next);
+                ++next;
+            }
+            producer.join();
+        });
+        if(result) {
+            result->counters["mitems_per_s"] = double(ITEMS) / result->meanNs * 1e3;
+            runner.Check(*result, "mismatches", mismatches);
+            result->counters["full_rate"] = fullPushes / std::max(fullPushes + double(ITEMS) * double(result->iterations), 1.0);
+        }
+    }
+
+    // A column per raw sample on every sensor. The incremental path must leave the same layer as a full draw
+    void BenchGraph(BenchRunner& runner, const path& dataDir, const path& tmpDir)
+    {
+        if(!runner.IsEnabled("graph/")) {
+            return;
+        }
+        YAML::Node config = CreateConfig(CreateSensorsRoot(tmpDir, std::size(FAKE_DEVICES)));
+        // The timers make their first reading only, the benchmark is the producer from then on
+        config["sensors"]["period"] = 1e6;
+        config["graph"] = YAML::Load("{ position: [67, 40], size: [125, 24], tier: raw }");
+        Options options{dataDir, config};
+        auto parent = std::make_unique<MainWidget>();
+        auto hub = std::make_unique<SensorHub>(options, *parent);
+        {
+            Reactor reactor;
+            hub->Start(reactor);
+            reactor.Start();
+            std::this_thread::sleep_for(std::chrono::milliseconds{100});
+        }
+        GraphWidget graph{options, *parent, *hub};
+        SoftCanvas layer{PANEL_WIDTH, PANEL_HEIGHT};
+        int64_t time = 0;
+        const auto addSamples = [&] {
+            ++time;
+            for(Sensor& sensor : hub->GetSensors()) {
+                sensor.GetHistory().Add(time, float(time % 17));
+            }
+            graph.Update();
+        };
+        addSamples();
+        graph.Draw(&layer);
+
+        runner.Run("graph/draw/full", [&] {
+            addSamples();
+            layer.Fill(graph.GetBounds(), 0, 0, 0);
+            graph.Draw(&layer);
+        });
+        double changedPixels = 0;
+        double changes = 0;
+        double fullRedraws = 0;
+        BenchResult* result = runner.Run("graph/draw/changes", [&] {
+            addSamples();
+            if(Rect changed; graph.DrawChanges(&layer, changed)) {
+                changedPixels += double(changed.Area());
+                ++changes;
+            }
+            else {
+                ++fullRedraws;
+                layer.Fill(graph.GetBounds(), 0, 0, 0);
+                graph.Draw(&layer);
+            }
+        });
+        if(result) {
+            SoftCanvas reference{PANEL_WIDTH, PANEL_HEIGHT};
+            graph.Draw(&reference);
+            double mismatches = 0;
+            for(int y = 0; y < PANEL_HEIGHT; ++y) {
+                for(int x = 0; x < PANEL_WIDTH; ++x) {
+                    mismatches += memcmp(layer.GetPixel(x, y), reference.GetPixel(x, y), SoftCanvas::BYTES_PER_PIXEL) != 0;
+                }
+            }
+            result->counters["changed_pixels"] = changedPixels / std::max(changes, 1.0);
+            result->counters["full_redraw_rate"] = fullRedraws / std::max(fullRedraws + changes, 1.0);
+            runner.Check(*result, "mismatched_pixels", mismatches);
+        }
+    }
+
+    void BenchSampleStore(BenchRunner& runner, const path& tmpDir)
+    {
+        using Stored = std::tuple<uint32_t, int64_t, float>;
+        static constexpr int64_t START_TIME = 1'600'000'000;
+        const auto loadAll = [](SampleStore& store) {
+            vector<Stored> records;
+            store.Load(0, [&records](uint32_t sensor, int64_t time, float value) {
+                records.emplace_back(sensor, time, value);
+            });
+            return records;
+        };
+        // A sync per hour keeps the disk out of the append timing
+        const auto config = [&tmpDir](const char* name, size_t segmentBytes) {
+            return SampleStore::Config{tmpDir / "store" / name, segmentBytes, size_t{1} << 30, std::chrono::hours{1}};
+        };
+
+        if(runner.IsEnabled("store/append")) {
+            SampleStore store{config("append", 256 * 1024)};
+            const uint32_t key = SampleStore::GetKey("bmp280/in_temp");
+            int64_t time = START_TIME;
+            if(BenchResult* result = runner.Run("store/append", [&] { store.Append(key, ++time, 21.5f); }); result) {
+                result->counters["segments"] = double(store.GetStats().segments);
+            }
+        }
+
+        // A day of five sensors polled every 10 s
+        if(runner.IsEnabled("store/load")) {
+            static constexpr size_t RECORDS = 5 * 8640;
+            const SampleStore::Config loadConfig = config("load", 256 * 1024);
+            {
+                SampleStore store{loadConfig};
+                for(size_t i = 0; i < RECORDS; ++i) {
+                    store.Append(uint32_t(i % 5), START_TIME + int64_t(i / 5) * 10, float(i));
+                }
+            }
+            size_t loaded = 0;
+            BenchResult* result = runner.Run("store/load/records_43200", [&] {
+                SampleStore store{loadConfig};
+                loaded = loadAll(store).size();
+            });
+            if(result) {
+                result->counters["records"] = double(loaded);
+                result->counters["records_per_ms"] = double(loaded) / result->meanNs * 1e6;
+            }
+        }
+
+        // Cuts one segment at a random offset, as a power loss could. Everything before the cut and in the
+        // other segments must come back in order, an append must follow the intact records
+        const string recoveryName = "store/recovery/truncate";
+        if(runner.IsEnabled(recoveryName)) {
+            static constexpr size_t RECORDS = 1000;
+            static constexpr size_t HEADER_BYTES = 64;
+            static constexpr size_t RECORD_BYTES = 16;
+            const SampleStore::Config recoveryConfig = config("recovery", 4096);
+            const size_t perSegment = (recoveryConfig.segmentBytes - HEADER_BYTES) / RECORD_BYTES;
+            vector<Stored> written;
+            {
+                SampleStore store{recoveryConfig};
+                for(size_t i = 0; i < RECORDS; ++i) {
+                    written.emplace_back(uint32_t(i % 3), START_TIME + int64_t(i), float(i) * 0.5f);
+                    store.Append(std::get<0>(written.back()), std::get<1>(written.back()), std::get<2>(written.back()));
+                }
+            }
+            vector<std::pair<path, string>> files;
+            for(const auto& entry : std::filesystem::directory_iterator{recoveryConfig.directory}) {
+                std::ifstream file{entry.path(), std::ios::binary};
+                files.emplace_back(entry.path(), string{std::istreambuf_iterator<char>{file}, {}});
+            }
+            std::sort(files.begin(), files.end());
+
+            std::mt19937 random{7};
+            double failures = 0;
+            double lost = 0;
+            double trials = 0;
+            BenchResult* result = runner.Run(recoveryName, [&] {
+                for(const auto& [file, bytes] : files) {
+                    std::ofstream{file, std::ios::binary | std::ios::trunc} << bytes;
+                }
+                const size_t segment = random() % files.size();
+                const size_t offset = random() % (recoveryConfig.segmentBytes + 1);
+                std::filesystem::resize_file(files[segment].first, offset);
+
+                vector<Stored> expected;
+                for(size_t i = 0; i < written.size(); ++i) {
+                    const size_t index = i % perSegment;
+                    if(i / perSegment != segment || HEADER_BYTES + (index + 1) * RECORD_BYTES <= offset) {
+                        expected.push_back(written[i]);
+                    }
+                }
+                // A cut header makes the whole segment unreadable
+                if(offset < HEADER_BYTES) {
+                    expected.erase(std::remove_if(expected.begin(), expected.end(), [&](const Stored& record) {
+                        return size_t(std::get<1>(record) - START_TIME) / perSegment == segment;
+                    }), expected.end());
+                }
+                SampleStore store{recoveryConfig};
+                const Stored marker{42, START_TIME + int64_t(RECORDS), -1.0f};
+                store.Append(std::get<0>(marker), std::get<1>(marker), std::get<2>(marker));
+                expected.push_back(marker);
+                const vector<Stored> loaded = loadAll(store);
+                failures += loaded != expected;
+                lost += double(written.size() + 1 - loaded.size());
+                ++trials;
+            });
+            if(result) {
+                runner.Check(*result, "failed_recoveries", failures);
+                result->counters["lost_records"] = lost / std::max(trials, 1.0);
+            }
+        }
+
+        // A disk that takes no new segment, here a file size limit below the segment size. The appends
+        // that would rotate must neither throw nor lose what is already stored
+        const string fullName = "store/disk_full";
+        if(runner.IsEnabled(fullName)) {
+            static constexpr size_t APPENDS = 10;
+            const SampleStore::Config fullConfig = config("full", 4096);
+            const size_t perSegment = (fullConfig.segmentBytes - 64) / 16;
+            SampleStore store{fullConfig};
+            for(size_t i = 0; i < perSegment; ++i) {
+                store.Append(1, START_TIME + int64_t(i), float(i));
+            }
+            rlimit limit;
+            getrlimit(RLIMIT_FSIZE, &limit);
+            const rlimit lowered{fullConfig.segmentBytes / 2, limit.rlim_max};
+            const auto previous = signal(SIGXFSZ, SIG_IGN);
+            setrlimit(RLIMIT_FSIZE, &lowered);
+            vector<double> samples;
+            double thrown = 0;
+            for(size_t i = 0; i < APPENDS; ++i) {
+                const auto start = std::chrono::steady_clock::now();
+                try {
+                    store.Append(1, START_TIME + int64_t(perSegment + i), 0.0f);
+                } catch(const std::exception&) {
+                    ++thrown;
+                }
+                samples.push_back(double((std::chrono::steady_clock::now() - start).count()));
+            }
+            setrlimit(RLIMIT_FSIZE, &limit);
+            signal(SIGXFSZ, previous);
+            const size_t loaded = loadAll(store).size();
+            BenchResult& result = runner.AddSamples(fullName, samples);
+            result.counters["dropped"] = double(store.GetStats().dropped);
+            runner.Check(result, "append_exceptions", thrown);
+            runner.Check(result, "lost_records", double(perSegment - loaded));
+        }
+    }
+
+    // Cost on the hot path, and a whole scrape over the socket of a registry the size of a full panel setup
+    void BenchMetrics(BenchRunner& runner, const path& tmpDir)
+    {
+        if(!runner.IsEnabled("metrics/")) {
+            return;
+        }
+        MetricsRegistry registry;
+        Histogram& histogram = registry.AddHistogram("bench_observe_seconds", "Observed by the benchmark");
+        int64_t value = 0;
+        runner.Run("metrics/histogram/observe", [&] { histogram.Observe(value += 997); });
+        std::atomic<uint64_t>& counter = registry.AddCounter("bench_events_total", "Counted by the benchmark");
+        runner.Run("metrics/counter/add", [&] { counter.fetch_add(1, std::memory_order_relaxed); });
+
+        for(int i = 0; i < 16; ++i) {
+            registry.AddHistogram("bench_widget_draw_seconds", "Per widget", "slot=\"" + std::to_string(i) + '"')
+                    .Observe(1000 * i);
+        }
+        const string socketPath = (tmpDir / "metrics.sock").string();
+        MetricsExporter exporter{registry, {socketPath, {}, std::chrono::seconds{15}}};
+        exporter.Start();
+        size_t received = 0;
+        double incomplete = 0;
+        BenchResult* result = runner.Run("metrics/scrape/socket", [&] {
+            const int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+            sockaddr_un address{};
+            address.sun_family = AF_UNIX;
+            memcpy(address.sun_path, socketPath.c_str(), socketPath.size() + 1);
+            if(connect(fd, reinterpret_cast<const sockaddr*>(&address), sizeof(address)) < 0) {
+                close(fd);
+                ++incomplete;
+                return;
+            }
+            string text;
+            char buffer[4096];
+            for(ssize_t length; (length = read(fd, buffer, sizeof(buffer))) > 0; ) {
+                text.append(buffer, size_t(length));
+            }
+            close(fd);
+            received = text.size();
+            // The last family in name order ends the text
+            incomplete += text.find("bench_widget_draw_seconds_count{slot=\"9\"} 1\n") == string::npos;
+        });
+        if(!result) {
+            return;
+        }
+        result->counters["bytes"] = double(received);
+        result->counters["incomplete_scrapes"] = incomplete;
+        // Made while root and started once the privileges are dropped, around the display the way
+        // piclock does it. The file is written by then from a directory the process can't write to
+        if(geteuid()) {
+            return;
+        }
+        const path filePath = tmpDir / "textfile" / "piclock.prom";
+        if(const pid_t child = fork(); !child) {
+            int status = 0;
+            try {
+                MetricsExporter dropped{registry, {{}, filePath, std::chrono::seconds{1}}};
+                // The daemon user, like the matrix library
+                if(setresgid(1, 1, 1) || setresuid(1, 1, 1)) {
+                    _exit(2);
+                }
+                dropped.Start();
+                std::this_thread::sleep_for(std::chrono::milliseconds{200});
+            } catch(const std::exception& e) {
+                std::cerr << e.what() << std::endl;
+                status = 3;
+            }
+            _exit(status);
+        }
+        else if(child > 0) {
+            waitpid(child, nullptr, 0);
+        }
+        std::ifstream file{filePath};
+        const string text{std::istreambuf_iterator<char>{file}, {}};
+        runner.Check(*result, "unprivileged_file_unwritten", text.find("bench_events_total") == string::npos);
+    }
+
+    // Parse, diff and apply of a changed clock node, then the same through inotify with its settle delay.
+    // The new color has to show up in the pixels the clock draws next
+    void BenchConfigReload(BenchRunner& runner, const path& dataDir, const path& tmpDir)
+    {
+        const string name = "config/reload/clock";
+        if(!runner.IsEnabled(name)) {
+            return;
+        }
+        const path configDir = tmpDir / "config";
+        std::filesystem::create_directories(configDir);
+        YAML::Node config = CreateConfig(tmpDir);
+        const auto writeConfig = [&](uint32_t red) {
+            config["clock"]["color"][0] = red;
+            // Replaced like an editor would, the watcher sees IN_MOVED_TO
+            std::ofstream{configDir / "config.yml.new"} << YAML::Dump(config);
+            std::filesystem::rename(configDir / "config.yml.new", configDir / "config.yml");
+        };
+        writeConfig(255);
+        for(const char* font : { "fonts-aux/hoog36.bdf", "fonts/6x13B.bdf" }) {
+            std::filesystem::create_directories((configDir / font).parent_path());
+            std::filesystem::copy_file(dataDir / font, configDir / font, std::filesystem::copy_options::skip_existing);
+        }
+        const Options options{(configDir / "piclock").c_str()};
+        MainWidget parent;
+        Clock clock{options, parent};
+        ConfigWatcher watcher{options};
+        watcher.Subscribe("clock", [&clock](const Options& changed) { clock.Reconfigure(changed); });
+
+        uint32_t red = 0;
+        BenchResult* result = runner.Run(name, [&] {
+            writeConfig(red = (red + 1) % 256);
+            watcher.Reload();
+        });
+        if(!result) {
+            return;
+        }
+        // End to end, the thread is started only now so that the timed reloads have it to themselves
+        watcher.Start();
+        const uint64_t reloads = watcher.GetReloads();
+        const auto start = std::chrono::steady_clock::now();
+        writeConfig(red = 7);
+        while(watcher.GetReloads() == reloads && std::chrono::steady_clock::now() - start < std::chrono::seconds{5}) {
+            std::this_thread::sleep_for(std::chrono::milliseconds{1});
+        }
+        const double latency = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+        SoftCanvas canvas{PANEL_WIDTH, PANEL_HEIGHT};
+        clock.Update();
+        clock.Draw(&canvas);
+        double applied = 0;
+        for(int y = 0; y < PANEL_HEIGHT; ++y) {
+            for(int x = 0; x < PANEL_WIDTH; ++x) {
+                applied += canvas.GetPixel(x, y)[0] == red;
+            }
+        }
+        result->counters["inotify_latency_ms"] = latency;
+        result->counters["pixels_in_new_color"] = applied;
+        result->counters["failures"] = double(watcher.GetFailures());
+    }
+
+    // Whole panel repainted every frame versus repainting only the changed widgets
+    void BenchFrame(BenchRunner& runner, const path& dataDir, const path& tmpDir)
+    {
+        if(!runner.IsEnabled("frame/")) {
+            return;
+        }
+        Options options{dataDir, CreateConfig(CreateSensorsRoot(tmpDir, std::size(FAKE_DEVICES)))};
+        // The hub requests updates from its own parent, so its first reading doesn't add frames
+        auto parent = std::make_unique<MainWidget>();
+        auto mainWidget = std::make_unique<MainWidget>();
+        WidgetPtr clock = std::make_unique<Clock>(options, *parent);
+        auto sensorHub = std::make_unique<SensorHub>(options, *parent);
+        {
+            Reactor reactor;
+            sensorHub->Start(reactor);
+            reactor.Start();
+            std::this_thread::sleep_for(std::chrono::milliseconds{100});
+        }
+        WidgetPtr hub = std::move(sensorHub);
+        BaseWidget* widgets[] = { hub.get(), clock.get() };
+        mainWidget->AddWidgets(hub, clock);
+
+        SoftCanvas canvas{PANEL_WIDTH, PANEL_HEIGHT};
+        runner.Run("frame/full_repaint", [&] {
+            canvas.Fill(0, 0, 0);
+            for(BaseWidget* widget : widgets) {
+                widget->Update();
+                widget->Draw(&canvas);
+            }
+        });
+        double damagedPixels = 0;
+        uint64_t frames = 0;
+        BenchResult* result = runner.Run("frame/dirty_rect", [&] {
+            mainWidget->RequestUpdate();
+            mainWidget->Draw(&canvas);
+            for(const Rect& rect : mainWidget->GetDamage()) {
+                damagedPixels += double(rect.Area());
+            }
+            ++frames;
+        });
+        if(result) {
+            result->counters["damaged_pixels_per_frame"] = damagedPixels / double(frames);
+        }
+    }
+
+    // Rasterizes a new counter text on every update, stands in for heavy widgets
+    class CounterWidget : public WidgetWrapper {
+    public:
+        CounterWidget(BaseWidget& parent, const FontFace& font, int x, int y) : WidgetWrapper{parent},
+            font_{font}, x_{x}, y_{y}
+        { }
+
+        bool Update() final {
+            sprite_ = std::make_unique<Sprite>(font_, std::to_string(++counter_), rgb_matrix::Color{255, 255, 255});
+            return true;
+        }
+        void Draw(rgb_matrix::Canvas* canvas) final {
+            sprite_->Blit(canvas, x_, y_);
+        }
+        Rect GetBounds() const final {
+            return sprite_ ? Rect{x_, y_, sprite_->width(), sprite_->height()} : Rect{};
+        }
+    private:
+        const FontFace& font_;
+        int x_;
+        int y_;
+        unsigned counter_{100000};
+        std::unique_ptr<Sprite> sprite_;
+    };
+
+    // Frame time with every widget changing, drawn on the frame thread only versus the worker pool
+    void BenchLayers(BenchRunner& runner, const Options& options)
+    {
+        if(!runner.IsEnabled("frame/layers/")) {
+            return;
+        }
+        const FontPtr font = LoadFont(options, "fonts-aux/hoog24.bdf");
+        // At least one worker, so that the pool is exercised on single core machines as well
+        for(size_t workers : { 0u, std::max(std::thread::hardware_concurrency(), 2u) - 1 }) {
+            for(size_t widgetCount : { 1, 2, 4, 8, 16 }) {
+                const string name = "frame/layers/widgets_" + std::to_string(widgetCount) + "/workers_" + std::to_string(workers);
+                if(!runner.IsEnabled(name)) {
+                    continue;
+                }
+                MainWidget mainWidget{workers};
+                for(size_t i = 0; i < widgetCount; ++i) {
+                    WidgetPtr widget = std::make_unique<CounterWidget>(mainWidget, *font, int(i % 4) * 48, int(i / 4) * 16);
+                    mainWidget.AddWidget(widget);
+                }
+                SoftCanvas canvas{PANEL_WIDTH, PANEL_HEIGHT};
+                BenchResult* result = runner.Run(name, [&] {
+                    mainWidget.RequestUpdate();
+                    mainWidget.Draw(&canvas);
+                });
+                if(result) {
+                    result->counters["widgets"] = double(widgetCount);
+                    result->counters["workers"] = double(workers);
+                }
+            }
+        }
+    }
+
+    // Redraws the same text on every update, the frame comes out identical
+    class RepeatWidget : public WidgetWrapper {
+    public:
+        RepeatWidget(BaseWidget& parent, const FontFace& font) : WidgetWrapper{parent}, font_{font}
+        { }
+
+        bool Update() final {
+            sprite_ = std::make_unique<Sprite>(font_, "12:34", rgb_matrix::Color{255, 255, 50});
+            return true;
+        }
+        void Draw(rgb_matrix::Canvas* canvas) final {
+            sprite_->Blit(canvas, 67, 0);
+        }
+        Rect GetBounds() const final {
+            return sprite_ ? Rect{67, 0, sprite_->width(), sprite_->height()} : Rect{};
+        }
+    private:
+        const FontFace& font_;
+        std::unique_ptr<Sprite> sprite_;
+    };
+
+    // A wake that changes nothing on the panel, presented versus held back by the idle filter.
+    // The headless display waits for a 100 Hz vsync like the panel does
+    void BenchIdle(BenchRunner& runner, const Options& options)
+    {
+        const FontPtr font = LoadFont(options, "fonts-aux/hoog36.bdf");
+        for(const bool filter : { false, true }) {
+            const string name = filter ? "idle/wake/skip" : "idle/wake/present";
+            if(!runner.IsEnabled(name)) {
+                continue;
+            }
+            MainWidget mainWidget{0};
+            WidgetPtr widget = std::make_unique<RepeatWidget>(mainWidget, *font);
+            mainWidget.AddWidget(widget);
+            HeadlessDisplay display{{PANEL_WIDTH, PANEL_HEIGHT, 100, {}, HeadlessDisplay::DumpFormat::PPM, 0}};
+            SoftCanvas frame{PANEL_WIDTH, PANEL_HEIGHT};
+            IdleFilter idle;
+            mainWidget.Draw(&frame);
+            idle.IsChanged(frame, mainWidget.GetDamage());
+            display.Present(frame, mainWidget.GetDamage());
+            uint64_t wakes = 0;
+            timespec start, end;
+            clock_gettime(CLOCK_THREAD_CPUTIME_ID, &start);
+            BenchResult* result = runner.Run(name, [&] {
+                mainWidget.RequestUpdate();
+                mainWidget.Draw(&frame);
+                ++wakes;
+                if(!filter || idle.IsChanged(frame, mainWidget.GetDamage()) || display.HasPendingChanges()) {
+                    display.Present(frame, mainWidget.GetDamage());
+                }
+            });
+            clock_gettime(CLOCK_THREAD_CPUTIME_ID, &end);
+            if(result) {
+                const double cpuNs = double(end.tv_sec - start.tv_sec) * 1e9 + double(end.tv_nsec - start.tv_nsec);
+                result->counters["cpu_us_per_wake"] = cpuNs / 1e3 / double(wakes);
+                result->counters["skipped_ratio"] = double(idle.GetSkipped()) / double(wakes);
+                result->counters["presented"] = double(display.GetFrameCount());
+            }
+        }
+    }
+
+    // A pixel of its own that changes on every update, cheap enough for the calls to it to show
+    template<int N>
+    class DotWidget final : public WidgetWrapper {
+    public:
+        using WidgetWrapper::WidgetWrapper;
+        bool Update() final {
+            return true;
+        }
+        void Draw(rgb_matrix::Canvas* canvas) final {
+            Set(canvas);
+        }
+        bool DrawChanges(rgb_matrix::Canvas* canvas, Rect& changed) final {
+            Set(canvas);
+            changed = GetBounds();
+            return true;
+        }
+        Rect GetBounds() const final {
+            return {N * 8, N, 1, 1};
+        }
+    private:
+        uint8_t value_{};
+
+        void Set(rgb_matrix::Canvas* canvas) {
+            ++value_;
+            canvas->SetPixel(N * 8, N, value_, value_, value_);
+        }
+    };
+
+    template<size_t... I>
+    void AddDots(MainWidget& mainWidget, std::index_sequence<I...>)
+    {
+        WidgetPtr widgets[] = { std::make_unique<DotWidget<int(I)>>(mainWidget)... };
+        for(WidgetPtr& widget : widgets) {
+            mainWidget.AddWidget(widget);
+        }
+    }
+
+    template<size_t... I>
+    void EmplaceWidgets(vector<WidgetPtr>& widgets, MainWidget& parent, std::index_sequence<I...>)
+    {
+        (widgets.push_back(std::make_unique<DotWidget<int(I)>>(parent)), ...);
+    }
+
+    template<size_t... I>
+    auto MakeDots(MainWidget& parent, std::index_sequence<I...>)
+    {
+        return std::tuple<DotWidget<int(I)>...>{ ((void)I, parent)... };
+    }
+
+    template<typename Container, size_t... I>
+    void EmplaceDots(Container& mainWidget, std::index_sequence<I...>)
+    {
+        (mainWidget.template Emplace<DotWidget<int(I)>>(mainWidget), ...);
+    }
+
+    // The same eight widgets called through BaseWidget and stored inline with their types known
+    void BenchDispatch(BenchRunner& runner)
+    {
+        const auto frame = [&runner](const string& name, MainWidget& mainWidget, size_t widgets) {
+            SoftCanvas canvas{PANEL_WIDTH, PANEL_HEIGHT};
+            mainWidget.Draw(&canvas);
+            BenchResult* result = runner.Run(name, [&] {
+                mainWidget.RequestUpdate();
+                mainWidget.Draw(&canvas);
+            });
+            if(result) {
+                result->counters["widgets"] = double(widgets);
+                result->counters["damage_rects"] = double(mainWidget.GetDamage().size());
+            }
+        };
+        if(runner.IsEnabled("widget/dispatch/dynamic")) {
+            MainWidget mainWidget{0};
+            AddDots(mainWidget, std::make_index_sequence<8>{});
+            frame("widget/dispatch/dynamic", mainWidget, 8);
+        }
+        if(runner.IsEnabled("widget/dispatch/static")) {
+            StaticMainWidget<DotWidget<0>, DotWidget<1>, DotWidget<2>, DotWidget<3>,
+                             DotWidget<4>, DotWidget<5>, DotWidget<6>, DotWidget<7>> mainWidget{0};
+            EmplaceDots(mainWidget, std::make_index_sequence<8>{});
+            frame("widget/dispatch/static", mainWidget, 8);
+        }
+        // Only the calls a frame makes to each child, without the scheduler and the compositing
+        if(runner.IsEnabled("widget/calls/virtual")) {
+            MainWidget parent{0};
+            vector<WidgetPtr> widgets;
+            SoftCanvas canvas{PANEL_WIDTH, PANEL_HEIGHT};
+            EmplaceWidgets(widgets, parent, std::make_index_sequence<8>{});
+            Rect changed;
+            runner.Run("widget/calls/virtual", [&] {
+                for(const WidgetPtr& widget : widgets) {
+                    if(widget->Update() && widget->DrawChanges(&canvas, changed)) {
+                        changed = changed.Union(widget->GetBounds());
+                    }
+                }
+            }, widgets.size());
+        }
+        if(runner.IsEnabled("widget/calls/static")) {
+            MainWidget parent{0};
+            auto widgets = MakeDots(parent, std::make_index_sequence<8>{});
+            SoftCanvas canvas{PANEL_WIDTH, PANEL_HEIGHT};
+            Rect changed;
+            runner.Run("widget/calls/static", [&] {
+                std::apply([&](auto&... widget) {
+                    ((widget.Update() && widget.DrawChanges(&canvas, changed)
+                      && (changed = changed.Union(widget.GetBounds()), true)), ...);
+                }, widgets);
+            }, std::tuple_size_v<decltype(widgets)>);
+        }
+    }
+
+    struct KernelSet {
+        const char* isa;
+        void (*fill)(uint8_t*, size_t, uint8_t, uint8_t, uint8_t);
+        void (*expandMask)(uint8_t*, const uint32_t*, size_t, uint8_t, uint8_t, uint8_t);
+        void (*composite)(uint8_t*, const uint8_t*, size_t);
+        void (*blend)(uint8_t*, const uint8_t*, size_t, uint8_t);
+        void (*scale)(uint8_t*, size_t, uint8_t, uint8_t, uint8_t);
+    };
+
+    // Random pixels, about half of them black
+    vector<uint8_t> RandomPixels(std::mt19937& random, size_t count)
+    {
+        vector<uint8_t> pixels(count * SoftCanvas::BYTES_PER_PIXEL);
+        for(size_t i = 0; i < pixels.size(); i += SoftCanvas::BYTES_PER_PIXEL) {
+            if(random() & 1) {
+                for(size_t c = 0; c < SoftCanvas::BYTES_PER_PIXEL; ++c) {
+                    pixels[i + c] = uint8_t(random());
+                }
+            }
+        }
+        return pixels;
+    }
+
+    // Bytes differing from the scalar reference over odd lengths and every block tail
+    double CheckKernels(const KernelSet& kernels)
+    {
+        const KernelSet reference{ "scalar", pixel::scalar::Fill, pixel::scalar::ExpandMask, pixel::scalar::Composite,
+                                   pixel::scalar::Blend, pixel::scalar::Scale };
+        std::mt19937 random{42};
+        double mismatches = 0;
+        for(size_t count = 0; count <= 100; ++count) {
+            const vector<uint8_t> src = RandomPixels(random, count);
+            const vector<uint8_t> dst = RandomPixels(random, count);
+            vector<uint32_t> mask(count / 32 + 1);
+            for(auto& word : mask) {
+                word = uint32_t(random());
+            }
+            const uint8_t alpha = uint8_t(random());
+            const auto run = [&](const KernelSet& set) {
+                vector<vector<uint8_t>> out(5, dst);
+                set.fill(out[0].data(), count, 1, 2, 3);
+                set.expandMask(out[1].data(), mask.data(), count, 10, 20, 30);
+                set.composite(out[2].data(), src.data(), count);
+                set.blend(out[3].data(), src.data(), count, alpha);
+                set.scale(out[4].data(), count, alpha, 255, 0);
+                return out;
+            };
+            const auto expected = run(reference);
+            const auto actual = run(kernels);
+            for(size_t k = 0; k < expected.size(); ++k) {
+                for(size_t i = 0; i < expected[k].size(); ++i) {
+                    mismatches += expected[k][i] != actual[k][i];
+                }
+            }
+        }
+        return mismatches;
+    }
+
+    // Full panel worth of pixels per call
+    void BenchKernels(BenchRunner& runner)
+    {
+        static constexpr size_t PIXELS = size_t(PANEL_WIDTH) * PANEL_HEIGHT;
+        vector<KernelSet> sets = {
+            { "scalar", pixel::scalar::Fill, pixel::scalar::ExpandMask, pixel::scalar::Composite,
+              pixel::scalar::Blend, pixel::scalar::Scale },
+        };
+        if(string{pixel::GetIsa()} != "scalar") {
+            sets.push_back({ pixel::GetIsa(), pixel::Fill, pixel::ExpandMask, pixel::Composite, pixel::Blend, pixel::Scale });
+        }
+        std::mt19937 random{7};
+        const vector<uint8_t> src = RandomPixels(random, PIXELS);
+        vector<uint8_t> dst = RandomPixels(random, PIXELS);
+        vector<uint32_t> mask(PIXELS / 32);
+        for(auto& word : mask) {
+            word = uint32_t(random());
+        }
+        for(const KernelSet& set : sets) {
+            const string suffix = "/"s + set.isa;
+            const auto addRate = [&](BenchResult* result) {
+                if(result) {
+                    result->counters["mpixels_per_s"] = 1e3 / result->medianNs;
+                }
+                return result;
+            };
+            BenchResult* fill = addRate(runner.Run("kernel/fill" + suffix, [&] {
+                set.fill(dst.data(), PIXELS, 0, 0, 0);
+            }, PIXELS));
+            addRate(runner.Run("kernel/expand_mask" + suffix, [&] {
+                set.expandMask(dst.data(), mask.data(), PIXELS, 255, 255, 50);
+            }, PIXELS));
+            addRate(runner.Run("kernel/composite" + suffix, [&] {
+                set.composite(dst.data(), src.data(), PIXELS);
+            }, PIXELS));
+            addRate(runner.Run("kernel/blend" + suffix, [&] {
+                set.blend(dst.data(), src.data(), PIXELS, 128);
+            }, PIXELS));
+            addRate(runner.Run("kernel/scale" + suffix, [&] {
+                set.scale(dst.data(), PIXELS, 200, 220, 255);
+            }, PIXELS));
+            if(fill && set.fill != pixel::scalar::Fill) {
+                runner.Check(*fill, "mismatched_bytes", CheckKernels(set));
+            }
+        }
+    }
+
+    // Runtime parsed BDF fonts versus the tables compiled into the binary
+    void BenchFonts(BenchRunner& runner, const path& dataDir, SoftCanvas& canvas)
+    {
+        static const char text[] = "0123456789:.%";
+        static constexpr uint64_t glyphs = sizeof(text) - 1;
+        const rgb_matrix::Color color{255, 255, 255};
+        for(const char* fontFile : { "fonts/6x13B.bdf", "fonts-aux/hoog24.bdf", "fonts-aux/hoog36.bdf" }) {
+            const string stem = path{fontFile}.stem().string();
+            runner.Run("font/load/" + stem + "/bdf", [&] {
+                BdfFontFace font;
+                font.LoadFont((dataDir / fontFile).c_str());
+            });
+            BdfFontFace bdfFont;
+            if(!bdfFont.LoadFont((dataDir / fontFile).c_str())) {
+                std::cerr << "Couldn't load font " << fontFile << std::endl;
+                continue;
+            }
+            runner.Run("drawtext/glyph/" + stem + "/bdf", [&] {
+                bdfFont.DrawText(&canvas, 0, bdfFont.baseline(), color, text);
+            }, glyphs);
+
+            const EmbeddedFontData* data = EmbeddedFontFace::Find(fontFile);
+            if(!data) {
+                continue;
+            }
+            runner.Run("font/load/" + stem + "/embedded", [&] {
+                EmbeddedFontFace font{*EmbeddedFontFace::Find(fontFile)};
+            });
+            EmbeddedFontFace embeddedFont{*data};
+            BenchResult* result = runner.Run("drawtext/glyph/" + stem + "/embedded", [&] {
+                embeddedFont.DrawText(&canvas, 0, embeddedFont.baseline(), color, text);
+            }, glyphs);
+            runner.Run("sprite/rasterize/" + stem, [&] {
+                Sprite sprite{embeddedFont, text, color};
+            });
+            SpriteCache cache{64 * 1024};
+            runner.Run("sprite/blit/" + stem, [&] {
+                cache.Get(embeddedFont, text, color).Blit(&canvas, 0, 0);
+            }, glyphs);
+            if(result) {
+                // Both paths have to produce the same pixels
+                SoftCanvas expected{canvas.width(), canvas.height()};
+                SoftCanvas actual{canvas.width(), canvas.height()};
+                bdfFont.DrawText(&expected, 1, bdfFont.baseline(), color, text);
+                embeddedFont.DrawText(&actual, 1, embeddedFont.baseline(), color, text);
+                double mismatches = 0;
+                for(size_t i = 0; i < expected.Size(); ++i) {
+                    mismatches += expected.Data()[i] != actual.Data()[i];
+                }
+                runner.Check(*result, "mismatched_bytes", mismatches);
+            }
+        }
+    }
+
+    // A cold start parses the BDF file, a warm start reads the glyph tables back from the cache file
+    void BenchWarmStart(BenchRunner& runner, const path& dataDir, const path& tmpDir)
+    {
+        const path cacheFile = tmpDir / "piclock.cache";
+        string text;
+        for(char c = ' '; c <= '~'; ++c) {
+            text += c;
+        }
+        const rgb_matrix::Color color{255, 255, 255};
+        for(const char* fontFile : { "fonts/6x13B.bdf", "fonts-aux/hoog36.bdf" }) {
+            const string stem = path{fontFile}.stem().string();
+            const path fontPath = dataDir / fontFile;
+            runner.Run("startup/font/" + stem + "/cold", [&] {
+                FontTable table;
+                table.ParseBdf(fontPath.c_str());
+            });
+            {
+                std::filesystem::remove(cacheFile);
+                WarmCache cache{cacheFile};
+                cache.GetFont(fontPath);
+                cache.Save();
+            }
+            BenchResult* result = runner.Run("startup/font/" + stem + "/warm", [&] {
+                WarmCache cache{cacheFile};
+                cache.GetFont(fontPath);
+            });
+            if(!result) {
+                continue;
+            }
+            WarmCache cache{cacheFile};
+            const FontTablePtr table = cache.GetFont(fontPath);
+            result->counters["cache_hits"] = double(cache.GetStats().hits);
+            BdfFontFace bdfFont;
+            if(!table || !bdfFont.LoadFont(fontPath.c_str())) {
+                std::cerr << "Couldn't load font " << fontFile << std::endl;
+                continue;
+            }
+            // The cached tables have to draw what rgb_matrix::Font draws
+            const TableFontFace tableFont{table};
+            SoftCanvas expected{PANEL_WIDTH * 8, PANEL_HEIGHT};
+            SoftCanvas actual{PANEL_WIDTH * 8, PANEL_HEIGHT};
+            bdfFont.DrawText(&expected, 1, bdfFont.baseline(), color, text.c_str());
+            tableFont.DrawText(&actual, 1, tableFont.baseline(), color, text.c_str());
+            double mismatches = 0;
+            for(size_t i = 0; i < expected.Size(); ++i) {
+                mismatches += expected.Data()[i] != actual.Data()[i];
+            }
+            runner.Check(*result, "mismatched_bytes", mismatches);
+        }
+    }
+
+    // A day of bh1750 readings every 10 s: dark night, dawn, noisy daylight, a lamp in the evening
+    vector<double> CreateLuxTrace()
+    {
+        static constexpr int READINGS = 24 * 360;
+        std::mt19937 random{7};
+        std::normal_distribution<double> noise{0, 0.08};
+        vector<double> trace;
+        for(int i = 0; i < READINGS; ++i) {
+            const double hour = i / 360.0;
+            double lux = 0.2;
+            if(hour >= 6 && hour < 20) {
+                // Daylight peaks at noon, 300 lux indoors
+                lux = std::max(lux, 300 * std::pow(std::sin((hour - 6) / 14 * M_PI), 2));
+            }
+            if(hour >= 18 && hour < 23) {
+                lux += 60;
+            }
+            trace.push_back(lux * std::pow(10.0, noise(random)));
+        }
+        return trace;
+    }
+
+    void BenchAmbient(BenchRunner& runner)
+    {
+        const string name = "ambient/trace/day";
+        if(!runner.IsEnabled(name)) {
+            return;
+        }
+        const vector<double> trace = CreateLuxTrace();
+        const BrightnessController::Config config{};
+        const auto replay = [&trace](const BrightnessController::Config& config, auto&& visit) {
+            BrightnessController controller{config, config.brightnessHigh};
+            BrightnessController::Output previous = controller.GetOutput();
+            for(size_t i = 0; i < trace.size(); ++i) {
+                const BrightnessController::Output output = controller.Update(trace[i]);
+                visit(i, previous, output);
+                previous = output;
+            }
+        };
+        BenchResult* result = runner.Run(name, [&] {
+            replay(config, [](size_t, const auto&, const auto&) { });
+        }, trace.size());
+        if(!result) {
+            return;
+        }
+        double brightnessChanges = 0, pwmSwitches = 0, outOfRange = 0, darkNight = 0, nights = 0;
+        replay(config, [&](size_t i, const auto& previous, const auto& output) {
+            brightnessChanges += output.brightness != previous.brightness;
+            pwmSwitches += output.pwmBits != previous.pwmBits;
+            outOfRange += output.brightness < config.brightnessLow || output.brightness > config.brightnessHigh;
+            // Past the first hour the smoothing has settled
+            if(i >= 360 && i < 5 * 360) {
+                ++nights;
+                darkNight += output.pwmBits == config.darkPwmBits;
+            }
+        });
+        // The same trace followed reading by reading
+        BrightnessController::Config raw = config;
+        raw.smoothing = 1;
+        raw.hysteresis = 1;
+        double rawChanges = 0;
+        replay(raw, [&](size_t, const auto& previous, const auto& output) {
+            rawChanges += output.brightness != previous.brightness;
+        });
+        result->counters["brightness_changes"] = brightnessChanges;
+        result->counters["brightness_changes_unfiltered"] = rawChanges;
+        result->counters["pwm_switches"] = pwmSwitches;
+        result->counters["out_of_range"] = outOfRange;
+        result->counters["dark_pwm_at_night"] = darkNight / nights;
+    }
+
+    // Parent that only counts the updates its child scheduled
+    class ScheduleProbe final : public BaseWidget {
+    public:
+        void Draw(rgb_matrix::Canvas*) final
+        { }
+        void RequestUpdate() final
+        { }
+        void ScheduleUpdate(TimePoint) final {
+            ++scheduled_;
+        }
+        uint64_t GetScheduled() const {
+            return scheduled_;
+        }
+    private:
+        uint64_t scheduled_{};
+    };
+
+    // A scrolling frame blits a window of the pre-rendered strip instead of drawing the text again
+    void BenchTicker(BenchRunner& runner, const Options& options)
+    {
+        const string text = "Outside 12.5 C, humidity 64 %, pressure 1013 hPa, CO2 612 ppm";
+        FontPtr font = LoadFont(options, "fonts/6x13B.bdf");
+        if(!font) {
+            return;
+        }
+        const rgb_matrix::Color color{255, 128, 0};
+        const Sprite strip{*font, text, color};
+        const Rect window{0, 0, PANEL_WIDTH, font->height()};
+        const int lap = strip.width() + 24;
+        SoftCanvas canvas{PANEL_WIDTH, PANEL_HEIGHT};
+        const auto drawBlit = [&](SoftCanvas& target, int offset) {
+            target.Fill(window, 0, 0, 0);
+            for(int x = window.x - offset; x < window.Right(); x += lap) {
+                strip.Blit(&target, x, window.y, window);
+            }
+        };
+        const auto drawText = [&](SoftCanvas& target, int offset) {
+            target.Fill(window, 0, 0, 0);
+            for(int x = window.x - offset; x < window.Right(); x += lap) {
+                font->DrawText(&target, x, window.y + font->baseline(), color, text.c_str());
+            }
+        };
+        int offset = 0;
+        BenchResult* result = runner.Run("animation/ticker/blit", [&] {
+            drawBlit(canvas, offset);
+            offset = (offset + 1) % lap;
+        });
+        runner.Run("animation/ticker/drawtext", [&] {
+            drawText(canvas, offset);
+            offset = (offset + 1) % lap;
+        });
+        if(!result) {
+            return;
+        }
+        // Every offset of a lap has to match the text drawn in place
+        SoftCanvas expected{PANEL_WIDTH, PANEL_HEIGHT};
+        double mismatches = 0;
+        for(offset = 0; offset < lap; ++offset) {
+            drawBlit(canvas, offset);
+            drawText(expected, offset);
+            for(size_t i = 0; i < canvas.Size(); ++i) {
+                mismatches += canvas.Data()[i] != expected.Data()[i];
+            }
+        }
+        runner.Check(*result, "mismatched_bytes", mismatches);
+        result->counters["strip_width"] = strip.width();
+        // The scheduler hands a frame out before its steady due time when the wall clock is set
+        // forward, the ticker has to schedule that frame again or it stops for good
+        YAML::Node config = YAML::Clone(options.GetRoot());
+        config["ticker"] = YAML::Load("{ font: fonts/6x13B.bdf, position: [0, 0], width: 64, color: [255, 128, 0] }");
+        config["ticker"]["text"] = text;
+        ScheduleProbe parent;
+        TickerWidget ticker{Options{options.GetExecDir(), config}, parent};
+        ticker.Update();
+        const uint64_t scheduled = parent.GetScheduled();
+        ticker.Update();
+        runner.Check(*result, "unscheduled_early_frames", parent.GetScheduled() == scheduled);
+    }
+
+    // The system time set to itself, a step back by the time the call takes. Deadlines queued before
+    // a step are off, the scheduler drops them and updates every slot to have them scheduled again
+    void BenchTimeSet(BenchRunner& runner, const Options& options)
+    {
+        using namespace std::chrono_literals;
+        const string name = "scheduler/time_set";
+        if(!runner.IsEnabled(name)) {
+            return;
+        }
+        UpdateScheduler scheduler;
+        // Where the next minute ends up after the clock went back an hour
+        scheduler.Schedule(std::chrono::system_clock::now() + 1h, 1);
+        std::atomic<SlotMask> woken{};
+        std::thread waiter{[&] {
+            SlotMask slots = 0;
+            while(!slots) {
+                slots = scheduler.Wait();
+            }
+            woken = slots;
+        }};
+        // Let it block in poll
+        std::this_thread::sleep_for(50ms);
+        const auto start = std::chrono::steady_clock::now();
+        timespec now;
+        clock_gettime(CLOCK_REALTIME, &now);
+        const bool set = clock_settime(CLOCK_REALTIME, &now) == 0;
+        while(set && !woken && std::chrono::steady_clock::now() - start < 1s) {
+            std::this_thread::sleep_for(1ms);
+        }
+        vector<double> latency{double((std::chrono::steady_clock::now() - start).count())};
+        // Another slot, so that a missed wakeup still fails the check
+        scheduler.Wake(2);
+        waiter.join();
+        if(!set) {
+            std::cerr << "Couldn't set the system time, " << name << " skipped" << std::endl;
+            return;
+        }
+        // The clock woken again within its minute schedules the dropped boundary once more
+        ScheduleProbe parent;
+        Clock clock{options, parent};
+        clock.Update();
+        const uint64_t scheduled = parent.GetScheduled();
+        clock.Update();
+        BenchResult& result = runner.AddSamples(name, latency);
+        runner.Check(result, "slots_not_woken", woken != ALL_SLOTS);
+        runner.Check(result, "clock_unscheduled", parent.GetScheduled() == scheduled);
+    }
+
+    // A scrolling ticker with the minute text changing now and then, the way a recording mostly looks
+    void BenchRecorder(BenchRunner& runner, const Options& options, const path& tmpDir)
+    {
+        if(!runner.IsEnabled("record/")) {
+            return;
+        }
+        FontPtr font = LoadFont(options, "fonts/6x13B.bdf");
+        if(!font) {
+            return;
+        }
+        constexpr size_t FRAMES = 240;
+        const Sprite strip{*font, "Outside 12.5 C, humidity 64 %, pressure 1013 hPa", {255, 128, 0}};
+        const Rect window{0, PANEL_HEIGHT - font->height(), PANEL_WIDTH, font->height()};
+        const int lap = strip.width() + 24;
+        vector<SoftCanvas> frames;
+        frames.reserve(FRAMES);
+        SoftCanvas canvas{PANEL_WIDTH, PANEL_HEIGHT};
+        for(size_t i = 0; i < FRAMES; ++i) {
+            if(i % 60 == 0) {
+                canvas.Fill({0, 0, PANEL_WIDTH, font->height()}, 0, 0, 0);
+                const string minute = "12:0" + std::to_string(i / 60);
+                font->DrawText(&canvas, 0, font->baseline(), {255, 255, 50}, minute.c_str());
+            }
+            canvas.Fill(window, 0, 0, 0);
+            for(int x = window.x - int(i) % lap; x < window.Right(); x += lap) {
+                strip.Blit(&canvas, x, window.y, window);
+            }
+            frames.push_back(canvas);
+        }
+
+        vector<vector<uint8_t>> deltas(FRAMES);
+        size_t index = 1;
+        BenchResult* encode = runner.Run("record/encode", [&] {
+            deltas[index].clear();
+            FrameDelta::Encode(frames[index].Data(), frames[index - 1].Data(), frames[index].Size(), deltas[index]);
+            index = index % (FRAMES - 1) + 1;
+        });
+        runner.Run("record/encode/keyframe", [&] {
+            deltas[0].clear();
+            FrameDelta::Encode(frames[index].Data(), nullptr, frames[index].Size(), deltas[0]);
+        });
+        // Encode appends after whatever the output holds, a record header in the recorder
+        for(auto& delta : deltas) {
+            delta.clear();
+        }
+        FrameDelta::Encode(frames[0].Data(), nullptr, frames[0].Size(), deltas[0]);
+        double deltaBytes = 0;
+        for(size_t i = 1; i < FRAMES; ++i) {
+            FrameDelta::Encode(frames[i].Data(), frames[i - 1].Data(), frames[i].Size(), deltas[i]);
+            deltaBytes += double(deltas[i].size());
+        }
+        if(encode) {
+            encode->counters["raw_bytes"] = double(canvas.Size());
+            encode->counters["delta_bytes"] = deltaBytes / double(FRAMES - 1);
+            encode->counters["keyframe_bytes"] = double(deltas[0].size());
+        }
+        // Applying every delta in turn has to give the same frames back
+        Rect changed;
+        index = 0;
+        BenchResult* decode = runner.Run("record/decode", [&] {
+            if(!index) {
+                canvas.Fill(canvas.GetRect(), 0, 0, 0);
+            }
+            FrameDelta::Apply(deltas[index].data(), deltas[index].size(), canvas.Data(), canvas.Size(),
+                              canvas.Stride(), changed);
+            index = (index + 1) % FRAMES;
+        });
+        if(decode) {
+            canvas.Fill(canvas.GetRect(), 0, 0, 0);
+            double mismatches = 0;
+            for(size_t i = 0; i < FRAMES; ++i) {
+                FrameDelta::Apply(deltas[i].data(), deltas[i].size(), canvas.Data(), canvas.Size(), canvas.Stride(),
+                                  changed);
+                mismatches += !canvas.Equals(frames[i], canvas.GetRect());
+            }
+            runner.Check(*decode, "mismatched_frames", mismatches);
+        }
+
+        // Through the writer thread and back, small files to have them rotated
+        const string name = "record/file/round_trip";
+        if(!runner.IsEnabled(name)) {
+            return;
+        }
+        FrameRecorder::Config config;
+        config.filePath = tmpDir / "frames.rec";
+        config.keyframeInterval = 100;
+        config.maxBytes = 64 << 10;
+        constexpr size_t ROUNDS = 4;
+        vector<double> recordTimes;
+        {
+            FrameRecorder recorder{config, PANEL_WIDTH, PANEL_HEIGHT};
+            for(size_t round = 0; round < ROUNDS; ++round) {
+                for(const SoftCanvas& frame : frames) {
+                    const auto start = std::chrono::steady_clock::now();
+                    recorder.Record(frame);
+                    recordTimes.push_back(double((std::chrono::steady_clock::now() - start).count()));
+                    // Paced like the panel, the writer keeps up
+                    std::this_thread::sleep_for(std::chrono::microseconds{200});
+                }
+            }
+        }
+        BenchResult& result = runner.AddSamples(name, recordTimes);
+        double read = 0;
+        double readMismatches = 0;
+        double keyframes = 0;
+        for(const path& file : { path{config.filePath.string() + ".1"}, config.filePath }) {
+            FrameReader reader{file};
+            SoftCanvas replayed{reader.width(), reader.height()};
+            FrameReader::Frame frame{};
+            // A file holds a run of the frames, the first one is found by the content
+            size_t at = FRAMES;
+            while(reader.Next(replayed, frame)) {
+                if(at == FRAMES) {
+                    at = size_t(std::find_if(frames.begin(), frames.end(), [&](const SoftCanvas& expected) {
+                        return replayed.Equals(expected, replayed.GetRect());
+                    }) - frames.begin());
+                }
+                readMismatches += at == FRAMES || !replayed.Equals(frames[at], replayed.GetRect());
+                at = (at + 1) % FRAMES;
+                ++read;
+                keyframes += frame.keyframe;
+            }
+        }
+        result.counters["frames_read"] = read;
+        result.counters["keyframes_read"] = keyframes;
+        runner.Check(result, "mismatched_frames", readMismatches);
+        result.counters["file_bytes"] = double(std::filesystem::file_size(config.filePath));
+    }
+
+    // Every byte of frame n is n, so a copy that mixes two frames shows
+    void FillExportFrame(SoftCanvas& frame, uint64_t number)
+    {
+        frame.Fill(uint8_t(number), uint8_t(number), uint8_t(number));
+    }
+
+    // Copies of the memory of name with one header field damaged each, the readers accepting them
+    double CountDamagedLayoutsAccepted(const string& name)
+    {
+        using Header = SharedFrameLayout::Header;
+        const std::function<void(Header&)> damages[] = {
+            [](Header& header) { header.dataOffset += SharedFrameLayout::ALIGNMENT; },
+            [](Header& header) { header.slotSize *= 2; },
+            [](Header& header) { header.slots = ~uint32_t{}; },
+            [](Header& header) { header.height = uint16_t(header.height * 2); },
+            [](Header& header) { header.stride = 1; },
+        };
+        SharedFrameReader original{name};
+        const int sourceFd = shm_open(name.c_str(), O_RDONLY, 0);
+        struct stat st{};
+        fstat(sourceFd, &st);
+        const size_t size = size_t(st.st_size);
+        void* source = mmap(nullptr, size, PROT_READ, MAP_SHARED, sourceFd, 0);
+        close(sourceFd);
+        const string damagedName = name + ".damaged";
+        double accepted = 0;
+        for(const auto& damage : damages) {
+            const int fd = shm_open(damagedName.c_str(), O_CREAT | O_RDWR | O_TRUNC, 0600);
+            void* memory = ftruncate(fd, off_t(size)) ? MAP_FAILED : mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+            close(fd);
+            if(source == MAP_FAILED || memory == MAP_FAILED) {
+                ++accepted;
+                continue;
+            }
+            memcpy(memory, source, size);
+            damage(*static_cast<Header*>(memory));
+            munmap(memory, size);
+            try {
+                SharedFrameReader reader{damagedName};
+                ++accepted;
+            } catch(const SharedFrameReader::runtime_error&) {
+            }
+        }
+        shm_unlink(damagedName.c_str());
+        if(source != MAP_FAILED) {
+            munmap(source, size);
+        }
+        return accepted;
+    }
+
+    // The writer publishing unpaced while readers copy or visit the frames in place all along.
+    // A read that passed the sequence check and still holds two frames is a torn read
+    void BenchFrameExport(BenchRunner& runner)
+    {
+        if(!runner.IsEnabled("export/")) {
+            return;
+        }
+        FrameExport::Config config;
+        config.name = "/piclock-bench." + std::to_string(getpid());
+        FrameExport frameExport{config, PANEL_WIDTH, PANEL_HEIGHT};
+        SoftCanvas frame{PANEL_WIDTH, PANEL_HEIGHT};
+        runner.Run("export/publish", [&] {
+            frameExport.Publish(frame);
+        });
+        // Opening checks that every frame lies within the memory
+        if(BenchResult* result = runner.Run("export/open", [&] { SharedFrameReader reader{config.name}; }); result) {
+            runner.Check(*result, "accepted_damaged_layouts", CountDamagedLayoutsAccepted(config.name));
+        }
+        // Frame numbers go on from what the run above published
+        SharedFrameReader probe{config.name};
+        uint64_t number = probe.GetLatest();
+
+        const string name = "export/concurrent";
+        if(!runner.IsEnabled(name)) {
+            return;
+        }
+        constexpr unsigned READERS = 3;
+        constexpr unsigned FRAMES = 4000;
+        // The frames above were blank, the readers start from one that follows the pattern
+        FillExportFrame(frame, ++number);
+        frameExport.Publish(frame);
+        std::atomic<bool> stop{};
+        std::atomic<uint64_t> reads{};
+        std::atomic<uint64_t> visits{};
+        std::atomic<uint64_t> failed{};
+        std::atomic<uint64_t> torn{};
+        vector<vector<double>> readTimes(READERS);
+        vector<std::thread> readers;
+        for(unsigned i = 0; i < READERS; ++i) {
+            readers.emplace_back([&, i] {
+                SharedFrameReader reader{config.name};
+                vector<uint8_t> pixels(reader.Size());
+                SharedFrameReader::Info info{};
+                while(!stop.load(std::memory_order_relaxed)) {
+                    // Odd readers copy, even ones check the frame in place
+                    if(i % 2) {
+                        const auto start = std::chrono::steady_clock::now();
+                        if(!reader.Read(pixels.data(), info)) {
+                            failed.fetch_add(1, std::memory_order_relaxed);
+                            continue;
+                        }
+                        readTimes[i].push_back(double((std::chrono::steady_clock::now() - start).count()));
+                        reads.fetch_add(1, std::memory_order_relaxed);
+                        const uint8_t expected = uint8_t(info.frame);
+                        if(std::any_of(pixels.begin(), pixels.end(), [expected](uint8_t byte) { return byte != expected; })) {
+                            torn.fetch_add(1, std::memory_order_relaxed);
+                        }
+                    }
+                    else {
+                        bool mixed = false;
+                        if(!reader.Visit([&mixed, &reader](const uint8_t* pixels, const SharedFrameReader::Info& info) {
+                            const uint8_t expected = uint8_t(info.frame);
+                            mixed = std::any_of(pixels, pixels + reader.Size(),
+                                                [expected](uint8_t byte) { return byte != expected; });
+                        })) {
+                            failed.fetch_add(1, std::memory_order_relaxed);
+                            continue;
+                        }
+                        visits.fetch_add(1, std::memory_order_relaxed);
+                        torn.fetch_add(mixed, std::memory_order_relaxed);
+                    }
+                }
+            });
+        }
+        vector<double> publishTimes;
+        publishTimes.reserve(FRAMES);
+        for(unsigned i = 0; i < FRAMES; ++i) {
+            FillExportFrame(frame, ++number);
+            const auto start = std::chrono::steady_clock::now();
+            frameExport.Publish(frame);
+            publishTimes.push_back(double((std::chrono::steady_clock::now() - start).count()));
+            if(i % 64 == 0) {
+                std::this_thread::yield();
+            }
+        }
+        stop = true;
+        for(auto& reader : readers) {
+            reader.join();
+        }
+        vector<double> allReadTimes;
+        for(const auto& times : readTimes) {
+            allReadTimes.insert(allReadTimes.end(), times.cbegin(), times.cend());
+        }
+        BenchResult& result = runner.AddSamples(name + "/publish", publishTimes);
+        result.counters["readers"] = READERS;
+        result.counters["reads"] = double(reads.load());
+        result.counters["visits"] = double(visits.load());
+        result.counters["failed_reads"] = double(failed.load());
+        runner.Check(result, "torn_reads", double(torn.load()));
+        result.counters["frames_published"] = double(probe.GetLatest());
+        if(!allReadTimes.empty()) {
+            runner.AddSamples(name + "/read", allReadTimes);
+        }
+    }
+
+    // Four sensor cadences of 20 ms for a second, on the reactor and on a sleeping thread each the way
+    // the hub used to poll. Samples are how late each expiration was handled
+    void BenchReactorTimers(BenchRunner& runner)
+    {
+        using namespace std::chrono_literals;
+        constexpr unsigned TIMERS = 4;
+        constexpr auto period = 20ms;
+        constexpr auto duration = 1s;
+        const auto perMinute = [&](uint64_t count) {
+            return double(count) * double(std::chrono::nanoseconds{1min}.count())
+                   / double(std::chrono::nanoseconds{duration}.count());
+        };
+        if(const string name = "reactor/timers/aligned"; runner.IsEnabled(name)) {
+            vector<double> lateness;
+            std::mutex mtx;
+            Reactor reactor;
+            const auto start = std::chrono::steady_clock::now();
+            for(unsigned i = 0; i < TIMERS; ++i) {
+                reactor.AddTimer("timer" + std::to_string(i), period, [&](uint64_t) {
+                    const auto now = std::chrono::steady_clock::now();
+                    std::lock_guard lock{mtx};
+                    lateness.push_back(double(((now - start) % period).count()));
+                });
+            }
+            reactor.Start();
+            std::this_thread::sleep_for(duration);
+            reactor.Stop();
+            BenchResult& result = runner.AddSamples(name, lateness);
+            result.counters["timers"] = TIMERS;
+            result.counters["events_per_minute"] = perMinute(reactor.GetEvents());
+            result.counters["wakeups_per_minute"] = perMinute(reactor.GetWakeups());
+        }
+        if(const string name = "reactor/timers/threads"; runner.IsEnabled(name)) {
+            vector<vector<double>> lateness(TIMERS);
+            std::atomic<bool> stop{};
+            std::atomic<uint64_t> wakeups{};
+            vector<std::thread> threads;
+            for(unsigned i = 0; i < TIMERS; ++i) {
+                threads.emplace_back([&, i] {
+                    auto next = std::chrono::steady_clock::now();
+                    while(!stop) {
+                        next += period;
+                        std::this_thread::sleep_until(next);
+                        wakeups.fetch_add(1, std::memory_order_relaxed);
+                        lateness[i].push_back(double((std::chrono::steady_clock::now() - next).count()));
+                    }
+                });
+            }
+            std::this_thread::sleep_for(duration);
+            stop = true;
+            for(auto& thread : threads) {
+                thread.join();
+            }
+            vector<double> allLateness;
+            for(const auto& samples : lateness) {
+                allLateness.insert(allLateness.end(), samples.cbegin(), samples.cend());
+            }
+            BenchResult& result = runner.AddSamples(name, allLateness);
+            result.counters["timers"] = TIMERS;
+            result.counters["wakeups_per_minute"] = perMinute(wakeups);
+        }
+    }
+
+    // From a signal to the reactor thread joined, with sensors being read all along. SIGUSR1 is
+    // blocked by main, it stands in for SIGTERM
+    void BenchReactorShutdown(BenchRunner& runner, const path& dataDir, const path& tmpDir)
+    {
+        const string name = "reactor/shutdown";
+        if(!runner.IsEnabled(name)) {
+            return;
+        }
+        constexpr unsigned ROUNDS = 20;
+        YAML::Node config = CreateConfig(CreateSensorsRoot(tmpDir / "shutdown", std::size(FAKE_DEVICES)));
+        config["sensors"]["period"] = 0.005;
+        Options options{dataDir, config};
+        vector<double> times;
+        double joined = 0;
+        double reads = 0;
+        for(unsigned round = 0; round < ROUNDS; ++round) {
+            auto parent = std::make_unique<MainWidget>();
+            auto hub = std::make_unique<SensorHub>(options, *parent);
+            Reactor reactor;
+            std::atomic<bool> received{};
+            reactor.AddSignals({ SIGUSR1 }, [&](int) {
+                received = true;
+                reactor.Stop();
+            });
+            hub->Start(reactor);
+            reactor.Start();
+            std::this_thread::sleep_for(std::chrono::milliseconds{20});
+            const auto start = std::chrono::steady_clock::now();
+            kill(getpid(), SIGUSR1);
+            // As in main, the loop is left once the handler ran, a Stop racing with it would leave
+            // the signal pending for the next round
+            for(int i = 0; i < 1000 && !received; ++i) {
+                std::this_thread::sleep_for(std::chrono::microseconds{100});
+            }
+            reactor.Stop();
+            times.push_back(double((std::chrono::steady_clock::now() - start).count()));
+            joined += received;
+            for(Sensor& sensor : hub->GetSensors()) {
+                reads += double(sensor.GetReadStats().reads);
+            }
+        }
+        BenchResult& result = runner.AddSamples(name, times);
+        result.counters["rounds"] = ROUNDS;
+        result.counters["stopped_by_signal"] = joined;
+        result.counters["reads_per_round"] = reads / ROUNDS;
+    }
+
+    // One sensor hangs in open the way a driver can, the bmp280 pressure file becomes a FIFO no one
+    // writes to. For a second the others have to keep their 20 ms cadence, then SIGUSR1 has to stop
+    // the reactor. The sample is the time from the signal until the reactor stopped
+    void BenchStuckSensor(BenchRunner& runner, const path& dataDir, const path& tmpDir)
+    {
+        using namespace std::chrono_literals;
+        const string name = "reactor/stuck_sensor";
+        if(!runner.IsEnabled(name)) {
+            return;
+        }
+        const path root = CreateSensorsRoot(tmpDir / "stuck", std::size(FAKE_DEVICES));
+        YAML::Node config = CreateConfig(root);
+        config["sensors"]["period"] = 0.02;
+        config["sensors"]["timeout"] = 0.5;
+        Options options{dataDir, config};
+        auto parent = std::make_unique<MainWidget>();
+        auto hub = std::make_unique<SensorHub>(options, *parent);
+        // The open file turns bad, so the sensor opens it again and blocks there
+        const path stuckFile = root / "iio:device1" / "in_pressure_input";
+        std::ofstream{stuckFile, std::ios::trunc} << "x\n";
+        std::filesystem::remove(stuckFile);
+        if(mkfifo(stuckFile.c_str(), 0600)) {
+            std::cerr << "Couldn't create " << stuckFile << std::endl;
+            return;
+        }
+        Reactor reactor;
+        std::atomic<bool> received{};
+        reactor.AddSignals({ SIGUSR1 }, [&](int) {
+            received = true;
+            reactor.Stop();
+        });
+        hub->Start(reactor);
+        reactor.Start();
+        // The first reads are the ones at the start, they are left out
+        std::this_thread::sleep_for(100ms);
+        const auto countReads = [&hub] {
+            vector<uint64_t> reads;
+            for(Sensor& sensor : hub->GetSensors()) {
+                reads.push_back(sensor.GetReadStats().reads);
+            }
+            return reads;
+        };
+        const vector<uint64_t> before = countReads();
+        std::this_thread::sleep_for(1s);
+        const vector<uint64_t> after = countReads();
+        bool stuckSeen = false;
+        double minReads = 1e9;
+        double starved = 0;
+        size_t index = 0;
+        for(Sensor& sensor : hub->GetSensors()) {
+            const double reads = double(after[index] - before[index]);
+            ++index;
+            if(sensor.GetSensorPath().filename() == "iio:device1" && sensor.GetValueName() == "in_pressure_input") {
+                stuckSeen = sensor.GetReadStats().stalled;
+                continue;
+            }
+            minReads = std::min(minReads, reads);
+            // 50 are due, half of them is the least a busy machine should manage
+            starved += reads < 25;
+        }
+        const auto start = std::chrono::steady_clock::now();
+        kill(getpid(), SIGUSR1);
+        for(int i = 0; i < 1000 && !received; ++i) {
+            std::this_thread::sleep_for(100us);
+        }
+        reactor.Stop();
+        vector<double> stopTime{double((std::chrono::steady_clock::now() - start).count())};
+        // A writer lets the stuck open return, the reader can be joined then
+        const int writer = open(stuckFile.c_str(), O_WRONLY | O_CLOEXEC);
+        hub.reset();
+        if(writer >= 0) {
+            close(writer);
+        }
+        BenchResult& result = runner.AddSamples(name, stopTime);
+        result.counters["min_reads_per_s"] = minReads;
+        result.counters["stalled_flagged"] = stuckSeen;
+        runner.Check(result, "starved_sensors", starved);
+        runner.Check(result, "signal_missed", !received);
+    }
+
+    // Simulated frames costing 1.5 times the 50 Hz budget for 10 s, then a fifth of it for 30 s
+    void BenchFrameClock(BenchRunner& runner)
+    {
+        const string name = "animation/clock/overload";
+        if(!runner.IsEnabled(name)) {
+            return;
+        }
+        using namespace std::chrono_literals;
+        constexpr auto overloadTime = 10s;
+        constexpr auto totalTime = 40s;
+        struct Outcome {
+            unsigned overloadRate;
+            uint64_t overloadLate;
+            uint64_t overloadDropped;
+            uint64_t settledLate;
+            unsigned finalRate;
+            uint64_t frames;
+        };
+        const auto simulate = [&] {
+            FrameClock frameClock{FrameClock::Config{}};
+            const FrameClock::clock::time_point start{1s};
+            FrameClock::clock::time_point now = start;
+            frameClock.Start(now);
+            Outcome outcome{};
+            uint64_t lateAtSettle = 0;
+            while(now - start < totalTime) {
+                now = std::max(now, frameClock.GetNextDue());
+                frameClock.Advance(now);
+                const bool overload = now - start < overloadTime;
+                now += overload ? 30ms : 4ms;
+                if(!lateAtSettle && now - start >= overloadTime / 2) {
+                    lateAtSettle = frameClock.GetLateFrames();
+                }
+                if(overload) {
+                    outcome.overloadRate = frameClock.GetFrameRate();
+                    outcome.overloadLate = frameClock.GetLateFrames();
+                    outcome.overloadDropped = frameClock.GetDroppedFrames();
+                }
+            }
+            outcome.settledLate = outcome.overloadLate - lateAtSettle;
+            outcome.finalRate = frameClock.GetFrameRate();
+            outcome.frames = frameClock.GetFrames();
+            return outcome;
+        };
+        const Outcome outcome = simulate();
+        BenchResult* result = runner.Run(name, [&] { simulate(); }, outcome.frames);
+        if(!result) {
+            return;
+        }
+        result->counters["overload_fps"] = outcome.overloadRate;
+        result->counters["overload_late_frames"] = double(outcome.overloadLate);
+        result->counters["overload_dropped_frames"] = double(outcome.overloadDropped);
+        // Late frames in the second half of the overload, none once the rate came down
+        result->counters["settled_late_frames"] = double(outcome.settledLate);
+        result->counters["recovered_fps"] = outcome.finalRate;
+    }
+
+    // Time from RequestUpdate on a producer thread until Draw returns on the render thread
+    void BenchUpdateHandoff(BenchRunner& runner, SoftCanvas& canvas)
+    {
+        using clock = std::chrono::steady_clock;
+        static constexpr size_t ROUNDS = 20000;
+        const string name = "mainwidget/request_to_draw";
+        if(!runner.IsEnabled(name)) {
+            return;
+        }
+        MainWidget mainWidget;
+        std::atomic<clock::rep> requestTime{};
+        std::atomic<size_t> completed{};
+        std::atomic_bool stop{};
+        vector<double> samples;
+        samples.reserve(ROUNDS);
+
+        // Consume the initial full repaint
+        mainWidget.Draw(&canvas);
+        std::thread renderThread{[&] {
+            while(true) {
+                mainWidget.Draw(&canvas);
+                if(stop) {
+                    break;
+                }
+                samples.push_back(double((clock::now().time_since_epoch().count() - requestTime)));
+                ++completed;
+            }
+        }};
+        for(size_t i = 0; i < ROUNDS; ++i) {
+            requestTime = clock::now().time_since_epoch().count();
+            mainWidget.RequestUpdate();
+            while(completed <= i) {
+                std::this_thread::yield();
+            }
+        }
+        stop = true;
+        mainWidget.RequestUpdate();
+        renderThread.join();
+        runner.AddSamples(name, samples);
+    }
+
+    // Latency distribution in decades from 1 us up
+    void AddHistogram(BenchResult& result, const vector<double>& samplesNs)
+    {
+        static const char* const buckets[] = { "le_1us", "le_10us", "le_100us", "le_1ms", "le_10ms", "gt_10ms" };
+        vector<double> counts(std::size(buckets));
+        for(double sample : samplesNs) {
+            size_t bucket = 0;
+            for(double limit = 1000; bucket < counts.size() - 1 && sample > limit; limit *= 10) {
+                ++bucket;
+            }
+            ++counts[bucket];
+        }
+        for(size_t i = 0; i < counts.size(); ++i) {
+            result.counters["hist_"s + buckets[i]] = counts[i];
+        }
+    }
+
+    // Marks the time of its oldest pending request, the wait is taken on Update. The widgets update
+    // concurrently on the worker pool, so each keeps its own samples
+    class StressWidget : public WidgetWrapper {
+    public:
+        using clock = std::chrono::steady_clock;
+
+        StressWidget(BaseWidget& parent, size_t requests) : WidgetWrapper{parent}
+        {
+            latencies_.reserve(requests);
+        }
+
+        void Request() {
+            clock::rep expected = 0;
+            requested_.compare_exchange_strong(expected, clock::now().time_since_epoch().count());
+            RequestUpdate();
+        }
+        bool Update() final {
+            if(clock::rep requested = requested_.exchange(0); requested) {
+                latencies_.push_back(double(clock::now().time_since_epoch().count() - requested));
+            }
+            ++updates_;
+            return false;
+        }
+        void Draw(rgb_matrix::Canvas*) final
+        { }
+        uint64_t GetUpdates() const {
+            return updates_;
+        }
+        const vector<double>& GetLatencies() const {
+            return latencies_;
+        }
+    private:
+        vector<double> latencies_;
+        std::atomic<clock::rep> requested_{};
+        uint64_t updates_{};
+    };
+
+    // Many producers hammering RequestUpdate while the render thread keeps drawing
+    void BenchUpdateStress(BenchRunner& runner, SoftCanvas& canvas)
+    {
+        using clock = std::chrono::steady_clock;
+        static constexpr size_t PRODUCERS = 16;
+        static constexpr size_t REQUESTS = 20000;
+        const string name = "mainwidget/stress/";
+        if(!runner.IsEnabled(name)) {
+            return;
+        }
+        MainWidget mainWidget;
+        vector<StressWidget*> widgets;
+        for(size_t i = 0; i < PRODUCERS; ++i) {
+            WidgetPtr widget = std::make_unique<StressWidget>(mainWidget, REQUESTS);
+            widgets.push_back(static_cast<StressWidget*>(widget.get()));
+            mainWidget.AddWidget(widget);
+        }
+        mainWidget.Draw(&canvas);
+        const uint64_t startEpoch = mainWidget.GetEpoch();
+
+        std::atomic_bool stop{};
+        std::thread renderThread{[&] {
+            while(!stop) {
+                mainWidget.Draw(&canvas);
+            }
+        }};
+        vector<vector<double>> callTimes(PRODUCERS);
+        vector<std::thread> producers;
+        for(size_t i = 0; i < PRODUCERS; ++i) {
+            producers.emplace_back([&, i] {
+                callTimes[i].reserve(REQUESTS);
+                for(size_t n = 0; n < REQUESTS; ++n) {
+                    const auto start = clock::now();
+                    widgets[i]->Request();
+                    callTimes[i].push_back(double((clock::now() - start).count()));
+                    if(n % 64 == 0) {
+                        std::this_thread::yield();
+                    }
+                }
+            });
+        }
+        for(auto& producer : producers) {
+            producer.join();
+        }
+        stop = true;
+        mainWidget.RequestUpdate();
+        renderThread.join();
+
+        vector<double> allCallTimes;
+        for(const auto& times : callTimes) {
+            allCallTimes.insert(allCallTimes.end(), times.cbegin(), times.cend());
+        }
+        uint64_t updates = 0;
+        vector<double> latencies;
+        latencies.reserve(PRODUCERS * REQUESTS);
+        for(const StressWidget* widget : widgets) {
+            updates += widget->GetUpdates();
+            latencies.insert(latencies.end(), widget->GetLatencies().cbegin(), widget->GetLatencies().cend());
+        }
+        BenchResult& calls = runner.AddSamples(name + "request_call", allCallTimes);
+        calls.counters["max_ns"] = allCallTimes.back();
+        AddHistogram(calls, allCallTimes);
+        BenchResult& result = runner.AddSamples(name + "request_to_update", latencies);
+        result.counters["producers"] = double(PRODUCERS);
+        result.counters["frames"] = double(mainWidget.GetEpoch() - startEpoch);
+        result.counters["requests_per_update"] = double(PRODUCERS * REQUESTS) / double(std::max<uint64_t>(updates, 1));
+        AddHistogram(result, latencies);
+    }
+
+    string GetMachine()
+    {
+        utsname info{};
+        if(uname(&info)) {
+            return "unknown";
+        }
+        return info.machine;
+    }
+
+    string GetTimestamp()
+    {
+        char buffer[32];
+        time_t now = time(nullptr);
+        struct tm tm;
+        gmtime_r(&now, &tm);
+        strftime(buffer, sizeof(buffer), "%Y-%m-%dT%H:%M:%SZ", &tm);
+        return buffer;
+    }
+
+    void Usage(const char* name)
+    {
+        std::cerr << "Usage: " << name << " [-d data_dir] [-o output.json] [-t tag] [-f filter] [-m min_time_ms]\n"
+                     "  -d  directory containing fonts/ and fonts-aux/, the executable directory by default\n"
+                     "  -o  JSON results file, piclock-bench.json by default\n"
+                     "  -t  free-form tag stored with the results, e.g. the commit hash\n"
+                     "  -f  run only benchmarks whose name contains the filter\n"
+                     "  -m  minimum sampling time per benchmark, 500 ms by default\n"
+                     "Exits with 2 if a correctness check of the benchmarks fails, -m 1 runs them quickly\n";
+    }
+
+    int ConnectUnix(const string& socketPath)
+    {
+        const int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+        sockaddr_un address{};
+        address.sun_family = AF_UNIX;
+        memcpy(address.sun_path, socketPath.c_str(), socketPath.size() + 1);
+        if(connect(fd, reinterpret_cast<const sockaddr*>(&address), sizeof(address)) < 0) {
+            close(fd);
+            return -1;
+        }
+        return fd;
+    }
+
+    // A 100 Hz animation requesting frames for a second alone, then for two seconds with clients pushing
+    // 16000 updates a second, one sending an endless line, one stalled halfway through a line and
+    // more connecting than allowed. Samples are the render thread CPU time of a frame
+    void BenchPush(BenchRunner& runner, const path& dataDir, const path& tmpDir)
+    {
+        using clock = std::chrono::steady_clock;
+        using namespace std::chrono_literals;
+        const string name = "push/frame";
+        if(!runner.IsEnabled(name)) {
+            return;
+        }
+        constexpr unsigned CLIENTS = 4;
+        constexpr unsigned LINES_PER_TICK = 10;
+        YAML::Node config = CreateConfig(tmpDir);
+        config["push"] = YAML::Load(R"(
+            font: fonts/6x13B.bdf
+            fields:
+              door: { position: [0, 40], width: 67 }
+              power: { position: [0, 52], width: 67, decimals: 0, unit: " W" }
+              temp: { position: [67, 40], width: 60, unit: " C" }
+              note: { position: [67, 52], width: 125 }
+        )");
+        const string socketPath = (tmpDir / "push.sock").string();
+        config["push"]["socket"] = socketPath;
+        Options options{dataDir, config};
+
+        SoftCanvas canvas{PANEL_WIDTH, PANEL_HEIGHT};
+        MainWidget mainWidget;
+        auto pushWidget = std::make_unique<PushWidget>(options, mainWidget);
+        PushWidget& push = *pushWidget;
+        WidgetPtr widget = std::move(pushWidget);
+        mainWidget.AddWidget(widget);
+        // Stops before the widget goes
+        Reactor reactor;
+        push.Start(reactor);
+        reactor.Start();
+        mainWidget.Draw(&canvas);
+
+        std::atomic<clock::rep> requestTime{};
+        std::atomic<bool> loaded{};
+        std::atomic<bool> stop{};
+        vector<double> cpuTimes[2];
+        vector<double> latencies[2];
+        uint64_t frames[2]{};
+        std::thread renderThread{[&] {
+            while(true) {
+                timespec start, end;
+                clock_gettime(CLOCK_THREAD_CPUTIME_ID, &start);
+                mainWidget.Draw(&canvas);
+                clock_gettime(CLOCK_THREAD_CPUTIME_ID, &end);
+                if(stop) {
+                    break;
+                }
+                const size_t phase = loaded;
+                ++frames[phase];
+                cpuTimes[phase].push_back(double(end.tv_sec - start.tv_sec) * 1e9 + double(end.tv_nsec - start.tv_nsec));
+                if(const clock::rep requested = requestTime.exchange(0); requested) {
+                    latencies[phase].push_back(double(clock::now().time_since_epoch().count() - requested));
+                }
+            }
+        }};
+        std::atomic<bool> animating{true};
+        std::thread animation{[&] {
+            for(auto next = clock::now(); animating; std::this_thread::sleep_until(next += 10ms)) {
+                clock::rep expected = 0;
+                requestTime.compare_exchange_strong(expected, clock::now().time_since_epoch().count());
+                mainWidget.RequestUpdate();
+            }
+        }};
+        std::this_thread::sleep_for(1s);
+
+        const uint64_t updatesBefore = push.GetUpdates();
+        const uint64_t requestsBefore = push.GetRequests();
+        loaded = true;
+        std::atomic<bool> pushing{true};
+        std::atomic<uint64_t> sent{};
+        vector<std::thread> clients;
+        // Connected first, so they are within the limit
+        for(unsigned client = 0; client < CLIENTS; ++client) {
+            const int fd = ConnectUnix(socketPath);
+            if(fd < 0) {
+                continue;
+            }
+            clients.emplace_back([&, client, fd] {
+                unsigned value = 0;
+                for(auto next = clock::now(); pushing; std::this_thread::sleep_until(next += 2500us)) {
+                    string lines;
+                    for(unsigned i = 0; i < LINES_PER_TICK; ++i, ++value) {
+                        switch((value + client) % 4) {
+                        case 0: lines += "door " + string{value % 2 ? "open" : "closed"} + "\n"; break;
+                        case 1: lines += "power=" + std::to_string(value % 3000) + "\n"; break;
+                        case 2: lines += "temp=" + std::to_string(20 + value % 10) + ".25\n"; break;
+                        default: lines += "note client " + std::to_string(client) + " #" + std::to_string(value) + "\n";
+                        }
+                    }
+                    if(send(fd, lines.data(), lines.size(), MSG_NOSIGNAL) != ssize_t(lines.size())) {
+                        break;
+                    }
+                    sent += LINES_PER_TICK;
+                }
+                close(fd);
+            });
+        }
+        // Never ends its line, dropped past the limit
+        const int endless = ConnectUnix(socketPath);
+        const string junk(4096, 'x');
+        for(int i = 0; i < 4 && send(endless, junk.data(), junk.size(), MSG_NOSIGNAL) > 0; ++i)
+        { }
+        // Half a line and silence
+        const int stalled = ConnectUnix(socketPath);
+        const string half = "note half a li";
+        if(send(stalled, half.data(), half.size(), MSG_NOSIGNAL) < 0) {
+            std::cerr << "Push -> the stalled client couldn't write" << std::endl;
+        }
+        // Over the client limit with the ones above, the last ones are dropped
+        vector<int> extra;
+        for(int i = 0; i < 8; ++i) {
+            extra.push_back(ConnectUnix(socketPath));
+        }
+        std::this_thread::sleep_for(2s);
+        pushing = false;
+        for(std::thread& client : clients) {
+            client.join();
+        }
+        // Let the reactor catch up with the last writes
+        std::this_thread::sleep_for(100ms);
+        animating = false;
+        animation.join();
+        stop = true;
+        mainWidget.RequestUpdate();
+        renderThread.join();
+        reactor.Stop();
+        for(int fd : extra) {
+            if(fd >= 0) {
+                close(fd);
+            }
+        }
+        close(stalled);
+        close(endless);
+
+        const auto p99 = [](vector<double> samples) {
+            if(samples.empty()) {
+                return 0.0;
+            }
+            auto nth = samples.begin() + ptrdiff_t(double(samples.size() - 1) * 0.99);
+            std::nth_element(samples.begin(), nth, samples.end());
+            return *nth;
+        };
+        const auto mean = [](const vector<double>& samples) {
+            return samples.empty() ? 0.0 : std::accumulate(samples.begin(), samples.end(), 0.0) / double(samples.size());
+        };
+        const double updates = double(push.GetUpdates() - updatesBefore);
+        const double requests = double(push.GetRequests() - requestsBefore);
+        const double idleCpu = mean(cpuTimes[0]);
+        const double idleLatency = p99(latencies[0]);
+        const double loadLatency = p99(latencies[1]);
+        BenchResult& result = runner.AddSamples(name, cpuTimes[1]);
+        result.counters["idle_frame_cpu_us"] = idleCpu / 1000;
+        result.counters["load_frame_cpu_us"] = mean(cpuTimes[1]) / 1000;
+        result.counters["idle_p99_latency_us"] = idleLatency / 1000;
+        result.counters["load_p99_latency_us"] = loadLatency / 1000;
+        result.counters["idle_fps"] = double(frames[0]);
+        result.counters["load_fps"] = double(frames[1]) / 2.1;
+        result.counters["updates_per_s"] = updates / 2.1;
+        // Every line sent by the well-behaved clients arrived
+        result.counters["lost_updates"] = double(sent) - updates;
+        result.counters["updates_per_request"] = updates / std::max(requests, 1.0);
+        result.counters["rejected"] = double(push.GetRejected());
+        result.counters["dropped_clients"] = double(push.GetDroppedClients());
+    }
+
+    // Connections while the process is out of fds. First only the spare fd of the widget is left to
+    // take them and drop them, then not even that and the listener has to pause. Either way the
+    // reactor must not spin on the queued connections, and the socket serves again once fds are back
+    void BenchPushOutOfFds(BenchRunner& runner, const path& dataDir, const path& tmpDir)
+    {
+        using namespace std::chrono_literals;
+        const string name = "push/accept/out_of_fds";
+        if(!runner.IsEnabled(name)) {
+            return;
+        }
+        constexpr int CLIENTS = 3;
+        YAML::Node config = CreateConfig(tmpDir);
+        config["push"] = YAML::Load("{ font: fonts/6x13B.bdf, fields: { door: { position: [0, 40] } } }");
+        const string socketPath = (tmpDir / "push-fds.sock").string();
+        config["push"]["socket"] = socketPath;
+        Options options{dataDir, config};
+        MainWidget mainWidget;
+        auto pushWidget = std::make_unique<PushWidget>(options, mainWidget);
+        PushWidget& push = *pushWidget;
+        WidgetPtr widget = std::move(pushWidget);
+        mainWidget.AddWidget(widget);
+        Reactor reactor;
+        push.Start(reactor);
+        reactor.Start();
+
+        rlimit limit{};
+        getrlimit(RLIMIT_NOFILE, &limit);
+        const int lowestFree = open("/dev/null", O_RDONLY | O_CLOEXEC);
+        close(lowestFree);
+        // Connects sockets made before the limit came down, returns the reactor wakeups meanwhile
+        vector<int> clients;
+        const auto connectWith = [&](rlim_t fds) {
+            vector<int> sockets;
+            for(int i = 0; i < CLIENTS; ++i) {
+                sockets.push_back(socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0));
+            }
+            const rlimit lowered{fds, limit.rlim_max};
+            setrlimit(RLIMIT_NOFILE, &lowered);
+            const uint64_t wakeups = reactor.GetWakeups();
+            sockaddr_un address{};
+            address.sun_family = AF_UNIX;
+            memcpy(address.sun_path, socketPath.c_str(), socketPath.size() + 1);
+            for(int fd : sockets) {
+                [[maybe_unused]] int result = connect(fd, reinterpret_cast<const sockaddr*>(&address), sizeof(address));
+            }
+            std::this_thread::sleep_for(200ms);
+            const double spent = double(reactor.GetWakeups() - wakeups);
+            setrlimit(RLIMIT_NOFILE, &limit);
+            clients.insert(clients.end(), sockets.begin(), sockets.end());
+            return spent;
+        };
+        const auto start = std::chrono::steady_clock::now();
+        const double spareWakeups = connectWith(rlim_t(lowestFree));
+        const uint64_t spareDropped = push.GetDroppedClients();
+        // Below the spare fd as well
+        const double pausedWakeups = connectWith(3);
+        // The retry timer takes the queued connections once the fds are back
+        std::this_thread::sleep_for(1100ms);
+        const uint64_t updates = push.GetUpdates();
+        const int fd = ConnectUnix(socketPath);
+        const string line = "door open\n";
+        const bool sent = fd >= 0 && send(fd, line.data(), line.size(), MSG_NOSIGNAL) == ssize_t(line.size());
+        for(int i = 0; i < 100 && push.GetUpdates() == updates; ++i) {
+            std::this_thread::sleep_for(1ms);
+        }
+        vector<double> elapsed{double((std::chrono::steady_clock::now() - start).count())};
+        reactor.Stop();
+        if(fd >= 0) {
+            close(fd);
+        }
+        for(int client : clients) {
+            close(client);
+        }
+        BenchResult& result = runner.AddSamples(name, elapsed);
+        result.counters["accept_errors"] = double(push.GetAcceptErrors());
+        result.counters["dropped_with_spare"] = double(spareDropped);
+        result.counters["wakeups_with_spare"] = spareWakeups;
+        result.counters["wakeups_paused"] = pausedWakeups;
+        // A few wakeups per connection at most, a spinning reactor makes hundreds of thousands
+        runner.Check(result, "spinning", double(spareWakeups > 50 || pausedWakeups > 50));
+        runner.Check(result, "served_after", double(!sent || push.GetUpdates() == updates));
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    // Before any thread, for the reactor benchmarks
+    Reactor::BlockSignals({ SIGUSR1 });
+    path dataDir = path{argv[0]}.remove_filename();
+    // Widgets log to stdout, so the results go to a file
+    string outputFile = "piclock-bench.json";
+    string tag;
+    string filter;
+    long minTime = 500;
+    for(int opt; (opt = getopt(argc, argv, "d:o:t:f:m:h")) != -1;) {
+        switch(opt) {
+        case 'd': dataDir = optarg; break;
+        case 'o': outputFile = optarg; break;
+        case 't': tag = optarg; break;
+        case 'f': filter = optarg; break;
+        case 'm': minTime = atol(optarg); break;
+        default:
+            Usage(argv[0]);
+            return 1;
+        }
+    }
+
+    char tmpTemplate[] = "/tmp/piclock-bench.XXXXXX";
+    if(!mkdtemp(tmpTemplate)) {
+        std::cerr << "Couldn't create temporary directory" << std::endl;
+        return 1;
+    }
+    const path tmpDir{tmpTemplate};
+
+    BenchRunner runner{std::chrono::milliseconds{minTime}, filter};
+    SoftCanvas canvas{PANEL_WIDTH, PANEL_HEIGHT};
+    try {
+        Options options{dataDir, CreateConfig(tmpDir)};
+        if(runner.IsEnabled("clock/draw/hoog36")) {
+            BenchClock(runner, options, canvas);
+        }
+        BenchSensorHub(runner, dataDir, tmpDir, canvas);
+        BenchSensorRead(runner, tmpDir);
+        BenchSensorStream(runner, dataDir, tmpDir);
+        BenchSensorCadence(runner, dataDir, tmpDir);
+        BenchHistoryRing(runner);
+        BenchAmbient(runner);
+        BenchGraph(runner, dataDir, tmpDir);
+        BenchSampleStore(runner, tmpDir);
+        BenchMetrics(runner, tmpDir);
+        BenchConfigReload(runner, dataDir, tmpDir);
+        BenchFrame(runner, dataDir, tmpDir);
+        BenchLayers(runner, options);
+        BenchIdle(runner, options);
+        BenchDispatch(runner);
+        BenchTicker(runner, options);
+        BenchTimeSet(runner, options);
+        BenchFrameClock(runner);
+        BenchRecorder(runner, options, tmpDir);
+        BenchFrameExport(runner);
+        BenchReactorTimers(runner);
+        BenchReactorShutdown(runner, dataDir, tmpDir);
+        BenchStuckSensor(runner, dataDir, tmpDir);
+        BenchPush(runner, dataDir, tmpDir);
+        BenchPushOutOfFds(runner, dataDir, tmpDir);
+        BenchKernels(runner);
+        BenchFonts(runner, dataDir, canvas);
+        BenchWarmStart(runner, dataDir, tmpDir);
+        BenchUpdateHandoff(runner, canvas);
+        BenchUpdateStress(runner, canvas);
+    } catch(const std::exception& e) {
+        std::cerr << e.what() << std::endl;
+        std::filesystem::remove_all(tmpDir);
+        return 1;
+    }
+    std::filesystem::remove_all(tmpDir);
+
+    runner.PrintSummary(std::cerr);
+    const std::map<string, string> context = {
+        { "tag", tag },
+        { "machine", GetMachine() },
+        { "compiler", __VERSION__ },
+        { "timestamp", GetTimestamp() },
+    };
+    std::ofstream output{outputFile};
+    runner.WriteJson(output, context);
+    if(!output) {
+        std::cerr << "Couldn't write " << outputFile << std::endl;
+        return 1;
+    }
+    // The results are kept for a look at the failures
+    for(const string& check : runner.GetFailedChecks()) {
+        std::cerr << "Check failed: " << check << std::endl;
+    }
+    return runner.GetFailedChecks().empty() ? 0 : 2;
+}
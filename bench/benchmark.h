@@ -0,0 +1,184 @@
+/*
+ * Copyright (c) 2019 Dmytro Shestakov
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#ifndef BENCHMARK_H
+#define BENCHMARK_H
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <iomanip>
+#include <map>
+#include <ostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+// Heap allocations made so far by the calling thread, counted by the operator new of piclock-bench
+uint64_t GetThreadAllocations();
+
+struct BenchResult {
+    std::string name;
+    uint64_t iterations;
+    double meanNs;
+    double minNs;
+    double medianNs;
+    double p99Ns;
+    std::map<std::string, double> counters;
+};
+
+class BenchRunner {
+private:
+    using clock = std::chrono::steady_clock;
+    using nanoseconds = std::chrono::nanoseconds;
+    using string = std::string;
+
+    nanoseconds minTime_;
+    string filter_;
+    // Keeps the results returned by Run valid while more are added
+    std::deque<BenchResult> results_;
+    std::vector<string> failedChecks_;
+
+    static double ToNs(clock::duration d) {
+        return double(std::chrono::duration_cast<nanoseconds>(d).count());
+    }
+
+    static string Escape(const string& text) {
+        string result;
+        for(char c : text) {
+            if(c == '"' || c == '\\') {
+                result += '\\';
+            }
+            result += c;
+        }
+        return result;
+    }
+
+public:
+    BenchRunner(std::chrono::milliseconds minTime, const string& filter) : minTime_{minTime}, filter_{filter}
+    { }
+
+    bool IsEnabled(const string& name) const {
+        return filter_.empty() || name.find(filter_) != string::npos;
+    }
+
+    // Calls func repeatedly for at least minTime, each call performs opsPerCall operations
+    template<typename Func>
+    BenchResult* Run(const string& name, Func&& func, uint64_t opsPerCall = 1) {
+        if(!IsEnabled(name)) {
+            return nullptr;
+        }
+        func();
+        // Batch calls so that a single sample is well above the clock resolution
+        uint64_t batch = 1;
+        for(auto start = clock::now(); batch < (1u << 20); batch *= 2) {
+            for(uint64_t i = 0; i < batch; ++i) {
+                func();
+            }
+            if(clock::now() - start > std::chrono::microseconds{20}) {
+                break;
+            }
+            start = clock::now();
+        }
+        std::vector<double> samples;
+        const auto deadline = clock::now() + minTime_;
+        while(clock::now() < deadline || samples.size() < 10) {
+            const auto start = clock::now();
+            for(uint64_t i = 0; i < batch; ++i) {
+                func();
+            }
+            samples.push_back(ToNs(clock::now() - start) / double(batch * opsPerCall));
+        }
+        return &AddSamples(name, samples, batch * opsPerCall);
+    }
+
+    // Records externally measured per-operation durations
+    BenchResult& AddSamples(const string& name, std::vector<double>& samplesNs, uint64_t opsPerSample = 1) {
+        std::sort(samplesNs.begin(), samplesNs.end());
+        BenchResult result{};
+        result.name = name;
+        result.iterations = samplesNs.size() * opsPerSample;
+        double sum = 0;
+        for(double sample : samplesNs) {
+            sum += sample;
+        }
+        if(!samplesNs.empty()) {
+            result.meanNs = sum / double(samplesNs.size());
+            result.minNs = samplesNs.front();
+            result.medianNs = samplesNs[samplesNs.size() / 2];
+            result.p99Ns = samplesNs[std::min(samplesNs.size() - 1, samplesNs.size() * 99 / 100)];
+        }
+        results_.push_back(result);
+        return results_.back();
+    }
+
+    // Records a count of wrong results, anything but zero fails the run
+    void Check(BenchResult& result, const string& counter, double failures) {
+        result.counters[counter] = failures;
+        if(failures != 0) {
+            std::ostringstream check;
+            check << result.name << " " << counter << "=" << failures;
+            failedChecks_.push_back(check.str());
+        }
+    }
+
+    const std::vector<string>& GetFailedChecks() const {
+        return failedChecks_;
+    }
+
+    void PrintSummary(std::ostream& os) const {
+        for(const auto& result : results_) {
+            os << std::left << std::setw(40) << result.name << std::right << std::fixed << std::setprecision(1)
+               << std::setw(12) << result.medianNs << " ns/op  p99 "
+               << std::setw(12) << result.p99Ns << " ns";
+            for(const auto& [key, value] : result.counters) {
+                os << "  " << key << "=" << value;
+            }
+            os << '\n';
+        }
+    }
+
+    void WriteJson(std::ostream& os, const std::map<string, string>& context) const {
+        os << "{\n  \"context\": {";
+        const char* separator = "\n";
+        for(const auto& [key, value] : context) {
+            os << separator << "    \"" << key << "\": \"" << Escape(value) << "\"";
+            separator = ",\n";
+        }
+        os << "\n  },\n  \"results\": [";
+        separator = "\n";
+        os << std::fixed << std::setprecision(2);
+        for(const auto& result : results_) {
+            os << separator << "    {\"name\": \"" << Escape(result.name) << "\", \"iterations\": " << result.iterations
+               << ", \"mean_ns\": " << result.meanNs << ", \"min_ns\": " << result.minNs
+               << ", \"median_ns\": " << result.medianNs << ", \"p99_ns\": " << result.p99Ns;
+            for(const auto& [key, value] : result.counters) {
+                os << ", \"" << key << "\": " << value;
+            }
+            os << "}";
+            separator = ",\n";
+        }
+        os << "\n  ]\n}\n";
+    }
+};
+
+#endif // BENCHMARK_H
@@ -0,0 +1,121 @@
+/*
+ * Copyright (c) 2019 Dmytro Shestakov
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef AMBIENT_H
+#define AMBIENT_H
+
+#include "display.h"
+#include "metrics.h"
+#include "options.h"
+#include "sensors.h"
+
+#include <chrono>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+
+// Maps ambient light readings to a panel brightness and PWM depth. The readings are smoothed
+// on a log scale, close to how the eye sees them, and changes within the hysteresis are ignored
+class BrightnessController {
+public:
+    struct Config {
+        double luxLow{1};
+        double luxHigh{400};
+        int brightnessLow{2};
+        int brightnessHigh{40};
+        double smoothing{0.3};      // weight of a new reading
+        int hysteresis{2};          // brightness steps left alone
+        double darkLux{3};          // the dark PWM depth applies below it, until twice as much light
+        int darkPwmBits{7};
+        int pwmBits{11};
+    };
+
+    struct Output {
+        int brightness;
+        int pwmBits;
+    };
+
+    BrightnessController(const Config& config, int brightness);
+    // The same value read that many times in a row
+    Output Update(double lux, uint64_t readings = 1);
+    Output GetOutput() const {
+        return output_;
+    }
+    // Log10 of the smoothed reading, NaN before the first one
+    double GetLevel() const {
+        return level_;
+    }
+
+private:
+    Config config_;
+    Output output_;
+    double level_;
+    bool dark_;
+};
+
+// Feeds a light sensor of the hub to the controller and applies its output to the display
+class AmbientLight {
+public:
+    using string = std::string;
+
+    class invalid_argument : public std::invalid_argument {
+    public:
+        invalid_argument(const string& msg);
+    };
+
+    AmbientLight(const BrightnessController::Config& config, Sensor& sensor, Display& display, int brightness);
+    // Does nothing until the sensor has new readings, called once per frame
+    void Poll();
+    void RegisterMetrics(MetricsRegistry& registry);
+
+    static BrightnessController::Config LoadConfig(const YAML::Node& node);
+
+private:
+    using clock = std::chrono::steady_clock;
+
+    // Refresh thread CPU time spent at a PWM depth and the wall time it ran for
+    struct Usage {
+        double cpuSeconds;
+        double wallSeconds;
+    };
+
+    void Account(int pwmBits);
+    double GetCpuShare(int pwmBits) const;
+
+    BrightnessController controller_;
+    const BrightnessController::Config config_;
+    Sensor& sensor_;
+    Display& display_;
+    uint32_t version_;
+    uint64_t readings_;
+    mutable std::mutex mtx_;
+    std::map<int, Usage> usage_;
+    double lastCpuSeconds_;
+    clock::time_point lastTime_;
+};
+
+// The controller of the ambient node, nullptr if it isn't configured
+std::unique_ptr<AmbientLight> CreateAmbientLight(const Options& options, SensorHub& hub, Display& display, int brightness);
+
+#endif // AMBIENT_H
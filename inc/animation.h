@@ -0,0 +1,102 @@
+/*
+ * Copyright (c) 2019 Dmytro Shestakov
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef ANIMATION_H
+#define ANIMATION_H
+
+#include "ledwidget.h"
+#include "metrics.h"
+
+#include <atomic>
+#include <chrono>
+#include <string>
+
+// Fixed timestep clock of an animation. Frames are due at whole ticks since the start, so the motion
+// follows the time and not the moment a frame happens to be drawn, the panel swap then lands it on
+// the next vsync. A frame that misses its slot is late and the slots it skipped are dropped. Late
+// frames piling up halve the frame rate, down to the lowest one, a long clean run doubles it back
+class FrameClock {
+public:
+    using clock = std::chrono::steady_clock;
+
+    struct Config {
+        unsigned rate{50};          // ticks per second, the highest frame rate
+        unsigned minRate{10};
+        unsigned window{32};        // frames looked at for late ones
+        unsigned lateLimit{4};      // late frames in the window that lower the rate
+        unsigned recovery{500};     // frames in a row on time that raise it again
+    };
+
+    FrameClock(const Config& config);
+    void Start(clock::time_point now);
+    void Stop();
+    bool IsRunning() const {
+        return running_;
+    }
+    // Ticks since the previous frame, 0 if the next one isn't due yet
+    uint64_t Advance(clock::time_point now);
+    // Ticks from the start to the last frame
+    uint64_t GetTick() const {
+        return tick_;
+    }
+    clock::time_point GetNextDue() const;
+    // The same moment on the wall clock, for ScheduleUpdate
+    TimePoint GetNextFrame() const;
+    unsigned GetRate() const {
+        return config_.rate;
+    }
+    unsigned GetFrameRate() const {
+        return config_.rate / divisor_.load(std::memory_order_relaxed);
+    }
+    uint64_t GetFrames() const {
+        return frames_.load(std::memory_order_relaxed);
+    }
+    uint64_t GetLateFrames() const {
+        return late_.load(std::memory_order_relaxed);
+    }
+    uint64_t GetDroppedFrames() const {
+        return dropped_.load(std::memory_order_relaxed);
+    }
+    // Labeled by the widget, the clock must outlive the registry
+    void RegisterMetrics(MetricsRegistry& registry, const std::string& widget) const;
+
+private:
+    const Config config_;
+    const clock::duration period_;
+    clock::time_point start_{};
+    bool running_{};
+    uint64_t tick_{};
+    // Frames of the current window and the late ones among them
+    unsigned windowFrames_{};
+    unsigned windowLate_{};
+    unsigned onTime_{};
+    std::atomic<unsigned> divisor_{1};
+    std::atomic<uint64_t> frames_{};
+    std::atomic<uint64_t> late_{};
+    std::atomic<uint64_t> dropped_{};
+    // From the due time of a frame to its update
+    Histogram lateness_;
+
+    void Adapt(bool late);
+};
+
+#endif // ANIMATION_H
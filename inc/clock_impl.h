@@ -23,21 +23,78 @@
 #ifndef CLOCK_IMPL_H
 #define CLOCK_IMPL_H
 
+#include "animation.h"
 #include "common.h"
+#include "fonts.h"
+#include "spritecache.h"
+#include <ctime>
+#include <memory>
+#include <mutex>
 
-class Clock : public WidgetWrapper
+class Clock final : public WidgetWrapper
 {
 private:
     using Node = YAML::Node;
-    using FrameCanvas = rgb_matrix::FrameCanvas;
+    using Canvas = rgb_matrix::Canvas;
 
-    rgb_matrix::Font font_;
+    class invalid_argument : public std::invalid_argument {
+    public:
+        invalid_argument(const std::string& msg);
+    };
+
+    struct Settings {
+        FontPtr font;
+        PositionType position;
+        rgb_matrix::Color color;
+        std::string timeFormat;
+        double transition;  // seconds, 0 - no slide
+    };
+
+    FontPtr font_;
     PositionType position_;
     std::string timeFormat_;
     rgb_matrix::Color color_;
+    std::string text_;
+    // Text for the next change of the displayed time, formatted ahead
+    std::string nextText_;
+    time_t nextChange_{};
+    time_t period_{};
+    // Changed digits slide up, the old ones out of their cells and the new ones in
+    FrameClock slide_;
+    uint64_t slideTicks_{};
+    int shift_{};
+    std::string oldText_;
+    std::vector<Rect> slideCells_;
+    std::vector<Rect> stillCells_;
+    SpriteCache cache_;
+    Rect bounds_{};
+    // Loaded by Reconfigure, taken by Update
+    std::mutex pendingMtx_;
+    std::unique_ptr<Settings> pending_;
+
+    static Settings LoadSettings(const Options& options);
+    void Apply(Settings&& settings);
+    std::unique_ptr<Settings> TakePending();
+    std::string Format(time_t time) const;
+    void PrepareNext(time_t now);
+    void StartSlide(const std::string& from, const std::string& to);
+    bool Slide();
 public:
     Clock(const Options& options, BaseWidget& widget);
-    void Draw(FrameCanvas* canvas) final;
+    void Draw(Canvas* canvas) final;
+    bool Update() final;
+    Rect GetBounds() const final;
+    std::string_view GetName() const final {
+        return "clock";
+    }
+    // Thread safe, throws std::invalid_argument and keeps the current settings if the node is bad
+    void Reconfigure(const Options& options);
+    const SpriteCache::Stats& GetCacheStats() const {
+        return cache_.GetStats();
+    }
+    const FrameClock& GetFrameClock() const {
+        return slide_;
+    }
 };
 
 #endif // CLOCK_IMPL_H
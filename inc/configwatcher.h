@@ -0,0 +1,80 @@
+/*
+ * Copyright (c) 2019 Dmytro Shestakov
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#ifndef CONFIGWATCHER_H
+#define CONFIGWATCHER_H
+
+#include "options.h"
+#include <atomic>
+#include <functional>
+#include <thread>
+#include <vector>
+
+// Reloads the config file whenever it is written or replaced, then calls the handlers of
+// the top level nodes that differ from the last good tree. Runs on its own thread, so the
+// handlers may load fonts and such, but must hand the results over to the render thread
+class ConfigWatcher {
+public:
+    using string = std::string;
+    using Handler = std::function<void(const Options& options)>;
+
+    class runtime_error : public std::runtime_error {
+    public:
+        runtime_error(const string& msg);
+    };
+
+    explicit ConfigWatcher(const Options& options);
+    ConfigWatcher(const ConfigWatcher&) = delete;
+    ConfigWatcher& operator=(const ConfigWatcher&) = delete;
+    ~ConfigWatcher();
+
+    // Before Start, the handlers of a node are called in the order they were added
+    void Subscribe(const string& node, Handler handler);
+    void Start();
+
+    // Reloads that changed at least one node, and the ones rejected as malformed
+    uint64_t GetReloads() const {
+        return reloads_.load(std::memory_order_relaxed);
+    }
+    uint64_t GetFailures() const {
+        return failures_.load(std::memory_order_relaxed);
+    }
+    // Parses the file and applies the changes right away, as a write would
+    void Reload();
+private:
+    // Editors save in bursts, the file is read once it stays quiet for that long
+    static constexpr int SETTLE_MS = 100;
+
+    // Replaced with emplace, assigning YAML nodes would write through to every copy of the old tree
+    std::optional<Options> options_;
+    std::vector<std::pair<string, Handler>> handlers_;
+    int inotifyFd_{-1};
+    int stopFd_{-1};
+    std::thread thread_;
+    std::atomic<uint64_t> reloads_{};
+    std::atomic<uint64_t> failures_{};
+
+    // Returns true if the config file was among the events
+    bool ReadEvents();
+    void WatchThread();
+};
+
+#endif // CONFIGWATCHER_H
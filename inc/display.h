@@ -0,0 +1,158 @@
+/*
+ * Copyright (c) 2019 Dmytro Shestakov
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#ifndef DISPLAY_H
+#define DISPLAY_H
+
+#include "metrics.h"
+#include "options.h"
+#include "softcanvas.h"
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <optional>
+#include <vector>
+#include <sys/types.h>
+
+// Output backend the frame loop presents completed frames to
+class Display {
+public:
+    virtual ~Display();
+    virtual int width() const = 0;
+    virtual int height() const = 0;
+    // Shows the frame, blocks until the next vertical sync. Only the damaged areas differ from the previous frame
+    virtual void Present(const SoftCanvas& frame, const DamageList& damage) = 0;
+    virtual void Clear() = 0;
+    virtual bool IsRunning() const;
+    // Thread safe, the next Present applies it. Returns false if the backend has no brightness
+    virtual bool SetBrightness(int brightness);
+    // Thread safe like SetBrightness. Fewer bit planes take less time to refresh, the darkest shades go black
+    virtual bool SetPwmBits(int bits);
+    // CPU time of the threads refreshing the panel, negative if the backend has none
+    virtual double GetRefreshCpuSeconds() const;
+    // Settings waiting for the next Present, which has to come even if the frame didn't change
+    virtual bool HasPendingChanges() const;
+    // Time Present spends blocked on the vertical sync
+    const Histogram& GetVSyncWait() const {
+        return vsyncWait_;
+    }
+protected:
+    Histogram vsyncWait_;
+};
+
+using DisplayPtr = std::unique_ptr<Display>;
+
+class MatrixDisplay final : public Display {
+private:
+    using RGBMatrix = rgb_matrix::RGBMatrix;
+    using FrameCanvas = rgb_matrix::FrameCanvas;
+
+    std::unique_ptr<RGBMatrix> matrix_;
+    FrameCanvas* offscreen_;
+    // The offscreen buffer holds the frame before the previous one
+    DamageList previousDamage_;
+    std::atomic<int> pendingBrightness_{-1};
+    int brightness_;
+    std::atomic<int> pendingPwmBits_{-1};
+    int pwmBits_;
+    // Started by the library along with the matrix
+    std::vector<pid_t> refreshThreads_;
+    // Presents left that upload the whole frame, both buffers hold pixels of the old brightness
+    int fullUploads_{};
+
+    void Upload(const SoftCanvas& frame, const Rect& rect);
+public:
+    // The refresh threads are told apart as the ones appearing while the matrix is created, no
+    // other thread may start one meanwhile. Those the library made realtime are preferred, it
+    // can't when not run as root
+    MatrixDisplay(const RGBMatrix::Options& matrixOptions, const rgb_matrix::RuntimeOptions& runtimeOptions);
+    int width() const final;
+    int height() const final;
+    void Present(const SoftCanvas& frame, const DamageList& damage) final;
+    void Clear() final;
+    bool SetBrightness(int brightness) final;
+    bool SetPwmBits(int bits) final;
+    double GetRefreshCpuSeconds() const final;
+    bool HasPendingChanges() const final;
+};
+
+// Holds back frames identical to the one on the display, the frame loop goes back to sleep instead
+class IdleFilter {
+public:
+    // False if the damaged areas hold what the last frame let through, the first frame always passes
+    bool IsChanged(const SoftCanvas& frame, const DamageList& damage);
+    uint64_t GetSkipped() const {
+        return skipped_.load(std::memory_order_relaxed);
+    }
+private:
+    std::optional<SoftCanvas> shown_;
+    std::atomic<uint64_t> skipped_{};
+};
+
+// Software stand-in for the LED panel, paces frames with a simulated vsync and optionally dumps them
+class HeadlessDisplay final : public Display {
+public:
+    enum class DumpFormat {
+        PPM,    // one binary PPM file per frame
+        RAW     // all frames appended to a single rgb24 stream
+    };
+    struct Config {
+        int width;
+        int height;
+        unsigned refreshRate;   // Hz, 0 - don't pace
+        std::filesystem::path dumpPath;     // empty - don't dump
+        DumpFormat format;
+        uint64_t frameLimit;    // 0 - unlimited
+    };
+
+    HeadlessDisplay(const Config& config);
+    int width() const final;
+    int height() const final;
+    void Present(const SoftCanvas& frame, const DamageList& damage) final;
+    void Clear() final;
+    bool IsRunning() const final;
+    uint64_t GetFrameCount() const {
+        return frames_;
+    }
+    // Frames the dump couldn't be written for
+    uint64_t GetDumpErrors() const {
+        return dumpErrors_;
+    }
+private:
+    using clock = std::chrono::steady_clock;
+
+    Config config_;
+    clock::duration period_;
+    clock::time_point start_;
+    std::ofstream rawStream_;
+    uint64_t frames_;
+    uint64_t dumpErrors_{};
+
+    void Dump(const SoftCanvas& frame);
+    void ReportDumpError(const std::string& fileName);
+    void WaitVSync();
+};
+
+// Creates the headless backend when the "headless" node is configured, the LED matrix otherwise.
+// The matrix options are those of options.GetMatrixOptions(), the caller keeps them for the reloads
+DisplayPtr CreateDisplay(const Options& options, const std::optional<rgb_matrix::RGBMatrix::Options>& matrixOptions);
+
+#endif // DISPLAY_H
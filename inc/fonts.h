@@ -0,0 +1,196 @@
+/*
+ * Copyright (c) 2019 Dmytro Shestakov
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#ifndef FONTS_H
+#define FONTS_H
+
+#include "graphics.h"
+#include "options.h"
+#include "softcanvas.h"
+#include <array>
+#include <memory>
+#include <vector>
+
+// Text rendering independent of where the glyphs come from
+class FontFace {
+public:
+    using Canvas = rgb_matrix::Canvas;
+    using Color = rgb_matrix::Color;
+
+    virtual ~FontFace();
+    virtual int height() const = 0;
+    virtual int baseline() const = 0;
+    // Advance of the glyph, -1 if the font doesn't have it
+    virtual int CharacterWidth(uint32_t codepoint) const = 0;
+    // Draws UTF-8 text with the baseline at y, returns the advance like rgb_matrix::DrawText
+    virtual int DrawText(Canvas* canvas, int x, int y, const Color& color,
+                         const char* utf8Text, int letterSpacing = 0) const = 0;
+    int TextWidth(const char* utf8Text, int letterSpacing = 0) const;
+};
+
+using FontPtr = std::unique_ptr<FontFace>;
+
+// Fonts parsed from BDF files at runtime
+class BdfFontFace final : public FontFace {
+private:
+    rgb_matrix::Font font_;
+public:
+    bool LoadFont(const char* path);
+    int height() const final;
+    int baseline() const final;
+    int CharacterWidth(uint32_t codepoint) const final;
+    int DrawText(Canvas* canvas, int x, int y, const Color& color,
+                 const char* utf8Text, int letterSpacing = 0) const final;
+};
+
+struct BlitTarget {
+    rgb_matrix::Canvas* canvas;
+    SoftCanvas* softCanvas;     // same canvas if it is a SoftCanvas, allows writing pixels directly
+    rgb_matrix::Color color;
+};
+
+using BlitFunction = void (*)(const BlitTarget& target, int x, int y, const uint32_t* rows);
+
+struct EmbeddedGlyph {
+    uint32_t codepoint;
+    int16_t advance;
+    int16_t left;       // first bitmap column relative to the pen position
+    int16_t top;        // first bitmap row relative to the baseline
+    BlitFunction blit;  // specialized on the bitmap size, nullptr for blank glyphs
+    uint32_t offset;    // first row in the font bitmap
+};
+
+// Font tables generated from BDF files by tools/bdf2cpp.py
+struct EmbeddedFontData {
+    const char* name;
+    int height;
+    int baseline;
+    const EmbeddedGlyph* glyphs;    // sorted by codepoint
+    size_t glyphCount;
+    const uint32_t* bitmap;         // rows of 32-bit words, leftmost pixel in the MSB
+    const int16_t* ascii;           // glyph index for codepoints below 128, -1 if missing
+};
+
+// Null terminated, defined by the generated embedded_fonts.cpp
+extern const EmbeddedFontData* const EMBEDDED_FONTS[];
+
+// Width and height are constants in the BlitGlyph specializations and runtime values for TableFontFace
+inline __attribute__((always_inline))
+void BlitRows(const BlitTarget& target, int x, int y, const uint32_t* rows, int width, int height)
+{
+    const int words = (width + 31) / 32;
+    const rgb_matrix::Color& color = target.color;
+    SoftCanvas* canvas = target.softCanvas;
+    if(canvas && x >= 0 && y >= 0 && x + width <= canvas->width() && y + height <= canvas->height()) {
+        uint8_t* line = canvas->Data() + size_t(y) * canvas->Stride() + size_t(x) * SoftCanvas::BYTES_PER_PIXEL;
+        for(int row = 0; row < height; ++row, line += canvas->Stride()) {
+            for(int word = 0; word < words; ++word) {
+                uint8_t* base = line + size_t(word) * 32 * SoftCanvas::BYTES_PER_PIXEL;
+                for(uint32_t bits = *rows++; bits; ) {
+                    const int column = __builtin_clz(bits);
+                    bits &= ~(0x80000000u >> column);
+                    uint8_t* pixel = base + size_t(column) * SoftCanvas::BYTES_PER_PIXEL;
+                    pixel[0] = color.r;
+                    pixel[1] = color.g;
+                    pixel[2] = color.b;
+                }
+            }
+        }
+        return;
+    }
+    // Partially visible or a foreign canvas, the canvas does the clipping
+    for(int row = 0; row < height; ++row) {
+        for(int word = 0; word < words; ++word) {
+            for(uint32_t bits = *rows++; bits; ) {
+                const int column = __builtin_clz(bits);
+                bits &= ~(0x80000000u >> column);
+                target.canvas->SetPixel(x + word * 32 + column, y + row, color.r, color.g, color.b);
+            }
+        }
+    }
+}
+
+template<int Width, int Height>
+void BlitGlyph(const BlitTarget& target, int x, int y, const uint32_t* rows)
+{
+    BlitRows(target, x, y, rows, Width, Height);
+}
+
+// Fonts compiled into the binary
+class EmbeddedFontFace final : public FontFace {
+private:
+    const EmbeddedFontData& data_;
+
+    const EmbeddedGlyph* FindGlyph(uint32_t codepoint) const;
+public:
+    EmbeddedFontFace(const EmbeddedFontData& data);
+    static const EmbeddedFontData* Find(const std::string& name);
+    int height() const final;
+    int baseline() const final;
+    int CharacterWidth(uint32_t codepoint) const final;
+    int DrawText(Canvas* canvas, int x, int y, const Color& color,
+                 const char* utf8Text, int letterSpacing = 0) const final;
+};
+
+struct TableGlyph {
+    uint32_t codepoint;
+    int16_t advance;
+    int16_t left;
+    int16_t top;
+    uint16_t width;     // 0 for blank glyphs
+    uint16_t height;
+    uint32_t offset;
+};
+
+// The tables bdf2cpp.py generates, built from a BDF file at runtime
+struct FontTable {
+    int height{};
+    int baseline{};
+    std::vector<TableGlyph> glyphs;     // sorted by codepoint
+    std::vector<uint32_t> bitmap;
+    std::array<int16_t, 128> ascii{};
+
+    // Crops the glyphs the way rgb_matrix::Font draws them, returns false if the file isn't a usable BDF font
+    bool ParseBdf(const char* path);
+};
+
+using FontTablePtr = std::shared_ptr<const FontTable>;
+
+// Fonts parsed at runtime into glyph tables, drawn like the embedded ones
+class TableFontFace final : public FontFace {
+private:
+    FontTablePtr table_;
+
+    const TableGlyph* FindGlyph(uint32_t codepoint) const;
+public:
+    TableFontFace(FontTablePtr table);
+    int height() const final;
+    int baseline() const final;
+    int CharacterWidth(uint32_t codepoint) const final;
+    int DrawText(Canvas* canvas, int x, int y, const Color& color,
+                 const char* utf8Text, int letterSpacing = 0) const final;
+};
+
+// Embedded font registered under fontFile if there is one, the BDF file relative to the executable otherwise,
+// through the warm start cache if the options have one. Returns nullptr if neither is available
+FontPtr LoadFont(const Options& options, const std::string& fontFile);
+
+#endif // FONTS_H
@@ -0,0 +1,75 @@
+/*
+ * Copyright (c) 2019 Dmytro Shestakov
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef FRAMEEXPORT_H
+#define FRAMEEXPORT_H
+
+#include "metrics.h"
+#include "options.h"
+#include "sharedframe.h"
+#include "softcanvas.h"
+
+#include <memory>
+#include <string>
+
+// Publishes the presented frames to shared memory for SharedFrameReader, a screenshot or a preview
+// served by another process. The frame loop copies a frame into the slot after the latest one and
+// goes on, the readers are never waited for
+class FrameExport {
+public:
+    using string = std::string;
+    using Layout = SharedFrameLayout;
+
+    class runtime_error : public std::runtime_error {
+    public:
+        runtime_error(const string& msg);
+    };
+
+    struct Config {
+        string name;            // for shm_open, starts with a slash
+        uint32_t slots{3};      // a reader copying a frame has slots - 1 frames of time before it tears
+    };
+
+    FrameExport(const Config& config, int width, int height);
+    FrameExport(const FrameExport&) = delete;
+    FrameExport& operator=(const FrameExport&) = delete;
+    // Marks the memory closed for the readers and removes the name
+    ~FrameExport();
+
+    void Publish(const SoftCanvas& frame);
+    void RegisterMetrics(MetricsRegistry& registry);
+
+private:
+    const Config config_;
+    size_t size_;
+    uint8_t* base_;
+    Layout::Header* header_;
+    Layout::Slot* slots_;
+    uint64_t frame_{};
+    std::atomic<uint64_t> published_{};
+    Histogram publishTime_;
+};
+
+// From the "export" node, nullptr if it is absent
+std::unique_ptr<FrameExport> CreateFrameExport(const Options& options, int width, int height);
+
+#endif // FRAMEEXPORT_H
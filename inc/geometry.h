@@ -0,0 +1,84 @@
+/*
+ * Copyright (c) 2019 Dmytro Shestakov
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#ifndef GEOMETRY_H
+#define GEOMETRY_H
+
+#include <algorithm>
+#include <climits>
+#include <vector>
+
+struct Rect {
+    int x;
+    int y;
+    int width;
+    int height;
+
+    // Covers any canvas
+    static constexpr Rect Infinite() {
+        return {0, 0, INT_MAX, INT_MAX};
+    }
+
+    bool IsEmpty() const {
+        return width <= 0 || height <= 0;
+    }
+    long Area() const {
+        return IsEmpty() ? 0 : long(width) * height;
+    }
+    int Right() const {
+        return x + width;
+    }
+    int Bottom() const {
+        return y + height;
+    }
+    Rect Intersect(const Rect& other) const {
+        const int left = std::max(x, other.x);
+        const int top = std::max(y, other.y);
+        const int right = std::min(Right(), other.Right());
+        const int bottom = std::min(Bottom(), other.Bottom());
+        return {left, top, right - left, bottom - top};
+    }
+    bool Intersects(const Rect& other) const {
+        return !Intersect(other).IsEmpty();
+    }
+    // Bounding box of both
+    Rect Union(const Rect& other) const {
+        if(IsEmpty()) {
+            return other;
+        }
+        if(other.IsEmpty()) {
+            return *this;
+        }
+        const int left = std::min(x, other.x);
+        const int top = std::min(y, other.y);
+        return {left, top, std::max(Right(), other.Right()) - left, std::max(Bottom(), other.Bottom()) - top};
+    }
+    bool operator==(const Rect& other) const {
+        return x == other.x && y == other.y && width == other.width && height == other.height;
+    }
+    bool operator!=(const Rect& other) const {
+        return !(*this == other);
+    }
+};
+
+using DamageList = std::vector<Rect>;
+
+#endif // GEOMETRY_H
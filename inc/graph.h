@@ -0,0 +1,96 @@
+/*
+ * Copyright (c) 2019 Dmytro Shestakov
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#ifndef GRAPH_H
+#define GRAPH_H
+
+#include "common.h"
+#include "history.h"
+#include "sensors.h"
+#include <memory>
+#include <mutex>
+
+// Sparklines of the sensor history, a band per sensor. New columns are drawn over the
+// oldest ones left to right, so an update repaints only the columns that came in
+class GraphWidget final : public WidgetWrapper {
+private:
+    using Node = YAML::Node;
+    using Canvas = rgb_matrix::Canvas;
+    using Color = rgb_matrix::Color;
+    using string = std::string;
+
+    class invalid_argument : public std::invalid_argument {
+    public:
+        invalid_argument(const string& msg);
+    };
+
+    struct Band {
+        Sensor* sensor;
+        Rect rect;
+        // Indexed by the column, empty ones have no samples
+        std::vector<HistoryBucket> columns;
+        size_t cursor{};
+        // Columns filled since the last draw
+        size_t fresh{};
+        // Values mapped to the band height, only grows
+        float low{1};
+        float high{0};
+        bool rescale{};
+    };
+
+    struct Settings {
+        Rect rect;
+        HistoryTier tier;
+        std::vector<Band> bands;
+    };
+
+    SensorHub& hub_;
+    Rect rect_{};
+    HistoryTier tier_{};
+    std::vector<Band> bands_;
+    // Set until the new settings are drawn in full
+    bool relayout_{};
+    // Loaded by Reconfigure, taken by Update
+    std::mutex pendingMtx_;
+    std::unique_ptr<Settings> pending_;
+    TimePoint nextRefresh_{};
+    Rect bounds_{};
+
+    Settings LoadSettings(const Options& options);
+    void Apply(Settings&& settings);
+    void Append(Band& band, const HistoryBucket& bucket);
+    int GetRow(const Band& band, float value) const;
+    // Returns the area of the column
+    Rect DrawColumn(Canvas* canvas, const Band& band, size_t column) const;
+public:
+    GraphWidget(const Options& options, BaseWidget& widget, SensorHub& hub);
+    void Draw(Canvas* canvas) final;
+    bool DrawChanges(Canvas* canvas, Rect& changed) final;
+    bool Update() final;
+    // Thread safe, throws std::invalid_argument and keeps the current settings if the node is bad
+    void Reconfigure(const Options& options);
+    Rect GetBounds() const final;
+    std::string_view GetName() const final {
+        return "graph";
+    }
+};
+
+#endif // GRAPH_H
@@ -0,0 +1,136 @@
+/*
+ * Copyright (c) 2019 Dmytro Shestakov
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#ifndef HISTORY_H
+#define HISTORY_H
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+#include <vector>
+
+// Fixed capacity queue for exactly one producer and one consumer thread, neither side locks.
+// Push fails when the consumer falls behind, the oldest queued items are never overwritten
+template<typename T, size_t Capacity>
+class SpscRing {
+    static_assert(Capacity && !(Capacity & (Capacity - 1)), "Capacity must be a power of two");
+public:
+    bool Push(const T& item) {
+        const size_t head = head_.load(std::memory_order_relaxed);
+        if(head - tail_.load(std::memory_order_acquire) == Capacity) {
+            return false;
+        }
+        items_[head & (Capacity - 1)] = item;
+        head_.store(head + 1, std::memory_order_release);
+        return true;
+    }
+    bool Pop(T& item) {
+        const size_t tail = tail_.load(std::memory_order_relaxed);
+        if(tail == head_.load(std::memory_order_acquire)) {
+            return false;
+        }
+        item = items_[tail & (Capacity - 1)];
+        tail_.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+    size_t Size() const {
+        return head_.load(std::memory_order_acquire) - tail_.load(std::memory_order_acquire);
+    }
+    static constexpr size_t GetCapacity() {
+        return Capacity;
+    }
+private:
+    // Apart, so that the two threads don't bounce one cache line
+    alignas(64) std::atomic<size_t> head_{};
+    alignas(64) std::atomic<size_t> tail_{};
+    alignas(64) std::array<T, Capacity> items_{};
+};
+
+enum class HistoryTier {
+    RAW,
+    MINUTE,
+    HOUR,
+
+    MAX_VAL
+};
+
+// Samples of a tier period, a raw one holds a single sample
+struct HistoryBucket {
+    int64_t start;      // unix time, seconds
+    float min;
+    float max;
+    float avg;
+    uint32_t count;
+};
+
+struct HistorySample {
+    int64_t time;
+    float value;
+};
+
+// Recent values of a sensor, raw and downsampled to minutes and hours.
+// Add is called by the thread reading the sensor, each tier is popped by a single reader
+class SensorHistory {
+public:
+    static constexpr size_t CAPACITY = 128;
+    using Ring = SpscRing<HistoryBucket, CAPACITY>;
+
+    // Seconds covered by a bucket of the tier, 0 for raw samples
+    static constexpr int64_t GetPeriod(HistoryTier tier) {
+        return tier == HistoryTier::MINUTE ? 60 : tier == HistoryTier::HOUR ? 3600 : 0;
+    }
+    // Accepts "raw", "minute" or "hour", throws std::invalid_argument otherwise
+    static HistoryTier ParseTier(const std::string_view& name);
+
+    void Add(int64_t time, float value);
+    // Refills the tiers from stored samples, oldest first, before the producer starts.
+    // Only the newest buckets that fit a ring are kept, the older ones just seed the aggregates
+    void Restore(const std::vector<HistorySample>& samples);
+    bool Pop(HistoryTier tier, HistoryBucket& bucket) {
+        return rings_[size_t(tier)].Pop(bucket);
+    }
+    // Buckets lost because the reader of their tier fell behind or doesn't exist
+    uint64_t GetDropped() const {
+        return dropped_.load(std::memory_order_relaxed);
+    }
+private:
+    // Bucket being filled by the producer, published once a sample of the next period comes
+    struct Aggregate {
+        int64_t start;
+        float min;
+        float max;
+        double sum;
+        uint32_t count;
+    };
+
+    std::array<Ring, size_t(HistoryTier::MAX_VAL)> rings_{};
+    std::array<Aggregate, size_t(HistoryTier::MAX_VAL)> aggregates_{};
+    std::atomic<uint64_t> dropped_{};
+
+    void Push(HistoryTier tier, const HistoryBucket& bucket);
+    // Calls publish(tier, bucket) for each aggregate the sample closes
+    template<typename Publish>
+    void Accumulate(int64_t time, float value, Publish&& publish);
+};
+
+#endif // HISTORY_H
@@ -0,0 +1,108 @@
+/*
+ * Copyright (c) 2019 Dmytro Shestakov
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#ifndef IIOBUFFER_H
+#define IIOBUFFER_H
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Storage of a single channel in a scan, as described by scan_elements/<channel>_type,
+// e.g. "le:s12/16>>4"
+struct ScanType {
+    bool bigEndian;
+    bool isSigned;
+    unsigned bits;
+    unsigned storageBits;
+    unsigned shift;
+
+    // Returns false if the description is malformed or not supported
+    static bool Parse(std::string_view text, ScanType& type);
+
+    size_t GetBytes() const {
+        return storageBits / 8;
+    }
+    int64_t Decode(const uint8_t* data) const;
+};
+
+// Triggered buffer of an IIO device. Enables the requested scan elements and the buffer,
+// then decodes the binary scans read from the character device
+class IioBuffer {
+public:
+    using path = std::filesystem::path;
+    using string = std::string;
+
+    class runtime_error : public std::runtime_error {
+    public:
+        runtime_error(const string& msg);
+    };
+
+    // Channels are scan element names without a suffix, e.g. in_temp. An empty trigger keeps the current one
+    IioBuffer(const path& devicePath, const path& chardevPath, const std::vector<string>& channels,
+              const string& trigger);
+    IioBuffer(const IioBuffer&) = delete;
+    IioBuffer& operator=(const IioBuffer&) = delete;
+    ~IioBuffer();
+
+    // Non-blocking, ready to read when readable
+    int GetFd() const {
+        return fd_;
+    }
+    // Read opens the chardev again once the other side goes away, the new fd has to be watched
+    uint32_t GetOpens() const {
+        return opens_;
+    }
+    // Consumes every complete scan available, returns the number of scans
+    size_t Read();
+    // Latest sample of a channel, in the order given to the constructor
+    int64_t GetValue(size_t channel) const {
+        return values_[channel];
+    }
+private:
+    struct Channel {
+        ScanType type;
+        size_t index;
+        size_t offset;
+    };
+
+    static constexpr size_t SCANS_PER_READ = 64;
+
+    path devicePath_;
+    path chardevPath_;
+    std::vector<Channel> channels_;
+    std::vector<int64_t> values_;
+    std::vector<uint8_t> buffer_;
+    size_t scanBytes_{};
+    size_t pending_{};
+    int fd_{-1};
+    uint32_t opens_{};
+
+    void WriteAttribute(const path& file, std::string_view value);
+    string ReadAttribute(const path& file);
+    void Open();
+};
+
+#endif // IIOBUFFER_H
@@ -23,14 +23,56 @@
 #define LEDWIDGET_H
 
 #include "led-matrix.h"
+#include "geometry.h"
+#include "metrics.h"
+#include "softcanvas.h"
+#include "workerpool.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <deque>
 #include <mutex>
-#include <condition_variable>
 #include <memory>
-#include <atomic>
+#include <optional>
+#include <set>
+#include <string_view>
+#include <thread>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+// Deadlines follow the wall clock, the displayed time changes on its boundaries
+using TimePoint = std::chrono::system_clock::time_point;
+
+// One bit per child widget of a container, children past the 64th share the last bit
+using SlotMask = uint64_t;
+constexpr SlotMask ALL_SLOTS = ~SlotMask{};
+
+class UpdateScheduler;
 
 struct BaseWidget {
-    virtual void Draw(rgb_matrix::FrameCanvas* canvas) = 0;
+    virtual void Draw(rgb_matrix::Canvas* canvas) = 0;
     virtual void RequestUpdate() = 0;
+    // Requests an update once the deadline is reached
+    virtual void ScheduleUpdate(TimePoint deadline) = 0;
+    // Called by children, containers update only the children whose slots are set
+    virtual void RequestUpdate(SlotMask slots);
+    virtual void ScheduleUpdate(TimePoint deadline, SlotMask slots);
+    // Assigned by the container the widget is added to, along with the scheduler of its slots
+    virtual void AttachSlot(SlotMask slot, UpdateScheduler& scheduler);
+    // Refreshes the content to show, returns false if it is the same as drawn last time. Runs on the
+    // worker pool concurrently with the Update and Draw of the other widgets, never of the same one.
+    // State shared with other widgets needs its own synchronization
+    virtual bool Update();
+    // Area touched by the last Draw
+    virtual Rect GetBounds() const;
+    // Draws only what changed since the last Draw over the content it left, stores the changed area.
+    // Returns false without drawing if the whole widget has to be redrawn, which is the default
+    virtual bool DrawChanges(rgb_matrix::Canvas* canvas, Rect& changed);
+    // Label of the widget metrics
+    virtual std::string_view GetName() const;
     virtual ~BaseWidget();
 };
 
@@ -40,16 +82,79 @@ class WidgetWrapper : public BaseWidget {
 public:
     WidgetWrapper(BaseWidget& widget);
     void RequestUpdate() final;
+    void ScheduleUpdate(TimePoint deadline) final;
+    using BaseWidget::RequestUpdate;
+    using BaseWidget::ScheduleUpdate;
+    void AttachSlot(SlotMask slot, UpdateScheduler& scheduler) final;
 private:
     BaseWidget& widget_;
+    // Every slot of the parent until attached
+    std::atomic<SlotMask> slot_{ALL_SLOTS};
+    // Of the container once attached, the requests skip the call to the parent
+    std::atomic<UpdateScheduler*> scheduler_{};
 };
 
+// Sleeps until a slot is marked dirty or the earliest registered deadline passes.
+// Uses an eventfd for requests and an absolute realtime timerfd for deadlines. Setting the system
+// time drops the deadlines and marks every slot dirty, the widgets schedule theirs again
+class UpdateScheduler {
+public:
+    UpdateScheduler();
+    UpdateScheduler(const UpdateScheduler&) = delete;
+    UpdateScheduler& operator=(const UpdateScheduler&) = delete;
+    ~UpdateScheduler();
+
+    // Lock-free, only the request that finds no dirty slots signals the eventfd
+    void Wake(SlotMask slots);
+    void Schedule(TimePoint deadline, SlotMask slots);
+    // Returns the dirty slots and clears them, 0 if interrupted by a signal
+    SlotMask Wait();
+    // Number of Wait calls that returned dirty slots
+    uint64_t GetEpoch() const {
+        return epoch_.load(std::memory_order_acquire);
+    }
+    // Steady clock nanoseconds when the slots returned by the last Wait became due, 0 if unknown.
+    // A request racing with Wait may be attributed to the neighbouring round
+    int64_t GetReadyTime() const {
+        return readyTime_;
+    }
+private:
+    using Deadline = std::pair<TimePoint, SlotMask>;
+    // A deadline scheduled again by an update is kept once
+    using DeadlineQueue = std::set<Deadline>;
+
+    int eventFd_;
+    int timerFd_;
+    std::atomic<SlotMask> dirty_{};
+    std::atomic<uint64_t> epoch_{};
+    // Of the first request since the last Wait
+    std::atomic<int64_t> requestTime_{};
+    int64_t readyTime_{};
+    std::mutex mtx_;
+    DeadlineQueue deadlines_;
+    // What the timer is set to, max if disarmed
+    TimePoint armed_{TimePoint::max()};
+
+    // Also returns the earliest expired deadline
+    SlotMask PopExpired(TimePoint& earliest);
+    // Only when the earliest deadline moved
+    void ArmTimer();
+};
+
+// Every widget draws into its own layer on the worker pool, the frame is composited from the layers.
+// The children added at run time are called through BaseWidget, see StaticMainWidget for the fixed ones
 class MainWidget : public BaseWidget {
 public:
     using WidgetVector = std::vector<WidgetPtr>;
 
+    // One worker less than the cores, the frame thread takes part as well
+    MainWidget();
+    explicit MainWidget(size_t workers);
+
     void AddWidget(WidgetPtr& widget) {
+        Attach(*widget, children_.size());
         widgets_.push_back(std::move(widget));
+        fullRepaint_ = true;
     }
 
     template<typename... Widgets>
@@ -60,15 +165,166 @@ public:
         }
     }
 
-    void Draw(rgb_matrix::FrameCanvas *canvas) final;
+    // Recomposites only the areas of changed widgets, the canvas must keep the previous frame
+    void Draw(rgb_matrix::Canvas *canvas) override;
 
     void RequestUpdate() final;
+    void ScheduleUpdate(TimePoint deadline) final;
+    void RequestUpdate(SlotMask slots) final;
+    void ScheduleUpdate(TimePoint deadline, SlotMask slots) final;
+
+    // Areas changed by the last Draw
+    const DamageList& GetDamage() const {
+        return damage_;
+    }
+
+    // Advances each time Draw picks up dirty widgets
+    uint64_t GetEpoch() const {
+        return scheduler_.GetEpoch();
+    }
+
+    // Steady clock nanoseconds when the changes drawn last became due, 0 for a repaint
+    int64_t GetReadyTime() const {
+        return readyTime_;
+    }
+
+    // Draw time of every widget added so far
+    void RegisterMetrics(MetricsRegistry& registry) const;
+
+protected:
+    // The first slots are kept for the children attached by index
+    MainWidget(size_t workers, size_t reserved);
+    // Thread safe for distinct reserved indexes
+    void Attach(BaseWidget& widget, size_t index);
+    // forEachFixed(f) calls f(widget, index) for each reserved child that is there, with its type.
+    // The others are called through BaseWidget on the pool meanwhile
+    template<typename ForEachFixed>
+    void DrawFrame(rgb_matrix::Canvas* canvas, ForEachFixed&& forEachFixed);
 
 private:
+    static SlotMask SlotOf(size_t index) {
+        return SlotMask{1} << std::min<size_t>(index, 63);
+    }
+
+    // Reserved ones are null until attached
+    std::vector<BaseWidget*> children_{};
+    const size_t fixed_;
+    // Owns the children added at run time
     WidgetVector widgets_{};
-    std::mutex mtx_{};
-    std::condition_variable cv_{};
-    std::atomic_bool pendingRequest_{};
+    // Same size as the canvas, so widgets keep drawing in panel coordinates
+    std::vector<SoftCanvas> layers_{};
+    enum Redraw : uint8_t {
+        NONE,
+        FULL,
+        CHANGES,
+    };
+
+    // Area to recomposite besides the new bounds, only that area after DrawChanges
+    std::vector<Rect> oldBounds_{};
+    // Of the last Draw of each child, clipped to the canvas
+    std::vector<Rect> bounds_{};
+    // Not vector<bool>, the workers write neighbouring elements concurrently
+    std::vector<Redraw> redraw_{};
+    DamageList damage_{};
+    // Per widget, includes DrawChanges
+    std::deque<Histogram> drawTimes_{};
+    int64_t readyTime_{};
+    bool fullRepaint_{true};
+    UpdateScheduler scheduler_{};
+    WorkerPool pool_;
+
+    // Waits for dirty slots, returns true if every layer has to be drawn again
+    bool BeginFrame(const Rect& canvasRect, SlotMask& dirty);
+    void Composite(rgb_matrix::Canvas* canvas, bool repaint, const Rect& canvasRect);
+    template<typename Widget>
+    void RedrawLayer(Widget& widget, size_t index, SlotMask dirty, bool repaint, const Rect& canvasRect);
+};
+
+template<typename ForEachFixed>
+void MainWidget::DrawFrame(rgb_matrix::Canvas* canvas, ForEachFixed&& forEachFixed) {
+    const Rect canvasRect{0, 0, canvas->width(), canvas->height()};
+    SlotMask dirty;
+    const bool repaint = BeginFrame(canvasRect, dirty);
+    // The fixed children are drawn on this thread while the workers start on the others, waking
+    // a worker costs more than one of them usually takes
+    pool_.Run(children_.size() - fixed_, [&](size_t i) {
+        RedrawLayer(*children_[fixed_ + i], fixed_ + i, dirty, repaint, canvasRect);
+    }, [&] {
+        forEachFixed([&](auto& widget, size_t index) {
+            RedrawLayer(widget, index, dirty, repaint, canvasRect);
+        });
+    });
+    forEachFixed([&](auto& widget, size_t index) {
+        bounds_[index] = widget.GetBounds().Intersect(canvasRect);
+    });
+    for(size_t i = fixed_; i < children_.size(); ++i) {
+        bounds_[i] = children_[i]->GetBounds().Intersect(canvasRect);
+    }
+    Composite(canvas, repaint, canvasRect);
+}
+
+// Runs on the worker pool or the frame thread, touches only the state of a single widget
+template<typename Widget>
+void MainWidget::RedrawLayer(Widget& widget, size_t index, SlotMask dirty, bool repaint, const Rect& canvasRect) {
+    const bool changed = (dirty & SlotOf(index)) && widget.Update();
+    if(!changed && !repaint) {
+        return;
+    }
+    const auto start = std::chrono::steady_clock::now();
+    // A fresh layer has nothing to draw the changes over
+    if(Rect changed{}; !repaint && widget.DrawChanges(&layers_[index], changed)) {
+        drawTimes_[index].Observe(std::chrono::steady_clock::now() - start);
+        changed = changed.Intersect(canvasRect);
+        oldBounds_[index] = changed;
+        redraw_[index] = changed.IsEmpty() ? NONE : CHANGES;
+        return;
+    }
+    const Rect oldBounds = widget.GetBounds().Intersect(canvasRect);
+    layers_[index].Fill(oldBounds, 0, 0, 0);
+    widget.Draw(&layers_[index]);
+    drawTimes_[index].Observe(std::chrono::steady_clock::now() - start);
+    oldBounds_[index] = oldBounds;
+    redraw_[index] = FULL;
+}
+
+// The listed widgets live inline in the container and take the first slots in that order. They are
+// drawn on the frame thread by direct calls, resolved at compile time to their final overrides.
+// Each one is constructed by Emplace, before the first Draw, the ones left empty are skipped.
+// AddWidget appends after them
+template<typename... Widgets>
+class StaticMainWidget final : public MainWidget {
+public:
+    StaticMainWidget() : StaticMainWidget{std::max(std::thread::hardware_concurrency(), 1u) - 1}
+    { }
+    explicit StaticMainWidget(size_t workers) : MainWidget{workers, sizeof...(Widgets)}
+    { }
+
+    // Thread safe for distinct types, the widgets may be built in parallel
+    template<typename Widget, typename... Args>
+    Widget& Emplace(Args&&... args) {
+        Widget& widget = std::get<std::optional<Widget>>(widgets_).emplace(std::forward<Args>(args)...);
+        Attach(widget, IndexOf<Widget>(std::index_sequence_for<Widgets...>{}));
+        return widget;
+    }
+
+    void Draw(rgb_matrix::Canvas* canvas) final {
+        DrawFrame(canvas, [this](auto&& f) {
+            ForEach(f, std::index_sequence_for<Widgets...>{});
+        });
+    }
+
+private:
+    std::tuple<std::optional<Widgets>...> widgets_;
+
+    template<typename Widget, size_t... I>
+    static constexpr size_t IndexOf(std::index_sequence<I...>) {
+        return ((std::is_same_v<Widget, Widgets> ? I : 0) + ...);
+    }
+
+    template<typename F, size_t... I>
+    void ForEach(F& f, std::index_sequence<I...>) {
+        ((std::get<I>(widgets_) ? f(*std::get<I>(widgets_), I) : void()), ...);
+    }
 };
 
 #endif // LEDWIDGET_H
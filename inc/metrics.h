@@ -0,0 +1,188 @@
+/*
+ * Copyright (c) 2019 Dmytro Shestakov
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#ifndef METRICS_H
+#define METRICS_H
+
+#include "options.h"
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <filesystem>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Nanosecond durations in power of two buckets from 1 us to 8.6 s. Observe is three relaxed
+// atomic increments, readers get a slightly torn but never decreasing snapshot
+class Histogram {
+public:
+    static constexpr size_t BUCKETS = 24;
+    static constexpr unsigned FIRST_BOUND_LOG2 = 10;
+
+    struct Snapshot {
+        // Not cumulative, the last one counts values past every bound
+        std::array<uint64_t, BUCKETS + 1> counts;
+        uint64_t count;
+        int64_t sum;
+    };
+
+    void Observe(int64_t ns) {
+        buckets_[GetBucket(ns)].fetch_add(1, std::memory_order_relaxed);
+        count_.fetch_add(1, std::memory_order_relaxed);
+        sum_.fetch_add(ns, std::memory_order_relaxed);
+    }
+    template<typename Rep, typename Period>
+    void Observe(std::chrono::duration<Rep, Period> duration) {
+        Observe(std::chrono::duration_cast<std::chrono::nanoseconds>(duration).count());
+    }
+    Snapshot GetSnapshot() const;
+    // Upper bound of a bucket in nanoseconds
+    static int64_t GetBound(size_t bucket) {
+        return int64_t{1} << (FIRST_BOUND_LOG2 + bucket);
+    }
+    static size_t GetBucket(int64_t ns) {
+        if(ns <= GetBound(0)) {
+            return 0;
+        }
+        // ceil(log2(ns))
+        const unsigned log2 = 64 - unsigned(__builtin_clzll(uint64_t(ns - 1)));
+        return std::min<size_t>(log2 - FIRST_BOUND_LOG2, BUCKETS);
+    }
+private:
+    std::array<std::atomic<uint64_t>, BUCKETS + 1> buckets_{};
+    std::atomic<uint64_t> count_{};
+    std::atomic<int64_t> sum_{};
+};
+
+// Events per second over the last full second, decays once the events stop
+class RateMeter {
+public:
+    // Called by a single thread
+    void Tick();
+    double GetRate() const;
+private:
+    using clock = std::chrono::steady_clock;
+
+    std::atomic<int64_t> windowStart_{};
+    std::atomic<uint64_t> windowCount_{};
+    std::atomic<double> rate_{};
+};
+
+// Metric families by name, formatted in the Prometheus text format on demand. Registration
+// locks and is meant for the startup, the registered values are read without locks
+class MetricsRegistry {
+public:
+    using string = std::string;
+    using Reader = std::function<double()>;
+
+    // Labels are written as they are, e.g. widget="clock",slot="0"
+    Histogram& AddHistogram(const string& name, const string& help, const string& labels = {});
+    // Exports a histogram owned elsewhere, it must outlive the registry
+    void AddHistogram(const string& name, const string& help, const string& labels, const Histogram& histogram);
+    std::atomic<uint64_t>& AddCounter(const string& name, const string& help, const string& labels = {});
+    void AddCounter(const string& name, const string& help, const string& labels, Reader reader);
+    void AddGauge(const string& name, const string& help, const string& labels, Reader reader);
+
+    void Write(std::ostream& output) const;
+    string Format() const;
+private:
+    enum class Type {
+        COUNTER,
+        GAUGE,
+        HISTOGRAM,
+    };
+
+    struct Series {
+        string labels;
+        const Histogram* histogram;
+        Reader reader;
+    };
+
+    struct Family {
+        string help;
+        Type type;
+        std::vector<Series> series;
+    };
+
+    mutable std::mutex mtx_;
+    std::map<string, Family> families_;
+    std::deque<Histogram> histograms_;
+    std::deque<std::atomic<uint64_t>> counters_;
+
+    void Add(const string& name, const string& help, Type type, Series series);
+};
+
+// Serves the registry to whoever connects to a unix socket and rewrites a text file for
+// collectors like the node_exporter textfile one. Works on its own thread, the frame loop never waits for it
+class MetricsExporter {
+public:
+    using path = std::filesystem::path;
+    using string = std::string;
+
+    class runtime_error : public std::runtime_error {
+    public:
+        runtime_error(const string& msg);
+    };
+
+    struct Config {
+        path socketPath;    // empty - no socket
+        path filePath;      // empty - no file
+        std::chrono::seconds fileInterval{15};
+    };
+
+    // Binds the socket and opens the file, nothing is served before Start
+    MetricsExporter(const MetricsRegistry& registry, const Config& config);
+    MetricsExporter(const MetricsExporter&) = delete;
+    MetricsExporter& operator=(const MetricsExporter&) = delete;
+    ~MetricsExporter();
+    // Starts the thread. Apart from the constructor, so that the paths are taken while still root
+    // and the thread comes after the display took the new ones for its refresh threads
+    void Start();
+private:
+    const MetricsRegistry& registry_;
+    const Config config_;
+    int listenFd_{-1};
+    int fileFd_{-1};
+    int stopFd_{-1};
+    // Only the first of the failed writes in a row is logged
+    bool fileFailed_{};
+    std::thread thread_;
+
+    void Listen();
+    void OpenFile();
+    void Serve();
+    void WriteFile();
+};
+
+// From the "metrics" node, nullptr if it is absent. Paths are relative to the executable
+std::unique_ptr<MetricsExporter> CreateMetricsExporter(const Options& options, const MetricsRegistry& registry);
+
+#endif // METRICS_H
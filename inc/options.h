@@ -36,6 +36,8 @@
 
 using OptionalNode = std::optional<YAML::Node>;
 
+class WarmCache;
+
 class Options
 {
 private:
@@ -48,6 +50,8 @@ private:
 
     YAML::Node rootNode_;
     path execDir_;
+    path configPath_;
+    std::shared_ptr<WarmCache> cache_;
 
 public:
     Options(const char* programPath, const char* configFileName = "config.yml") {
@@ -55,12 +59,21 @@ public:
         execDir_ = execPath.remove_filename();
         auto configPath = execPath.replace_filename(configFileName);
         std::cout << "Used config file: " << configPath << std::endl;
+        configPath_ = configPath;
         rootNode_ = YAML::LoadFile(configPath);
         if(!rootNode_.IsDefined()) {
             throw YAML::Exception{YAML::Mark::null_mark(), "Root node not found"};
         }
     }
 
+    // Without a config path the options can't be reloaded
+    Options(const path& execDir, const YAML::Node& rootNode, const path& configPath = {}) :
+        rootNode_{rootNode}, execDir_{execDir}, configPath_{configPath} {
+        if(!rootNode_.IsDefined()) {
+            throw YAML::Exception{YAML::Mark::null_mark(), "Root node not found"};
+        }
+    }
+
     optional<RGBMatrix::Options> GetMatrixOptions() const {
         if(auto optionalNode = GetNode("matrix"); optionalNode) {
             try {
@@ -93,6 +106,43 @@ public:
         return execDir_;
     }
 
+    const path& GetConfigPath() const
+    {
+        return configPath_;
+    }
+
+    const YAML::Node& GetRoot() const
+    {
+        return rootNode_;
+    }
+
+    // nullptr if the warm start cache isn't configured
+    WarmCache* GetCache() const
+    {
+        return cache_.get();
+    }
+
+    void SetCache(std::shared_ptr<WarmCache> cache)
+    {
+        cache_ = std::move(cache);
+    }
+
+    // Parses the config file again, throws YAML::Exception if it is malformed
+    Options Reload() const
+    {
+        Options options{execDir_, YAML::LoadFile(configPath_), configPath_};
+        options.cache_ = cache_;
+        return options;
+    }
+
+    // Yaml nodes share their memory and aren't safe to read from several threads, each thread takes a clone
+    Options Clone() const
+    {
+        Options options{execDir_, YAML::Clone(rootNode_), configPath_};
+        options.cache_ = cache_;
+        return options;
+    }
+
     OptionalNode GetNode(const string& nodeName) const {
         try {
             YAML::Node node = rootNode_[nodeName];
@@ -0,0 +1,56 @@
+/*
+ * Copyright (c) 2019 Dmytro Shestakov
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#ifndef PIXELKERNELS_H
+#define PIXELKERNELS_H
+
+#include <cstddef>
+#include <cstdint>
+
+// Row kernels over packed RGB888 pixels, vectorized with NEON or SSE2 when the compiler targets them.
+// Color math rounds x * y / 255 exactly, so every implementation produces the same bytes
+namespace pixel {
+
+    void Fill(uint8_t* dst, size_t count, uint8_t red, uint8_t green, uint8_t blue);
+    // Paints the pixels whose bits are set, mask words hold the leftmost pixel in the MSB
+    void ExpandMask(uint8_t* dst, const uint32_t* mask, size_t count, uint8_t red, uint8_t green, uint8_t blue);
+    // Copies src over dst, black source pixels are transparent
+    void Composite(uint8_t* dst, const uint8_t* src, size_t count);
+    // Same as Composite with the opaque pixels mixed at alpha / 255
+    void Blend(uint8_t* dst, const uint8_t* src, size_t count, uint8_t alpha);
+    // Multiplies every channel by its scale / 255
+    void Scale(uint8_t* dst, size_t count, uint8_t red, uint8_t green, uint8_t blue);
+
+    // Vector extension the kernels were built with
+    const char* GetIsa();
+
+    // Reference implementation, always available
+    namespace scalar {
+        void Fill(uint8_t* dst, size_t count, uint8_t red, uint8_t green, uint8_t blue);
+        void ExpandMask(uint8_t* dst, const uint32_t* mask, size_t count, uint8_t red, uint8_t green, uint8_t blue);
+        void Composite(uint8_t* dst, const uint8_t* src, size_t count);
+        void Blend(uint8_t* dst, const uint8_t* src, size_t count, uint8_t alpha);
+        void Scale(uint8_t* dst, size_t count, uint8_t red, uint8_t green, uint8_t blue);
+    }
+
+}
+
+#endif // PIXELKERNELS_H
@@ -0,0 +1,153 @@
+/*
+ * Copyright (c) 2019 Dmytro Shestakov
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef PUSHWIDGET_H
+#define PUSHWIDGET_H
+
+#include "common.h"
+#include "fonts.h"
+#include "metrics.h"
+#include "reactor.h"
+#include "spritecache.h"
+
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string_view>
+#include <vector>
+
+// Text and values pushed by other programs through a unix socket, one line per update:
+//   name text      shows the text in the field, nothing after the name clears it
+//   name=value     shows the number with the decimals and the unit of the field
+// The socket is served by the reactor and never written to, a client that stops reading holds
+// nothing up. Updates only replace the pending text of their field, a burst of them is one
+// update request and one frame
+class PushWidget final : public WidgetWrapper {
+private:
+    using Node = YAML::Node;
+    using Canvas = rgb_matrix::Canvas;
+    using Color = rgb_matrix::Color;
+    using string = std::string;
+    using string_view = std::string_view;
+
+    class invalid_argument : public std::invalid_argument {
+    public:
+        invalid_argument(const string& msg);
+    };
+
+    // Longer lines and more clients than that are dropped
+    static constexpr size_t MAX_LINE = 256;
+    static constexpr size_t MAX_CLIENTS = 8;
+    // A client gets that much read per wakeup, the others are served in between
+    static constexpr size_t READ_BUDGET = 4096;
+    // Of the listener left alone after an accept failed for lack of fds or memory
+    static constexpr std::chrono::seconds ACCEPT_RETRY{1};
+
+    struct Field {
+        string name;
+        Rect rect;
+        Color color;
+        int decimals;
+        string unit;
+        string text;
+        std::optional<Sprite> sprite;
+    };
+
+    struct Client {
+        int fd;
+        string partial;
+    };
+
+    FontPtr font_;
+    std::vector<Field> fields_;
+    string socketPath_;
+    int listenFd_{-1};
+    // Given up to take a connection and close it when out of fds
+    int spareFd_{-1};
+    // One shot, watches the listener again after a pause. Made up front, there may be no fds later
+    int retryFd_{-1};
+    Reactor* reactor_{};
+    Rect bounds_{};
+    // Reactor side
+    std::vector<Client> clients_;
+    bool acceptPaused_{};
+    // Latest text of each field since the last update, taken by Update
+    std::mutex pendingMtx_;
+    std::vector<std::optional<string>> pending_;
+    // Swapped with pending_, keeps the allocations
+    std::vector<std::optional<string>> taken_;
+    // Set by the first update after a frame, so a burst requests one
+    std::atomic<bool> requested_{};
+    std::atomic<uint64_t> updates_{};
+    std::atomic<uint64_t> requests_{};
+    std::atomic<uint64_t> rejected_{};
+    std::atomic<uint64_t> droppedClients_{};
+    std::atomic<uint64_t> acceptErrors_{};
+    std::atomic<uint64_t> connectedClients_{};
+
+    void LoadFields(const Node& pushNode);
+    void Listen();
+    void Accept();
+    void PauseAccept();
+    void ResumeAccept();
+    void Receive(int fd);
+    void Disconnect(int fd, bool dropped);
+    void Parse(string_view line);
+    void SetField(size_t index, string text);
+public:
+    PushWidget(const Options& options, BaseWidget& widget);
+    PushWidget(const PushWidget&) = delete;
+    PushWidget& operator=(const PushWidget&) = delete;
+    // Closes the socket and the clients, the reactor has to be stopped by then
+    ~PushWidget();
+
+    void Draw(Canvas* canvas) final;
+    bool Update() final;
+    Rect GetBounds() const final;
+    std::string_view GetName() const final {
+        return "push";
+    }
+    // Serves the socket on the reactor from then on
+    void Start(Reactor& reactor);
+    void RegisterMetrics(MetricsRegistry& registry);
+    // Updates through the socket and the update requests they came down to
+    uint64_t GetUpdates() const {
+        return updates_.load(std::memory_order_relaxed);
+    }
+    uint64_t GetRequests() const {
+        return requests_.load(std::memory_order_relaxed);
+    }
+    uint64_t GetRejected() const {
+        return rejected_.load(std::memory_order_relaxed);
+    }
+    uint64_t GetDroppedClients() const {
+        return droppedClients_.load(std::memory_order_relaxed);
+    }
+    // Accepts that failed for lack of fds or memory
+    uint64_t GetAcceptErrors() const {
+        return acceptErrors_.load(std::memory_order_relaxed);
+    }
+};
+
+#endif // PUSHWIDGET_H
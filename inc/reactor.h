@@ -0,0 +1,135 @@
+/*
+ * Copyright (c) 2019 Dmytro Shestakov
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef REACTOR_H
+#define REACTOR_H
+
+#include "metrics.h"
+
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <functional>
+#include <initializer_list>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+// The event loop of the process, one epoll on a thread of its own. It owns the signalfd, the
+// cadence timers and the device fds, and turns them into update requests for the render thread.
+// Sources are added at any time and stay until the reactor goes. Handlers run on the reactor
+// thread one at a time, so everything they reach needs to outlive Stop
+class Reactor {
+public:
+    using string = std::string;
+    using Duration = std::chrono::nanoseconds;
+    using FdHandler = std::function<void(uint32_t events)>;
+    // Called with the expirations since the last call, more than one if the handlers fell behind
+    using TimerHandler = std::function<void(uint64_t expirations)>;
+    using SignalHandler = std::function<void(int signo)>;
+
+    class runtime_error : public std::runtime_error {
+    public:
+        runtime_error(const string& msg);
+    };
+
+    Reactor();
+    Reactor(const Reactor&) = delete;
+    Reactor& operator=(const Reactor&) = delete;
+    ~Reactor();
+
+    // Blocks the signals for the calling thread and the ones it creates from then on. Called first
+    // thing in main, a signal left unblocked anywhere would still be delivered the old way
+    static void BlockSignals(std::initializer_list<int> signals);
+
+    // Level triggered, a handler that leaves the fd readable is called again
+    void AddFd(const string& source, int fd, uint32_t events, FdHandler handler);
+    // Stops watching the fd, closing it is up to the caller. Thread safe, a handler may remove its
+    // own fd. The source is reused once the events at hand are handled
+    void RemoveFd(int fd);
+    // Periodic on the monotonic clock and due right away. Timers of the same period share the phase
+    // of the reactor start, so they come due in a single wakeup
+    void AddTimer(const string& source, Duration period, TimerHandler handler);
+    // The signals have to be blocked, see BlockSignals
+    void AddSignals(std::initializer_list<int> signals, SignalHandler handler);
+
+    void Start();
+    // Thread safe and idempotent. Joins the thread unless called from a handler, the loop ends
+    // after that handler then, and the destructor joins
+    void Stop();
+
+    // Returns of epoll_wait with at least one event
+    uint64_t GetWakeups() const {
+        return wakeups_.load(std::memory_order_relaxed);
+    }
+    uint64_t GetEvents() const {
+        return events_.load(std::memory_order_relaxed);
+    }
+    // Of the sources added so far
+    void RegisterMetrics(MetricsRegistry& registry);
+
+private:
+    using clock = std::chrono::steady_clock;
+
+    enum class Kind {
+        FD,
+        TIMER,
+        SIGNAL,
+        STOP
+    };
+
+    struct Source {
+        string name;
+        Kind kind;
+        int fd;
+        bool owned;     // closed by the reactor
+        // Takes the events, the expirations or the signal number
+        std::function<void(uint64_t)> handler;
+        std::atomic<uint64_t> events{};
+        std::atomic<bool> active{};
+        bool exported{};    // in the metrics, never reused
+    };
+
+    const clock::time_point epoch_;
+    int epollFd_{-1};
+    int stopFd_{-1};
+    std::mutex mtx_;
+    // The epoll data points into it, a deque keeps the elements in place
+    std::deque<Source> sources_;
+    // Removed while events for them may be at hand, freed after them
+    std::vector<Source*> retired_;
+    std::vector<Source*> free_;
+    std::thread thread_;
+    std::atomic<bool> stop_{};
+    std::atomic<uint64_t> wakeups_{};
+    std::atomic<uint64_t> events_{};
+
+    void AddSource(const string& name, Kind kind, int fd, bool owned, uint32_t events,
+                   std::function<void(uint64_t)> handler);
+    void Dispatch(Source& source, uint32_t events);
+    void FreeRetired();
+    void Run();
+};
+
+#endif // REACTOR_H
@@ -0,0 +1,180 @@
+/*
+ * Copyright (c) 2019 Dmytro Shestakov
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef RECORDER_H
+#define RECORDER_H
+
+#include "geometry.h"
+#include "metrics.h"
+#include "options.h"
+#include "softcanvas.h"
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <filesystem>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+// XOR of a frame with the previous one, run-length coded as pairs of varints: bytes alike, bytes
+// that differ followed by their XOR. A keyframe is coded against a black frame
+class FrameDelta {
+public:
+    // Appended to output, previous is nullptr for a keyframe
+    static void Encode(const uint8_t* frame, const uint8_t* previous, size_t size, std::vector<uint8_t>& output);
+    // XORs the delta into frame, returns the rows it changed, or false if the delta is malformed
+    static bool Apply(const uint8_t* data, size_t length, uint8_t* frame, size_t size, size_t stride, Rect& changed);
+};
+
+// A recording starts with a header, the frames follow in records
+struct RecordingFormat {
+    static constexpr char MAGIC[8] = {'P', 'C', 'L', 'K', 'R', 'E', 'C', '1'};
+    // Magic, width and height as uint16, wall clock nanoseconds of the start as int64
+    static constexpr size_t HEADER_SIZE = 20;
+    // Payload length as uint32, flags as uint8, nanoseconds since the start as uint64
+    static constexpr size_t RECORD_HEADER_SIZE = 13;
+    static constexpr uint8_t KEYFRAME = 1;
+};
+
+// Records the presented frames for a replay off the panel. The frame loop only encodes, the
+// writes are left to a thread of its own. Writing alternates between two files, each one
+// starting with a keyframe, so the disk use stays bounded. Both are opened up front, before
+// the matrix drops the root privileges
+class FrameRecorder {
+public:
+    using path = std::filesystem::path;
+    using string = std::string;
+
+    class runtime_error : public std::runtime_error {
+    public:
+        runtime_error(const string& msg);
+    };
+
+    struct Config {
+        path filePath;                  // the other file is filePath with ".1" appended
+        unsigned keyframeInterval{600};
+        uint64_t maxBytes{16 << 20};    // of each file
+        size_t queueLimit{64};          // records waiting for the writer, newer ones are dropped past it
+    };
+
+    FrameRecorder(const Config& config, int width, int height);
+    FrameRecorder(const FrameRecorder&) = delete;
+    FrameRecorder& operator=(const FrameRecorder&) = delete;
+    ~FrameRecorder();
+
+    // Called by the frame loop for every frame presented
+    void Record(const SoftCanvas& frame);
+    void RegisterMetrics(MetricsRegistry& registry);
+
+private:
+    using clock = std::chrono::steady_clock;
+
+    struct Entry {
+        std::vector<uint8_t> bytes;
+        // Starts the other file
+        bool rotate;
+    };
+
+    const Config config_;
+    const int width_;
+    const int height_;
+    const clock::time_point start_;
+    const int64_t startWallTime_;
+    int fds_[2]{-1, -1};
+    // Frame loop side
+    std::vector<uint8_t> previous_;
+    bool hasPrevious_{};
+    unsigned sinceKeyframe_{};
+    uint64_t fileBytes_{};
+    std::vector<uint8_t> scratch_;
+    // Writer side
+    size_t current_{};
+    std::mutex mtx_;
+    std::condition_variable cv_;
+    std::deque<Entry> queue_;
+    bool stop_{};
+    std::thread thread_;
+    // Metrics
+    std::atomic<uint64_t> frames_{};
+    std::atomic<uint64_t> keyframes_{};
+    std::atomic<uint64_t> bytes_{};
+    std::atomic<uint64_t> dropped_{};
+    std::atomic<uint64_t> writeErrors_{};
+    Histogram encodeTime_;
+
+    std::vector<uint8_t> CreateHeader() const;
+    void Write();
+    bool WriteAll(int fd, const std::vector<uint8_t>& bytes);
+};
+
+// Reads a recording back frame by frame
+class FrameReader {
+public:
+    using path = std::filesystem::path;
+    using string = std::string;
+
+    class runtime_error : public std::runtime_error {
+    public:
+        runtime_error(const string& msg);
+    };
+
+    struct Frame {
+        int64_t time;       // nanoseconds since the start of the recording
+        bool keyframe;
+        size_t bytes;       // of the record
+        Rect changed;
+    };
+
+    explicit FrameReader(const path& filePath);
+    int width() const {
+        return width_;
+    }
+    int height() const {
+        return height_;
+    }
+    int64_t GetStartWallTime() const {
+        return startWallTime_;
+    }
+    // Applies the next frame to the canvas, which has to hold the one before it. Frames before the
+    // first keyframe are skipped. False at the end, a record cut short by a crash ends the recording
+    bool Next(SoftCanvas& canvas, Frame& frame);
+
+private:
+    std::ifstream file_;
+    int width_;
+    int height_;
+    int64_t startWallTime_;
+    bool synced_{};
+    std::vector<uint8_t> payload_;
+};
+
+// From the "record" node, nullptr if it is absent. The path is relative to the executable
+std::unique_ptr<FrameRecorder> CreateFrameRecorder(const Options& options, int width, int height);
+
+#endif // RECORDER_H
@@ -0,0 +1,148 @@
+/*
+ * Copyright (c) 2019 Dmytro Shestakov
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#ifndef SAMPLESTORE_H
+#define SAMPLESTORE_H
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <functional>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+// Append-only sensor samples in memory mapped segment files of fixed-size records.
+// Appends are plain memory writes, a background thread msyncs them in batches.
+// A record carries its own checksum, so a segment cut short by a power loss is read
+// up to the first torn record and appended from there
+class SampleStore {
+public:
+    using path = std::filesystem::path;
+    using string = std::string;
+    using Duration = std::chrono::nanoseconds;
+    using Visitor = std::function<void(uint32_t sensor, int64_t time, float value)>;
+
+    class runtime_error : public std::runtime_error {
+    public:
+        runtime_error(const string& msg);
+    };
+
+    struct Config {
+        path directory;
+        size_t segmentBytes{1 << 20};
+        // The oldest segments are removed past it, two segments at least are kept
+        size_t maxBytes{16 << 20};
+        Duration flushInterval{std::chrono::seconds{60}};
+    };
+
+    struct Stats {
+        uint64_t appended;
+        uint64_t flushes;
+        uint64_t segments;
+        // Records found intact when the active segment was opened
+        uint64_t recovered;
+        // Appends left out since a new segment couldn't be opened
+        uint64_t dropped;
+    };
+
+    explicit SampleStore(const Config& config);
+    SampleStore(const SampleStore&) = delete;
+    SampleStore& operator=(const SampleStore&) = delete;
+    // Flushes what is left
+    ~SampleStore();
+
+    // Stable id of a sensor across restarts, e.g. of "bmp280/in_temp"
+    static uint32_t GetKey(std::string_view name);
+
+    // Thread safe, doesn't allocate or make system calls unless a segment is full. If the next
+    // segment can't be opened, the store logs it and takes no more records
+    void Append(uint32_t sensor, int64_t time, float value);
+    // Visits the intact records not older than since, oldest first. Segments that end
+    // before it are skipped by their header without being read
+    void Load(int64_t since, const Visitor& visitor);
+    void Flush();
+    Stats GetStats();
+
+private:
+    struct Header {
+        char magic[8];
+        uint32_t version;
+        uint32_t recordSize;
+        // Time of the first record, 0 while empty
+        int64_t firstTime;
+        // Records synced by the last flush, the ones past it may be torn
+        uint64_t committed;
+        uint8_t reserved[32];
+    };
+
+    struct Record {
+        uint32_t time;
+        uint32_t sensor;
+        float value;
+        uint32_t check;
+    };
+
+    static_assert(sizeof(Header) == 64 && sizeof(Record) == 16);
+
+    static constexpr char MAGIC[8] = "PCLKTS1";
+    static constexpr uint32_t VERSION = 1;
+
+    const Config config_;
+    size_t capacity_;
+    std::mutex mtx_;
+    std::vector<path> segments_;    // oldest first, the last one is active
+    uint64_t nextIndex_{};
+    int fd_{-1};
+    uint8_t* map_{};
+    size_t position_{};
+    size_t flushed_{};
+    Stats stats_{};
+    std::condition_variable flushCv_;
+    bool stop_{};
+    std::thread flushThd_;
+
+    static uint32_t Checksum(const Record& record);
+    // Intact records at the start of a mapped segment of the given size
+    static size_t CountIntact(const uint8_t* map, size_t bytes, size_t capacity);
+    Header& GetHeader() {
+        return *reinterpret_cast<Header*>(map_);
+    }
+    Record* GetRecords() {
+        return reinterpret_cast<Record*>(map_ + sizeof(Header));
+    }
+
+    // Leaves no segment open if it throws
+    void OpenSegment(const path& file, bool create);
+    void CloseSegment();
+    void Rotate();
+    void RemoveOldest();
+    void FlushLocked();
+    void FlushThread();
+};
+
+#endif // SAMPLESTORE_H
@@ -25,7 +25,17 @@
 // It is assumed that all sensors already existed in sysfs-iio
 
 #include "common.h"
+#include "fonts.h"
+#include "history.h"
+#include "iiobuffer.h"
+#include "reactor.h"
+#include "samplestore.h"
+#include "spritecache.h"
+#include <atomic>
 #include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
 #include <thread>
 
 enum class SensorType {
@@ -52,14 +62,30 @@ public:
     using path = std::filesystem::path;
     using string = std::string;
     using string_view = std::string_view;
-    using fstream = std::ifstream;
     using Color = YAML::Color;
+    using Duration = std::chrono::nanoseconds;
+
+    struct Timing {
+        Duration interval{std::chrono::seconds{10}};
+        // Slower reads are counted and their values dropped
+        Duration timeout{std::chrono::seconds{2}};
+    };
 
-    Sensor(const SensorDescriptor& desc, PositionType position, Color color) : senseDesc_{desc},
-        fstream_{desc.sensorPath/desc.valueName},
-        position_{position},
-        color_{color}
-    {  }
+    struct ReadStats {
+        uint64_t reads;
+        uint64_t timeouts;
+        uint64_t failures;
+        Duration lastLatency;
+        Duration maxLatency;
+        Duration totalLatency;
+        // A read is running for longer than the timeout
+        bool stalled;
+    };
+
+    Sensor(const SensorDescriptor& desc, PositionType position, Color color, Timing timing);
+    Sensor(const Sensor&) = delete;
+    Sensor& operator=(const Sensor&) = delete;
+    ~Sensor();
 
     string_view GetName() {
         return senseDesc_.sensorName;
@@ -80,15 +106,78 @@ public:
         return color_;
     }
     string GetFormattedValue() {
-        return value_ + " " + UNITS[size_t(GetType())];
+        std::lock_guard lock{mtx_};
+        return formattedValue_;
+    }
+    // In the displayed units
+    double GetValue() {
+        std::lock_guard lock{mtx_};
+        return value_;
+    }
+    // Incremented whenever the formatted value changes
+    uint32_t GetVersion() const {
+        return version_.load(std::memory_order_acquire);
     }
+    const Timing& GetTiming() const {
+        return timing_;
+    }
+    ReadStats GetReadStats() const;
+    const Histogram& GetReadLatency() const {
+        return readLatency_;
+    }
+    // Doesn't allocate once the sensor is open
     void ReadValue();
+    // Scan element name, e.g. in_temp
+    string GetChannel();
+    // Takes raw scan values from an IIO buffer instead of reading sysfs
+    void SetStreamed();
+    bool IsStreamed() const {
+        return streamed_;
+    }
+    void SetRawValue(double raw);
+    // Filled by the thread reading the sensor
+    SensorHistory& GetHistory() {
+        return history_;
+    }
+    // Every value is appended under the key from then on
+    void SetStore(SampleStore* store, uint32_t key) {
+        store_ = store;
+        storeKey_ = key;
+    }
 private:
+    static constexpr size_t BUFFER_SIZE = 32;
+
     const SensorDescriptor senseDesc_;
-    fstream fstream_;
     const PositionType position_;
     const Color color_;
-    string value_;
+    const Timing timing_;
+    int fd_{-1};
+    // IIO scale and offset of raw values, converted to the displayed units
+    double scale_{1};
+    double offset_{0};
+    bool streamed_{};
+    char buffer_[BUFFER_SIZE];
+    std::mutex mtx_;
+    double value_{};
+    string formattedValue_;
+    std::atomic<uint32_t> version_{};
+    // Steady clock nanoseconds when the running read started, 0 if idle
+    std::atomic<int64_t> readStart_{};
+    std::atomic<uint64_t> reads_{};
+    std::atomic<uint64_t> timeouts_{};
+    std::atomic<uint64_t> failures_{};
+    std::atomic<int64_t> lastLatency_{};
+    std::atomic<int64_t> maxLatency_{};
+    std::atomic<int64_t> totalLatency_{};
+    Histogram readLatency_;
+    SensorHistory history_;
+    SampleStore* store_{};
+    uint32_t storeKey_{};
+
+    void Open();
+    bool ReadRaw(double& raw);
+    double ReadAttribute(const string& name, double fallback);
+    void LoadScale();
 };
 
 using ms = std::chrono::milliseconds;
@@ -103,7 +192,6 @@ private:
     using dir_iterator = std::filesystem::directory_iterator;
     using Path = std::filesystem::path;
     using PathMap = std::map<string, Path>;
-    using Font = rgb_matrix::Font;
     using Color = YAML::Color;
 
     class invalid_argument : public std::invalid_argument {
@@ -113,25 +201,115 @@ private:
 
     static constexpr string_view SENSORS_ROOT = "/sys/bus/iio/devices";
 
-    std::vector<Sensor> sensors_;
-    Font font_;
+
+    std::deque<Sensor> sensors_;
+    std::vector<string> values_;
+    std::vector<uint32_t> versions_;
+    SpriteCache cache_;
+    FontPtr font_;
+    // Of the lines as drawn, the sensors keep the ones they were created with
+    std::vector<PositionType> positions_;
+    std::vector<Color> colors_;
+
+    struct Layout {
+        FontPtr font;
+        std::vector<PositionType> positions;
+        std::vector<Color> colors;
+    };
+    // Loaded by Reconfigure, taken by Update
+    std::mutex pendingMtx_;
+    std::unique_ptr<Layout> pending_;
+    string restartSettings_;
+    Path sensorsRoot_;
+    // Defaults of the sensors without their own
+    Sensor::Timing timing_;
+    Rect bounds_{};
+
+    struct Stream {
+        IioBuffer buffer;
+        std::vector<Sensor*> sensors;   // in the order of the buffer channels
+
+        Stream(const Path& device, const Path& chardev, const std::vector<string>& channels,
+               const string& trigger, const std::vector<Sensor*>& streamSensors) :
+            buffer{device, chardev, channels, trigger}, sensors{streamSensors}
+        { }
+    };
+    std::deque<Stream> streams_;
+    // Persists the readings, absent unless configured
+    std::unique_ptr<SampleStore> store_;
+
+    // A thread per polled sensor doing the blocking reads the reactor finds due, so a read stuck in
+    // the driver holds up only its own sensor and never the signals, the streams or the other timers
+    class Reader {
+    public:
+        Reader(SensorHub& hub, Sensor& sensor);
+        Reader(const Reader&) = delete;
+        Reader& operator=(const Reader&) = delete;
+        // Waits for the read in progress
+        ~Reader();
+        // Never blocks, the requests coming during a read are served by one more read after it
+        void Request();
+    private:
+        SensorHub& hub_;
+        Sensor& sensor_;
+        std::mutex mtx_;
+        std::condition_variable cv_;
+        bool due_{};
+        bool stop_{};
+        std::thread thread_;
+
+        void Run();
+    };
+    // Last, they go before the sensors and the store they write to
+    std::deque<Reader> readers_;
 
 public:
     SensorHub(const Options& options, BaseWidget& widget);
-    void Draw(rgb_matrix::FrameCanvas* canvas) final;
+    void Draw(rgb_matrix::Canvas* canvas) final;
+    bool Update() final;
+    Rect GetBounds() const final;
+    const SpriteCache::Stats& GetCacheStats() const {
+        return cache_.GetStats();
+    }
+    // Polled and streamed sensors in the display order
+    std::deque<Sensor>& GetSensors() {
+        return sensors_;
+    }
+    SampleStore* GetStore() {
+        return store_.get();
+    }
+    std::string_view GetName() const final {
+        return "sensors";
+    }
+    // Read latency and outcomes of every sensor
+    void RegisterMetrics(MetricsRegistry& registry);
+    // Thread safe, applies the font, the position and the colors. Other changes are reported,
+    // they need a restart
+    void Reconfigure(const Options& options);
+    // The polled sensors come due on reactor timers and are read by a thread each, the streams are
+    // read on the reactor as their fds turn readable. The reactor has to be stopped before the hub goes
+    void Start(Reactor& reactor);
 
 private:
-    PathMap GetAvailableSensors();
+    PathMap GetAvailableSensors(WarmCache* cache);
     string GetSensorName(const Path& sensorPath);
-    std::thread pollThd_;
 
-    [[noreturn]]
-    void PollThread();
+    void ReadSensor(Sensor& sensor);
+    void WatchStream(Reactor& reactor, Stream& stream);
+    // True if the scan updated the sensors
+    bool ReadStream(Stream& stream);
 
     Node GetSensorsNode(const Options& options);
-    void InitFont(const Options& options, const Node& sensorsNode);
+    FontPtr LoadFont(const Options& options, const Node& sensorsNode);
+    size_t GetCacheCapacity() const;
+    static string GetRestartSettings(const Node& sensorsNode);
+    Path GetSensorsRoot(const Node& sensorsNode);
+    Sensor::Duration GetDuration(const Node& node, const char* key, Sensor::Duration fallback);
+    Sensor::Timing GetTiming(const Node& node, const char* intervalKey, const Sensor::Timing& fallback);
     PositionType GetPosition(const Node& sensorsNode);
-    void InitSensors(const Node& sensorsNode, PositionType startPosition);
+    void InitSensors(const Node& sensorsNode, PositionType startPosition, WarmCache* cache);
+    void InitStreams(const Node& sensorsNode);
+    void InitStore(const Options& options, const Node& sensorsNode);
 };
 
 
@@ -0,0 +1,225 @@
+/*
+ * Copyright (c) 2019 Dmytro Shestakov
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef SHAREDFRAME_H
+#define SHAREDFRAME_H
+
+// The frames piclock publishes to POSIX shared memory, and a reader for other programs. It
+// depends on nothing else in the tree, a reader only needs this header and -lrt on older libcs
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <atomic>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+
+// A header, a seqlock per slot and then the frames, rgb24 rows of stride bytes. Frame n, counted
+// from 1, goes to slot n % slots. Its sequence is 2n - 1 while the frame is written and 2n once
+// it is complete, then latest becomes n. The writer never waits, a reader checks the sequence
+// before and after the copy and tries again if the frame changed underneath it
+struct SharedFrameLayout {
+    static constexpr char MAGIC[8] = {'P', 'C', 'L', 'K', 'S', 'H', 'M', '1'};
+    static constexpr uint32_t VERSION = 1;
+    static constexpr size_t ALIGNMENT = 64;
+
+    struct alignas(ALIGNMENT) Header {
+        char magic[8];
+        uint32_t version;
+        uint16_t width;
+        uint16_t height;
+        uint32_t stride;
+        uint32_t slots;
+        uint64_t frameSize;
+        uint64_t dataOffset;        // of the first frame from the start of the memory
+        uint64_t slotSize;          // distance between the frames
+        std::atomic<uint64_t> latest;
+        std::atomic<uint32_t> closed;   // the writer has gone, a new one starts with a new memory
+    };
+
+    struct alignas(ALIGNMENT) Slot {
+        std::atomic<uint64_t> sequence;
+        std::atomic<int64_t> wallTime;  // nanoseconds since the epoch the frame was presented
+    };
+
+    static_assert(std::atomic<uint64_t>::is_always_lock_free, "The seqlock has to be address free");
+
+    static constexpr size_t Align(size_t size) {
+        return (size + ALIGNMENT - 1) / ALIGNMENT * ALIGNMENT;
+    }
+    static constexpr size_t GetDataOffset(uint32_t slots) {
+        return Align(sizeof(Header) + slots * sizeof(Slot));
+    }
+    static constexpr size_t GetSize(uint32_t slots, size_t frameSize) {
+        return GetDataOffset(slots) + slots * Align(frameSize);
+    }
+};
+
+// Maps the memory read only, the reads never hold the writer up
+class SharedFrameReader {
+public:
+    using string = std::string;
+    using Layout = SharedFrameLayout;
+
+    class runtime_error : public std::runtime_error {
+    public:
+        runtime_error(const string& msg) : std::runtime_error{"SharedFrameReader -> " + msg}
+        { }
+    };
+
+    struct Info {
+        uint64_t frame;     // counted from 1 since the writer started
+        int64_t wallTime;
+    };
+
+    // The name as given to shm_open, "/piclock.frame" is /dev/shm/piclock.frame
+    explicit SharedFrameReader(const string& name) {
+        const int fd = shm_open(name.c_str(), O_RDONLY, 0);
+        if(fd < 0) {
+            throw runtime_error{"Couldn't open " + name + ": " + strerror(errno)};
+        }
+        struct stat st{};
+        if(fstat(fd, &st) || size_t(st.st_size) < sizeof(Layout::Header)) {
+            close(fd);
+            throw runtime_error{name + " is not a frame memory"};
+        }
+        size_ = size_t(st.st_size);
+        void* memory = mmap(nullptr, size_, PROT_READ, MAP_SHARED, fd, 0);
+        close(fd);
+        if(memory == MAP_FAILED) {
+            throw runtime_error{"Couldn't map " + name + ": " + strerror(errno)};
+        }
+        base_ = static_cast<const uint8_t*>(memory);
+        header_ = reinterpret_cast<const Layout::Header*>(base_);
+        if(!IsValid(*header_, size_)) {
+            munmap(const_cast<uint8_t*>(base_), size_);
+            throw runtime_error{name + " has an unknown layout"};
+        }
+        slots_ = reinterpret_cast<const Layout::Slot*>(base_ + sizeof(Layout::Header));
+        // Only what was checked is used from then on, whatever the memory says later
+        width_ = header_->width;
+        height_ = header_->height;
+        stride_ = header_->stride;
+        slotCount_ = header_->slots;
+        frameSize_ = size_t(header_->frameSize);
+        frames_ = base_ + Layout::GetDataOffset(slotCount_);
+        slotSize_ = Layout::Align(frameSize_);
+    }
+    SharedFrameReader(const SharedFrameReader&) = delete;
+    SharedFrameReader& operator=(const SharedFrameReader&) = delete;
+    ~SharedFrameReader() {
+        munmap(const_cast<uint8_t*>(base_), size_);
+    }
+
+    int width() const {
+        return width_;
+    }
+    int height() const {
+        return height_;
+    }
+    size_t Stride() const {
+        return stride_;
+    }
+    size_t Size() const {
+        return frameSize_;
+    }
+    // Cheap to poll, 0 until the first frame
+    uint64_t GetLatest() const {
+        return header_->latest.load(std::memory_order_acquire);
+    }
+    // The writer has stopped, a restarted one is found by opening the name again
+    bool IsClosed() const {
+        return header_->closed.load(std::memory_order_acquire);
+    }
+
+    // Calls visit(const uint8_t* pixels, const Info&) on the latest frame in place, without a copy.
+    // True if the frame stayed intact all along, otherwise whatever visit made of it has to be
+    // dropped. False as well before the first frame
+    template<typename Visitor>
+    bool Visit(Visitor&& visit) const {
+        const uint64_t frame = GetLatest();
+        if(!frame) {
+            return false;
+        }
+        const Layout::Slot& slot = slots_[frame % slotCount_];
+        const uint64_t sequence = slot.sequence.load(std::memory_order_acquire);
+        // Overwritten since latest was read, the writer went round the ring
+        if(sequence != 2 * frame) {
+            return false;
+        }
+        const Info info{frame, slot.wallTime.load(std::memory_order_relaxed)};
+        visit(frames_ + frame % slotCount_ * slotSize_, info);
+        std::atomic_thread_fence(std::memory_order_acquire);
+        return slot.sequence.load(std::memory_order_relaxed) == sequence;
+    }
+
+    // Copies the latest frame, Size() bytes. Tries again while the writer gets in the way, false if
+    // it kept doing so or there is no frame yet
+    bool Read(uint8_t* pixels, Info& info, unsigned attempts = 8) const {
+        for(unsigned attempt = 0; attempt < attempts; ++attempt) {
+            if(Visit([this, pixels, &info](const uint8_t* frame, const Info& frameInfo) {
+                memcpy(pixels, frame, frameSize_);
+                info = frameInfo;
+            })) {
+                return true;
+            }
+            if(!GetLatest()) {
+                return false;
+            }
+        }
+        return false;
+    }
+
+private:
+    const uint8_t* base_;
+    size_t size_;
+    const Layout::Header* header_;
+    const Layout::Slot* slots_;
+    const uint8_t* frames_;
+    int width_;
+    int height_;
+    size_t stride_;
+    uint32_t slotCount_;
+    size_t frameSize_;
+    size_t slotSize_;
+
+    // The memory may come from anywhere, every frame has to lie within it. The sizes are checked
+    // before they are multiplied, size_t is 32 bits on the Pi
+    static bool IsValid(const Layout::Header& header, size_t size) {
+        if(memcmp(header.magic, Layout::MAGIC, sizeof(Layout::MAGIC)) || header.version != Layout::VERSION
+           || !header.slots || header.slots > (size - sizeof(Layout::Header)) / sizeof(Layout::Slot)
+           || header.stride < size_t(header.width) * 3 || header.frameSize > size
+           || header.frameSize != uint64_t(header.stride) * header.height) {
+            return false;
+        }
+        const size_t frameSize = size_t(header.frameSize);
+        const size_t dataOffset = Layout::GetDataOffset(header.slots);
+        return header.dataOffset == dataOffset && header.slotSize == Layout::Align(frameSize)
+               && dataOffset <= size && (size - dataOffset) / header.slots >= Layout::Align(frameSize);
+    }
+};
+
+#endif // SHAREDFRAME_H
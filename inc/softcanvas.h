@@ -0,0 +1,87 @@
+/*
+ * Copyright (c) 2019 Dmytro Shestakov
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#ifndef SOFTCANVAS_H
+#define SOFTCANVAS_H
+
+#include "canvas.h"
+#include "geometry.h"
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+
+// Packed RGB888 canvas in plain memory, the render target for all widgets
+class SoftCanvas : public rgb_matrix::Canvas {
+public:
+    static constexpr size_t BYTES_PER_PIXEL = 3;
+
+    SoftCanvas(int width, int height);
+
+    int width() const final {
+        return width_;
+    }
+    int height() const final {
+        return height_;
+    }
+    void SetPixel(int x, int y, uint8_t red, uint8_t green, uint8_t blue) final {
+        if(x < 0 || y < 0 || x >= width_ || y >= height_) {
+            return;
+        }
+        uint8_t* pixel = &pixels_[(size_t(y) * size_t(width_) + size_t(x)) * BYTES_PER_PIXEL];
+        pixel[0] = red;
+        pixel[1] = green;
+        pixel[2] = blue;
+    }
+    void Clear() final;
+    void Fill(uint8_t red, uint8_t green, uint8_t blue) final;
+    void Fill(const Rect& rect, uint8_t red, uint8_t green, uint8_t blue);
+    // Copies the pixels of a same sized layer within rect, black ones are transparent
+    void Composite(const SoftCanvas& layer, const Rect& rect);
+    // Both work within rect on a same sized canvas
+    void Copy(const SoftCanvas& source, const Rect& rect);
+    bool Equals(const SoftCanvas& other, const Rect& rect) const;
+
+    Rect GetRect() const {
+        return {0, 0, width_, height_};
+    }
+
+    const uint8_t* GetPixel(int x, int y) const {
+        return &pixels_[(size_t(y) * size_t(width_) + size_t(x)) * BYTES_PER_PIXEL];
+    }
+    uint8_t* Data() {
+        return pixels_.data();
+    }
+    const uint8_t* Data() const {
+        return pixels_.data();
+    }
+    size_t Stride() const {
+        return size_t(width_) * BYTES_PER_PIXEL;
+    }
+    size_t Size() const {
+        return pixels_.size();
+    }
+private:
+    int width_;
+    int height_;
+    std::vector<uint8_t> pixels_;
+};
+
+#endif // SOFTCANVAS_H
@@ -0,0 +1,106 @@
+/*
+ * Copyright (c) 2019 Dmytro Shestakov
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#ifndef SPRITECACHE_H
+#define SPRITECACHE_H
+
+#include "fonts.h"
+#include <list>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Pre-rasterized text, blitting copies runs of lit pixels and leaves the background untouched
+class Sprite {
+public:
+    Sprite(const FontFace& font, const std::string& text, const rgb_matrix::Color& color);
+    // (x, y) is the top left corner of the text box
+    void Blit(rgb_matrix::Canvas* canvas, int x, int y) const;
+    // Only the part within clip, in canvas coordinates. Scrolling is a window moving over the sprite
+    void Blit(rgb_matrix::Canvas* canvas, int x, int y, const Rect& clip) const;
+    int width() const {
+        return width_;
+    }
+    int height() const {
+        return height_;
+    }
+    size_t GetBytes() const {
+        return pixels_.capacity() + runs_.capacity() * sizeof(Run);
+    }
+private:
+    struct Run {
+        uint16_t row;
+        uint16_t x;
+        uint16_t length;
+    };
+
+    int width_;
+    int height_;
+    std::vector<uint8_t> pixels_;
+    std::vector<Run> runs_;
+};
+
+// Bounded LRU of sprites keyed by font, text and color. Not thread-safe, meant to be owned by a widget
+class SpriteCache {
+public:
+    struct Stats {
+        uint64_t hits;
+        uint64_t misses;
+        uint64_t evictions;
+        size_t entries;
+        size_t bytes;
+    };
+
+    SpriteCache(size_t capacityBytes);
+    // Rasterizes the text on a miss, the sprite stays valid until the next call
+    const Sprite& Get(const FontFace& font, const std::string& text, const rgb_matrix::Color& color);
+    const Stats& GetStats() const {
+        return stats_;
+    }
+    void Clear();
+private:
+    struct Key {
+        const FontFace* font;
+        std::string text;
+        uint32_t color;
+
+        bool operator==(const Key& other) const {
+            return font == other.font && color == other.color && text == other.text;
+        }
+    };
+    struct KeyHash {
+        size_t operator()(const Key& key) const {
+            return std::hash<std::string>{}(key.text) ^ std::hash<const void*>{}(key.font) ^ key.color;
+        }
+    };
+    using Entry = std::pair<Key, Sprite>;
+    using EntryList = std::list<Entry>;
+
+    size_t capacity_;
+    // Most recently used first
+    EntryList entries_;
+    std::unordered_map<Key, EntryList::iterator, KeyHash> index_;
+    Stats stats_{};
+
+    void Evict();
+};
+
+#endif // SPRITECACHE_H
@@ -0,0 +1,67 @@
+/*
+ * Copyright (c) 2019 Dmytro Shestakov
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef STARTUP_H
+#define STARTUP_H
+
+#include <chrono>
+#include <mutex>
+#include <ostream>
+#include <vector>
+
+// Wall time of the init steps from main to the first frame, steps may run on different threads
+class StartupProfile {
+public:
+    using clock = std::chrono::steady_clock;
+
+    // Measures its own lifetime
+    class Phase {
+    public:
+        Phase(StartupProfile& profile, const char* name);
+        ~Phase();
+        Phase(const Phase&) = delete;
+        Phase& operator=(const Phase&) = delete;
+    private:
+        StartupProfile& profile_;
+        const char* name_;
+        clock::time_point start_;
+    };
+
+    StartupProfile();
+    void Add(const char* name, clock::time_point start, clock::time_point end);
+    // Prints the steps in the order they started and the total, only the first call does
+    void Finish(std::ostream& out);
+
+private:
+    struct Entry {
+        const char* name;
+        clock::time_point start;
+        clock::time_point end;
+    };
+
+    const clock::time_point start_;
+    std::mutex mtx_;
+    std::vector<Entry> entries_;
+    bool finished_;
+};
+
+#endif // STARTUP_H
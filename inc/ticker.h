@@ -0,0 +1,99 @@
+/*
+ * Copyright (c) 2019 Dmytro Shestakov
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef TICKER_H
+#define TICKER_H
+
+#include "animation.h"
+#include "common.h"
+#include "fonts.h"
+#include "spritecache.h"
+#include <memory>
+#include <mutex>
+#include <optional>
+
+// Text scrolling through a window at a fixed speed. The text is rasterized once, a frame blits
+// the part of it in the window. Text that fits stands still and needs no frames
+class TickerWidget final : public WidgetWrapper {
+private:
+    using Node = YAML::Node;
+    using Canvas = rgb_matrix::Canvas;
+    using Color = rgb_matrix::Color;
+    using string = std::string;
+
+    class invalid_argument : public std::invalid_argument {
+    public:
+        invalid_argument(const string& msg);
+    };
+
+    struct Settings {
+        FontPtr font;
+        Rect rect;
+        Color color;
+        string text;
+        double speed;       // pixels per second
+        int gap;            // blank pixels between the passes of the text
+        unsigned rate;
+    };
+
+    FontPtr font_;
+    Rect rect_{};
+    Color color_;
+    string text_;
+    double speed_{};
+    int gap_{};
+    FrameClock frameClock_;
+    std::optional<Sprite> strip_;
+    int offset_{};
+    // Set by Apply, the strip is rasterized again by the next update
+    bool restart_{};
+    Rect bounds_{};
+    // Loaded by Reconfigure and SetText, taken by Update
+    std::mutex pendingMtx_;
+    std::unique_ptr<Settings> pending_;
+    std::optional<string> pendingText_;
+
+    TickerWidget(BaseWidget& widget, Settings&& settings);
+    static Settings LoadSettings(const Options& options);
+    void Apply(Settings&& settings);
+    bool IsScrolling() const {
+        return strip_ && strip_->width() > rect_.width;
+    }
+    void Restart();
+public:
+    TickerWidget(const Options& options, BaseWidget& widget);
+    void Draw(Canvas* canvas) final;
+    bool Update() final;
+    Rect GetBounds() const final;
+    std::string_view GetName() const final {
+        return "ticker";
+    }
+    // Thread safe, throws std::invalid_argument and keeps the current settings if the node is bad
+    void Reconfigure(const Options& options);
+    // Thread safe, the text starts over from the left edge
+    void SetText(string text);
+    const FrameClock& GetFrameClock() const {
+        return frameClock_;
+    }
+};
+
+#endif // TICKER_H
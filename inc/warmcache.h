@@ -0,0 +1,101 @@
+/*
+ * Copyright (c) 2019 Dmytro Shestakov
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#ifndef WARMCACHE_H
+#define WARMCACHE_H
+
+#include "fonts.h"
+#include "options.h"
+
+#include <cstdint>
+#include <filesystem>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+// Startup work kept between runs: BDF fonts parsed into glyph tables and the IIO devices found
+// under the sensors root. Entries are checked against their source before use, a stale or
+// damaged file costs a cold start and nothing else
+class WarmCache {
+public:
+    using path = std::filesystem::path;
+    using string = std::string;
+    using SensorPaths = std::map<string, path>;
+
+    class runtime_error : public std::runtime_error {
+    public:
+        runtime_error(const string& msg);
+    };
+
+    struct Stats {
+        uint64_t hits;
+        uint64_t misses;
+    };
+
+    // The file stays open, Save still works after the matrix has dropped the root privileges
+    explicit WarmCache(const path& file);
+    ~WarmCache();
+    WarmCache(const WarmCache&) = delete;
+    WarmCache& operator=(const WarmCache&) = delete;
+
+    // Parses the file again if its size or modification time changed, nullptr if it isn't a BDF font
+    FontTablePtr GetFont(const path& fontPath);
+    // The sensors found before, if the root still lists the same entries
+    std::optional<SensorPaths> GetSensors(const path& root, const std::vector<string>& entries);
+    void SetSensors(const path& root, const std::vector<string>& entries, const SensorPaths& sensors);
+    // Rewrites the file with the entries used since the start if any of them changed
+    bool Save();
+    Stats GetStats() const;
+
+private:
+    struct FontEntry {
+        int64_t mtime;
+        uint64_t size;
+        FontTablePtr table;
+        bool used;
+    };
+
+    struct SensorEntry {
+        std::vector<string> entries;
+        SensorPaths sensors;
+        bool used;
+    };
+
+    bool Load(const std::vector<char>& data);
+    std::vector<char> Serialize() const;
+
+    int fd_;
+    mutable std::mutex mtx_;
+    std::map<string, FontEntry> fonts_;
+    std::map<string, SensorEntry> sensors_;
+    bool dirty_;
+    Stats stats_;
+};
+
+// The cache of the startup node, nullptr if it isn't configured
+std::shared_ptr<WarmCache> CreateWarmCache(const Options& options);
+
+#endif // WARMCACHE_H
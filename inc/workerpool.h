@@ -0,0 +1,101 @@
+/*
+ * Copyright (c) 2019 Dmytro Shestakov
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#ifndef WORKERPOOL_H
+#define WORKERPOOL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <exception>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Fixed set of threads running indexed batches, the caller takes part in every batch
+class WorkerPool {
+public:
+    explicit WorkerPool(size_t workers);
+    WorkerPool(const WorkerPool&) = delete;
+    WorkerPool& operator=(const WorkerPool&) = delete;
+    ~WorkerPool();
+
+    // Calls task(0) ... task(count - 1) and returns when all of them are done. The caller runs
+    // local() first while the workers start on the tasks. The first exception thrown is rethrown
+    // here. The task is called through a plain function pointer, nothing is allocated
+    template<typename Task, typename Local>
+    void Run(size_t count, const Task& task, Local&& local);
+    template<typename Task>
+    void Run(size_t count, const Task& task) {
+        Run(count, task, [] {});
+    }
+
+    size_t GetWorkers() const {
+        return threads_.size();
+    }
+private:
+    using Invoke = void (*)(const void* task, size_t index);
+
+    std::vector<std::thread> threads_;
+    std::mutex mtx_;
+    std::condition_variable start_;
+    std::condition_variable done_;
+    const void* task_{};
+    Invoke invoke_{};
+    size_t count_{};
+    std::atomic<size_t> next_{};
+    size_t active_{};
+    uint64_t generation_{};
+    bool stop_{};
+    std::exception_ptr error_{};
+
+    // Hands the batch to the workers
+    void Begin(size_t count, const void* task, Invoke invoke);
+    // Takes part in the batch and waits for it, rethrows error or else the first one of the tasks
+    void End(std::exception_ptr error);
+    void Worker();
+    void Execute();
+};
+
+template<typename Task, typename Local>
+void WorkerPool::Run(size_t count, const Task& task, Local&& local)
+{
+    // Waking the workers costs more than a single task
+    if(threads_.empty() || count < 2) {
+        local();
+        for(size_t i = 0; i < count; ++i) {
+            task(i);
+        }
+        return;
+    }
+    Begin(count, &task, [](const void* task, size_t index) {
+        (*static_cast<const Task*>(task))(index);
+    });
+    std::exception_ptr error;
+    try {
+        local();
+    } catch(...) {
+        error = std::current_exception();
+    }
+    End(error);
+}
+
+#endif // WORKERPOOL_H
@@ -0,0 +1,226 @@
+/*
+ * Copyright (c) 2019 Dmytro Shestakov
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "ambient.h"
+#include <algorithm>
+#include <cmath>
+#include <iomanip>
+#include <iostream>
+#include <limits>
+#include <tuple>
+#include <vector>
+
+using std::string;
+
+namespace {
+
+    // Readings are clamped to it before the logarithm, a covered sensor reads 0
+    constexpr double MIN_LUX = 0.01;
+    // The normal PWM depth comes back at this many times the dark threshold
+    constexpr double DARK_RELEASE = 2.0;
+    constexpr int MAX_PWM_BITS = 11;
+
+    std::pair<double, double> ReadPair(const YAML::Node& node, const char* key, std::pair<double, double> fallback)
+    {
+        if(!node[key]) {
+            return fallback;
+        }
+        const auto values = node[key].as<std::vector<double>>();
+        if(values.size() != 2) {
+            throw AmbientLight::invalid_argument{string{key} + " needs two values"};
+        }
+        return {values[0], values[1]};
+    }
+
+}
+
+BrightnessController::BrightnessController(const Config& config, int brightness) : config_{config},
+    output_{brightness, config.pwmBits}, level_{std::numeric_limits<double>::quiet_NaN()}, dark_{}
+{ }
+
+BrightnessController::Output BrightnessController::Update(double lux, uint64_t readings)
+{
+    const double level = std::log10(std::max(lux, MIN_LUX));
+    const double weight = 1 - std::pow(1 - config_.smoothing, double(readings));
+    level_ = std::isnan(level_) ? level : level_ + weight * (level - level_);
+    const double low = std::log10(std::max(config_.luxLow, MIN_LUX));
+    const double high = std::log10(std::max(config_.luxHigh, MIN_LUX));
+    const double position = high > low ? std::clamp((level_ - low) / (high - low), 0.0, 1.0) : 1.0;
+    const int target = int(std::lround(config_.brightnessLow + position * (config_.brightnessHigh - config_.brightnessLow)));
+    // The ends of the range are reached whatever the hysteresis
+    const bool end = target == config_.brightnessLow || target == config_.brightnessHigh;
+    if(std::abs(target - output_.brightness) >= std::max(config_.hysteresis, 1) || (end && target != output_.brightness)) {
+        output_.brightness = target;
+    }
+    const double smoothed = std::pow(10.0, level_);
+    if(dark_ ? smoothed > config_.darkLux * DARK_RELEASE : smoothed < config_.darkLux) {
+        dark_ = !dark_;
+    }
+    output_.pwmBits = dark_ ? config_.darkPwmBits : config_.pwmBits;
+    return output_;
+}
+
+AmbientLight::AmbientLight(const BrightnessController::Config& config, Sensor& sensor, Display& display, int brightness) :
+    controller_{config, brightness}, config_{config}, sensor_{sensor}, display_{display}, version_{}, readings_{},
+    lastCpuSeconds_{display.GetRefreshCpuSeconds()}, lastTime_{clock::now()}
+{ }
+
+// Frames come with changed values, the readings in between repeated the value. Streamed sensors
+// don't count their reads, a changed value is one reading for them. Version 0 has no value yet
+void AmbientLight::Poll()
+{
+    const Sensor::ReadStats stats = sensor_.GetReadStats();
+    const uint64_t readings = stats.reads - stats.failures - stats.timeouts;
+    const uint32_t version = sensor_.GetVersion();
+    const uint64_t count = std::max<uint64_t>(readings - readings_, version != version_);
+    if(!count || !version) {
+        return;
+    }
+    readings_ = readings;
+    version_ = version;
+    const double lux = sensor_.GetValue();
+    BrightnessController::Output previous, output;
+    {
+        std::lock_guard lock{mtx_};
+        previous = controller_.GetOutput();
+        output = controller_.Update(lux, count);
+    }
+    Account(previous.pwmBits);
+    if(output.brightness != previous.brightness) {
+        display_.SetBrightness(output.brightness);
+    }
+    if(output.pwmBits == previous.pwmBits) {
+        return;
+    }
+    display_.SetPwmBits(output.pwmBits);
+    std::cout << "Ambient light " << lux << " lux, PWM bits " << previous.pwmBits << " -> " << output.pwmBits;
+    for(const int bits : { previous.pwmBits, output.pwmBits }) {
+        if(const double share = GetCpuShare(bits); !std::isnan(share)) {
+            std::cout << ", refresh " << std::fixed << std::setprecision(1) << share * 100 << "% of a core at "
+                      << bits << " bits" << std::defaultfloat;
+        }
+    }
+    std::cout << std::endl;
+}
+
+void AmbientLight::Account(int pwmBits)
+{
+    const double cpuSeconds = display_.GetRefreshCpuSeconds();
+    const clock::time_point now = clock::now();
+    if(cpuSeconds >= 0 && lastCpuSeconds_ >= 0) {
+        std::lock_guard lock{mtx_};
+        Usage& usage = usage_[pwmBits];
+        usage.cpuSeconds += cpuSeconds - lastCpuSeconds_;
+        usage.wallSeconds += std::chrono::duration<double>(now - lastTime_).count();
+    }
+    lastCpuSeconds_ = cpuSeconds;
+    lastTime_ = now;
+}
+
+// NaN until the refresh threads ran at that depth
+double AmbientLight::GetCpuShare(int pwmBits) const
+{
+    std::lock_guard lock{mtx_};
+    const auto it = usage_.find(pwmBits);
+    return it != usage_.end() && it->second.wallSeconds > 0 ? it->second.cpuSeconds / it->second.wallSeconds
+                                                            : std::numeric_limits<double>::quiet_NaN();
+}
+
+void AmbientLight::RegisterMetrics(MetricsRegistry& registry)
+{
+    registry.AddGauge("piclock_ambient_lux", "Smoothed reading of the light sensor", {}, [this] {
+        std::lock_guard lock{mtx_};
+        return std::pow(10.0, controller_.GetLevel());
+    });
+    registry.AddGauge("piclock_brightness", "Panel brightness set by the ambient light", {}, [this] {
+        std::lock_guard lock{mtx_};
+        return double(controller_.GetOutput().brightness);
+    });
+    registry.AddGauge("piclock_pwm_bits", "PWM depth set by the ambient light", {}, [this] {
+        std::lock_guard lock{mtx_};
+        return double(controller_.GetOutput().pwmBits);
+    });
+    for(const int bits : { config_.darkPwmBits, config_.pwmBits }) {
+        registry.AddGauge("piclock_refresh_cpu_share", "Cores used by the panel refresh threads at a PWM depth",
+                          "pwm_bits=\"" + std::to_string(bits) + '"', [this, bits] { return GetCpuShare(bits); });
+        if(config_.darkPwmBits == config_.pwmBits) {
+            break;
+        }
+    }
+}
+
+BrightnessController::Config AmbientLight::LoadConfig(const YAML::Node& node)
+{
+    BrightnessController::Config config;
+    try {
+        std::tie(config.luxLow, config.luxHigh) = ReadPair(node, "lux", {config.luxLow, config.luxHigh});
+        const auto brightness = ReadPair(node, "brightness", {config.brightnessLow, config.brightnessHigh});
+        config.brightnessLow = int(brightness.first);
+        config.brightnessHigh = int(brightness.second);
+        const auto pwmBits = ReadPair(node, "pwm_bits", {config.darkPwmBits, config.pwmBits});
+        config.darkPwmBits = int(pwmBits.first);
+        config.pwmBits = int(pwmBits.second);
+        config.smoothing = node["smoothing"].as<double>(config.smoothing);
+        config.hysteresis = node["hysteresis"].as<int>(config.hysteresis);
+        config.darkLux = node["dark"].as<double>(config.darkLux);
+    } catch(const YAML::BadConversion&) {
+        throw invalid_argument{"Reading ambient failed"};
+    }
+    if(config.luxLow <= 0 || config.luxHigh <= config.luxLow) {
+        throw invalid_argument{"The lux range must be positive and increasing"};
+    }
+    if(config.brightnessLow < 1 || config.brightnessHigh > 100 || config.brightnessLow > config.brightnessHigh) {
+        throw invalid_argument{"The brightness range must be increasing within 1..100"};
+    }
+    if(config.darkPwmBits < 1 || config.pwmBits > MAX_PWM_BITS || config.darkPwmBits > config.pwmBits) {
+        throw invalid_argument{"The PWM bits must be increasing within 1..11"};
+    }
+    if(config.smoothing <= 0 || config.smoothing > 1) {
+        throw invalid_argument{"Smoothing must be within (0, 1]"};
+    }
+    return config;
+}
+
+AmbientLight::invalid_argument::invalid_argument(const string& msg) : std::invalid_argument{"AmbientLight -> " + msg}
+{ }
+
+std::unique_ptr<AmbientLight> CreateAmbientLight(const Options& options, SensorHub& hub, Display& display, int brightness)
+{
+    OptionalNode optionalNode = options.GetNode("ambient");
+    if(!optionalNode) {
+        return nullptr;
+    }
+    const YAML::Node node = *optionalNode;
+    const auto config = AmbientLight::LoadConfig(node);
+    string name;
+    try {
+        name = node["sensor"].as<string>("bh1750");
+    } catch(const YAML::BadConversion&) {
+        throw AmbientLight::invalid_argument{"Reading sensor failed"};
+    }
+    for(Sensor& sensor : hub.GetSensors()) {
+        if(sensor.GetName() == name && sensor.GetType() == SensorType::LUMINOSITY) {
+            return std::make_unique<AmbientLight>(config, sensor, display, brightness);
+        }
+    }
+    throw AmbientLight::invalid_argument{"No light sensor " + name};
+}
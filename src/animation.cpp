@@ -0,0 +1,116 @@
+/*
+ * Copyright (c) 2019 Dmytro Shestakov
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "animation.h"
+
+#include <algorithm>
+
+FrameClock::FrameClock(const Config& config) : config_{config},
+    period_{std::chrono::duration_cast<clock::duration>(std::chrono::nanoseconds{std::chrono::seconds{1}} / std::max(config.rate, 1u))}
+{ }
+
+void FrameClock::Start(clock::time_point now)
+{
+    start_ = now;
+    tick_ = 0;
+    running_ = true;
+}
+
+void FrameClock::Stop()
+{
+    running_ = false;
+}
+
+// The wake up may come a bit early, the deadline went through the wall clock and the timer slack
+uint64_t FrameClock::Advance(clock::time_point now)
+{
+    if(!running_ || now < start_) {
+        return 0;
+    }
+    const uint64_t divisor = divisor_.load(std::memory_order_relaxed);
+    const uint64_t tick = uint64_t((now - start_ + period_ / 4) / period_);
+    const uint64_t slot = tick / divisor;
+    const uint64_t lastSlot = tick_ / divisor;
+    if(slot <= lastSlot) {
+        return 0;
+    }
+    const clock::time_point due = start_ + int64_t((lastSlot + 1) * divisor) * period_;
+    lateness_.Observe(std::max(now - due, clock::duration::zero()));
+    const uint64_t missed = slot - lastSlot - 1;
+    frames_.fetch_add(1, std::memory_order_relaxed);
+    if(missed) {
+        late_.fetch_add(1, std::memory_order_relaxed);
+        dropped_.fetch_add(missed, std::memory_order_relaxed);
+    }
+    Adapt(missed);
+    const uint64_t elapsed = tick - tick_;
+    tick_ = tick;
+    return elapsed;
+}
+
+void FrameClock::Adapt(bool late)
+{
+    unsigned divisor = divisor_.load(std::memory_order_relaxed);
+    windowLate_ += late;
+    onTime_ = late ? 0 : onTime_ + 1;
+    if(windowLate_ >= config_.lateLimit) {
+        if(config_.rate / (divisor * 2) >= std::max(config_.minRate, 1u)) {
+            divisor_.store(divisor * 2, std::memory_order_relaxed);
+        }
+        windowFrames_ = windowLate_ = 0;
+        return;
+    }
+    if(++windowFrames_ >= config_.window) {
+        windowFrames_ = windowLate_ = 0;
+    }
+    if(divisor > 1 && onTime_ >= config_.recovery) {
+        divisor_.store(divisor / 2, std::memory_order_relaxed);
+        onTime_ = 0;
+    }
+}
+
+FrameClock::clock::time_point FrameClock::GetNextDue() const
+{
+    const uint64_t divisor = divisor_.load(std::memory_order_relaxed);
+    return start_ + int64_t((tick_ / divisor + 1) * divisor) * period_;
+}
+
+TimePoint FrameClock::GetNextFrame() const
+{
+    return std::chrono::system_clock::now()
+           + std::chrono::duration_cast<std::chrono::system_clock::duration>(GetNextDue() - clock::now());
+}
+
+void FrameClock::RegisterMetrics(MetricsRegistry& registry, const std::string& widget) const
+{
+    const std::string labels = "widget=\"" + widget + '"';
+    registry.AddCounter("piclock_animation_frames_total", "Animation frames updated", labels,
+                        [this] { return double(GetFrames()); });
+    registry.AddCounter("piclock_animation_late_frames_total", "Animation frames that missed their slot", labels,
+                        [this] { return double(GetLateFrames()); });
+    registry.AddCounter("piclock_animation_dropped_frames_total", "Animation frame slots skipped by late frames", labels,
+                        [this] { return double(GetDroppedFrames()); });
+    registry.AddGauge("piclock_animation_fps", "Animation frame rate, lowered while the frames are late", labels,
+                      [this] { return double(GetFrameRate()); });
+    registry.AddHistogram("piclock_animation_lateness_seconds", "From the due time of an animation frame to its update",
+                          labels, lateness_);
+}
@@ -15,6 +15,7 @@
 
 #include "clock_impl.h"
 
+#include <algorithm>
 #include <vector>
 #include <string>
 #include <stdexcept>
@@ -25,8 +26,6 @@
 using std::string;
 using std::vector;
 using std::to_string;
-using std::filesystem::path;
-using std::filesystem::exists;
 using namespace std::string_literals;
 using namespace rgb_matrix;
 using rgb_matrix::Color;
@@ -45,16 +44,32 @@ namespace {
                && (c.b == 0 || c.b == 255);
     }
 
+    // Holds the current and the upcoming time with room to spare
+    constexpr size_t CACHE_CAPACITY = 64 * 1024;
+    constexpr unsigned SLIDE_RATE = 50;
+
+    // Formats showing seconds change every second, all others once a minute
+    time_t GetUpdatePeriod(const string& format)
+    {
+        for(size_t pos = format.find('%'); pos != string::npos && pos + 1 < format.size(); pos = format.find('%', pos + 2)) {
+            if(strchr("STsrXc+", format[pos + 1])) {
+                return 1;
+            }
+        }
+        return 60;
+    }
+
 }
 
-Clock::Clock(const Options& options, BaseWidget& widget) : WidgetWrapper{widget}
+Clock::Clock(const Options& options, BaseWidget& widget) : WidgetWrapper{widget},
+    slide_{FrameClock::Config{SLIDE_RATE}}, cache_{CACHE_CAPACITY}
 {
-    class invalid_argument : public std::invalid_argument {
-    public:
-        invalid_argument(const string& msg) : std::invalid_argument{"Clock -> " + msg}
-        { }
-    };
+    Apply(LoadSettings(options));
+}
 
+Clock::Settings Clock::LoadSettings(const Options& options)
+{
+    Settings settings;
     try {
         OptionalNode optionalNode = options.GetNode("clock");
         if(!optionalNode) {
@@ -62,17 +77,14 @@ Clock::Clock(const Options& options, BaseWidget& widget) : WidgetWrapper{widget}
         }
         Node clockNode = *optionalNode;
         const string fontFile = clockNode["font"].as<string>();
-        path fontPath = options.GetExecDir() / fontFile;
-        std::error_code ec;
-        if(!exists(fontPath, ec)) {
-            throw invalid_argument{"Font file doesn't exist: "s + fontPath.c_str()};
-        }
-        if(!font_.LoadFont(fontPath.c_str())) {
-            throw invalid_argument("Couldn't load font "s + fontPath.c_str());
+        settings.font = LoadFont(options, fontFile);
+        if(!settings.font) {
+            throw invalid_argument("Couldn't load font "s + fontFile);
         }
-        position_ = clockNode["position"].as<PositionType>();
-        color_ = clockNode["color"].as<Color>();
-        timeFormat_ = clockNode["format"].as<string>();
+        settings.position = clockNode["position"].as<PositionType>();
+        settings.color = clockNode["color"].as<Color>();
+        settings.timeFormat = clockNode["format"].as<string>();
+        settings.transition = clockNode["transition"].as<double>(0);
 
     } catch(const YAML::TypedBadConversion<string>& ) {
         throw invalid_argument{"Error reading font from yaml"};
@@ -80,23 +92,175 @@ Clock::Clock(const Options& options, BaseWidget& widget) : WidgetWrapper{widget}
         throw invalid_argument{"Error reading position from yaml"};
     } catch(const YAML::TypedBadConversion<uint32_t>&) {
         throw invalid_argument{"Error reading color from yaml"};
+    } catch(const YAML::TypedBadConversion<double>&) {
+        throw invalid_argument{"Error reading transition from yaml"};
     }
+    return settings;
 }
 
-void Clock::Draw(rgb_matrix::FrameCanvas* canvas)
+void Clock::Apply(Settings&& settings)
 {
-    static const int letterSpacing = 0;
-    char text_buffer[32];
+    font_ = std::move(settings.font);
+    position_ = settings.position;
+    color_ = settings.color;
+    timeFormat_ = std::move(settings.timeFormat);
+    period_ = GetUpdatePeriod(timeFormat_);
+    slideTicks_ = uint64_t(std::max(settings.transition, 0.0) * SLIDE_RATE);
+}
 
-    struct timespec next_time;
-    next_time.tv_sec = time(nullptr);
-    next_time.tv_nsec = 0;
+// The font is loaded here, on the caller's thread, Update swaps the settings in between frames
+void Clock::Reconfigure(const Options& options)
+{
+    auto settings = std::make_unique<Settings>(LoadSettings(options));
+    {
+        std::lock_guard lock{pendingMtx_};
+        pending_ = std::move(settings);
+    }
+    RequestUpdate();
+}
+
+string Clock::Format(time_t time) const
+{
+    char text_buffer[32];
     struct tm tm;
 
-    localtime_r(&next_time.tv_sec, &tm);
-    strftime(text_buffer, sizeof(text_buffer), timeFormat_.data(), &tm);
+    localtime_r(&time, &tm);
+    if(!strftime(text_buffer, sizeof(text_buffer), timeFormat_.data(), &tm)) {
+        return {};
+    }
+    return text_buffer;
+}
+
+// Formats and rasterizes the text of the next boundary so that switching to it is only a blit
+void Clock::PrepareNext(time_t now)
+{
+    nextChange_ = (now / period_ + 1) * period_;
+    nextText_ = Format(nextChange_);
+    cache_.Get(*font_, nextText_, color_);
+    ScheduleUpdate(std::chrono::system_clock::from_time_t(nextChange_));
+}
+
+bool Clock::Update()
+{
+    if(std::unique_ptr<Settings> settings = TakePending(); settings) {
+        Apply(std::move(*settings));
+        // Everything formatted or rasterized so far is stale
+        cache_ = SpriteCache{CACHE_CAPACITY};
+        text_.clear();
+        nextChange_ = 0;
+        slide_.Stop();
+    }
+    const bool sliding = slide_.IsRunning() && Slide();
+    // Not time(), it reads a coarse clock that can still be a second behind the expired deadline
+    const time_t now = std::chrono::system_clock::to_time_t(std::chrono::system_clock::now());
+    if(now < nextChange_ && now >= nextChange_ - period_) {
+        // Kept once if still queued, the scheduler drops the deadlines when the system time is set
+        ScheduleUpdate(std::chrono::system_clock::from_time_t(nextChange_));
+        return sliding;
+    }
+    // Not the first update and the system time didn't jump
+    const bool onTime = now < nextChange_ + period_ && nextChange_;
+    string text = onTime ? std::move(nextText_) : Format(now);
+    PrepareNext(now);
+    if(text == text_) {
+        return sliding;
+    }
+    if(slideTicks_ && onTime && !text_.empty()) {
+        StartSlide(text_, text);
+    }
+    text_ = std::move(text);
+    return true;
+}
+
+// Only the cells of the characters that changed move. Texts laid out differently slide as a whole
+void Clock::StartSlide(const string& from, const string& to)
+{
+    const int x = position_[0];
+    const int y = position_[1];
+    const int height = font_->height();
+    slideCells_.clear();
+    stillCells_.clear();
+    const auto isAscii = [](const string& text) {
+        return std::all_of(text.begin(), text.end(), [](char c) { return uint8_t(c) < 0x80; });
+    };
+    bool aligned = from.size() == to.size() && isAscii(from) && isAscii(to);
+    for(size_t i = 0, left = size_t(x); aligned && i < to.size(); ++i) {
+        const int width = font_->CharacterWidth(uint8_t(to[i]));
+        aligned = width == font_->CharacterWidth(uint8_t(from[i]));
+        (from[i] == to[i] ? stillCells_ : slideCells_).push_back({int(left), y, width, height});
+        left += size_t(width);
+    }
+    if(!aligned) {
+        slideCells_.assign(1, {x, y, std::max(cache_.Get(*font_, from, color_).width(),
+                                              cache_.Get(*font_, to, color_).width()), height});
+        stillCells_.clear();
+    }
+    oldText_ = from;
+    shift_ = 0;
+    slide_.Start(FrameClock::clock::now());
+    ScheduleUpdate(slide_.GetNextFrame());
+}
 
-    rgb_matrix::DrawText(canvas, font_, position_[0], position_[1] + font_.baseline(),
-                         color_, nullptr, text_buffer,
-                         letterSpacing);
+bool Clock::Slide()
+{
+    if(!slide_.Advance(FrameClock::clock::now())) {
+        // Woken before the slot, a wall clock set forward brings the deadline in early
+        ScheduleUpdate(slide_.GetNextFrame());
+        return false;
+    }
+    const int height = font_->height();
+    const uint64_t tick = slide_.GetTick();
+    if(tick >= slideTicks_) {
+        slide_.Stop();
+        shift_ = height;
+        return true;
+    }
+    const int shift = int(tick * uint64_t(height) / slideTicks_);
+    ScheduleUpdate(slide_.GetNextFrame());
+    if(shift == shift_) {
+        return false;
+    }
+    shift_ = shift;
+    return true;
 }
+
+void Clock::Draw(rgb_matrix::Canvas* canvas)
+{
+    const int x = position_[0];
+    const int y = position_[1];
+    if(!slide_.IsRunning()) {
+        const Sprite& sprite = cache_.Get(*font_, text_, color_);
+        sprite.Blit(canvas, x, y);
+        bounds_ = {x, y, sprite.width(), sprite.height()};
+        return;
+    }
+    // One sprite at a time, the cache keeps only the last one valid
+    const Sprite& old = cache_.Get(*font_, oldText_, color_);
+    const int height = old.height();
+    Rect bounds{x, y, old.width(), height};
+    for(const Rect& cell : slideCells_) {
+        old.Blit(canvas, x, y - shift_, cell);
+    }
+    const Sprite& sprite = cache_.Get(*font_, text_, color_);
+    for(const Rect& cell : slideCells_) {
+        sprite.Blit(canvas, x, y + height - shift_, cell);
+    }
+    for(const Rect& cell : stillCells_) {
+        sprite.Blit(canvas, x, y, cell);
+    }
+    bounds_ = bounds.Union({x, y, sprite.width(), sprite.height()});
+}
+
+Rect Clock::GetBounds() const
+{
+    return bounds_;
+}
+
+std::unique_ptr<Clock::Settings> Clock::TakePending()
+{
+    std::lock_guard lock{pendingMtx_};
+    return std::move(pending_);
+}
+
+Clock::invalid_argument::invalid_argument(const string& msg) : std::invalid_argument{"Clock -> " + msg}
+{ }
@@ -0,0 +1,157 @@
+/*
+ * Copyright (c) 2019 Dmytro Shestakov
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#include "configwatcher.h"
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstring>
+#include <set>
+
+using std::string;
+
+ConfigWatcher::ConfigWatcher(const Options& options) : options_{std::in_place, options}
+{
+    const auto& configPath = options_->GetConfigPath();
+    if(configPath.empty()) {
+        throw runtime_error{"Options don't come from a file"};
+    }
+    inotifyFd_ = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    stopFd_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    // The directory is watched, editors and deployment tools replace the file rather than write it
+    const string directory = configPath.has_parent_path() ? configPath.parent_path().string() : ".";
+    if(inotifyFd_ < 0 || stopFd_ < 0
+       || inotify_add_watch(inotifyFd_, directory.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO) < 0) {
+        const string error = strerror(errno);
+        for(int fd : { inotifyFd_, stopFd_ }) {
+            if(fd >= 0) {
+                close(fd);
+            }
+        }
+        throw runtime_error{"Couldn't watch " + directory + ": " + error};
+    }
+}
+
+ConfigWatcher::~ConfigWatcher()
+{
+    if(thread_.joinable()) {
+        const uint64_t value = 1;
+        [[maybe_unused]] auto result = write(stopFd_, &value, sizeof(value));
+        thread_.join();
+    }
+    close(inotifyFd_);
+    close(stopFd_);
+}
+
+void ConfigWatcher::Subscribe(const string& node, Handler handler)
+{
+    handlers_.emplace_back(node, std::move(handler));
+}
+
+void ConfigWatcher::Start()
+{
+    thread_ = std::thread{&ConfigWatcher::WatchThread, this};
+}
+
+// Nodes are compared by their emitted text, so reformatting or comments alone change nothing
+void ConfigWatcher::Reload()
+{
+    std::optional<Options> reloaded;
+    try {
+        reloaded.emplace(options_->Reload());
+    } catch(const YAML::Exception& e) {
+        failures_.fetch_add(1, std::memory_order_relaxed);
+        std::cerr << "ConfigWatcher -> " << options_->GetConfigPath() << " not applied: " << e.what() << std::endl;
+        return;
+    }
+    std::set<string> changed;
+    for(const auto& [node, handler] : handlers_) {
+        const OptionalNode previous = options_->GetNode(node);
+        const OptionalNode current = reloaded->GetNode(node);
+        if(bool(previous) != bool(current) || (previous && YAML::Dump(*previous) != YAML::Dump(*current))) {
+            changed.insert(node);
+        }
+    }
+    options_.emplace(*reloaded);
+    if(changed.empty()) {
+        return;
+    }
+    reloads_.fetch_add(1, std::memory_order_relaxed);
+    for(const auto& [node, handler] : handlers_) {
+        if(!changed.count(node)) {
+            continue;
+        }
+        std::cout << "Config node changed: " << node << std::endl;
+        // A handler that fails keeps its widget as it was, the others still apply
+        try {
+            handler(*options_);
+        } catch(const std::exception& e) {
+            std::cerr << e.what() << std::endl;
+        }
+    }
+}
+
+bool ConfigWatcher::ReadEvents()
+{
+    const string name = options_->GetConfigPath().filename().string();
+    bool matched = false;
+    alignas(inotify_event) char buffer[4096];
+    for(ssize_t length; (length = read(inotifyFd_, buffer, sizeof(buffer))) > 0; ) {
+        for(ssize_t offset = 0; offset < length; ) {
+            const auto* event = reinterpret_cast<const inotify_event*>(buffer + offset);
+            matched |= event->len && name == event->name;
+            offset += ssize_t(sizeof(inotify_event) + event->len);
+        }
+    }
+    return matched;
+}
+
+void ConfigWatcher::WatchThread()
+{
+    bool pending = false;
+    while(true) {
+        pollfd fds[] = {
+            { stopFd_, POLLIN, 0 },
+            { inotifyFd_, POLLIN, 0 },
+        };
+        const int ready = poll(fds, std::size(fds), pending ? SETTLE_MS : -1);
+        if(ready < 0 && errno != EINTR) {
+            std::cerr << "ConfigWatcher -> poll failed  " << strerror(errno) << std::endl;
+            return;
+        }
+        if(fds[0].revents & POLLIN) {
+            return;
+        }
+        if(fds[1].revents & POLLIN) {
+            pending |= ReadEvents();
+            continue;
+        }
+        if(!ready && pending) {
+            pending = false;
+            Reload();
+        }
+    }
+}
+
+ConfigWatcher::runtime_error::runtime_error(const string& msg) : std::runtime_error{"ConfigWatcher -> " + msg}
+{ }
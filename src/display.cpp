@@ -0,0 +1,344 @@
+/*
+ * Copyright (c) 2019 Dmytro Shestakov
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "display.h"
+
+#include <sched.h>
+#include <unistd.h>
+#include <algorithm>
+#include <iomanip>
+#include <sstream>
+#include <thread>
+
+using std::string;
+using namespace std::string_literals;
+using rgb_matrix::RGBMatrix;
+
+namespace {
+
+    class invalid_argument : public std::invalid_argument {
+    public:
+        invalid_argument(const string& msg) : std::invalid_argument{"Display -> " + msg}
+        { }
+    };
+
+    HeadlessDisplay::DumpFormat ParseDumpFormat(const string& format)
+    {
+        if(format == "ppm") {
+            return HeadlessDisplay::DumpFormat::PPM;
+        }
+        if(format == "raw") {
+            return HeadlessDisplay::DumpFormat::RAW;
+        }
+        throw invalid_argument{"Unknown dump format: " + format};
+    }
+
+    std::vector<pid_t> ListThreads()
+    {
+        std::vector<pid_t> threads;
+        std::error_code ec;
+        for(const auto& entry : std::filesystem::directory_iterator{"/proc/self/task", ec}) {
+            threads.push_back(pid_t(std::stol(entry.path().filename().string())));
+        }
+        std::sort(threads.begin(), threads.end());
+        return threads;
+    }
+
+    // User and system time from the 14th and 15th fields, after the parenthesized command name
+    double GetThreadCpuSeconds(pid_t thread)
+    {
+        std::ifstream file{"/proc/self/task/" + std::to_string(thread) + "/stat"};
+        string stat;
+        std::getline(file, stat);
+        const size_t commEnd = stat.rfind(')');
+        if(commEnd == string::npos) {
+            return 0;
+        }
+        std::istringstream fields{stat.substr(commEnd + 1)};
+        string field;
+        unsigned long long ticks = 0;
+        for(int i = 3; i <= 15 && fields >> field; ++i) {
+            if(i >= 14) {
+                ticks += std::stoull(field);
+            }
+        }
+        return double(ticks) / double(sysconf(_SC_CLK_TCK));
+    }
+
+}
+
+Display::~Display() = default;
+
+bool Display::IsRunning() const {
+    return true;
+}
+
+bool Display::SetBrightness(int) {
+    return false;
+}
+
+bool Display::SetPwmBits(int) {
+    return false;
+}
+
+double Display::GetRefreshCpuSeconds() const {
+    return -1;
+}
+
+bool Display::HasPendingChanges() const {
+    return false;
+}
+
+// The threads that appear while the matrix is created are the ones refreshing it
+MatrixDisplay::MatrixDisplay(const RGBMatrix::Options& matrixOptions,
+                             const rgb_matrix::RuntimeOptions& runtimeOptions) :
+    brightness_{matrixOptions.brightness}, pwmBits_{matrixOptions.pwm_bits}
+{
+    const std::vector<pid_t> before = ListThreads();
+    matrix_.reset(rgb_matrix::CreateMatrixFromOptions(matrixOptions, runtimeOptions));
+    if(!matrix_) {
+        throw invalid_argument{"The matrix creation failed"};
+    }
+    const std::vector<pid_t> after = ListThreads();
+    std::set_difference(after.begin(), after.end(), before.begin(), before.end(), std::back_inserter(refreshThreads_));
+    // piclock starts no realtime threads of its own
+    std::vector<pid_t> realtime;
+    std::copy_if(refreshThreads_.begin(), refreshThreads_.end(), std::back_inserter(realtime), [](pid_t thread) {
+        const int policy = sched_getscheduler(thread);
+        return policy == SCHED_FIFO || policy == SCHED_RR;
+    });
+    if(!realtime.empty()) {
+        refreshThreads_.swap(realtime);
+    }
+    offscreen_ = matrix_->CreateFrameCanvas();
+}
+
+int MatrixDisplay::width() const {
+    return matrix_->width();
+}
+
+int MatrixDisplay::height() const {
+    return matrix_->height();
+}
+
+// The library scales the colors by the brightness as pixels are set, so the buffers are uploaded again
+void MatrixDisplay::Present(const SoftCanvas& frame, const DamageList& damage) {
+    if(const int brightness = pendingBrightness_.exchange(-1, std::memory_order_relaxed);
+       brightness >= 0 && brightness != brightness_) {
+        brightness_ = brightness;
+        matrix_->SetBrightness(uint8_t(brightness));
+        fullUploads_ = 2;
+    }
+    if(offscreen_->brightness() != brightness_) {
+        offscreen_->SetBrightness(uint8_t(brightness_));
+    }
+    // The buffers keep every bit plane, the depth only limits how many of them are shown
+    if(const int bits = pendingPwmBits_.exchange(-1, std::memory_order_relaxed); bits > 0 && bits != pwmBits_) {
+        pwmBits_ = bits;
+        matrix_->SetPWMBits(uint8_t(bits));
+    }
+    if(offscreen_->pwmbits() != pwmBits_) {
+        offscreen_->SetPWMBits(uint8_t(pwmBits_));
+    }
+    if(fullUploads_) {
+        --fullUploads_;
+        Upload(frame, frame.GetRect());
+    }
+    else {
+        for(const Rect& rect : previousDamage_) {
+            Upload(frame, rect);
+        }
+        for(const Rect& rect : damage) {
+            Upload(frame, rect);
+        }
+    }
+    previousDamage_ = damage;
+    // Atomic swap with double buffer
+    const auto start = std::chrono::steady_clock::now();
+    offscreen_ = matrix_->SwapOnVSync(offscreen_);
+    vsyncWait_.Observe(std::chrono::steady_clock::now() - start);
+}
+
+bool MatrixDisplay::SetBrightness(int brightness) {
+    pendingBrightness_.store(std::clamp(brightness, 1, 100), std::memory_order_relaxed);
+    return true;
+}
+
+bool MatrixDisplay::SetPwmBits(int bits) {
+    pendingPwmBits_.store(std::clamp(bits, 1, 11), std::memory_order_relaxed);
+    return true;
+}
+
+double MatrixDisplay::GetRefreshCpuSeconds() const {
+    if(refreshThreads_.empty()) {
+        return -1;
+    }
+    double seconds = 0;
+    for(pid_t thread : refreshThreads_) {
+        seconds += GetThreadCpuSeconds(thread);
+    }
+    return seconds;
+}
+
+bool MatrixDisplay::HasPendingChanges() const {
+    return pendingBrightness_.load(std::memory_order_relaxed) >= 0 || pendingPwmBits_.load(std::memory_order_relaxed) >= 0;
+}
+
+void MatrixDisplay::Upload(const SoftCanvas& frame, const Rect& rect) {
+    const Rect area = rect.Intersect(frame.GetRect()).Intersect({0, 0, offscreen_->width(), offscreen_->height()});
+    for(int y = area.y; y < area.Bottom(); ++y) {
+        const uint8_t* pixel = frame.GetPixel(area.x, y);
+        for(int x = area.x; x < area.Right(); ++x, pixel += SoftCanvas::BYTES_PER_PIXEL) {
+            offscreen_->SetPixel(x, y, pixel[0], pixel[1], pixel[2]);
+        }
+    }
+}
+
+void MatrixDisplay::Clear() {
+    matrix_->Clear();
+}
+
+// Compares only the damage, the widgets leave everything else as it was
+bool IdleFilter::IsChanged(const SoftCanvas& frame, const DamageList& damage) {
+    if(!shown_ || shown_->GetRect() != frame.GetRect()) {
+        shown_.emplace(frame);
+        return true;
+    }
+    const bool changed = std::any_of(damage.begin(), damage.end(),
+                                     [&](const Rect& rect) { return !shown_->Equals(frame, rect); });
+    if(!changed) {
+        skipped_.fetch_add(1, std::memory_order_relaxed);
+        return false;
+    }
+    for(const Rect& rect : damage) {
+        shown_->Copy(frame, rect);
+    }
+    return true;
+}
+
+HeadlessDisplay::HeadlessDisplay(const Config& config) : config_{config},
+    period_{config.refreshRate ? std::chrono::nanoseconds{std::chrono::seconds{1}} / config.refreshRate : clock::duration::zero()},
+    start_{clock::now()},
+    frames_{}
+{
+    if(config_.width <= 0 || config_.height <= 0) {
+        throw invalid_argument{"Invalid canvas size"};
+    }
+    if(!config_.dumpPath.empty() && config_.format == DumpFormat::RAW) {
+        rawStream_.open(config_.dumpPath.string() + ".rgb", std::ios::binary | std::ios::trunc);
+        if(!rawStream_) {
+            throw invalid_argument{"Couldn't open dump file "s + config_.dumpPath.c_str()};
+        }
+    }
+}
+
+int HeadlessDisplay::width() const {
+    return config_.width;
+}
+
+int HeadlessDisplay::height() const {
+    return config_.height;
+}
+
+void HeadlessDisplay::Present(const SoftCanvas& frame, const DamageList&) {
+    if(!config_.dumpPath.empty()) {
+        Dump(frame);
+    }
+    WaitVSync();
+    ++frames_;
+}
+
+void HeadlessDisplay::Clear() {
+    if(rawStream_.is_open() && !rawStream_.flush()) {
+        ReportDumpError(config_.dumpPath.string() + ".rgb");
+    }
+    if(dumpErrors_) {
+        std::cerr << "Display -> " << dumpErrors_ << " frame dumps failed" << std::endl;
+    }
+}
+
+bool HeadlessDisplay::IsRunning() const {
+    return !config_.frameLimit || frames_ < config_.frameLimit;
+}
+
+void HeadlessDisplay::Dump(const SoftCanvas& frame) {
+    const auto data = reinterpret_cast<const char*>(frame.Data());
+    if(config_.format == DumpFormat::RAW) {
+        if(!rawStream_.write(data, std::streamsize(frame.Size()))) {
+            ReportDumpError(config_.dumpPath.string() + ".rgb");
+        }
+        return;
+    }
+    std::ostringstream fileName;
+    fileName << config_.dumpPath.string() << std::setw(6) << std::setfill('0') << frames_ << ".ppm";
+    std::ofstream file{fileName.str(), std::ios::binary | std::ios::trunc};
+    file << "P6\n" << frame.width() << ' ' << frame.height() << "\n255\n";
+    file.write(data, std::streamsize(frame.Size()));
+    if(!file.flush()) {
+        ReportDumpError(fileName.str());
+    }
+}
+
+// A full disk fails every frame from then on, only the first one is printed
+void HeadlessDisplay::ReportDumpError(const string& fileName) {
+    if(!dumpErrors_++) {
+        std::cerr << "Display -> Couldn't write " << fileName << ", the frame dumps are incomplete" << std::endl;
+    }
+    rawStream_.clear();
+}
+
+// The panel refreshes at a fixed rate from its start, a swap completes on the first refresh after the request
+void HeadlessDisplay::WaitVSync() {
+    if(period_ == clock::duration::zero()) {
+        return;
+    }
+    const auto now = clock::now();
+    std::this_thread::sleep_until(start_ + ((now - start_) / period_ + 1) * period_);
+    vsyncWait_.Observe(clock::now() - now);
+}
+
+DisplayPtr CreateDisplay(const Options& options, const std::optional<RGBMatrix::Options>& matrixOptions)
+{
+    if(!matrixOptions) {
+        throw invalid_argument{"Matrix configuration is invalid"};
+    }
+    OptionalNode headlessNode = options.GetNode("headless");
+    if(!headlessNode) {
+        return std::make_unique<MatrixDisplay>(*matrixOptions, *options.GetRuntimeOptions());
+    }
+    try {
+        const YAML::Node& node = *headlessNode;
+        HeadlessDisplay::Config config{};
+        config.width = matrixOptions->cols * matrixOptions->chain_length;
+        config.height = matrixOptions->rows * matrixOptions->parallel;
+        config.refreshRate = node["vsync"].as<unsigned>(100);
+        if(node["dump"]) {
+            config.dumpPath = options.GetExecDir() / node["dump"].as<string>();
+        }
+        config.format = ParseDumpFormat(node["format"].as<string>("ppm"));
+        config.frameLimit = node["frames"].as<uint64_t>(0);
+        std::cout << "Headless display " << config.width << "x" << config.height << std::endl;
+        return std::make_unique<HeadlessDisplay>(config);
+    } catch(const YAML::Exception&) {
+        throw invalid_argument{"Error reading headless configuration from yaml"};
+    }
+}
@@ -0,0 +1,349 @@
+/*
+ * Copyright (c) 2019 Dmytro Shestakov
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "fonts.h"
+#include "warmcache.h"
+#include <algorithm>
+#include <cstring>
+#include <map>
+
+using std::string;
+
+namespace {
+
+    constexpr uint32_t REPLACEMENT_CODEPOINT = 0xFFFD;
+
+    // Same decoding as rgb_matrix::DrawText, so both font kinds accept the same input
+    uint32_t NextCodepoint(const char*& it)
+    {
+        uint32_t codepoint = uint8_t(*it++);
+        if(codepoint < 0x80) {
+            return codepoint;
+        }
+        int continuation = 0;
+        if((codepoint & 0xE0) == 0xC0) {
+            codepoint &= 0x1F;
+            continuation = 1;
+        } else if((codepoint & 0xF0) == 0xE0) {
+            codepoint &= 0x0F;
+            continuation = 2;
+        } else if((codepoint & 0xF8) == 0xF0) {
+            codepoint &= 0x07;
+            continuation = 3;
+        }
+        for(; continuation > 0 && *it; --continuation) {
+            codepoint = (codepoint << 6) | (uint8_t(*it++) & 0x3F);
+        }
+        return codepoint;
+    }
+
+    bool IsKeyword(const string& line, const char* keyword)
+    {
+        const size_t length = strlen(keyword);
+        return line.compare(0, length, keyword) == 0 && (line.size() == length || isspace(uint8_t(line[length])));
+    }
+
+    // The leftmost pixel of a BDF bitmap row is the most significant bit of its first hex digit
+    bool GetHexBit(const string& row, int column)
+    {
+        const size_t digit = size_t(column / 4);
+        if(digit >= row.size() || !isxdigit(uint8_t(row[digit]))) {
+            return false;
+        }
+        const char c = char(tolower(row[digit]));
+        const int value = c <= '9' ? c - '0' : c - 'a' + 10;
+        return value >> (3 - column % 4) & 1;
+    }
+
+}
+
+FontFace::~FontFace() = default;
+
+int FontFace::TextWidth(const char* utf8Text, int letterSpacing) const {
+    int width = 0;
+    while(*utf8Text) {
+        int advance = CharacterWidth(NextCodepoint(utf8Text));
+        if(advance < 0) {
+            advance = std::max(CharacterWidth(REPLACEMENT_CODEPOINT), 0);
+        }
+        width += advance + letterSpacing;
+    }
+    return width;
+}
+
+bool BdfFontFace::LoadFont(const char* path) {
+    return font_.LoadFont(path);
+}
+
+int BdfFontFace::height() const {
+    return font_.height();
+}
+
+int BdfFontFace::baseline() const {
+    return font_.baseline();
+}
+
+int BdfFontFace::CharacterWidth(uint32_t codepoint) const {
+    return font_.CharacterWidth(codepoint);
+}
+
+int BdfFontFace::DrawText(Canvas* canvas, int x, int y, const Color& color,
+                          const char* utf8Text, int letterSpacing) const {
+    return rgb_matrix::DrawText(canvas, font_, x, y, color, nullptr, utf8Text, letterSpacing);
+}
+
+// Same cropping and layout as tools/bdf2cpp.py
+bool FontTable::ParseBdf(const char* path)
+{
+    std::ifstream file{path};
+    if(!file) {
+        return false;
+    }
+    *this = {};
+    ascii.fill(-1);
+    struct Glyph {
+        TableGlyph glyph;
+        std::vector<uint32_t> words;
+    };
+    std::map<uint32_t, Glyph> parsed;
+    bool hasBounds = false;
+    int codepoint = -1;
+    int advance = 0;
+    int bbx[4]{};
+    std::vector<string> rows;
+    const auto addGlyph = [&] {
+        if(codepoint < 0) {
+            return;
+        }
+        const auto [width, rowCount, xOffset, yOffset] = bbx;
+        // Pixel columns relative to the pen position, limited to the advance like rgb_matrix does
+        const int first = std::max(0, xOffset);
+        const int cropWidth = std::max(0, std::min(advance, xOffset + width) - first);
+        const int words = (cropWidth + 31) / 32;
+        const size_t height = std::min(rows.size(), size_t(std::max(rowCount, 0)));
+        Glyph& glyph = parsed[uint32_t(codepoint)];
+        glyph = {{uint32_t(codepoint), int16_t(advance), 0, 0, 0, 0, 0}, std::vector<uint32_t>(height * size_t(words))};
+        bool blank = true;
+        for(size_t row = 0; row < height; ++row) {
+            for(int column = 0; column < cropWidth; ++column) {
+                if(GetHexBit(rows[row], first + column - xOffset)) {
+                    glyph.words[row * size_t(words) + size_t(column / 32)] |= 0x80000000u >> column % 32;
+                    blank = false;
+                }
+            }
+        }
+        if(blank) {
+            glyph.words.clear();
+            return;
+        }
+        glyph.glyph.left = int16_t(first);
+        glyph.glyph.top = int16_t(-(rowCount + yOffset));
+        glyph.glyph.width = uint16_t(cropWidth);
+        glyph.glyph.height = uint16_t(height);
+    };
+
+    enum class State { HEADER, GLYPH, BITMAP } state = State::HEADER;
+    string line;
+    while(std::getline(file, line)) {
+        if(state == State::BITMAP) {
+            if(IsKeyword(line, "ENDCHAR")) {
+                addGlyph();
+                state = State::HEADER;
+            }
+            else {
+                const size_t end = line.find_first_of(" \t\r");
+                rows.push_back(line.substr(0, end));
+            }
+            continue;
+        }
+        int a, b, c, d;
+        if(state == State::HEADER) {
+            if(sscanf(line.c_str(), "FONTBOUNDINGBOX %d %d %d %d", &a, &b, &c, &d) == 4) {
+                height = b;
+                baseline = b + d;
+                hasBounds = true;
+            }
+            else if(IsKeyword(line, "STARTCHAR")) {
+                codepoint = -1;
+                advance = 0;
+                std::fill(std::begin(bbx), std::end(bbx), 0);
+                rows.clear();
+                state = State::GLYPH;
+            }
+        }
+        else if(sscanf(line.c_str(), "ENCODING %d", &a) == 1) {
+            codepoint = a;
+        }
+        else if(sscanf(line.c_str(), "DWIDTH %d", &a) == 1) {
+            advance = a;
+        }
+        else if(sscanf(line.c_str(), "BBX %d %d %d %d", &a, &b, &c, &d) == 4) {
+            bbx[0] = a;
+            bbx[1] = b;
+            bbx[2] = c;
+            bbx[3] = d;
+        }
+        else if(IsKeyword(line, "BITMAP")) {
+            state = State::BITMAP;
+        }
+    }
+    if(!hasBounds) {
+        return false;
+    }
+    glyphs.reserve(parsed.size());
+    for(auto& [codepoint, glyph] : parsed) {
+        glyph.glyph.offset = uint32_t(bitmap.size());
+        bitmap.insert(bitmap.end(), glyph.words.begin(), glyph.words.end());
+        if(codepoint < ascii.size()) {
+            ascii[codepoint] = int16_t(glyphs.size());
+        }
+        glyphs.push_back(glyph.glyph);
+    }
+    return true;
+}
+
+TableFontFace::TableFontFace(FontTablePtr table) : table_{std::move(table)}
+{ }
+
+int TableFontFace::height() const {
+    return table_->height;
+}
+
+int TableFontFace::baseline() const {
+    return table_->baseline;
+}
+
+int TableFontFace::CharacterWidth(uint32_t codepoint) const {
+    const TableGlyph* glyph = FindGlyph(codepoint);
+    return glyph ? glyph->advance : -1;
+}
+
+const TableGlyph* TableFontFace::FindGlyph(uint32_t codepoint) const {
+    if(codepoint < table_->ascii.size()) {
+        const int16_t index = table_->ascii[codepoint];
+        return index < 0 ? nullptr : &table_->glyphs[size_t(index)];
+    }
+    const auto end = table_->glyphs.end();
+    const auto glyph = std::lower_bound(table_->glyphs.begin(), end, codepoint,
+        [](const TableGlyph& glyph, uint32_t codepoint) { return glyph.codepoint < codepoint; });
+    return glyph != end && glyph->codepoint == codepoint ? &*glyph : nullptr;
+}
+
+int TableFontFace::DrawText(Canvas* canvas, int x, int y, const Color& color,
+                            const char* utf8Text, int letterSpacing) const {
+    const BlitTarget target{canvas, dynamic_cast<SoftCanvas*>(canvas), color};
+    const int startX = x;
+    while(*utf8Text) {
+        const TableGlyph* glyph = FindGlyph(NextCodepoint(utf8Text));
+        if(!glyph) {
+            glyph = FindGlyph(REPLACEMENT_CODEPOINT);
+        }
+        if(!glyph) {
+            continue;
+        }
+        if(glyph->width) {
+            BlitRows(target, x + glyph->left, y + glyph->top, table_->bitmap.data() + glyph->offset,
+                     glyph->width, glyph->height);
+        }
+        x += glyph->advance + letterSpacing;
+    }
+    return x - startX;
+}
+
+EmbeddedFontFace::EmbeddedFontFace(const EmbeddedFontData& data) : data_{data}
+{ }
+
+const EmbeddedFontData* EmbeddedFontFace::Find(const string& name) {
+    for(auto font = EMBEDDED_FONTS; *font; ++font) {
+        if(name == (*font)->name) {
+            return *font;
+        }
+    }
+    return nullptr;
+}
+
+int EmbeddedFontFace::height() const {
+    return data_.height;
+}
+
+int EmbeddedFontFace::baseline() const {
+    return data_.baseline;
+}
+
+int EmbeddedFontFace::CharacterWidth(uint32_t codepoint) const {
+    const EmbeddedGlyph* glyph = FindGlyph(codepoint);
+    return glyph ? glyph->advance : -1;
+}
+
+const EmbeddedGlyph* EmbeddedFontFace::FindGlyph(uint32_t codepoint) const {
+    if(codepoint < 128) {
+        const int16_t index = data_.ascii[codepoint];
+        return index < 0 ? nullptr : &data_.glyphs[index];
+    }
+    const EmbeddedGlyph* end = data_.glyphs + data_.glyphCount;
+    const EmbeddedGlyph* glyph = std::lower_bound(data_.glyphs, end, codepoint,
+        [](const EmbeddedGlyph& glyph, uint32_t codepoint) { return glyph.codepoint < codepoint; });
+    return glyph != end && glyph->codepoint == codepoint ? glyph : nullptr;
+}
+
+int EmbeddedFontFace::DrawText(Canvas* canvas, int x, int y, const Color& color,
+                               const char* utf8Text, int letterSpacing) const {
+    const BlitTarget target{canvas, dynamic_cast<SoftCanvas*>(canvas), color};
+    const int startX = x;
+    while(*utf8Text) {
+        const EmbeddedGlyph* glyph = FindGlyph(NextCodepoint(utf8Text));
+        if(!glyph) {
+            glyph = FindGlyph(REPLACEMENT_CODEPOINT);
+        }
+        if(!glyph) {
+            continue;
+        }
+        if(glyph->blit) {
+            glyph->blit(target, x + glyph->left, y + glyph->top, data_.bitmap + glyph->offset);
+        }
+        x += glyph->advance + letterSpacing;
+    }
+    return x - startX;
+}
+
+FontPtr LoadFont(const Options& options, const string& fontFile)
+{
+    if(const EmbeddedFontData* data = EmbeddedFontFace::Find(fontFile); data) {
+        return std::make_unique<EmbeddedFontFace>(*data);
+    }
+    const auto fontPath = options.GetExecDir() / fontFile;
+    std::error_code ec;
+    if(!std::filesystem::exists(fontPath, ec)) {
+        std::cerr << "Font file doesn't exist: " << fontPath << std::endl;
+        return nullptr;
+    }
+    if(WarmCache* cache = options.GetCache(); cache) {
+        if(FontTablePtr table = cache->GetFont(fontPath); table) {
+            return std::make_unique<TableFontFace>(std::move(table));
+        }
+    }
+    auto font = std::make_unique<BdfFontFace>();
+    if(!font->LoadFont(fontPath.c_str())) {
+        return nullptr;
+    }
+    return font;
+}
@@ -0,0 +1,138 @@
+/*
+ * Copyright (c) 2019 Dmytro Shestakov
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "frameexport.h"
+
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <new>
+
+using std::string;
+
+FrameExport::runtime_error::runtime_error(const string& msg) : std::runtime_error{"FrameExport -> " + msg}
+{ }
+
+// A memory left behind by a crash is unlinked rather than reused, readers that still map it keep
+// their pages instead of faulting on a truncated file
+FrameExport::FrameExport(const Config& config, int width, int height) : config_{config}
+{
+    if(width <= 0 || height <= 0 || width > UINT16_MAX || height > UINT16_MAX || !config_.slots) {
+        throw runtime_error{"Invalid frame geometry"};
+    }
+    const size_t stride = size_t(width) * SoftCanvas::BYTES_PER_PIXEL;
+    const size_t frameSize = stride * size_t(height);
+    size_ = Layout::GetSize(config_.slots, frameSize);
+    shm_unlink(config_.name.c_str());
+    const int fd = shm_open(config_.name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0644);
+    if(fd < 0) {
+        throw runtime_error{"Couldn't create " + config_.name + ": " + strerror(errno)};
+    }
+    if(ftruncate(fd, off_t(size_))) {
+        close(fd);
+        shm_unlink(config_.name.c_str());
+        throw runtime_error{"Couldn't size " + config_.name + ": " + strerror(errno)};
+    }
+    void* memory = mmap(nullptr, size_, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if(memory == MAP_FAILED) {
+        shm_unlink(config_.name.c_str());
+        throw runtime_error{"Couldn't map " + config_.name + ": " + strerror(errno)};
+    }
+    base_ = static_cast<uint8_t*>(memory);
+    // The memory comes zeroed, which is what the atomics start from
+    header_ = new(base_) Layout::Header{};
+    slots_ = reinterpret_cast<Layout::Slot*>(base_ + sizeof(Layout::Header));
+    for(uint32_t i = 0; i < config_.slots; ++i) {
+        new(&slots_[i]) Layout::Slot{};
+    }
+    header_->version = Layout::VERSION;
+    header_->width = uint16_t(width);
+    header_->height = uint16_t(height);
+    header_->stride = uint32_t(stride);
+    header_->slots = config_.slots;
+    header_->frameSize = frameSize;
+    header_->dataOffset = Layout::GetDataOffset(config_.slots);
+    header_->slotSize = Layout::Align(frameSize);
+    // Readers check the magic first, it goes last
+    std::atomic_thread_fence(std::memory_order_release);
+    memcpy(header_->magic, Layout::MAGIC, sizeof(Layout::MAGIC));
+}
+
+FrameExport::~FrameExport()
+{
+    header_->closed.store(1, std::memory_order_release);
+    munmap(base_, size_);
+    shm_unlink(config_.name.c_str());
+}
+
+// An odd sequence while the frame is copied, the even one after it
+void FrameExport::Publish(const SoftCanvas& frame)
+{
+    if(frame.Size() != header_->frameSize) {
+        return;
+    }
+    const auto start = std::chrono::steady_clock::now();
+    const uint64_t number = ++frame_;
+    Layout::Slot& slot = slots_[number % header_->slots];
+    slot.sequence.store(2 * number - 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    slot.wallTime.store(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                            std::chrono::system_clock::now().time_since_epoch()).count(), std::memory_order_relaxed);
+    memcpy(base_ + header_->dataOffset + number % header_->slots * header_->slotSize, frame.Data(), frame.Size());
+    slot.sequence.store(2 * number, std::memory_order_release);
+    header_->latest.store(number, std::memory_order_release);
+    published_.fetch_add(1, std::memory_order_relaxed);
+    publishTime_.Observe(std::chrono::steady_clock::now() - start);
+}
+
+void FrameExport::RegisterMetrics(MetricsRegistry& registry)
+{
+    registry.AddCounter("piclock_export_frames_total", "Frames published to the shared memory", {},
+                        [this] { return double(published_.load(std::memory_order_relaxed)); });
+    registry.AddHistogram("piclock_export_publish_seconds", "Time the frame loop spends publishing a frame", {},
+                          publishTime_);
+}
+
+std::unique_ptr<FrameExport> CreateFrameExport(const Options& options, int width, int height)
+{
+    OptionalNode optionalNode = options.GetNode("export");
+    if(!optionalNode) {
+        return nullptr;
+    }
+    const YAML::Node node = *optionalNode;
+    FrameExport::Config config;
+    try {
+        config.name = node["name"].as<string>("piclock.frame");
+        config.slots = std::clamp(node["slots"].as<uint32_t>(3), 2u, 16u);
+    } catch(const YAML::BadConversion&) {
+        throw std::invalid_argument("FrameExport -> Reading export failed");
+    }
+    if(config.name.empty() || config.name.find('/', 1) != string::npos) {
+        throw std::invalid_argument("FrameExport -> The name has to be a single path component");
+    }
+    if(config.name.front() != '/') {
+        config.name.insert(0, "/");
+    }
+    std::cout << "Publishing frames to /dev/shm" << config.name << std::endl;
+    return std::make_unique<FrameExport>(config, width, height);
+}
@@ -0,0 +1,244 @@
+/*
+ * Copyright (c) 2019 Dmytro Shestakov
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#include "graph.h"
+
+#include <algorithm>
+
+using std::string;
+using namespace std::chrono_literals;
+
+namespace {
+
+    // How often new buckets are looked for, raw samples come at the poll interval of the sensors
+    constexpr auto RAW_REFRESH = 1s;
+    constexpr auto TIER_REFRESH = 10s;
+    // Headroom added when the range grows, so that a slow drift doesn't rescale every column
+    constexpr float RANGE_MARGIN = 0.1f;
+
+    rgb_matrix::Color Dim(const rgb_matrix::Color& color)
+    {
+        return {uint8_t(color.r / 4), uint8_t(color.g / 4), uint8_t(color.b / 4)};
+    }
+
+}
+
+GraphWidget::GraphWidget(const Options& options, BaseWidget& widget, SensorHub& hub) : WidgetWrapper{widget}, hub_{hub}
+{
+    Apply(LoadSettings(options));
+}
+
+GraphWidget::Settings GraphWidget::LoadSettings(const Options& options)
+{
+    Settings settings;
+    try {
+        OptionalNode optionalNode = options.GetNode("graph");
+        if(!optionalNode) {
+            throw std::invalid_argument("Configuration node not found");
+        }
+        Node graphNode = *optionalNode;
+        const auto position = graphNode["position"].as<PositionType>();
+        const auto size = graphNode["size"].as<PositionType>();
+        settings.rect = {position[0], position[1], size[0], size[1]};
+        if(settings.rect.IsEmpty()) {
+            throw std::invalid_argument("Empty graph area");
+        }
+        settings.tier = SensorHistory::ParseTier(graphNode["tier"].as<string>("minute"));
+
+        // Every sensor by default, otherwise the listed devices in the display order
+        const Node namesNode = graphNode["sensors"];
+        for(Sensor& sensor : hub_.GetSensors()) {
+            const bool listed = !namesNode.IsDefined() || std::any_of(namesNode.begin(), namesNode.end(),
+                [&](const Node& name) { return name.as<string>() == sensor.GetName(); });
+            if(listed) {
+                settings.bands.push_back({&sensor, {}, std::vector<HistoryBucket>(size_t(settings.rect.width))});
+            }
+        }
+    } catch(const YAML::TypedBadConversion<int32_t>&) {
+        throw invalid_argument{"Error reading position or size from yaml"};
+    } catch(const YAML::TypedBadConversion<string>&) {
+        throw invalid_argument{"Error reading tier or sensors from yaml"};
+    } catch(const std::invalid_argument& e) {
+        throw invalid_argument{e.what()};
+    }
+
+    if(settings.bands.empty()) {
+        return settings;
+    }
+    const Rect& rect = settings.rect;
+    const int bandHeight = rect.height / int(settings.bands.size());
+    if(!bandHeight) {
+        throw invalid_argument{"Too many sensors for the graph height"};
+    }
+    for(size_t i = 0; i < settings.bands.size(); ++i) {
+        // A blank row between the bands if there is room for it
+        settings.bands[i].rect = {rect.x, rect.y + int(i) * bandHeight, rect.width, bandHeight - (bandHeight > 2)};
+    }
+    return settings;
+}
+
+void GraphWidget::Apply(Settings&& settings)
+{
+    rect_ = settings.rect;
+    tier_ = settings.tier;
+    bands_ = std::move(settings.bands);
+}
+
+// The columns drawn so far are dropped, the new bands fill up from the history to come
+void GraphWidget::Reconfigure(const Options& options)
+{
+    auto settings = std::make_unique<Settings>(LoadSettings(options));
+    {
+        std::lock_guard lock{pendingMtx_};
+        pending_ = std::move(settings);
+    }
+    RequestUpdate();
+}
+
+bool GraphWidget::Update()
+{
+    bool changed = false;
+    std::unique_ptr<Settings> settings;
+    {
+        std::lock_guard lock{pendingMtx_};
+        settings = std::move(pending_);
+    }
+    if(settings) {
+        Apply(std::move(*settings));
+        relayout_ = true;
+        changed = true;
+    }
+    for(Band& band : bands_) {
+        HistoryBucket bucket;
+        while(band.sensor->GetHistory().Pop(tier_, bucket)) {
+            Append(band, bucket);
+            changed = true;
+        }
+    }
+    // Extra updates requested by the parent schedule the same deadline again, the scheduler keeps it
+    // once. It dropped them all if the system time was set, the refresh is then due from now on
+    const TimePoint now = std::chrono::system_clock::now();
+    const auto refresh = tier_ == HistoryTier::RAW ? RAW_REFRESH : TIER_REFRESH;
+    if(now >= nextRefresh_ || nextRefresh_ - now > refresh) {
+        nextRefresh_ = now + refresh;
+    }
+    ScheduleUpdate(nextRefresh_);
+    return changed;
+}
+
+void GraphWidget::Append(Band& band, const HistoryBucket& bucket)
+{
+    band.columns[band.cursor] = bucket;
+    band.cursor = (band.cursor + 1) % band.columns.size();
+    band.fresh = std::min(band.fresh + 1, band.columns.size());
+    if(band.low > band.high) {
+        band.low = bucket.min;
+        band.high = bucket.max;
+        band.rescale = true;
+    }
+    else if(bucket.min < band.low || bucket.max > band.high) {
+        const float low = std::min(band.low, bucket.min);
+        const float high = std::max(band.high, bucket.max);
+        const float margin = (high - low) * RANGE_MARGIN;
+        band.low = bucket.min < band.low ? low - margin : low;
+        band.high = bucket.max > band.high ? high + margin : high;
+        band.rescale = true;
+    }
+}
+
+int GraphWidget::GetRow(const Band& band, float value) const
+{
+    const int rows = band.rect.height;
+    const float span = band.high - band.low;
+    const int offset = span > 0 ? int((value - band.low) / span * float(rows - 1) + 0.5f) : rows / 2;
+    return band.rect.Bottom() - 1 - std::clamp(offset, 0, rows - 1);
+}
+
+// The range of the bucket is dimmed, its average is drawn in the sensor color
+Rect GraphWidget::DrawColumn(Canvas* canvas, const Band& band, size_t column) const
+{
+    const int x = band.rect.x + int(column);
+    const Rect area{x, band.rect.y, 1, band.rect.height};
+    const HistoryBucket& bucket = band.columns[column];
+    const bool empty = !bucket.count || column == band.cursor;
+    const int top = empty ? area.Bottom() : GetRow(band, bucket.max);
+    const int bottom = empty ? area.Bottom() : GetRow(band, bucket.min);
+    const int average = empty ? area.Bottom() : GetRow(band, bucket.avg);
+    const Color& color = band.sensor->GetColor();
+    const Color dim = Dim(color);
+    for(int y = area.y; y < area.Bottom(); ++y) {
+        if(y == average) {
+            canvas->SetPixel(x, y, color.r, color.g, color.b);
+        }
+        else if(y >= top && y <= bottom) {
+            canvas->SetPixel(x, y, dim.r, dim.g, dim.b);
+        }
+        else {
+            canvas->SetPixel(x, y, 0, 0, 0);
+        }
+    }
+    return area;
+}
+
+void GraphWidget::Draw(Canvas* canvas)
+{
+    for(Band& band : bands_) {
+        for(size_t column = 0; column < band.columns.size(); ++column) {
+            DrawColumn(canvas, band, column);
+        }
+        band.fresh = 0;
+        band.rescale = false;
+    }
+    bounds_ = rect_;
+    relayout_ = false;
+}
+
+bool GraphWidget::DrawChanges(Canvas* canvas, Rect& changed)
+{
+    // A new range moves every column, a full lap leaves nothing to keep
+    const bool redraw = std::any_of(bands_.begin(), bands_.end(), [](const Band& band) {
+        return band.rescale || band.fresh >= band.columns.size();
+    });
+    if(redraw || relayout_ || bounds_.IsEmpty()) {
+        return false;
+    }
+    changed = {};
+    for(Band& band : bands_) {
+        if(!band.fresh) {
+            continue;
+        }
+        const size_t width = band.columns.size();
+        // The cursor column is the gap in front of the newest one
+        for(size_t i = 0; i <= band.fresh; ++i) {
+            changed = changed.Union(DrawColumn(canvas, band, (band.cursor + width - i) % width));
+        }
+        band.fresh = 0;
+    }
+    return true;
+}
+
+Rect GraphWidget::GetBounds() const
+{
+    return bounds_;
+}
+
+GraphWidget::invalid_argument::invalid_argument(const string& msg) : std::invalid_argument{"GraphWidget -> " + msg}
+{ }
@@ -0,0 +1,91 @@
+/*
+ * Copyright (c) 2019 Dmytro Shestakov
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#include "history.h"
+
+#include <algorithm>
+#include <deque>
+#include <stdexcept>
+#include <string>
+
+HistoryTier SensorHistory::ParseTier(const std::string_view& name) {
+    static constexpr std::string_view NAMES[size_t(HistoryTier::MAX_VAL)] = { "raw", "minute", "hour" };
+    for(size_t i = 0; i < std::size(NAMES); ++i) {
+        if(name == NAMES[i]) {
+            return HistoryTier(i);
+        }
+    }
+    throw std::invalid_argument("SensorHistory -> unknown tier: " + std::string{name});
+}
+
+template<typename Publish>
+void SensorHistory::Accumulate(int64_t time, float value, Publish&& publish) {
+    for(size_t i = size_t(HistoryTier::MINUTE); i < aggregates_.size(); ++i) {
+        const int64_t period = GetPeriod(HistoryTier(i));
+        const int64_t start = time - time % period;
+        Aggregate& aggregate = aggregates_[i];
+        if(aggregate.count && aggregate.start != start) {
+            publish(HistoryTier(i), {aggregate.start, aggregate.min, aggregate.max,
+                                     float(aggregate.sum / aggregate.count), aggregate.count});
+            aggregate.count = 0;
+        }
+        if(!aggregate.count) {
+            aggregate = {start, value, value, 0, 0};
+        }
+        aggregate.min = std::min(aggregate.min, value);
+        aggregate.max = std::max(aggregate.max, value);
+        aggregate.sum += value;
+        ++aggregate.count;
+    }
+}
+
+void SensorHistory::Add(int64_t time, float value) {
+    Push(HistoryTier::RAW, {time, value, value, value, 1});
+    Accumulate(time, value, [this](HistoryTier tier, const HistoryBucket& bucket) {
+        Push(tier, bucket);
+    });
+}
+
+void SensorHistory::Restore(const std::vector<HistorySample>& samples) {
+    std::array<std::deque<HistoryBucket>, size_t(HistoryTier::MAX_VAL)> kept;
+    const auto keep = [&kept](HistoryTier tier, const HistoryBucket& bucket) {
+        auto& buckets = kept[size_t(tier)];
+        buckets.push_back(bucket);
+        if(buckets.size() > CAPACITY) {
+            buckets.pop_front();
+        }
+    };
+    for(const HistorySample& sample : samples) {
+        keep(HistoryTier::RAW, {sample.time, sample.value, sample.value, sample.value, 1});
+        Accumulate(sample.time, sample.value, keep);
+    }
+    for(size_t i = 0; i < kept.size(); ++i) {
+        for(const HistoryBucket& bucket : kept[i]) {
+            Push(HistoryTier(i), bucket);
+        }
+    }
+}
+
+void SensorHistory::Push(HistoryTier tier, const HistoryBucket& bucket) {
+    if(!rings_[size_t(tier)].Push(bucket)) {
+        dropped_.fetch_add(1, std::memory_order_relaxed);
+    }
+}
@@ -0,0 +1,210 @@
+/*
+ * Copyright (c) 2019 Dmytro Shestakov
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "iiobuffer.h"
+#include <fcntl.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cerrno>
+#include <charconv>
+#include <cstring>
+#include <fstream>
+#include <numeric>
+
+using std::string_view;
+
+bool ScanType::Parse(string_view text, ScanType& type)
+{
+    // [be|le]:[s|u]bits/storagebits[Xrepeat]>>shift
+    const auto number = [&text](unsigned& value) {
+        auto [end, error] = std::from_chars(text.data(), text.data() + text.size(), value);
+        text.remove_prefix(size_t(end - text.data()));
+        return error == std::errc{};
+    };
+    while(!text.empty() && isspace(static_cast<unsigned char>(text.back()))) {
+        text.remove_suffix(1);
+    }
+    if(text.size() < 4 || text[2] != ':' || (text[3] != 's' && text[3] != 'u')) {
+        return false;
+    }
+    type.bigEndian = text.substr(0, 2) == "be";
+    if(!type.bigEndian && text.substr(0, 2) != "le") {
+        return false;
+    }
+    type.isSigned = text[3] == 's';
+    text.remove_prefix(4);
+    if(!number(type.bits) || text.empty() || text.front() != '/') {
+        return false;
+    }
+    text.remove_prefix(1);
+    if(!number(type.storageBits) || text.substr(0, 2) != ">>") {
+        return false;
+    }
+    text.remove_prefix(2);
+    if(!number(type.shift) || !text.empty()) {
+        return false;
+    }
+    const bool storageSupported = type.storageBits == 8 || type.storageBits == 16 || type.storageBits == 32
+                                  || type.storageBits == 64;
+    return storageSupported && type.bits > 0 && type.bits + type.shift <= type.storageBits;
+}
+
+int64_t ScanType::Decode(const uint8_t* data) const
+{
+    uint64_t value = 0;
+    const size_t bytes = GetBytes();
+    for(size_t i = 0; i < bytes; ++i) {
+        value |= uint64_t(data[bigEndian ? i : bytes - 1 - i]) << (8 * (bytes - 1 - i));
+    }
+    value >>= shift;
+    if(bits < 64) {
+        value &= (uint64_t{1} << bits) - 1;
+        if(isSigned && value >> (bits - 1)) {
+            value |= ~uint64_t{0} << bits;
+        }
+    }
+    return int64_t(value);
+}
+
+IioBuffer::IioBuffer(const path& devicePath, const path& chardevPath, const std::vector<string>& channels,
+                     const string& trigger) :
+    devicePath_{devicePath}, chardevPath_{chardevPath}, values_(channels.size())
+{
+    const path scanElements = devicePath_ / "scan_elements";
+    // Changing the scan layout is refused while the buffer runs
+    WriteAttribute(devicePath_ / "buffer" / "enable", "0");
+    std::error_code ec;
+    for(const auto& entry : std::filesystem::directory_iterator{scanElements, ec}) {
+        const string name = entry.path().filename().string();
+        if(name.size() > 3 && name.compare(name.size() - 3, 3, "_en") == 0) {
+            WriteAttribute(entry.path(), "0");
+        }
+    }
+    if(ec) {
+        throw runtime_error{devicePath_.string() + " has no scan elements"};
+    }
+    for(const string& channel : channels) {
+        Channel result{};
+        if(!ScanType::Parse(ReadAttribute(scanElements / (channel + "_type")), result.type)) {
+            throw runtime_error{"Unsupported scan type of " + channel};
+        }
+        const string index = ReadAttribute(scanElements / (channel + "_index"));
+        if(std::from_chars(index.data(), index.data() + index.size(), result.index).ec != std::errc{}) {
+            throw runtime_error{"Bad scan index of " + channel};
+        }
+        WriteAttribute(scanElements / (channel + "_en"), "1");
+        channels_.push_back(result);
+    }
+    // Enabled channels follow each other by index, every one aligned to its own size
+    std::vector<size_t> order(channels_.size());
+    std::iota(order.begin(), order.end(), 0);
+    std::sort(order.begin(), order.end(), [this](size_t a, size_t b) {
+        return channels_[a].index < channels_[b].index;
+    });
+    size_t largest = 1;
+    for(size_t i : order) {
+        const size_t bytes = channels_[i].type.GetBytes();
+        channels_[i].offset = (scanBytes_ + bytes - 1) / bytes * bytes;
+        scanBytes_ = channels_[i].offset + bytes;
+        largest = std::max(largest, bytes);
+    }
+    scanBytes_ = (scanBytes_ + largest - 1) / largest * largest;
+    buffer_.resize(scanBytes_ * SCANS_PER_READ);
+    if(!trigger.empty()) {
+        WriteAttribute(devicePath_ / "trigger" / "current_trigger", trigger);
+    }
+    WriteAttribute(devicePath_ / "buffer" / "enable", "1");
+    Open();
+}
+
+IioBuffer::~IioBuffer()
+{
+    if(fd_ >= 0) {
+        close(fd_);
+    }
+    std::ofstream{devicePath_ / "buffer" / "enable"} << "0";
+}
+
+size_t IioBuffer::Read()
+{
+    size_t scans = 0;
+    while(true) {
+        const ssize_t length = read(fd_, buffer_.data() + pending_, buffer_.size() - pending_);
+        if(length < 0) {
+            if(errno == EINTR) {
+                continue;
+            }
+            if(errno != EAGAIN) {
+                throw runtime_error{"Reading " + chardevPath_.string() + " failed: " + strerror(errno)};
+            }
+            return scans;
+        }
+        if(length == 0) {
+            // The other side went away, a FIFO in tests
+            close(fd_);
+            pending_ = 0;
+            Open();
+            return scans;
+        }
+        const size_t available = pending_ + size_t(length);
+        const size_t complete = available / scanBytes_;
+        if(complete) {
+            const uint8_t* scan = buffer_.data() + (complete - 1) * scanBytes_;
+            for(size_t i = 0; i < channels_.size(); ++i) {
+                values_[i] = channels_[i].type.Decode(scan + channels_[i].offset);
+            }
+            scans += complete;
+        }
+        pending_ = available - complete * scanBytes_;
+        std::copy_n(buffer_.data() + complete * scanBytes_, pending_, buffer_.data());
+    }
+}
+
+void IioBuffer::WriteAttribute(const path& file, string_view value)
+{
+    std::ofstream stream{file};
+    if(!(stream << value << std::flush)) {
+        throw runtime_error{"Writing " + file.string() + " failed"};
+    }
+}
+
+IioBuffer::string IioBuffer::ReadAttribute(const path& file)
+{
+    std::ifstream stream{file};
+    string result;
+    if(!(stream >> result)) {
+        throw runtime_error{"Reading " + file.string() + " failed"};
+    }
+    return result;
+}
+
+void IioBuffer::Open()
+{
+    fd_ = open(chardevPath_.c_str(), O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+    if(fd_ < 0) {
+        throw runtime_error{"Opening " + chardevPath_.string() + " failed: " + strerror(errno)};
+    }
+    ++opens_;
+}
+
+IioBuffer::runtime_error::runtime_error(const string& msg) : std::runtime_error{"IioBuffer -> " + msg}
+{ }
@@ -20,8 +20,84 @@
  * SOFTWARE.
  */
 #include "ledwidget.h"
+#include "softcanvas.h"
 
-using std::unique_lock;
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+#include <cerrno>
+#include <system_error>
+
+using std::lock_guard;
+using std::string;
+
+namespace {
+
+    int64_t SteadyNow()
+    {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    void ClearRect(rgb_matrix::Canvas* canvas, const Rect& rect)
+    {
+        if(auto softCanvas = dynamic_cast<SoftCanvas*>(canvas); softCanvas) {
+            softCanvas->Fill(rect, 0, 0, 0);
+            return;
+        }
+        const Rect area = rect.Intersect({0, 0, canvas->width(), canvas->height()});
+        for(int y = area.y; y < area.Bottom(); ++y) {
+            for(int x = area.x; x < area.Right(); ++x) {
+                canvas->SetPixel(x, y, 0, 0, 0);
+            }
+        }
+    }
+
+    void CompositeRect(rgb_matrix::Canvas* canvas, const SoftCanvas& layer, const Rect& rect)
+    {
+        if(auto softCanvas = dynamic_cast<SoftCanvas*>(canvas); softCanvas) {
+            softCanvas->Composite(layer, rect);
+            return;
+        }
+        const Rect area = rect.Intersect(layer.GetRect());
+        for(int y = area.y; y < area.Bottom(); ++y) {
+            for(int x = area.x; x < area.Right(); ++x) {
+                const uint8_t* pixel = layer.GetPixel(x, y);
+                if(pixel[0] | pixel[1] | pixel[2]) {
+                    canvas->SetPixel(x, y, pixel[0], pixel[1], pixel[2]);
+                }
+            }
+        }
+    }
+
+}
+
+bool BaseWidget::Update() {
+    return true;
+}
+
+Rect BaseWidget::GetBounds() const {
+    return Rect::Infinite();
+}
+
+bool BaseWidget::DrawChanges(rgb_matrix::Canvas*, Rect&) {
+    return false;
+}
+
+std::string_view BaseWidget::GetName() const {
+    return "widget";
+}
+
+void BaseWidget::RequestUpdate(SlotMask) {
+    RequestUpdate();
+}
+
+void BaseWidget::ScheduleUpdate(TimePoint deadline, SlotMask) {
+    ScheduleUpdate(deadline);
+}
+
+void BaseWidget::AttachSlot(SlotMask, UpdateScheduler&)
+{ }
 
 BaseWidget::~BaseWidget() = default;
 
@@ -29,24 +105,248 @@ WidgetWrapper::WidgetWrapper(BaseWidget &widget) : widget_{widget}
 { }
 
 void WidgetWrapper::RequestUpdate() {
-    widget_.RequestUpdate();
+    UpdateScheduler* scheduler = scheduler_.load(std::memory_order_acquire);
+    const SlotMask slot = slot_.load(std::memory_order_relaxed);
+    if(scheduler) {
+        scheduler->Wake(slot);
+        return;
+    }
+    widget_.RequestUpdate(slot);
+}
+
+void WidgetWrapper::ScheduleUpdate(TimePoint deadline) {
+    UpdateScheduler* scheduler = scheduler_.load(std::memory_order_acquire);
+    const SlotMask slot = slot_.load(std::memory_order_relaxed);
+    if(scheduler) {
+        scheduler->Schedule(deadline, slot);
+        return;
+    }
+    widget_.ScheduleUpdate(deadline, slot);
+}
+
+// The slot first, a request that sees the scheduler also sees its slot
+void WidgetWrapper::AttachSlot(SlotMask slot, UpdateScheduler& scheduler) {
+    slot_.store(slot, std::memory_order_relaxed);
+    scheduler_.store(&scheduler, std::memory_order_release);
+}
+
+UpdateScheduler::UpdateScheduler() :
+    eventFd_{eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)},
+    timerFd_{timerfd_create(CLOCK_REALTIME, TFD_NONBLOCK | TFD_CLOEXEC)}
+{
+    if(eventFd_ < 0 || timerFd_ < 0) {
+        throw std::system_error{errno, std::generic_category(), "UpdateScheduler -> fd creation failed"};
+    }
+}
+
+UpdateScheduler::~UpdateScheduler() {
+    close(eventFd_);
+    close(timerFd_);
+}
+
+void UpdateScheduler::Wake(SlotMask slots) {
+    if(!slots) {
+        return;
+    }
+    // Checked first, so that a burst of requests reads the clock once
+    if(!requestTime_.load(std::memory_order_relaxed)) {
+        int64_t none = 0;
+        requestTime_.compare_exchange_strong(none, SteadyNow(), std::memory_order_relaxed);
+    }
+    if(dirty_.fetch_or(slots, std::memory_order_release)) {
+        return;
+    }
+    const uint64_t value = 1;
+    // The counter can't realistically overflow, a failed write still leaves the fd readable
+    [[maybe_unused]] auto result = write(eventFd_, &value, sizeof(value));
+}
+
+void UpdateScheduler::Schedule(TimePoint deadline, SlotMask slots) {
+    lock_guard lock{mtx_};
+    const bool earliest = deadlines_.empty() || deadline < deadlines_.begin()->first;
+    deadlines_.emplace(deadline, slots);
+    if(earliest) {
+        ArmTimer();
+    }
+}
+
+SlotMask UpdateScheduler::Wait() {
+    while(true) {
+        SlotMask slots = dirty_.exchange(0, std::memory_order_acquire);
+        const int64_t requested = slots ? requestTime_.exchange(0, std::memory_order_relaxed) : 0;
+        TimePoint earliest = TimePoint::max();
+        SlotMask expired;
+        {
+            lock_guard lock{mtx_};
+            expired = PopExpired(earliest);
+        }
+        if(slots | expired) {
+            // Deadlines follow the wall clock, the delay past them is moved to the steady one
+            const int64_t due = expired ? SteadyNow() - std::chrono::duration_cast<std::chrono::nanoseconds>(
+                                              std::chrono::system_clock::now() - earliest).count() : 0;
+            readyTime_ = requested && due ? std::min(requested, due) : std::max(requested, due);
+            epoch_.fetch_add(1, std::memory_order_release);
+            return slots | expired;
+        }
+        pollfd fds[] = {
+            { eventFd_, POLLIN, 0 },
+            { timerFd_, POLLIN, 0 },
+        };
+        if(poll(fds, std::size(fds), -1) < 0) {
+            if(errno == EINTR) {
+                return 0;
+            }
+            throw std::system_error{errno, std::generic_category(), "UpdateScheduler -> poll failed"};
+        }
+        // The eventfd may also be left over from slots already taken, so the mask is checked again
+        uint64_t value;
+        if(fds[1].revents & POLLIN) {
+            // Fails with ECANCELED if the system time was set
+            const bool timeSet = read(timerFd_, &value, sizeof(value)) < 0 && errno == ECANCELED;
+            lock_guard lock{mtx_};
+            armed_ = TimePoint::max();
+            if(timeSet) {
+                // Made against the old wall clock, every widget works out its next deadline again
+                deadlines_.clear();
+                // Still armed to the old deadline
+                armed_ = TimePoint{};
+                ArmTimer();
+                Wake(ALL_SLOTS);
+            }
+        }
+        if(fds[0].revents & POLLIN) {
+            [[maybe_unused]] auto result = read(eventFd_, &value, sizeof(value));
+        }
+    }
+}
+
+SlotMask UpdateScheduler::PopExpired(TimePoint& earliest) {
+    const TimePoint now = std::chrono::system_clock::now();
+    SlotMask expired = 0;
+    while(!deadlines_.empty() && deadlines_.begin()->first <= now) {
+        earliest = std::min(earliest, deadlines_.begin()->first);
+        expired |= deadlines_.begin()->second;
+        deadlines_.erase(deadlines_.begin());
+    }
+    ArmTimer();
+    return expired;
 }
 
-void MainWidget::Draw(rgb_matrix::FrameCanvas *canvas) {
-    unique_lock lk{mtx_};
-    cv_.wait(lk, [this]{ return pendingRequest_.load();});
-    for(WidgetPtr& widget : widgets_) {
-        widget->Draw(canvas);
+void UpdateScheduler::ArmTimer() {
+    const TimePoint deadline = deadlines_.empty() ? TimePoint::max() : deadlines_.begin()->first;
+    if(deadline == armed_) {
+        return;
+    }
+    armed_ = deadline;
+    itimerspec spec{};
+    if(!deadlines_.empty()) {
+        const auto sinceEpoch = deadline.time_since_epoch();
+        const auto seconds = std::chrono::duration_cast<std::chrono::seconds>(sinceEpoch);
+        spec.it_value.tv_sec = seconds.count();
+        spec.it_value.tv_nsec = std::chrono::duration_cast<std::chrono::nanoseconds>(sinceEpoch - seconds).count();
+        // Zero disarms the timer
+        if(!spec.it_value.tv_sec && !spec.it_value.tv_nsec) {
+            spec.it_value.tv_nsec = 1;
+        }
+    }
+    timerfd_settime(timerFd_, TFD_TIMER_ABSTIME | TFD_TIMER_CANCEL_ON_SET, &spec, nullptr);
+}
+
+MainWidget::MainWidget() : MainWidget{std::max(std::thread::hardware_concurrency(), 1u) - 1}
+{ }
+
+MainWidget::MainWidget(size_t workers) : MainWidget{workers, 0}
+{ }
+
+MainWidget::MainWidget(size_t workers, size_t reserved) : children_(reserved), fixed_{reserved}, drawTimes_(reserved),
+    pool_{workers}
+{ }
+
+void MainWidget::Attach(BaseWidget& widget, size_t index) {
+    widget.AttachSlot(SlotOf(index), scheduler_);
+    if(index == children_.size()) {
+        children_.push_back(&widget);
+        drawTimes_.emplace_back();
+        return;
+    }
+    children_[index] = &widget;
+}
+
+void MainWidget::Draw(rgb_matrix::Canvas *canvas) {
+    DrawFrame(canvas, [](auto&&) {});
+}
+
+bool MainWidget::BeginFrame(const Rect& canvasRect, SlotMask& dirty) {
+    // The first frame is drawn right away
+    dirty = fullRepaint_ ? ALL_SLOTS : scheduler_.Wait();
+    readyTime_ = fullRepaint_ ? 0 : scheduler_.GetReadyTime();
+    const bool repaint = fullRepaint_ || layers_.size() != children_.size()
+                         || (!layers_.empty() && layers_.front().GetRect() != canvasRect);
+    if(repaint) {
+        layers_.assign(children_.size(), SoftCanvas{canvasRect.width, canvasRect.height});
+        oldBounds_.assign(children_.size(), canvasRect);
+        bounds_.assign(children_.size(), {});
+        fullRepaint_ = false;
+    }
+    redraw_.assign(children_.size(), NONE);
+    return repaint;
+}
+
+// The old content of a changed widget is erased, its new one may cover a different area
+void MainWidget::Composite(rgb_matrix::Canvas* canvas, bool repaint, const Rect& canvasRect) {
+    damage_.clear();
+    if(repaint) {
+        damage_.push_back(canvasRect);
+    }
+    else {
+        for(size_t i = 0; i < children_.size(); ++i) {
+            if(redraw_[i] == NONE) {
+                continue;
+            }
+            if(redraw_[i] == CHANGES) {
+                damage_.push_back(oldBounds_[i]);
+                continue;
+            }
+            for(const Rect& bounds : { oldBounds_[i], bounds_[i] }) {
+                if(!bounds.IsEmpty()) {
+                    damage_.push_back(bounds);
+                }
+            }
+        }
+    }
+    for(const Rect& rect : damage_) {
+        ClearRect(canvas, rect);
+        for(size_t i = 0; i < children_.size(); ++i) {
+            if(Rect area = bounds_[i].Intersect(rect); !area.IsEmpty()) {
+                CompositeRect(canvas, layers_[i], area);
+            }
+        }
+    }
+}
+
+void MainWidget::RegisterMetrics(MetricsRegistry& registry) const {
+    for(size_t i = 0; i < children_.size(); ++i) {
+        if(!children_[i]) {
+            continue;
+        }
+        const string labels = "widget=\"" + string{children_[i]->GetName()} + "\",slot=\"" + std::to_string(i) + '"';
+        registry.AddHistogram("piclock_widget_draw_seconds", "Time spent in Draw or DrawChanges of a widget",
+                              labels, drawTimes_[i]);
     }
-    pendingRequest_ = false;
-    lk.unlock();
-    cv_.notify_one();
 }
 
 void MainWidget::RequestUpdate() {
-    unique_lock lk{mtx_};
-    cv_.wait(lk, [this] { return !pendingRequest_.load();});
-    pendingRequest_ = true;
-    lk.unlock();
-    cv_.notify_one();
+    scheduler_.Wake(ALL_SLOTS);
+}
+
+void MainWidget::ScheduleUpdate(TimePoint deadline) {
+    scheduler_.Schedule(deadline, ALL_SLOTS);
+}
+
+void MainWidget::RequestUpdate(SlotMask slots) {
+    scheduler_.Wake(slots);
+}
+
+void MainWidget::ScheduleUpdate(TimePoint deadline, SlotMask slots) {
+    scheduler_.Schedule(deadline, slots);
 }
@@ -0,0 +1,325 @@
+/*
+ * Copyright (c) 2019 Dmytro Shestakov
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#include "metrics.h"
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+#include <sstream>
+
+using std::string;
+using std::lock_guard;
+using namespace std::string_literals;
+
+namespace {
+
+    int64_t SteadyNow()
+    {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+    }
+
+    // A scraper that stops reading must not keep the exporter thread
+    constexpr timeval SEND_TIMEOUT{1, 0};
+
+}
+
+Histogram::Snapshot Histogram::GetSnapshot() const {
+    Snapshot snapshot{};
+    for(size_t i = 0; i < buckets_.size(); ++i) {
+        snapshot.counts[i] = buckets_[i].load(std::memory_order_relaxed);
+    }
+    snapshot.count = count_.load(std::memory_order_relaxed);
+    snapshot.sum = sum_.load(std::memory_order_relaxed);
+    return snapshot;
+}
+
+void RateMeter::Tick() {
+    const int64_t now = SteadyNow();
+    const int64_t start = windowStart_.load(std::memory_order_relaxed);
+    const uint64_t count = windowCount_.load(std::memory_order_relaxed) + 1;
+    if(!start) {
+        windowStart_.store(now, std::memory_order_relaxed);
+        return;
+    }
+    if(now - start >= 1'000'000'000) {
+        rate_.store(double(count) * 1e9 / double(now - start), std::memory_order_relaxed);
+        windowStart_.store(now, std::memory_order_relaxed);
+        windowCount_.store(0, std::memory_order_relaxed);
+        return;
+    }
+    windowCount_.store(count, std::memory_order_relaxed);
+}
+
+double RateMeter::GetRate() const {
+    const int64_t start = windowStart_.load(std::memory_order_relaxed);
+    const int64_t elapsed = SteadyNow() - start;
+    // The loop sleeps while nothing changes, the last full second would be reported forever
+    if(start && elapsed >= 2'000'000'000) {
+        return double(windowCount_.load(std::memory_order_relaxed)) * 1e9 / double(elapsed);
+    }
+    return rate_.load(std::memory_order_relaxed);
+}
+
+Histogram& MetricsRegistry::AddHistogram(const string& name, const string& help, const string& labels) {
+    Histogram* histogram;
+    {
+        lock_guard lock{mtx_};
+        histogram = &histograms_.emplace_back();
+    }
+    AddHistogram(name, help, labels, *histogram);
+    return *histogram;
+}
+
+void MetricsRegistry::AddHistogram(const string& name, const string& help, const string& labels, const Histogram& histogram) {
+    Add(name, help, Type::HISTOGRAM, {labels, &histogram, {}});
+}
+
+std::atomic<uint64_t>& MetricsRegistry::AddCounter(const string& name, const string& help, const string& labels) {
+    std::atomic<uint64_t>* counter;
+    {
+        lock_guard lock{mtx_};
+        counter = &counters_.emplace_back();
+    }
+    AddCounter(name, help, labels, [counter] { return double(counter->load(std::memory_order_relaxed)); });
+    return *counter;
+}
+
+void MetricsRegistry::AddCounter(const string& name, const string& help, const string& labels, Reader reader) {
+    Add(name, help, Type::COUNTER, {labels, nullptr, std::move(reader)});
+}
+
+void MetricsRegistry::AddGauge(const string& name, const string& help, const string& labels, Reader reader) {
+    Add(name, help, Type::GAUGE, {labels, nullptr, std::move(reader)});
+}
+
+void MetricsRegistry::Add(const string& name, const string& help, Type type, Series series) {
+    lock_guard lock{mtx_};
+    Family& family = families_[name];
+    if(family.series.empty()) {
+        family.help = help;
+        family.type = type;
+    }
+    else if(family.type != type) {
+        throw std::invalid_argument("MetricsRegistry -> " + name + " registered with another type");
+    }
+    family.series.push_back(std::move(series));
+}
+
+// Durations are exported in seconds, as Prometheus expects
+void MetricsRegistry::Write(std::ostream& output) const {
+    static constexpr const char* TYPES[] = { "counter", "gauge", "histogram" };
+    lock_guard lock{mtx_};
+    for(const auto& [name, family] : families_) {
+        output << "# HELP " << name << ' ' << family.help << '\n'
+               << "# TYPE " << name << ' ' << TYPES[size_t(family.type)] << '\n';
+        for(const Series& series : family.series) {
+            const string separator = series.labels.empty() ? "" : ",";
+            if(!series.histogram) {
+                output << name;
+                if(!series.labels.empty()) {
+                    output << '{' << series.labels << '}';
+                }
+                output << ' ' << series.reader() << '\n';
+                continue;
+            }
+            const Histogram::Snapshot snapshot = series.histogram->GetSnapshot();
+            uint64_t cumulative = 0;
+            for(size_t i = 0; i < Histogram::BUCKETS; ++i) {
+                cumulative += snapshot.counts[i];
+                output << name << "_bucket{" << series.labels << separator << "le=\""
+                       << double(Histogram::GetBound(i)) * 1e-9 << "\"} " << cumulative << '\n';
+            }
+            cumulative += snapshot.counts[Histogram::BUCKETS];
+            output << name << "_bucket{" << series.labels << separator << "le=\"+Inf\"} " << cumulative << '\n';
+            const string labels = series.labels.empty() ? "" : '{' + series.labels + '}';
+            output << name << "_sum" << labels << ' ' << double(snapshot.sum) * 1e-9 << '\n'
+                   << name << "_count" << labels << ' ' << cumulative << '\n';
+        }
+    }
+}
+
+string MetricsRegistry::Format() const {
+    std::ostringstream output;
+    output.precision(9);
+    Write(output);
+    return output.str();
+}
+
+MetricsExporter::MetricsExporter(const MetricsRegistry& registry, const Config& config) :
+    registry_{registry}, config_{config}, stopFd_{eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)}
+{
+    if(stopFd_ < 0) {
+        throw runtime_error{"eventfd failed: "s + strerror(errno)};
+    }
+    try {
+        if(!config_.socketPath.empty()) {
+            Listen();
+        }
+        if(!config_.filePath.empty()) {
+            OpenFile();
+        }
+    } catch(...) {
+        if(listenFd_ >= 0) {
+            close(listenFd_);
+            unlink(config_.socketPath.c_str());
+        }
+        close(stopFd_);
+        throw;
+    }
+}
+
+MetricsExporter::~MetricsExporter() {
+    if(thread_.joinable()) {
+        const uint64_t value = 1;
+        [[maybe_unused]] auto result = write(stopFd_, &value, sizeof(value));
+        thread_.join();
+    }
+    if(listenFd_ >= 0) {
+        close(listenFd_);
+        unlink(config_.socketPath.c_str());
+    }
+    if(fileFd_ >= 0) {
+        close(fileFd_);
+    }
+    close(stopFd_);
+}
+
+void MetricsExporter::Start() {
+    thread_ = std::thread{&MetricsExporter::Serve, this};
+}
+
+void MetricsExporter::Listen() {
+    sockaddr_un address{};
+    address.sun_family = AF_UNIX;
+    const string socketPath = config_.socketPath.string();
+    if(socketPath.size() >= sizeof(address.sun_path)) {
+        throw runtime_error{"Socket path too long: " + socketPath};
+    }
+    memcpy(address.sun_path, socketPath.c_str(), socketPath.size() + 1);
+    // Left over by a previous run that didn't shut down
+    unlink(address.sun_path);
+    listenFd_ = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if(listenFd_ < 0 || bind(listenFd_, reinterpret_cast<const sockaddr*>(&address), sizeof(address)) < 0
+       || listen(listenFd_, 4) < 0) {
+        const string error = strerror(errno);
+        if(listenFd_ >= 0) {
+            close(listenFd_);
+            listenFd_ = -1;
+        }
+        throw runtime_error{"Couldn't listen on " + socketPath + ": " + error};
+    }
+}
+
+void MetricsExporter::OpenFile() {
+    std::error_code error;
+    std::filesystem::create_directories(config_.filePath.parent_path(), error);
+    fileFd_ = open(config_.filePath.c_str(), O_WRONLY | O_CREAT | O_CLOEXEC, 0644);
+    if(fileFd_ < 0) {
+        throw runtime_error{"Couldn't open " + config_.filePath.string() + ": " + strerror(errno)};
+    }
+}
+
+// A connection gets the text and is closed, like a plain HTTP-less scrape
+void MetricsExporter::Serve() {
+    using clock = std::chrono::steady_clock;
+    const bool writeFile = fileFd_ >= 0;
+    auto nextWrite = clock::now();
+    while(true) {
+        if(writeFile && clock::now() >= nextWrite) {
+            WriteFile();
+            nextWrite = clock::now() + config_.fileInterval;
+        }
+        pollfd fds[] = {
+            { stopFd_, POLLIN, 0 },
+            { listenFd_, POLLIN, 0 },
+        };
+        const int timeout = writeFile ? int(std::chrono::duration_cast<std::chrono::milliseconds>(
+                                                 std::max(nextWrite - clock::now(), clock::duration{})).count()) : -1;
+        if(poll(fds, listenFd_ >= 0 ? 2 : 1, timeout) < 0 && errno != EINTR) {
+            std::cerr << "MetricsExporter -> poll failed  " << strerror(errno) << std::endl;
+            return;
+        }
+        if(fds[0].revents & POLLIN) {
+            return;
+        }
+        if(listenFd_ < 0 || !(fds[1].revents & POLLIN)) {
+            continue;
+        }
+        const int client = accept4(listenFd_, nullptr, nullptr, SOCK_CLOEXEC);
+        if(client < 0) {
+            continue;
+        }
+        setsockopt(client, SOL_SOCKET, SO_SNDTIMEO, &SEND_TIMEOUT, sizeof(SEND_TIMEOUT));
+        const string text = registry_.Format();
+        for(size_t sent = 0; sent < text.size(); ) {
+            const ssize_t result = send(client, text.data() + sent, text.size() - sent, MSG_NOSIGNAL);
+            if(result <= 0) {
+                break;
+            }
+            sent += size_t(result);
+        }
+        close(client);
+    }
+}
+
+// Rewritten in place, the directory may not be writable once the display dropped the root privileges.
+// The text goes in one write before the old tail is cut, a collector reading just then sees a mix
+void MetricsExporter::WriteFile() {
+    const string text = registry_.Format();
+    const bool written = pwrite(fileFd_, text.data(), text.size(), 0) == ssize_t(text.size())
+                         && !ftruncate(fileFd_, off_t(text.size()));
+    if(!written && !fileFailed_) {
+        std::cerr << "MetricsExporter -> Couldn't write " << config_.filePath << "  " << strerror(errno)
+                  << ", not logged again until a write succeeds" << std::endl;
+    }
+    fileFailed_ = !written;
+}
+
+MetricsExporter::runtime_error::runtime_error(const string& msg) : std::runtime_error{"MetricsExporter -> " + msg}
+{ }
+
+std::unique_ptr<MetricsExporter> CreateMetricsExporter(const Options& options, const MetricsRegistry& registry)
+{
+    OptionalNode optionalNode = options.GetNode("metrics");
+    if(!optionalNode) {
+        return nullptr;
+    }
+    const YAML::Node node = *optionalNode;
+    MetricsExporter::Config config;
+    try {
+        if(node["socket"]) {
+            config.socketPath = options.GetExecDir() / node["socket"].as<string>();
+        }
+        if(node["file"]) {
+            config.filePath = options.GetExecDir() / node["file"].as<string>();
+        }
+        config.fileInterval = std::chrono::seconds{std::max(node["interval"].as<int>(15), 1)};
+    } catch(const YAML::BadConversion&) {
+        throw std::invalid_argument("MetricsExporter -> Reading metrics failed");
+    }
+    return std::make_unique<MetricsExporter>(registry, config);
+}
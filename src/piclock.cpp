@@ -21,9 +21,23 @@
  */
 
 #include "common.h"
+#include "ambient.h"
 #include "clock_impl.h"
+#include "configwatcher.h"
 #include "sensors.h"
+#include "graph.h"
+#include "display.h"
+#include "frameexport.h"
+#include "metrics.h"
+#include "pushwidget.h"
+#include "reactor.h"
+#include "recorder.h"
+#include "startup.h"
+#include "ticker.h"
+#include "warmcache.h"
 
+#include <future>
+#include <pthread.h>
 #include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -31,54 +45,290 @@
 #include <time.h>
 #include <unistd.h>
 
-using rgb_matrix::FrameCanvas;
-using rgb_matrix::RGBMatrix;
-
-static volatile bool interrupt_received = false;
-static void InterruptHandler(int /*signo*/)
-{
-    interrupt_received = true;
-}
-
 using namespace std;
 using ms = chrono::milliseconds;
-int main(int /*argc*/, char* argv[])
+// The widgets and the frame loop throw std::system_error if they can't get their fds
+int main(int /*argc*/, char* argv[]) try
 {
-    signal(SIGTERM, InterruptHandler);
-    signal(SIGINT, InterruptHandler);
+    // Before any thread is created, they all inherit the mask and the signals go to the reactor only
+    Reactor::BlockSignals({ SIGINT, SIGTERM });
 
-    Options opts{argv[0]};
-    MainWidget mainWidget;
-    unique_ptr<RGBMatrix> matrix;
+    StartupProfile profile;
+    Options opts = [&profile, argv] {
+        StartupProfile::Phase phase{profile, "config"};
+        return Options{argv[0]};
+    }();
+    // Starts cold without the cache if it fails
+    try {
+        StartupProfile::Phase phase{profile, "cache"};
+        opts.SetCache(CreateWarmCache(opts));
+    } catch (const std::exception& e) {
+        std::cerr << e.what() << endl;
+    }
+    const auto matrixOptions = opts.GetMatrixOptions();
+    if(!matrixOptions) {
+        std::cerr << "Matrix configuration is invalid" << endl;
+        return 1;
+    }
+    // The clock and the hub are always there, the optional widgets are added at run time
+    StaticMainWidget<SensorHub, Clock> mainWidget;
+    DisplayPtr display;
+    MetricsRegistry metrics;
+    Clock* clock;
+    SensorHub* sensorHub;
+    GraphWidget* graph = nullptr;
+    TickerWidget* ticker = nullptr;
+    PushWidget* push = nullptr;
+    std::unique_ptr<FrameRecorder> recorder;
+    std::unique_ptr<FrameExport> frameExport;
+    std::unique_ptr<MetricsExporter> exporter;
+    // Declared after the widgets its handlers reach, it stops before they go
+    Reactor reactor;
+    std::atomic<bool> interruptReceived{};
     try {
-        WidgetPtr clock = std::make_unique<Clock>(opts, mainWidget);
-        WidgetPtr hub = std::make_unique<SensorHub>(opts, mainWidget);
+        reactor.AddSignals({ SIGINT, SIGTERM }, [&interruptReceived, &mainWidget](int) {
+            interruptReceived = true;
+            mainWidget.RequestUpdate();
+        });
+        reactor.Start();
+        // The clock loads its font while the hub looks for the sensors
+        auto clockFuture = std::async(std::launch::async, [&profile, &mainWidget, options = opts.Clone()]() -> Clock& {
+            StartupProfile::Phase phase{profile, "clock"};
+            return mainWidget.Emplace<Clock>(options, mainWidget);
+        });
+        {
+            StartupProfile::Phase phase{profile, "sensors"};
+            sensorHub = &mainWidget.Emplace<SensorHub>(opts, mainWidget);
+            sensorHub->Start(reactor);
+        }
+        // Optional, draws the history of the hub sensors
+        std::unique_ptr<GraphWidget> graphWidget;
+        if(opts.GetNode("graph")) {
+            StartupProfile::Phase phase{profile, "graph"};
+            graphWidget = std::make_unique<GraphWidget>(opts, mainWidget, *sensorHub);
+        }
+        // Optional, scrolls a line of text
+        std::unique_ptr<TickerWidget> tickerWidget;
+        if(opts.GetNode("ticker")) {
+            StartupProfile::Phase phase{profile, "ticker"};
+            tickerWidget = std::make_unique<TickerWidget>(opts, mainWidget);
+            tickerWidget->GetFrameClock().RegisterMetrics(metrics, "ticker");
+        }
+        // Optional, shows what other programs push through a socket. Runs without it if it fails
+        std::unique_ptr<PushWidget> pushWidget;
+        if(opts.GetNode("push")) {
+            StartupProfile::Phase phase{profile, "push"};
+            try {
+                pushWidget = std::make_unique<PushWidget>(opts, mainWidget);
+            } catch (const std::exception& e) {
+                std::cerr << e.what() << endl;
+            }
+        }
+        clock = &clockFuture.get();
+        sensorHub->RegisterMetrics(metrics);
+        clock->GetFrameClock().RegisterMetrics(metrics, "clock");
+        graph = graphWidget.get();
+        ticker = tickerWidget.get();
+        push = pushWidget.get();
 
-        mainWidget.AddWidgets(hub, clock);
+        if(graphWidget) {
+            WidgetPtr graphPtr = std::move(graphWidget);
+            mainWidget.AddWidget(graphPtr);
+        }
+        if(tickerWidget) {
+            WidgetPtr tickerPtr = std::move(tickerWidget);
+            mainWidget.AddWidget(tickerPtr);
+        }
+        // Served once the main widget owns it, which outlives the reactor
+        if(pushWidget) {
+            WidgetPtr pushPtr = std::move(pushWidget);
+            mainWidget.AddWidget(pushPtr);
+            try {
+                push->Start(reactor);
+            } catch (const std::exception& e) {
+                std::cerr << e.what() << endl;
+            }
+        }
 
-        if(auto matrixOpts = opts.GetMatrixOptions(); matrixOpts) {
-            auto ptr = rgb_matrix::CreateMatrixFromOptions(*opts.GetMatrixOptions(), *opts.GetRuntimeOptions());
-            matrix.reset(ptr);
+        // Runs without the recording if it fails
+        try {
+            StartupProfile::Phase phase{profile, "recorder"};
+            recorder = CreateFrameRecorder(opts, matrixOptions->cols * matrixOptions->chain_length,
+                                           matrixOptions->rows * matrixOptions->parallel);
+        } catch (const std::exception& e) {
+            std::cerr << e.what() << endl;
+        }
+        // Runs without the export if it fails
+        try {
+            StartupProfile::Phase phase{profile, "export"};
+            frameExport = CreateFrameExport(opts, matrixOptions->cols * matrixOptions->chain_length,
+                                            matrixOptions->rows * matrixOptions->parallel);
+        } catch (const std::exception& e) {
+            std::cerr << e.what() << endl;
         }
-        if(!matrix) {
-            std::cerr << "The matrix creation failed";
-            return 1;
+
+        // Runs without the exporter if it fails, the clock matters more. Its thread is started later
+        try {
+            StartupProfile::Phase phase{profile, "metrics"};
+            exporter = CreateMetricsExporter(opts, metrics);
+        } catch (const std::exception& e) {
+            std::cerr << e.what() << endl;
         }
-    } catch (const std::invalid_argument& e) {
+
+        // The matrix drops the root privileges, so it comes after everything that opens files. The
+        // threads appearing meanwhile are taken for its refresh threads: the clock load is joined
+        // above, the pool, the reactor and the recorder started theirs when created, and nothing
+        // that starts threads may come before this point unless it is done with it by then
+        StartupProfile::Phase phase{profile, "display"};
+        display = CreateDisplay(opts, matrixOptions);
+    } catch (const std::exception& e) {
         std::cerr << e.what() << endl;
         return 1;
     }
 
-    FrameCanvas* offscreen = matrix->CreateFrameCanvas();
+    mainWidget.RegisterMetrics(metrics);
+    reactor.RegisterMetrics(metrics);
+    metrics.AddHistogram("piclock_vsync_wait_seconds", "Time the frame loop waits for the vertical sync", {},
+                         display->GetVSyncWait());
+    Histogram& updateLatency = metrics.AddHistogram("piclock_update_latency_seconds",
+                                                    "From an update request or deadline to the frame reaching the panel");
+    std::atomic<uint64_t>& frames = metrics.AddCounter("piclock_frames_total", "Frames presented");
+    IdleFilter idle;
+    std::atomic<uint64_t>& wakeups = metrics.AddCounter("piclock_wakeups_total", "Times the frame loop woke up");
+    metrics.AddCounter("piclock_frames_skipped_total", "Frames held back for being identical to the shown one", {},
+                       [&idle] { return double(idle.GetSkipped()); });
+    if(clockid_t frameCpuClock; !pthread_getcpuclockid(pthread_self(), &frameCpuClock)) {
+        metrics.AddCounter("piclock_frame_thread_cpu_seconds_total", "CPU time of the frame loop thread", {},
+                           [frameCpuClock] {
+            timespec time;
+            clock_gettime(frameCpuClock, &time);
+            return double(time.tv_sec) + double(time.tv_nsec) * 1e-9;
+        });
+    }
+    if(recorder) {
+        recorder->RegisterMetrics(metrics);
+    }
+    if(frameExport) {
+        frameExport->RegisterMetrics(metrics);
+    }
+    if(push) {
+        push->RegisterMetrics(metrics);
+    }
+    RateMeter frameRate;
+    metrics.AddGauge("piclock_fps", "Frames presented per second", {}, [&frameRate] { return frameRate.GetRate(); });
+    // Brightness and PWM depth follow the light sensor from its next reading on
+    std::unique_ptr<AmbientLight> ambient;
+    try {
+        ambient = CreateAmbientLight(opts, *sensorHub, *display, matrixOptions->brightness);
+        if(ambient) {
+            ambient->RegisterMetrics(metrics);
+        }
+    } catch (const std::exception& e) {
+        std::cerr << e.what() << endl;
+    }
+    if(exporter) {
+        exporter->Start();
+    }
+
+    // Widgets take the new settings in between frames, nothing stops drawing meanwhile
+    std::unique_ptr<ConfigWatcher> watcher;
+    try {
+        StartupProfile::Phase phase{profile, "watcher"};
+        watcher = std::make_unique<ConfigWatcher>(opts);
+        watcher->Subscribe("clock", [clock](const Options& options) { clock->Reconfigure(options); });
+        watcher->Subscribe("sensors", [sensorHub](const Options& options) { sensorHub->Reconfigure(options); });
+        watcher->Subscribe("graph", [graph](const Options& options) {
+            if(!graph || !options.GetNode("graph")) {
+                std::cerr << "Adding or removing the graph applies after a restart" << endl;
+                return;
+            }
+            graph->Reconfigure(options);
+        });
+        watcher->Subscribe("ticker", [ticker](const Options& options) {
+            if(!ticker || !options.GetNode("ticker")) {
+                std::cerr << "Adding or removing the ticker applies after a restart" << endl;
+                return;
+            }
+            ticker->Reconfigure(options);
+        });
+        watcher->Subscribe("matrix", [&display, &mainWidget, ambientLight = ambient.get(),
+                                      applied = matrixOptions](const Options& options) mutable {
+            const auto matrixOptions = options.GetMatrixOptions();
+            if(!matrixOptions || !applied) {
+                std::cerr << "Matrix configuration is invalid, kept the current one" << endl;
+                return;
+            }
+            if(matrixOptions->rows != applied->rows || matrixOptions->cols != applied->cols
+               || matrixOptions->chain_length != applied->chain_length) {
+                std::cerr << "Matrix geometry changed, it applies after a restart" << endl;
+            }
+            if(matrixOptions->brightness != applied->brightness) {
+                if(ambientLight) {
+                    std::cerr << "The brightness follows the ambient light" << endl;
+                }
+                else if(display->SetBrightness(matrixOptions->brightness)) {
+                    applied->brightness = matrixOptions->brightness;
+                    // The idle loop would keep it until the next change otherwise
+                    mainWidget.RequestUpdate();
+                }
+                else {
+                    std::cerr << "The display has no brightness to change" << endl;
+                }
+            }
+        });
+        for(const char* node : { "ambient", "export", "headless", "metrics", "push", "record", "startup" }) {
+            watcher->Subscribe(node, [node](const Options&) {
+                std::cerr << "Changes to " << node << " apply after a restart" << endl;
+            });
+        }
+        watcher->Start();
+    } catch (const std::exception& e) {
+        std::cerr << e.what() << endl;
+    }
+
+    // Keeps the previous frame, widgets repaint only what they changed
+    SoftCanvas frame{display->width(), display->height()};
 
-    while(!interrupt_received) {
-        offscreen->Fill(0, 0, 0);
-        mainWidget.Draw(offscreen);
-        // Atomic swap with double buffer
-        offscreen = matrix->SwapOnVSync(offscreen);
+    const auto firstFrameStart = StartupProfile::clock::now();
+    while(!interruptReceived && display->IsRunning()) {
+        mainWidget.Draw(&frame);
+        wakeups.fetch_add(1, std::memory_order_relaxed);
+        if(ambient) {
+            ambient->Poll();
+        }
+        // Nothing new to show, back to sleep until the next update or deadline
+        if(!idle.IsChanged(frame, mainWidget.GetDamage()) && !display->HasPendingChanges()) {
+            continue;
+        }
+        display->Present(frame, mainWidget.GetDamage());
+        if(frameExport) {
+            frameExport->Publish(frame);
+        }
+        if(recorder) {
+            recorder->Record(frame);
+        }
+        if(!frames.load(std::memory_order_relaxed)) {
+            profile.Add("first frame", firstFrameStart, StartupProfile::clock::now());
+            profile.Finish(std::cout);
+            // Off the way to the first frame, the next start finds what this one parsed
+            if(WarmCache* cache = opts.GetCache(); cache) {
+                cache->Save();
+            }
+        }
+        if(const int64_t ready = mainWidget.GetReadyTime(); ready) {
+            const auto now = chrono::steady_clock::now().time_since_epoch();
+            updateLatency.Observe(chrono::duration_cast<chrono::nanoseconds>(now).count() - ready);
+        }
+        frames.fetch_add(1, std::memory_order_relaxed);
+        frameRate.Tick();
     }
-    // Finished. Shut down the RGB matrix.
-    matrix->Clear();
+    // Finished. No more sensor reads, then shut down the display. The other threads are joined as
+    // their owners go
+    reactor.Stop();
+    display->Clear();
     write(STDOUT_FILENO, "\n", 1);  // Create a fresh new line after ^C on screen
     return 0;
+} catch (const std::exception& e) {
+    std::cerr << e.what() << endl;
+    return 1;
 }
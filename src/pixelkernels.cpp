@@ -0,0 +1,496 @@
+/*
+ * Copyright (c) 2019 Dmytro Shestakov
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "pixelkernels.h"
+
+#if defined(__ARM_NEON)
+#include <arm_neon.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+namespace {
+
+    constexpr size_t BYTES_PER_PIXEL = 3;
+
+    // Exact round(value / 255) for value <= 255 * 255
+    inline uint8_t Div255(unsigned value)
+    {
+        value += 128;
+        return uint8_t((value + (value >> 8)) >> 8);
+    }
+
+    // Pixel k of dst takes mask bit first + k, glyph rows are sparse so only the set bits are visited
+    void ExpandMaskFrom(uint8_t* dst, const uint32_t* mask, size_t first, size_t count,
+                        uint8_t red, uint8_t green, uint8_t blue)
+    {
+        const size_t end = first + count;
+        for(size_t base = first / 32 * 32; base < end; base += 32) {
+            uint32_t bits = mask[base / 32];
+            if(base < first) {
+                bits &= 0xFFFFFFFFu >> (first - base);
+            }
+            if(end < base + 32) {
+                bits &= ~(0xFFFFFFFFu >> (end - base));
+            }
+            while(bits) {
+                const int column = __builtin_clz(bits);
+                bits &= ~(0x80000000u >> column);
+                uint8_t* pixel = dst + (base + size_t(column) - first) * BYTES_PER_PIXEL;
+                pixel[0] = red;
+                pixel[1] = green;
+                pixel[2] = blue;
+            }
+        }
+    }
+
+}
+
+namespace pixel::scalar {
+
+    void Fill(uint8_t* dst, size_t count, uint8_t red, uint8_t green, uint8_t blue)
+    {
+        for(size_t i = 0; i < count; ++i, dst += BYTES_PER_PIXEL) {
+            dst[0] = red;
+            dst[1] = green;
+            dst[2] = blue;
+        }
+    }
+
+    void ExpandMask(uint8_t* dst, const uint32_t* mask, size_t count, uint8_t red, uint8_t green, uint8_t blue)
+    {
+        ExpandMaskFrom(dst, mask, 0, count, red, green, blue);
+    }
+
+    void Composite(uint8_t* dst, const uint8_t* src, size_t count)
+    {
+        for(size_t i = 0; i < count; ++i, dst += BYTES_PER_PIXEL, src += BYTES_PER_PIXEL) {
+            if(src[0] | src[1] | src[2]) {
+                dst[0] = src[0];
+                dst[1] = src[1];
+                dst[2] = src[2];
+            }
+        }
+    }
+
+    void Blend(uint8_t* dst, const uint8_t* src, size_t count, uint8_t alpha)
+    {
+        const unsigned inverse = 255u - alpha;
+        for(size_t i = 0; i < count; ++i, dst += BYTES_PER_PIXEL, src += BYTES_PER_PIXEL) {
+            if(src[0] | src[1] | src[2]) {
+                for(size_t c = 0; c < BYTES_PER_PIXEL; ++c) {
+                    dst[c] = Div255(src[c] * unsigned{alpha} + dst[c] * inverse);
+                }
+            }
+        }
+    }
+
+    void Scale(uint8_t* dst, size_t count, uint8_t red, uint8_t green, uint8_t blue)
+    {
+        for(size_t i = 0; i < count; ++i, dst += BYTES_PER_PIXEL) {
+            dst[0] = Div255(dst[0] * unsigned{red});
+            dst[1] = Div255(dst[1] * unsigned{green});
+            dst[2] = Div255(dst[2] * unsigned{blue});
+        }
+    }
+
+}
+
+#if defined(__ARM_NEON)
+
+// vld3/vst3 deinterleave 16 pixels into one register per channel
+namespace {
+
+    constexpr size_t BLOCK = 16;
+
+    inline uint8x8_t Div255(uint16x8_t value)
+    {
+        value = vaddq_u16(value, vdupq_n_u16(128));
+        return vshrn_n_u16(vsraq_n_u16(value, value, 8), 8);
+    }
+
+    inline uint8x16_t Mix(uint8x16_t src, uint8x16_t dst, uint8x8_t alpha, uint8x8_t inverse)
+    {
+        const uint16x8_t low = vmlal_u8(vmull_u8(vget_low_u8(src), alpha), vget_low_u8(dst), inverse);
+        const uint16x8_t high = vmlal_u8(vmull_u8(vget_high_u8(src), alpha), vget_high_u8(dst), inverse);
+        return vcombine_u8(Div255(low), Div255(high));
+    }
+
+    inline uint8x16_t Mul(uint8x16_t value, uint8x8_t scale)
+    {
+        return vcombine_u8(Div255(vmull_u8(vget_low_u8(value), scale)), Div255(vmull_u8(vget_high_u8(value), scale)));
+    }
+
+    inline uint8x16_t OpaqueMask(const uint8x16x3_t& src)
+    {
+        const uint8x16_t any = vorrq_u8(vorrq_u8(src.val[0], src.val[1]), src.val[2]);
+        return vtstq_u8(any, any);
+    }
+
+}
+
+namespace pixel {
+
+    void Fill(uint8_t* dst, size_t count, uint8_t red, uint8_t green, uint8_t blue)
+    {
+        const uint8x16x3_t color{{ vdupq_n_u8(red), vdupq_n_u8(green), vdupq_n_u8(blue) }};
+        size_t i = 0;
+        for(; i + BLOCK <= count; i += BLOCK) {
+            vst3q_u8(dst + i * BYTES_PER_PIXEL, color);
+        }
+        scalar::Fill(dst + i * BYTES_PER_PIXEL, count - i, red, green, blue);
+    }
+
+    void ExpandMask(uint8_t* dst, const uint32_t* mask, size_t count, uint8_t red, uint8_t green, uint8_t blue)
+    {
+        static const uint8_t bits[BLOCK] = { 128, 64, 32, 16, 8, 4, 2, 1, 128, 64, 32, 16, 8, 4, 2, 1 };
+        const uint8x16_t select = vld1q_u8(bits);
+        const uint8x16_t color[] = { vdupq_n_u8(red), vdupq_n_u8(green), vdupq_n_u8(blue) };
+        size_t i = 0;
+        for(; i + BLOCK <= count; i += BLOCK) {
+            const uint32_t word = mask[i / 32];
+            const uint32_t chunk = i % 32 ? word & 0xFFFF : word >> 16;
+            if(!chunk) {
+                continue;
+            }
+            const uint8x16_t set = vtstq_u8(vcombine_u8(vdup_n_u8(uint8_t(chunk >> 8)), vdup_n_u8(uint8_t(chunk))), select);
+            uint8_t* block = dst + i * BYTES_PER_PIXEL;
+            uint8x16x3_t pixels = vld3q_u8(block);
+            for(int c = 0; c < 3; ++c) {
+                pixels.val[c] = vbslq_u8(set, color[c], pixels.val[c]);
+            }
+            vst3q_u8(block, pixels);
+        }
+        ExpandMaskFrom(dst + i * BYTES_PER_PIXEL, mask, i, count - i, red, green, blue);
+    }
+
+    void Composite(uint8_t* dst, const uint8_t* src, size_t count)
+    {
+        size_t i = 0;
+        for(; i + BLOCK <= count; i += BLOCK) {
+            const uint8x16x3_t source = vld3q_u8(src + i * BYTES_PER_PIXEL);
+            const uint8x16_t opaque = OpaqueMask(source);
+            uint8x16x3_t pixels = vld3q_u8(dst + i * BYTES_PER_PIXEL);
+            for(int c = 0; c < 3; ++c) {
+                pixels.val[c] = vbslq_u8(opaque, source.val[c], pixels.val[c]);
+            }
+            vst3q_u8(dst + i * BYTES_PER_PIXEL, pixels);
+        }
+        scalar::Composite(dst + i * BYTES_PER_PIXEL, src + i * BYTES_PER_PIXEL, count - i);
+    }
+
+    void Blend(uint8_t* dst, const uint8_t* src, size_t count, uint8_t alpha)
+    {
+        const uint8x8_t alphas = vdup_n_u8(alpha);
+        const uint8x8_t inverse = vdup_n_u8(uint8_t(255 - alpha));
+        size_t i = 0;
+        for(; i + BLOCK <= count; i += BLOCK) {
+            const uint8x16x3_t source = vld3q_u8(src + i * BYTES_PER_PIXEL);
+            const uint8x16_t opaque = OpaqueMask(source);
+            uint8x16x3_t pixels = vld3q_u8(dst + i * BYTES_PER_PIXEL);
+            for(int c = 0; c < 3; ++c) {
+                pixels.val[c] = vbslq_u8(opaque, Mix(source.val[c], pixels.val[c], alphas, inverse), pixels.val[c]);
+            }
+            vst3q_u8(dst + i * BYTES_PER_PIXEL, pixels);
+        }
+        scalar::Blend(dst + i * BYTES_PER_PIXEL, src + i * BYTES_PER_PIXEL, count - i, alpha);
+    }
+
+    void Scale(uint8_t* dst, size_t count, uint8_t red, uint8_t green, uint8_t blue)
+    {
+        const uint8x8_t scale[] = { vdup_n_u8(red), vdup_n_u8(green), vdup_n_u8(blue) };
+        size_t i = 0;
+        for(; i + BLOCK <= count; i += BLOCK) {
+            uint8x16x3_t pixels = vld3q_u8(dst + i * BYTES_PER_PIXEL);
+            for(int c = 0; c < 3; ++c) {
+                pixels.val[c] = Mul(pixels.val[c], scale[c]);
+            }
+            vst3q_u8(dst + i * BYTES_PER_PIXEL, pixels);
+        }
+        scalar::Scale(dst + i * BYTES_PER_PIXEL, count - i, red, green, blue);
+    }
+
+    const char* GetIsa()
+    {
+        return "neon";
+    }
+
+}
+
+#elif defined(__SSE2__)
+
+// Blocks of 16 pixels in three 16 byte vectors, byte b of vector v belongs to pixel (16 * v + b) / 3
+namespace {
+
+    constexpr size_t BLOCK = 16;
+    constexpr int VECTORS = 3;
+
+    struct BlockTables {
+        uint8_t starts[VECTORS][16];    // 0xFF on the first byte of a pixel
+        uint8_t channel[VECTORS][16];
+        uint8_t maskHigh[VECTORS][16];  // bit of the pixel in the high byte of a 16 bit mask chunk
+        uint8_t maskLow[VECTORS][16];
+    };
+
+    constexpr BlockTables MakeBlockTables()
+    {
+        BlockTables tables{};
+        for(int v = 0; v < VECTORS; ++v) {
+            for(int b = 0; b < 16; ++b) {
+                const int byte = 16 * v + b;
+                const int bit = 15 - byte / 3;
+                tables.starts[v][b] = byte % 3 ? 0 : 0xFF;
+                tables.channel[v][b] = uint8_t(byte % 3);
+                tables.maskHigh[v][b] = bit >= 8 ? uint8_t(1 << (bit - 8)) : 0;
+                tables.maskLow[v][b] = bit < 8 ? uint8_t(1 << bit) : 0;
+            }
+        }
+        return tables;
+    }
+
+    constexpr BlockTables TABLES = MakeBlockTables();
+
+    inline __m128i Load(const uint8_t* data)
+    {
+        return _mm_loadu_si128(reinterpret_cast<const __m128i*>(data));
+    }
+
+    inline void Store(uint8_t* data, __m128i value)
+    {
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(data), value);
+    }
+
+    inline __m128i Select(__m128i mask, __m128i a, __m128i b)
+    {
+        return _mm_or_si128(_mm_and_si128(mask, a), _mm_andnot_si128(mask, b));
+    }
+
+    // Per channel values laid out like the pixels of a block
+    void Pattern(__m128i pattern[VECTORS], uint8_t red, uint8_t green, uint8_t blue)
+    {
+        const uint8_t values[] = { red, green, blue };
+        for(int v = 0; v < VECTORS; ++v) {
+            uint8_t bytes[16];
+            for(int b = 0; b < 16; ++b) {
+                bytes[b] = values[TABLES.channel[v][b]];
+            }
+            pattern[v] = Load(bytes);
+        }
+    }
+
+    inline __m128i Div255(__m128i value)
+    {
+        value = _mm_add_epi16(value, _mm_set1_epi16(128));
+        return _mm_srli_epi16(_mm_add_epi16(value, _mm_srli_epi16(value, 8)), 8);
+    }
+
+    inline __m128i Mix(__m128i src, __m128i dst, __m128i alpha, __m128i inverse)
+    {
+        const __m128i zero = _mm_setzero_si128();
+        const __m128i low = _mm_add_epi16(_mm_mullo_epi16(_mm_unpacklo_epi8(src, zero), alpha),
+                                          _mm_mullo_epi16(_mm_unpacklo_epi8(dst, zero), inverse));
+        const __m128i high = _mm_add_epi16(_mm_mullo_epi16(_mm_unpackhi_epi8(src, zero), alpha),
+                                           _mm_mullo_epi16(_mm_unpackhi_epi8(dst, zero), inverse));
+        return _mm_packus_epi16(Div255(low), Div255(high));
+    }
+
+    // 0xFF on every byte of the non-black pixels
+    void OpaqueMask(const __m128i src[VECTORS], __m128i mask[VECTORS])
+    {
+        const __m128i zero = _mm_setzero_si128();
+        __m128i nonZero[VECTORS];
+        for(int v = 0; v < VECTORS; ++v) {
+            nonZero[v] = _mm_xor_si128(_mm_cmpeq_epi8(src[v], zero), _mm_set1_epi8(-1));
+        }
+        // Each byte ORed with the next two, kept on the first byte of a pixel only
+        __m128i any[VECTORS];
+        for(int v = 0; v < VECTORS; ++v) {
+            const __m128i next = v + 1 < VECTORS ? nonZero[v + 1] : zero;
+            const __m128i second = _mm_or_si128(_mm_srli_si128(nonZero[v], 1), _mm_slli_si128(next, 15));
+            const __m128i third = _mm_or_si128(_mm_srli_si128(nonZero[v], 2), _mm_slli_si128(next, 14));
+            any[v] = _mm_and_si128(_mm_or_si128(nonZero[v], _mm_or_si128(second, third)), Load(TABLES.starts[v]));
+        }
+        // Spread back over the other two bytes
+        for(int v = 0; v < VECTORS; ++v) {
+            const __m128i previous = v > 0 ? any[v - 1] : zero;
+            const __m128i second = _mm_or_si128(_mm_slli_si128(any[v], 1), _mm_srli_si128(previous, 15));
+            const __m128i third = _mm_or_si128(_mm_slli_si128(any[v], 2), _mm_srli_si128(previous, 14));
+            mask[v] = _mm_or_si128(any[v], _mm_or_si128(second, third));
+        }
+    }
+
+}
+
+namespace pixel {
+
+    void Fill(uint8_t* dst, size_t count, uint8_t red, uint8_t green, uint8_t blue)
+    {
+        size_t i = 0;
+        if(count >= BLOCK) {
+            __m128i color[VECTORS];
+            Pattern(color, red, green, blue);
+            for(; i + BLOCK <= count; i += BLOCK) {
+                uint8_t* block = dst + i * BYTES_PER_PIXEL;
+                for(int v = 0; v < VECTORS; ++v) {
+                    Store(block + 16 * v, color[v]);
+                }
+            }
+        }
+        scalar::Fill(dst + i * BYTES_PER_PIXEL, count - i, red, green, blue);
+    }
+
+    void ExpandMask(uint8_t* dst, const uint32_t* mask, size_t count, uint8_t red, uint8_t green, uint8_t blue)
+    {
+        size_t i = 0;
+        if(count >= BLOCK) {
+            __m128i color[VECTORS];
+            Pattern(color, red, green, blue);
+            for(; i + BLOCK <= count; i += BLOCK) {
+                const uint32_t word = mask[i / 32];
+                const uint32_t chunk = i % 32 ? word & 0xFFFF : word >> 16;
+                if(!chunk) {
+                    continue;
+                }
+                const __m128i high = _mm_set1_epi8(char(chunk >> 8));
+                const __m128i low = _mm_set1_epi8(char(chunk));
+                uint8_t* block = dst + i * BYTES_PER_PIXEL;
+                for(int v = 0; v < VECTORS; ++v) {
+                    const __m128i highBits = Load(TABLES.maskHigh[v]);
+                    const __m128i lowBits = Load(TABLES.maskLow[v]);
+                    const __m128i bits = _mm_or_si128(_mm_and_si128(high, highBits), _mm_and_si128(low, lowBits));
+                    const __m128i set = _mm_cmpeq_epi8(bits, _mm_or_si128(highBits, lowBits));
+                    Store(block + 16 * v, Select(set, color[v], Load(block + 16 * v)));
+                }
+            }
+        }
+        ExpandMaskFrom(dst + i * BYTES_PER_PIXEL, mask, i, count - i, red, green, blue);
+    }
+
+    void Composite(uint8_t* dst, const uint8_t* src, size_t count)
+    {
+        size_t i = 0;
+        for(; i + BLOCK <= count; i += BLOCK) {
+            uint8_t* block = dst + i * BYTES_PER_PIXEL;
+            __m128i source[VECTORS];
+            __m128i opaque[VECTORS];
+            for(int v = 0; v < VECTORS; ++v) {
+                source[v] = Load(src + i * BYTES_PER_PIXEL + 16 * v);
+            }
+            OpaqueMask(source, opaque);
+            for(int v = 0; v < VECTORS; ++v) {
+                Store(block + 16 * v, Select(opaque[v], source[v], Load(block + 16 * v)));
+            }
+        }
+        scalar::Composite(dst + i * BYTES_PER_PIXEL, src + i * BYTES_PER_PIXEL, count - i);
+    }
+
+    void Blend(uint8_t* dst, const uint8_t* src, size_t count, uint8_t alpha)
+    {
+        const __m128i alphas = _mm_set1_epi16(alpha);
+        const __m128i inverse = _mm_set1_epi16(short(255 - alpha));
+        size_t i = 0;
+        for(; i + BLOCK <= count; i += BLOCK) {
+            uint8_t* block = dst + i * BYTES_PER_PIXEL;
+            __m128i source[VECTORS];
+            __m128i opaque[VECTORS];
+            for(int v = 0; v < VECTORS; ++v) {
+                source[v] = Load(src + i * BYTES_PER_PIXEL + 16 * v);
+            }
+            OpaqueMask(source, opaque);
+            for(int v = 0; v < VECTORS; ++v) {
+                const __m128i pixels = Load(block + 16 * v);
+                Store(block + 16 * v, Select(opaque[v], Mix(source[v], pixels, alphas, inverse), pixels));
+            }
+        }
+        scalar::Blend(dst + i * BYTES_PER_PIXEL, src + i * BYTES_PER_PIXEL, count - i, alpha);
+    }
+
+    void Scale(uint8_t* dst, size_t count, uint8_t red, uint8_t green, uint8_t blue)
+    {
+        size_t i = 0;
+        if(count >= BLOCK) {
+            const __m128i zero = _mm_setzero_si128();
+            __m128i pattern[VECTORS];
+            __m128i scaleLow[VECTORS];
+            __m128i scaleHigh[VECTORS];
+            Pattern(pattern, red, green, blue);
+            for(int v = 0; v < VECTORS; ++v) {
+                scaleLow[v] = _mm_unpacklo_epi8(pattern[v], zero);
+                scaleHigh[v] = _mm_unpackhi_epi8(pattern[v], zero);
+            }
+            for(; i + BLOCK <= count; i += BLOCK) {
+                uint8_t* block = dst + i * BYTES_PER_PIXEL;
+                for(int v = 0; v < VECTORS; ++v) {
+                    const __m128i pixels = Load(block + 16 * v);
+                    const __m128i low = Div255(_mm_mullo_epi16(_mm_unpacklo_epi8(pixels, zero), scaleLow[v]));
+                    const __m128i high = Div255(_mm_mullo_epi16(_mm_unpackhi_epi8(pixels, zero), scaleHigh[v]));
+                    Store(block + 16 * v, _mm_packus_epi16(low, high));
+                }
+            }
+        }
+        scalar::Scale(dst + i * BYTES_PER_PIXEL, count - i, red, green, blue);
+    }
+
+    const char* GetIsa()
+    {
+        return "sse2";
+    }
+
+}
+
+#else
+
+namespace pixel {
+
+    void Fill(uint8_t* dst, size_t count, uint8_t red, uint8_t green, uint8_t blue)
+    {
+        scalar::Fill(dst, count, red, green, blue);
+    }
+
+    void ExpandMask(uint8_t* dst, const uint32_t* mask, size_t count, uint8_t red, uint8_t green, uint8_t blue)
+    {
+        scalar::ExpandMask(dst, mask, count, red, green, blue);
+    }
+
+    void Composite(uint8_t* dst, const uint8_t* src, size_t count)
+    {
+        scalar::Composite(dst, src, count);
+    }
+
+    void Blend(uint8_t* dst, const uint8_t* src, size_t count, uint8_t alpha)
+    {
+        scalar::Blend(dst, src, count, alpha);
+    }
+
+    void Scale(uint8_t* dst, size_t count, uint8_t red, uint8_t green, uint8_t blue)
+    {
+        scalar::Scale(dst, count, red, green, blue);
+    }
+
+    const char* GetIsa()
+    {
+        return "scalar";
+    }
+
+}
+
+#endif
@@ -0,0 +1,411 @@
+/*
+ * Copyright (c) 2019 Dmytro Shestakov
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "pushwidget.h"
+
+#include <fcntl.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/timerfd.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cerrno>
+#include <charconv>
+#include <cstring>
+#include <iostream>
+#include <system_error>
+
+using std::string;
+using namespace std::string_literals;
+
+namespace {
+
+    std::system_error SystemError(const string& what)
+    {
+        return std::system_error{errno, std::generic_category(), "PushWidget -> " + what};
+    }
+
+}
+
+PushWidget::invalid_argument::invalid_argument(const string& msg) : std::invalid_argument{"PushWidget -> " + msg}
+{ }
+
+PushWidget::PushWidget(const Options& options, BaseWidget& widget) : WidgetWrapper{widget}
+{
+    OptionalNode optionalNode = options.GetNode("push");
+    if(!optionalNode) {
+        throw invalid_argument{"Configuration node not found"};
+    }
+    const Node pushNode = *optionalNode;
+    try {
+        const string fontFile = pushNode["font"].as<string>("fonts/6x13B.bdf");
+        font_ = LoadFont(options, fontFile);
+        if(!font_) {
+            throw invalid_argument{"Couldn't load font "s + fontFile};
+        }
+        socketPath_ = (options.GetExecDir() / pushNode["socket"].as<string>("push.sock")).string();
+    } catch(const YAML::TypedBadConversion<string>&) {
+        throw invalid_argument{"Error reading font or socket from yaml"};
+    }
+    LoadFields(pushNode);
+    pending_.resize(fields_.size());
+    taken_.resize(fields_.size());
+    for(const Field& field : fields_) {
+        bounds_ = bounds_.Union(field.rect);
+    }
+    Listen();
+}
+
+// Fields are drawn in the order of the config, a later one covers an earlier one where they overlap
+void PushWidget::LoadFields(const Node& pushNode)
+{
+    const Node fieldsNode = pushNode["fields"];
+    if(!fieldsNode.IsMap() || !fieldsNode.size()) {
+        throw invalid_argument{"No fields"};
+    }
+    try {
+        for(const auto& item : fieldsNode) {
+            const Node node = item.second;
+            Field field;
+            field.name = item.first.as<string>();
+            if(field.name.empty() || field.name.find_first_of(" =") != string::npos) {
+                throw invalid_argument{"Field names can't have spaces or '='"};
+            }
+            const auto position = node["position"].as<PositionType>();
+            field.rect = {position[0], position[1], node["width"].as<int>(64), font_->height()};
+            if(field.rect.IsEmpty()) {
+                throw invalid_argument{"Empty area of " + field.name};
+            }
+            field.color = node["color"] ? node["color"].as<Color>() : Color{255, 255, 255};
+            field.decimals = std::clamp(node["decimals"].as<int>(1), 0, 6);
+            field.unit = node["unit"].as<string>("");
+            field.text = node["text"].as<string>("");
+            if(!field.text.empty()) {
+                field.sprite.emplace(*font_, field.text, field.color);
+            }
+            fields_.push_back(std::move(field));
+        }
+    } catch(const YAML::TypedBadConversion<string>&) {
+        throw invalid_argument{"Error reading a field name, unit or text from yaml"};
+    } catch(const YAML::TypedBadConversion<int32_t>&) {
+        throw invalid_argument{"Error reading a field position, width or decimals from yaml"};
+    } catch(const YAML::TypedBadConversion<uint32_t>&) {
+        throw invalid_argument{"Error reading a field color from yaml"};
+    }
+}
+
+// A socket left behind by a crash is replaced
+void PushWidget::Listen()
+{
+    sockaddr_un address{};
+    address.sun_family = AF_UNIX;
+    if(socketPath_.size() >= sizeof(address.sun_path)) {
+        throw invalid_argument{"Socket path too long: " + socketPath_};
+    }
+    std::copy(socketPath_.begin(), socketPath_.end(), address.sun_path);
+    retryFd_ = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if(retryFd_ < 0) {
+        throw SystemError("timerfd_create failed");
+    }
+    listenFd_ = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if(listenFd_ < 0) {
+        const auto error = SystemError("socket failed");
+        close(retryFd_);
+        throw error;
+    }
+    unlink(socketPath_.c_str());
+    if(bind(listenFd_, reinterpret_cast<const sockaddr*>(&address), sizeof(address))
+       || listen(listenFd_, int(MAX_CLIENTS))) {
+        const auto error = SystemError("Couldn't listen on " + socketPath_);
+        close(listenFd_);
+        close(retryFd_);
+        throw error;
+    }
+    spareFd_ = open("/dev/null", O_RDONLY | O_CLOEXEC);
+    std::cout << "Push socket " << socketPath_ << std::endl;
+}
+
+PushWidget::~PushWidget()
+{
+    for(const Client& client : clients_) {
+        close(client.fd);
+    }
+    close(listenFd_);
+    if(spareFd_ >= 0) {
+        close(spareFd_);
+    }
+    close(retryFd_);
+    unlink(socketPath_.c_str());
+}
+
+void PushWidget::Start(Reactor& reactor)
+{
+    reactor_ = &reactor;
+    reactor.AddFd("push", listenFd_, EPOLLIN, [this](uint32_t) { Accept(); });
+    reactor.AddFd("push retry", retryFd_, EPOLLIN, [this](uint32_t) {
+        uint64_t expirations;
+        [[maybe_unused]] auto result = read(retryFd_, &expirations, sizeof(expirations));
+        ResumeAccept();
+    });
+}
+
+// A connection that can't be taken stays queued and keeps the listener readable, so it is either
+// dropped or the listener is left alone for a while
+void PushWidget::Accept()
+{
+    while(true) {
+        const int fd = accept4(listenFd_, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if(fd < 0) {
+            const int error = errno;
+            if(error == EINTR || error == ECONNABORTED || error == EPROTO) {
+                continue;
+            }
+            if(error == EAGAIN || error == EWOULDBLOCK) {
+                return;
+            }
+            acceptErrors_.fetch_add(1, std::memory_order_relaxed);
+            // Out of fds, the spare one makes room to take the connection and close it
+            if((error == EMFILE || error == ENFILE) && spareFd_ >= 0) {
+                close(spareFd_);
+                const int dropped = accept4(listenFd_, nullptr, nullptr, SOCK_CLOEXEC);
+                if(dropped >= 0) {
+                    close(dropped);
+                    droppedClients_.fetch_add(1, std::memory_order_relaxed);
+                }
+                spareFd_ = open("/dev/null", O_RDONLY | O_CLOEXEC);
+                if(dropped >= 0 && spareFd_ >= 0) {
+                    continue;
+                }
+            }
+            std::cerr << "PushWidget -> Couldn't accept a client: " << strerror(error) << std::endl;
+            PauseAccept();
+            return;
+        }
+        if(clients_.size() >= MAX_CLIENTS) {
+            close(fd);
+            droppedClients_.fetch_add(1, std::memory_order_relaxed);
+            continue;
+        }
+        clients_.push_back({fd, {}});
+        connectedClients_.store(clients_.size(), std::memory_order_relaxed);
+        reactor_->AddFd("push client", fd, EPOLLIN, [this, fd](uint32_t) { Receive(fd); });
+    }
+}
+
+// Complete lines are parsed straight from the read buffer, only a line split between reads is copied
+void PushWidget::Receive(int fd)
+{
+    const auto client = std::find_if(clients_.begin(), clients_.end(), [fd](const Client& c) { return c.fd == fd; });
+    if(client == clients_.end()) {
+        return;
+    }
+    string& partial = client->partial;
+    char buffer[1024];
+    for(size_t budget = READ_BUDGET; budget; ) {
+        const ssize_t length = read(fd, buffer, std::min(sizeof(buffer), budget));
+        if(length < 0) {
+            if(errno == EINTR) {
+                continue;
+            }
+            if(errno != EAGAIN) {
+                Disconnect(fd, true);
+            }
+            return;
+        }
+        // A last line without a newline still counts
+        if(length == 0) {
+            if(!partial.empty()) {
+                Parse(partial);
+            }
+            Disconnect(fd, false);
+            return;
+        }
+        budget -= size_t(length);
+        const char* begin = buffer;
+        const char* end = buffer + length;
+        for(const char* newline; (newline = static_cast<const char*>(memchr(begin, '\n', size_t(end - begin)))); ) {
+            if(partial.empty()) {
+                Parse({begin, size_t(newline - begin)});
+            }
+            else {
+                partial.append(begin, newline);
+                Parse(partial);
+                partial.clear();
+            }
+            begin = newline + 1;
+        }
+        partial.append(begin, end);
+        if(partial.size() > MAX_LINE) {
+            Disconnect(fd, true);
+            return;
+        }
+    }
+}
+
+void PushWidget::Disconnect(int fd, bool dropped)
+{
+    reactor_->RemoveFd(fd);
+    close(fd);
+    clients_.erase(std::remove_if(clients_.begin(), clients_.end(), [fd](const Client& c) { return c.fd == fd; }),
+                   clients_.end());
+    connectedClients_.store(clients_.size(), std::memory_order_relaxed);
+    if(dropped) {
+        droppedClients_.fetch_add(1, std::memory_order_relaxed);
+    }
+    // The fd freed may be what the listener was waiting for
+    ResumeAccept();
+}
+
+// Watched again once a client leaves or the retry timer expires, whichever comes first
+void PushWidget::PauseAccept()
+{
+    if(acceptPaused_) {
+        return;
+    }
+    acceptPaused_ = true;
+    reactor_->RemoveFd(listenFd_);
+    itimerspec spec{};
+    spec.it_value.tv_sec = ACCEPT_RETRY.count();
+    timerfd_settime(retryFd_, 0, &spec, nullptr);
+}
+
+void PushWidget::ResumeAccept()
+{
+    if(!acceptPaused_) {
+        return;
+    }
+    acceptPaused_ = false;
+    if(spareFd_ < 0) {
+        spareFd_ = open("/dev/null", O_RDONLY | O_CLOEXEC);
+    }
+    reactor_->AddFd("push", listenFd_, EPOLLIN, [this](uint32_t) { Accept(); });
+}
+
+void PushWidget::Parse(string_view line)
+{
+    if(!line.empty() && line.back() == '\r') {
+        line.remove_suffix(1);
+    }
+    if(line.size() > MAX_LINE) {
+        rejected_.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+    const size_t separator = line.find_first_of(" =");
+    const string_view name = line.substr(0, separator);
+    const auto field = std::find_if(fields_.begin(), fields_.end(), [name](const Field& f) { return f.name == name; });
+    if(field == fields_.end()) {
+        rejected_.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+    const size_t index = size_t(field - fields_.begin());
+    if(separator == string_view::npos || line[separator] == ' ') {
+        SetField(index, string{separator == string_view::npos ? string_view{} : line.substr(separator + 1)});
+        return;
+    }
+    const string_view number = line.substr(separator + 1);
+    double value;
+    if(std::from_chars(number.data(), number.data() + number.size(), value).ptr != number.data() + number.size()
+       || number.empty()) {
+        rejected_.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+    char text[64];
+    const auto [end, error] = std::to_chars(text, text + sizeof(text), value, std::chars_format::fixed, field->decimals);
+    if(error != std::errc{}) {
+        rejected_.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+    SetField(index, string{text, end} + field->unit);
+}
+
+// Only the first update after a frame requests one
+void PushWidget::SetField(size_t index, string text)
+{
+    {
+        std::lock_guard lock{pendingMtx_};
+        pending_[index] = std::move(text);
+    }
+    updates_.fetch_add(1, std::memory_order_relaxed);
+    if(!requested_.exchange(true, std::memory_order_acq_rel)) {
+        requests_.fetch_add(1, std::memory_order_relaxed);
+        RequestUpdate();
+    }
+}
+
+// Cleared before the texts are taken, an update racing with it requests another frame
+bool PushWidget::Update()
+{
+    requested_.store(false, std::memory_order_release);
+    {
+        std::lock_guard lock{pendingMtx_};
+        pending_.swap(taken_);
+    }
+    bool changed = false;
+    for(size_t i = 0; i < fields_.size(); ++i) {
+        std::optional<string>& text = taken_[i];
+        if(!text) {
+            continue;
+        }
+        Field& field = fields_[i];
+        if(*text != field.text) {
+            field.text = std::move(*text);
+            field.sprite.reset();
+            if(!field.text.empty()) {
+                field.sprite.emplace(*font_, field.text, field.color);
+            }
+            changed = true;
+        }
+        text.reset();
+    }
+    return changed;
+}
+
+void PushWidget::Draw(Canvas* canvas)
+{
+    for(const Field& field : fields_) {
+        if(field.sprite) {
+            field.sprite->Blit(canvas, field.rect.x, field.rect.y, field.rect);
+        }
+    }
+}
+
+Rect PushWidget::GetBounds() const
+{
+    return bounds_;
+}
+
+void PushWidget::RegisterMetrics(MetricsRegistry& registry)
+{
+    registry.AddCounter("piclock_push_updates_total", "Updates received through the push socket", {},
+                        [this] { return double(GetUpdates()); });
+    registry.AddCounter("piclock_push_requests_total", "Update requests the pushed updates came down to", {},
+                        [this] { return double(GetRequests()); });
+    registry.AddCounter("piclock_push_rejected_total", "Pushed lines with an unknown field or a bad number", {},
+                        [this] { return double(GetRejected()); });
+    registry.AddCounter("piclock_push_dropped_clients_total", "Push clients cut off for overlong lines, over the limit or out of fds",
+                        {}, [this] { return double(GetDroppedClients()); });
+    registry.AddCounter("piclock_push_accept_errors_total", "Push connections that couldn't be taken for lack of fds or memory",
+                        {}, [this] { return double(GetAcceptErrors()); });
+    registry.AddGauge("piclock_push_clients", "Push clients connected", {},
+                      [this] { return double(connectedClients_.load(std::memory_order_relaxed)); });
+}
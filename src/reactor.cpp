@@ -0,0 +1,289 @@
+/*
+ * Copyright (c) 2019 Dmytro Shestakov
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "reactor.h"
+
+#include <pthread.h>
+#include <signal.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/signalfd.h>
+#include <sys/timerfd.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+
+using std::string;
+using namespace std::string_literals;
+
+namespace {
+
+    timespec ToTimespec(std::chrono::nanoseconds duration)
+    {
+        const auto seconds = std::chrono::duration_cast<std::chrono::seconds>(duration);
+        return { time_t(seconds.count()), long((duration - seconds).count()) };
+    }
+
+    sigset_t ToSigset(std::initializer_list<int> signals)
+    {
+        sigset_t set;
+        sigemptyset(&set);
+        for(int signo : signals) {
+            sigaddset(&set, signo);
+        }
+        return set;
+    }
+
+}
+
+Reactor::runtime_error::runtime_error(const string& msg) : std::runtime_error{"Reactor -> " + msg}
+{ }
+
+Reactor::Reactor() : epoch_{clock::now()}
+{
+    epollFd_ = epoll_create1(EPOLL_CLOEXEC);
+    stopFd_ = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if(epollFd_ < 0 || stopFd_ < 0) {
+        const string error = strerror(errno);
+        for(int fd : { epollFd_, stopFd_ }) {
+            if(fd >= 0) {
+                close(fd);
+            }
+        }
+        throw runtime_error{"Couldn't create the epoll: " + error};
+    }
+    AddSource("stop", Kind::STOP, stopFd_, false, EPOLLIN, nullptr);
+}
+
+Reactor::~Reactor()
+{
+    Stop();
+    if(thread_.joinable()) {
+        thread_.join();
+    }
+    for(const Source& source : sources_) {
+        if(source.owned) {
+            close(source.fd);
+        }
+    }
+    close(stopFd_);
+    close(epollFd_);
+}
+
+void Reactor::BlockSignals(std::initializer_list<int> signals)
+{
+    const sigset_t set = ToSigset(signals);
+    if(const int error = pthread_sigmask(SIG_BLOCK, &set, nullptr); error) {
+        throw runtime_error{"Couldn't block the signals: "s + strerror(error)};
+    }
+}
+
+// Complete before the fd is watched, the loop may pick it up right away
+void Reactor::AddSource(const string& name, Kind kind, int fd, bool owned, uint32_t events,
+                        std::function<void(uint64_t)> handler)
+{
+    std::lock_guard lock{mtx_};
+    Source* reused = nullptr;
+    if(!free_.empty()) {
+        reused = free_.back();
+        free_.pop_back();
+    }
+    Source& source = reused ? *reused : sources_.emplace_back();
+    source.name = name;
+    source.kind = kind;
+    source.fd = fd;
+    source.owned = owned;
+    source.handler = std::move(handler);
+    source.events.store(0, std::memory_order_relaxed);
+    source.active.store(true, std::memory_order_relaxed);
+    epoll_event event{};
+    event.events = events;
+    event.data.ptr = &source;
+    if(epoll_ctl(epollFd_, EPOLL_CTL_ADD, fd, &event)) {
+        const string error = strerror(errno);
+        source.active.store(false, std::memory_order_relaxed);
+        source.handler = nullptr;
+        if(reused) {
+            free_.push_back(reused);
+        }
+        else {
+            sources_.pop_back();
+        }
+        if(owned) {
+            close(fd);
+        }
+        throw runtime_error{"Couldn't watch " + name + ": " + error};
+    }
+}
+
+void Reactor::AddFd(const string& source, int fd, uint32_t events, FdHandler handler)
+{
+    AddSource(source, Kind::FD, fd, false, events, [handler = std::move(handler)](uint64_t events) {
+        handler(uint32_t(events));
+    });
+}
+
+void Reactor::RemoveFd(int fd)
+{
+    std::lock_guard lock{mtx_};
+    for(Source& source : sources_) {
+        if(source.kind == Kind::FD && source.fd == fd && source.active.load(std::memory_order_relaxed)) {
+            epoll_ctl(epollFd_, EPOLL_CTL_DEL, fd, nullptr);
+            source.active.store(false, std::memory_order_relaxed);
+            retired_.push_back(&source);
+            return;
+        }
+    }
+}
+
+// The handler may be the one that removed its fd, so it goes only after the events at hand. The
+// metrics keep counting the exported ones
+void Reactor::FreeRetired()
+{
+    std::lock_guard lock{mtx_};
+    for(Source* source : retired_) {
+        source->handler = nullptr;
+        if(!source->exported) {
+            free_.push_back(source);
+        }
+    }
+    retired_.clear();
+}
+
+void Reactor::AddTimer(const string& source, Duration period, TimerHandler handler)
+{
+    if(period <= Duration::zero()) {
+        throw runtime_error{"Invalid period of " + source};
+    }
+    const int fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if(fd < 0) {
+        throw runtime_error{"Couldn't create the timer of " + source + ": " + strerror(errno)};
+    }
+    // The steady clock is the monotonic one, its start has passed, so the first expiration is now
+    itimerspec spec{};
+    spec.it_interval = ToTimespec(period);
+    spec.it_value = ToTimespec(epoch_.time_since_epoch());
+    if(timerfd_settime(fd, TFD_TIMER_ABSTIME, &spec, nullptr)) {
+        const string error = strerror(errno);
+        close(fd);
+        throw runtime_error{"Couldn't arm the timer of " + source + ": " + error};
+    }
+    AddSource(source, Kind::TIMER, fd, true, EPOLLIN, std::move(handler));
+}
+
+void Reactor::AddSignals(std::initializer_list<int> signals, SignalHandler handler)
+{
+    const sigset_t set = ToSigset(signals);
+    const int fd = signalfd(-1, &set, SFD_NONBLOCK | SFD_CLOEXEC);
+    if(fd < 0) {
+        throw runtime_error{"Couldn't create the signalfd: "s + strerror(errno)};
+    }
+    AddSource("signal", Kind::SIGNAL, fd, true, EPOLLIN, [handler = std::move(handler)](uint64_t signo) {
+        handler(int(signo));
+    });
+}
+
+void Reactor::Start()
+{
+    thread_ = std::thread{&Reactor::Run, this};
+}
+
+void Reactor::Stop()
+{
+    if(!stop_.exchange(true)) {
+        const uint64_t value = 1;
+        [[maybe_unused]] auto result = write(stopFd_, &value, sizeof(value));
+    }
+    if(thread_.joinable() && thread_.get_id() != std::this_thread::get_id()) {
+        thread_.join();
+    }
+}
+
+// A handler that throws is reported and the loop goes on
+void Reactor::Dispatch(Source& source, uint32_t events)
+{
+    source.events.fetch_add(1, std::memory_order_relaxed);
+    events_.fetch_add(1, std::memory_order_relaxed);
+    try {
+        switch(source.kind) {
+        case Kind::FD:
+            source.handler(events);
+            break;
+        case Kind::TIMER:
+            if(uint64_t expirations; read(source.fd, &expirations, sizeof(expirations)) == sizeof(expirations)) {
+                source.handler(expirations);
+            }
+            break;
+        case Kind::SIGNAL:
+            for(signalfd_siginfo info; read(source.fd, &info, sizeof(info)) == sizeof(info); ) {
+                source.handler(info.ssi_signo);
+            }
+            break;
+        case Kind::STOP:
+            break;
+        }
+    } catch(const std::exception& e) {
+        std::cerr << "Reactor -> " << source.name << ": " << e.what() << std::endl;
+    }
+}
+
+void Reactor::Run()
+{
+    epoll_event events[16];
+    while(!stop_.load(std::memory_order_relaxed)) {
+        const int ready = epoll_wait(epollFd_, events, int(std::size(events)), -1);
+        if(ready < 0) {
+            if(errno == EINTR) {
+                continue;
+            }
+            std::cerr << "Reactor -> epoll_wait failed: " << strerror(errno) << std::endl;
+            return;
+        }
+        wakeups_.fetch_add(1, std::memory_order_relaxed);
+        for(int i = 0; i < ready && !stop_.load(std::memory_order_relaxed); ++i) {
+            Source& source = *static_cast<Source*>(events[i].data.ptr);
+            // Removed by a handler before it in the same round
+            if(source.active.load(std::memory_order_relaxed)) {
+                Dispatch(source, events[i].events);
+            }
+        }
+        FreeRetired();
+    }
+}
+
+void Reactor::RegisterMetrics(MetricsRegistry& registry)
+{
+    registry.AddCounter("piclock_reactor_wakeups_total", "Times the event loop woke up", {},
+                        [this] { return double(GetWakeups()); });
+    std::lock_guard lock{mtx_};
+    for(Source& source : sources_) {
+        // Removed ones are left out, the fds added later count in the wakeups only
+        if(source.kind == Kind::STOP || !source.active.load(std::memory_order_relaxed)) {
+            continue;
+        }
+        source.exported = true;
+        registry.AddCounter("piclock_reactor_events_total", "Events handled by the event loop",
+                            "source=\"" + source.name + "\"",
+                            [&source] { return double(source.events.load(std::memory_order_relaxed)); });
+    }
+}
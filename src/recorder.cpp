@@ -0,0 +1,371 @@
+/*
+ * Copyright (c) 2019 Dmytro Shestakov
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "recorder.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+
+using std::string;
+using std::vector;
+
+namespace {
+
+    // Alike bytes up to that many in a row stay in the stretch that differs, a new pair costs about as much
+    constexpr size_t MAX_GAP = 3;
+
+    void PutVarint(vector<uint8_t>& output, uint64_t value)
+    {
+        for(; value >= 0x80; value >>= 7) {
+            output.push_back(uint8_t(value) | 0x80);
+        }
+        output.push_back(uint8_t(value));
+    }
+
+    bool GetVarint(const uint8_t*& data, const uint8_t* end, uint64_t& value)
+    {
+        value = 0;
+        for(unsigned shift = 0; data < end && shift < 64; shift += 7) {
+            const uint8_t byte = *data++;
+            value |= uint64_t(byte & 0x7F) << shift;
+            if(!(byte & 0x80)) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    template<typename T>
+    void PutLe(uint8_t* output, T value)
+    {
+        for(size_t i = 0; i < sizeof(T); ++i) {
+            output[i] = uint8_t(uint64_t(value) >> (8 * i));
+        }
+    }
+
+    template<typename T>
+    T GetLe(const uint8_t* data)
+    {
+        uint64_t value = 0;
+        for(size_t i = 0; i < sizeof(T); ++i) {
+            value |= uint64_t(data[i]) << (8 * i);
+        }
+        return T(value);
+    }
+
+    // Bytes alike from pos on, eight at a time while they last
+    size_t SkipAlike(const uint8_t* frame, const uint8_t* previous, size_t pos, size_t size)
+    {
+        static const uint8_t zeros[8]{};
+        while(pos + 8 <= size && !std::memcmp(frame + pos, previous ? previous + pos : zeros, 8)) {
+            pos += 8;
+        }
+        while(pos < size && frame[pos] == (previous ? previous[pos] : 0)) {
+            ++pos;
+        }
+        return pos;
+    }
+
+}
+
+void FrameDelta::Encode(const uint8_t* frame, const uint8_t* previous, size_t size, vector<uint8_t>& output)
+{
+    const auto differs = [frame, previous](size_t i) {
+        return frame[i] != (previous ? previous[i] : 0);
+    };
+    for(size_t pos = 0; pos < size;) {
+        const size_t start = SkipAlike(frame, previous, pos, size);
+        if(start == size) {
+            break;
+        }
+        size_t end = start;
+        for(size_t scan = start; scan < size && scan - end <= MAX_GAP; ++scan) {
+            if(differs(scan)) {
+                end = scan + 1;
+            }
+        }
+        PutVarint(output, start - pos);
+        PutVarint(output, end - start);
+        for(size_t i = start; i < end; ++i) {
+            output.push_back(frame[i] ^ (previous ? previous[i] : 0));
+        }
+        pos = end;
+    }
+}
+
+bool FrameDelta::Apply(const uint8_t* data, size_t length, uint8_t* frame, size_t size, size_t stride, Rect& changed)
+{
+    const uint8_t* end = data + length;
+    size_t first = size;
+    size_t last = 0;
+    for(size_t pos = 0; data < end;) {
+        uint64_t skip, count;
+        if(!GetVarint(data, end, skip) || !GetVarint(data, end, count)
+           || skip > size - pos || count > size - pos - skip || count > size_t(end - data)) {
+            return false;
+        }
+        pos += skip;
+        for(size_t i = 0; i < count; ++i) {
+            frame[pos + i] ^= data[i];
+        }
+        if(count) {
+            first = std::min(first, pos);
+            last = pos + count;
+        }
+        pos += count;
+        data += count;
+    }
+    changed = {};
+    if(first < last) {
+        const int top = int(first / stride);
+        changed = {0, top, int(stride / SoftCanvas::BYTES_PER_PIXEL), int((last - 1) / stride) + 1 - top};
+    }
+    return true;
+}
+
+FrameRecorder::FrameRecorder(const Config& config, int width, int height) : config_{config},
+    width_{width}, height_{height}, start_{clock::now()},
+    startWallTime_{std::chrono::duration_cast<std::chrono::nanoseconds>(
+                       std::chrono::system_clock::now().time_since_epoch()).count()},
+    previous_(size_t(width) * size_t(height) * SoftCanvas::BYTES_PER_PIXEL)
+{
+    path otherPath = config_.filePath;
+    otherPath += ".1";
+    fds_[0] = open(config_.filePath.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    fds_[1] = open(otherPath.c_str(), O_WRONLY | O_CREAT | O_CLOEXEC, 0644);
+    if(fds_[0] < 0 || fds_[1] < 0) {
+        const int error = errno;
+        for(int fd : fds_) {
+            if(fd >= 0) {
+                close(fd);
+            }
+        }
+        throw runtime_error{"Couldn't open " + config_.filePath.string() + ": " + strerror(error)};
+    }
+    const vector<uint8_t> header = CreateHeader();
+    if(!WriteAll(fds_[0], header)) {
+        writeErrors_.fetch_add(1, std::memory_order_relaxed);
+    }
+    fileBytes_ = header.size();
+    thread_ = std::thread{&FrameRecorder::Write, this};
+}
+
+FrameRecorder::~FrameRecorder()
+{
+    {
+        std::lock_guard lock{mtx_};
+        stop_ = true;
+    }
+    cv_.notify_one();
+    thread_.join();
+    for(int fd : fds_) {
+        close(fd);
+    }
+}
+
+vector<uint8_t> FrameRecorder::CreateHeader() const
+{
+    vector<uint8_t> header(RecordingFormat::HEADER_SIZE);
+    std::copy(std::begin(RecordingFormat::MAGIC), std::end(RecordingFormat::MAGIC), header.begin());
+    PutLe(&header[8], uint16_t(width_));
+    PutLe(&header[10], uint16_t(height_));
+    PutLe(&header[12], startWallTime_);
+    return header;
+}
+
+// A keyframe after every interval, after a dropped record and at the start of a file
+void FrameRecorder::Record(const SoftCanvas& frame)
+{
+    if(frame.Size() != previous_.size()) {
+        return;
+    }
+    const auto start = clock::now();
+    const auto encode = [&](bool keyframe) {
+        scratch_.assign(RecordingFormat::RECORD_HEADER_SIZE, 0);
+        FrameDelta::Encode(frame.Data(), keyframe ? nullptr : previous_.data(), frame.Size(), scratch_);
+        PutLe(&scratch_[0], uint32_t(scratch_.size() - RecordingFormat::RECORD_HEADER_SIZE));
+        scratch_[4] = keyframe ? RecordingFormat::KEYFRAME : 0;
+        PutLe(&scratch_[5], std::chrono::duration_cast<std::chrono::nanoseconds>(start - start_).count());
+    };
+    bool keyframe = !hasPrevious_ || sinceKeyframe_ + 1 >= config_.keyframeInterval;
+    encode(keyframe);
+    const bool rotate = fileBytes_ + scratch_.size() > config_.maxBytes;
+    if(rotate && !keyframe) {
+        keyframe = true;
+        encode(keyframe);
+    }
+    encodeTime_.Observe(clock::now() - start);
+    {
+        std::lock_guard lock{mtx_};
+        if(queue_.size() >= config_.queueLimit) {
+            dropped_.fetch_add(1, std::memory_order_relaxed);
+            hasPrevious_ = false;
+            return;
+        }
+        queue_.push_back({scratch_, rotate});
+    }
+    cv_.notify_one();
+    std::copy(frame.Data(), frame.Data() + frame.Size(), previous_.begin());
+    hasPrevious_ = true;
+    sinceKeyframe_ = keyframe ? 0 : sinceKeyframe_ + 1;
+    fileBytes_ = (rotate ? RecordingFormat::HEADER_SIZE : fileBytes_) + scratch_.size();
+    frames_.fetch_add(1, std::memory_order_relaxed);
+    keyframes_.fetch_add(keyframe, std::memory_order_relaxed);
+    bytes_.fetch_add(scratch_.size(), std::memory_order_relaxed);
+}
+
+// Writes what the frame loop queued, whatever is left at the stop included
+void FrameRecorder::Write()
+{
+    std::unique_lock lock{mtx_};
+    while(true) {
+        cv_.wait(lock, [this] { return stop_ || !queue_.empty(); });
+        if(queue_.empty()) {
+            return;
+        }
+        std::deque<Entry> records;
+        records.swap(queue_);
+        lock.unlock();
+        for(const Entry& record : records) {
+            if(record.rotate) {
+                current_ ^= 1;
+                if(ftruncate(fds_[current_], 0) || lseek(fds_[current_], 0, SEEK_SET) < 0
+                   || !WriteAll(fds_[current_], CreateHeader())) {
+                    writeErrors_.fetch_add(1, std::memory_order_relaxed);
+                }
+            }
+            if(!WriteAll(fds_[current_], record.bytes)) {
+                writeErrors_.fetch_add(1, std::memory_order_relaxed);
+            }
+        }
+        lock.lock();
+    }
+}
+
+bool FrameRecorder::WriteAll(int fd, const vector<uint8_t>& bytes)
+{
+    for(size_t written = 0; written < bytes.size();) {
+        const ssize_t result = write(fd, bytes.data() + written, bytes.size() - written);
+        if(result < 0 && errno == EINTR) {
+            continue;
+        }
+        if(result <= 0) {
+            return false;
+        }
+        written += size_t(result);
+    }
+    return true;
+}
+
+void FrameRecorder::RegisterMetrics(MetricsRegistry& registry)
+{
+    registry.AddCounter("piclock_recorder_frames_total", "Frames written to the recording", {},
+                        [this] { return double(frames_.load(std::memory_order_relaxed)); });
+    registry.AddCounter("piclock_recorder_keyframes_total", "Frames recorded whole", {},
+                        [this] { return double(keyframes_.load(std::memory_order_relaxed)); });
+    registry.AddCounter("piclock_recorder_bytes_total", "Bytes of the recorded frames", {},
+                        [this] { return double(bytes_.load(std::memory_order_relaxed)); });
+    registry.AddCounter("piclock_recorder_dropped_total", "Frames dropped while the writer fell behind", {},
+                        [this] { return double(dropped_.load(std::memory_order_relaxed)); });
+    registry.AddCounter("piclock_recorder_write_errors_total", "Failed writes of the recording", {},
+                        [this] { return double(writeErrors_.load(std::memory_order_relaxed)); });
+    registry.AddHistogram("piclock_recorder_encode_seconds", "Time the frame loop spends encoding a frame", {},
+                          encodeTime_);
+}
+
+FrameRecorder::runtime_error::runtime_error(const string& msg) : std::runtime_error{"FrameRecorder -> " + msg}
+{ }
+
+FrameReader::FrameReader(const path& filePath) : file_{filePath, std::ios::binary}
+{
+    uint8_t header[RecordingFormat::HEADER_SIZE];
+    if(!file_.read(reinterpret_cast<char*>(header), sizeof(header))
+       || !std::equal(std::begin(RecordingFormat::MAGIC), std::end(RecordingFormat::MAGIC), header)) {
+        throw runtime_error{"Not a recording: " + filePath.string()};
+    }
+    width_ = GetLe<uint16_t>(&header[8]);
+    height_ = GetLe<uint16_t>(&header[10]);
+    startWallTime_ = GetLe<int64_t>(&header[12]);
+    if(!width_ || !height_) {
+        throw runtime_error{"Empty frames in " + filePath.string()};
+    }
+}
+
+bool FrameReader::Next(SoftCanvas& canvas, Frame& frame)
+{
+    if(canvas.width() != width_ || canvas.height() != height_) {
+        throw runtime_error{"The canvas doesn't match the recording size"};
+    }
+    while(true) {
+        uint8_t header[RecordingFormat::RECORD_HEADER_SIZE];
+        if(!file_.read(reinterpret_cast<char*>(header), sizeof(header))) {
+            return false;
+        }
+        payload_.resize(GetLe<uint32_t>(&header[0]));
+        if(!file_.read(reinterpret_cast<char*>(payload_.data()), std::streamsize(payload_.size()))) {
+            return false;
+        }
+        frame.keyframe = header[4] & RecordingFormat::KEYFRAME;
+        frame.time = GetLe<int64_t>(&header[5]);
+        frame.bytes = sizeof(header) + payload_.size();
+        if(!synced_ && !frame.keyframe) {
+            continue;
+        }
+        synced_ = true;
+        if(frame.keyframe) {
+            std::fill(canvas.Data(), canvas.Data() + canvas.Size(), 0);
+        }
+        if(!FrameDelta::Apply(payload_.data(), payload_.size(), canvas.Data(), canvas.Size(), canvas.Stride(), frame.changed)) {
+            throw runtime_error{"Malformed frame at " + std::to_string(frame.time) + " ns"};
+        }
+        if(frame.keyframe) {
+            frame.changed = canvas.GetRect();
+        }
+        return true;
+    }
+}
+
+FrameReader::runtime_error::runtime_error(const string& msg) : std::runtime_error{"FrameReader -> " + msg}
+{ }
+
+std::unique_ptr<FrameRecorder> CreateFrameRecorder(const Options& options, int width, int height)
+{
+    OptionalNode optionalNode = options.GetNode("record");
+    if(!optionalNode) {
+        return nullptr;
+    }
+    const YAML::Node node = *optionalNode;
+    FrameRecorder::Config config;
+    try {
+        config.filePath = options.GetExecDir() / node["file"].as<string>("frames.rec");
+        config.keyframeInterval = std::max(node["keyframe"].as<unsigned>(600), 1u);
+        config.maxBytes = std::max(node["max_size"].as<uint64_t>(16384), uint64_t{64}) << 10;
+    } catch(const YAML::BadConversion&) {
+        throw std::invalid_argument("FrameRecorder -> Reading record failed");
+    }
+    std::cout << "Recording frames to " << config.filePath.string() << std::endl;
+    return std::make_unique<FrameRecorder>(config, width, height);
+}
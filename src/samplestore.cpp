@@ -0,0 +1,357 @@
+/*
+ * Copyright (c) 2019 Dmytro Shestakov
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#include "samplestore.h"
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+
+using std::string;
+using std::unique_lock;
+using std::lock_guard;
+
+namespace {
+
+    constexpr std::string_view SEGMENT_PREFIX = "segment-";
+    constexpr std::string_view SEGMENT_SUFFIX = ".ts";
+
+    uint32_t Fnv1a(const void* data, size_t size)
+    {
+        uint32_t hash = 2166136261u;
+        for(const uint8_t* byte = static_cast<const uint8_t*>(data); size--; ++byte) {
+            hash = (hash ^ *byte) * 16777619u;
+        }
+        return hash;
+    }
+
+    string SegmentName(uint64_t index)
+    {
+        char name[32];
+        snprintf(name, sizeof(name), "%.*s%08llu%.*s", int(SEGMENT_PREFIX.size()), SEGMENT_PREFIX.data(),
+                 static_cast<unsigned long long>(index), int(SEGMENT_SUFFIX.size()), SEGMENT_SUFFIX.data());
+        return name;
+    }
+
+    // Returns false for files that are not segments
+    bool ParseSegmentName(const string& name, uint64_t& index)
+    {
+        if(name.size() <= SEGMENT_PREFIX.size() + SEGMENT_SUFFIX.size() || name.compare(0, SEGMENT_PREFIX.size(), SEGMENT_PREFIX)
+           || name.compare(name.size() - SEGMENT_SUFFIX.size(), SEGMENT_SUFFIX.size(), SEGMENT_SUFFIX)) {
+            return false;
+        }
+        char* end;
+        index = strtoull(name.c_str() + SEGMENT_PREFIX.size(), &end, 10);
+        return end == name.c_str() + name.size() - SEGMENT_SUFFIX.size();
+    }
+
+}
+
+SampleStore::SampleStore(const Config& config) : config_{config},
+    capacity_{config.segmentBytes > sizeof(Header) ? (config.segmentBytes - sizeof(Header)) / sizeof(Record) : 0}
+{
+    if(!capacity_) {
+        throw runtime_error{"Segment size too small"};
+    }
+    std::error_code error;
+    std::filesystem::create_directories(config_.directory, error);
+    std::vector<std::pair<uint64_t, path>> found;
+    for(const auto& entry : std::filesystem::directory_iterator{config_.directory, error}) {
+        if(uint64_t index; entry.is_regular_file() && ParseSegmentName(entry.path().filename().string(), index)) {
+            found.emplace_back(index, entry.path());
+        }
+    }
+    if(error) {
+        throw runtime_error{"Couldn't list " + config_.directory.string() + ": " + error.message()};
+    }
+    std::sort(found.begin(), found.end());
+    for(const auto& segment : found) {
+        segments_.push_back(segment.second);
+    }
+    if(segments_.empty()) {
+        Rotate();
+    }
+    else {
+        nextIndex_ = found.back().first + 1;
+        OpenSegment(segments_.back(), false);
+        RemoveOldest();
+    }
+    flushThd_ = std::thread{&SampleStore::FlushThread, this};
+}
+
+SampleStore::~SampleStore()
+{
+    {
+        lock_guard lock{mtx_};
+        stop_ = true;
+    }
+    flushCv_.notify_one();
+    flushThd_.join();
+    lock_guard lock{mtx_};
+    FlushLocked();
+    CloseSegment();
+}
+
+uint32_t SampleStore::GetKey(std::string_view name)
+{
+    return Fnv1a(name.data(), name.size());
+}
+
+// Zeroed space never passes, the FNV basis makes a zero hash out of reach for zero bytes
+uint32_t SampleStore::Checksum(const Record& record)
+{
+    return Fnv1a(&record, offsetof(Record, check));
+}
+
+size_t SampleStore::CountIntact(const uint8_t* map, size_t bytes, size_t capacity)
+{
+    const size_t available = bytes > sizeof(Header) ? std::min(capacity, (bytes - sizeof(Header)) / sizeof(Record)) : 0;
+    const Record* records = reinterpret_cast<const Record*>(map + sizeof(Header));
+    size_t count = 0;
+    while(count < available && Checksum(records[count]) == records[count].check) {
+        ++count;
+    }
+    return count;
+}
+
+void SampleStore::Append(uint32_t sensor, int64_t time, float value)
+{
+    lock_guard lock{mtx_};
+    if(position_ == capacity_ && map_) {
+        try {
+            Rotate();
+        } catch(const runtime_error& e) {
+            // Most likely a full disk, it won't be better on the next sample
+            std::cerr << e.what() << ", no more samples are stored" << std::endl;
+        }
+    }
+    if(!map_) {
+        ++stats_.dropped;
+        return;
+    }
+    if(!position_) {
+        GetHeader().firstTime = time;
+    }
+    Record& record = GetRecords()[position_++];
+    record = {uint32_t(time), sensor, value, 0};
+    record.check = Checksum(record);
+    ++stats_.appended;
+}
+
+void SampleStore::Load(int64_t since, const Visitor& visitor)
+{
+    lock_guard lock{mtx_};
+    // All of them once no segment is open
+    const size_t closed = map_ ? segments_.size() - 1 : segments_.size();
+    // Read ahead, a segment ends where the next one begins
+    std::vector<int64_t> firstTimes(closed + 1);
+    for(size_t i = 0; i < closed; ++i) {
+        Header header{};
+        if(const int fd = open(segments_[i].c_str(), O_RDONLY | O_CLOEXEC); fd >= 0) {
+            if(pread(fd, &header, sizeof(header), 0) != ssize_t(sizeof(header))) {
+                header = {};
+            }
+            close(fd);
+        }
+        firstTimes[i] = header.firstTime;
+    }
+    firstTimes.back() = map_ ? GetHeader().firstTime : 0;
+
+    const auto visit = [&](const uint8_t* map, size_t count) {
+        const Record* records = reinterpret_cast<const Record*>(map + sizeof(Header));
+        for(size_t i = 0; i < count; ++i) {
+            if(int64_t(records[i].time) >= since) {
+                visitor(records[i].sensor, records[i].time, records[i].value);
+            }
+        }
+    };
+    for(size_t i = 0; i < closed; ++i) {
+        // Zero is an empty or never flushed header, such a segment is read anyway
+        if(firstTimes[i + 1] && firstTimes[i + 1] <= since) {
+            continue;
+        }
+        const int fd = open(segments_[i].c_str(), O_RDONLY | O_CLOEXEC);
+        struct stat st;
+        if(fd < 0 || fstat(fd, &st) < 0) {
+            std::cerr << "SampleStore -> Couldn't read " << segments_[i] << "  " << strerror(errno) << std::endl;
+            if(fd >= 0) {
+                close(fd);
+            }
+            continue;
+        }
+        // Mapping past the end of a truncated file would fault
+        const size_t bytes = std::min(size_t(st.st_size), config_.segmentBytes);
+        void* map = bytes >= sizeof(Header) ? mmap(nullptr, bytes, PROT_READ, MAP_PRIVATE, fd, 0) : MAP_FAILED;
+        close(fd);
+        if(map == MAP_FAILED) {
+            continue;
+        }
+        const Header& header = *static_cast<const Header*>(map);
+        if(!memcmp(header.magic, MAGIC, sizeof(MAGIC)) && header.version == VERSION
+           && header.recordSize == sizeof(Record)) {
+            visit(static_cast<const uint8_t*>(map), CountIntact(static_cast<const uint8_t*>(map), bytes, capacity_));
+        }
+        munmap(map, bytes);
+    }
+    if(map_) {
+        visit(map_, position_);
+    }
+}
+
+void SampleStore::Flush()
+{
+    lock_guard lock{mtx_};
+    FlushLocked();
+}
+
+SampleStore::Stats SampleStore::GetStats()
+{
+    lock_guard lock{mtx_};
+    Stats stats = stats_;
+    stats.segments = segments_.size();
+    return stats;
+}
+
+void SampleStore::OpenSegment(const path& file, bool create)
+{
+    // A new file is removed again, it may hold blocks the disk is short of
+    const auto fail = [this, &file, create](const char* what, int error) {
+        if(fd_ >= 0) {
+            close(fd_);
+            fd_ = -1;
+            if(create) {
+                unlink(file.c_str());
+            }
+        }
+        return runtime_error{what + file.string() + ": " + strerror(error)};
+    };
+    fd_ = open(file.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    struct stat st;
+    if(fd_ < 0 || fstat(fd_, &st) < 0) {
+        throw fail("Couldn't open ", errno);
+    }
+    // A cut file is extended with zeros, which never pass the checksum. The blocks are allocated up
+    // front, a store on a full disk would otherwise fault on its first write to the map
+    const size_t size = size_t(st.st_size);
+    if(const int error = posix_fallocate(fd_, 0, off_t(config_.segmentBytes)); error) {
+        throw fail("Couldn't allocate ", error);
+    }
+    void* map = mmap(nullptr, config_.segmentBytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd_, 0);
+    if(map == MAP_FAILED) {
+        throw fail("Couldn't map ", errno);
+    }
+    map_ = static_cast<uint8_t*>(map);
+    Header& header = GetHeader();
+    const bool valid = !create && size >= sizeof(Header) && !memcmp(header.magic, MAGIC, sizeof(MAGIC))
+                       && header.version == VERSION && header.recordSize == sizeof(Record);
+    if(!valid) {
+        header = {};
+        memcpy(header.magic, MAGIC, sizeof(MAGIC));
+        header.version = VERSION;
+        header.recordSize = sizeof(Record);
+    }
+    position_ = valid ? CountIntact(map_, std::min(size, config_.segmentBytes), capacity_) : 0;
+    // Records behind a torn one may have reached the disk on their own, they would come back after the new ones
+    static const Record EMPTY{};
+    for(size_t i = position_; i < capacity_; ++i) {
+        if(memcmp(&GetRecords()[i], &EMPTY, sizeof(Record))) {
+            GetRecords()[i] = EMPTY;
+        }
+    }
+    header.committed = position_;
+    flushed_ = position_;
+    stats_.recovered = position_;
+    // Only the repaired pages are dirty, a clean segment costs no writes
+    if(!create) {
+        msync(map_, config_.segmentBytes, MS_SYNC);
+    }
+}
+
+void SampleStore::CloseSegment()
+{
+    if(map_) {
+        munmap(map_, config_.segmentBytes);
+        map_ = nullptr;
+    }
+    if(fd_ >= 0) {
+        close(fd_);
+        fd_ = -1;
+    }
+}
+
+void SampleStore::Rotate()
+{
+    if(map_) {
+        FlushLocked();
+        CloseSegment();
+    }
+    const path file = config_.directory / SegmentName(nextIndex_++);
+    OpenSegment(file, true);
+    segments_.push_back(file);
+    RemoveOldest();
+}
+
+void SampleStore::RemoveOldest()
+{
+    const size_t maxSegments = std::max<size_t>(config_.maxBytes / config_.segmentBytes, 2);
+    while(segments_.size() > maxSegments) {
+        std::error_code error;
+        std::filesystem::remove(segments_.front(), error);
+        segments_.erase(segments_.begin());
+    }
+}
+
+// The records go first, the header that commits them after
+void SampleStore::FlushLocked()
+{
+    if(!map_ || position_ == flushed_) {
+        return;
+    }
+    static const size_t pageSize = size_t(sysconf(_SC_PAGESIZE));
+    const size_t begin = (sizeof(Header) + flushed_ * sizeof(Record)) / pageSize * pageSize;
+    const size_t end = sizeof(Header) + position_ * sizeof(Record);
+    if(msync(map_ + begin, end - begin, MS_SYNC) < 0) {
+        std::cerr << "SampleStore -> msync failed  " << strerror(errno) << std::endl;
+        return;
+    }
+    GetHeader().committed = position_;
+    msync(map_, pageSize, MS_SYNC);
+    flushed_ = position_;
+    ++stats_.flushes;
+}
+
+// Holds the lock while syncing, appends of the sensor reads wait for it but the display never does
+void SampleStore::FlushThread()
+{
+    unique_lock lock{mtx_};
+    while(!stop_) {
+        if(!flushCv_.wait_for(lock, config_.flushInterval, [this] { return stop_; })) {
+            FlushLocked();
+        }
+    }
+}
+
+SampleStore::runtime_error::runtime_error(const string& msg) : std::runtime_error{"SampleStore -> " + msg}
+{ }
@@ -21,6 +21,14 @@
  */
 
 #include "sensors.h"
+#include "warmcache.h"
+#include <fcntl.h>
+#include <sys/epoll.h>
+#include <unistd.h>
+#include <cerrno>
+#include <charconv>
+#include <cstring>
+#include <ctime>
 
 using std::literals::operator""s;
 
@@ -32,37 +40,332 @@ static const std::array<SensorDescriptor, 5> DESCRIPTORS = {{
     { "hdc1080", "1-0040", SensorType::TEMPERATURE, "in_temp_raw", {} },
 }};
 
-void Sensor::ReadValue() {
-    string result;
-    try {
-        fstream_ >> result;
-        fstream_.seekg(0);
-    } catch(const std::exception& e) {
-        std::cerr << "Read failed for" << GetName() << "  " << e.what() << std::endl;
-        fstream_.close();
-        fstream_.open(GetSensorPath()/GetValueName());
-        if(!fstream_) {
-            std::cerr << "Retry open failed" << std::endl;
+namespace {
+
+    struct UnitFormat {
+        double factor;      // from the IIO unit to the displayed one
+        int decimals;
+    };
+
+    // IIO reports milli degrees Celsius, milli percents, lux and kilopascals
+    constexpr UnitFormat UNIT_FORMATS[size_t(SensorType::MAX_VAL)] = {
+        { 0.001, 1 },
+        { 0.001, 0 },
+        { 1, 0 },
+        { 10, 0 },
+    };
+
+    constexpr std::string_view RAW_SUFFIX = "_raw";
+    constexpr std::string_view INPUT_SUFFIX = "_input";
+
+    bool EndsWith(std::string_view text, std::string_view suffix)
+    {
+        return text.size() > suffix.size() && text.substr(text.size() - suffix.size()) == suffix;
+    }
+
+}
+
+Sensor::Sensor(const SensorDescriptor& desc, PositionType position, Color color, Timing timing) : senseDesc_{desc},
+    position_{position},
+    color_{color},
+    timing_{timing}
+{
+    // Processed *_input values come without scale and offset
+    if(EndsWith(GetValueName(), RAW_SUFFIX)) {
+        LoadScale();
+    }
+    else {
+        scale_ = UNIT_FORMATS[size_t(GetType())].factor;
+    }
+    formattedValue_.reserve(BUFFER_SIZE);
+    Open();
+}
+
+Sensor::string Sensor::GetChannel() {
+    string_view valueName = GetValueName();
+    for(string_view suffix : { RAW_SUFFIX, INPUT_SUFFIX }) {
+        if(EndsWith(valueName, suffix)) {
+            valueName.remove_suffix(suffix.size());
+            break;
         }
     }
-    value_ = result;
+    return string{valueName};
+}
+
+// Scans are always raw, even for channels with a processed sysfs value
+void Sensor::SetStreamed() {
+    LoadScale();
+    streamed_ = true;
+    if(fd_ >= 0) {
+        close(fd_);
+        fd_ = -1;
+    }
+}
+
+void Sensor::LoadScale() {
+    const string channel = GetChannel();
+    scale_ = ReadAttribute(channel + "_scale", 1) * UNIT_FORMATS[size_t(GetType())].factor;
+    offset_ = ReadAttribute(channel + "_offset", 0);
+}
+
+Sensor::~Sensor() {
+    if(fd_ >= 0) {
+        close(fd_);
+    }
+}
+
+void Sensor::Open() {
+    fd_ = open((GetSensorPath()/GetValueName()).c_str(), O_RDONLY | O_CLOEXEC);
+    if(fd_ < 0) {
+        std::cerr << "Open failed for " << GetName() << "  " << strerror(errno) << std::endl;
+    }
+}
+
+double Sensor::ReadAttribute(const string& name, double fallback) {
+    std::ifstream file{GetSensorPath()/name};
+    double value;
+    if(!(file >> value)) {
+        return fallback;
+    }
+    return value;
+}
+
+Sensor::ReadStats Sensor::GetReadStats() const {
+    const int64_t start = readStart_.load(std::memory_order_relaxed);
+    const int64_t now = std::chrono::steady_clock::now().time_since_epoch().count();
+    return {
+        reads_.load(std::memory_order_relaxed),
+        timeouts_.load(std::memory_order_relaxed),
+        failures_.load(std::memory_order_relaxed),
+        Duration{lastLatency_.load(std::memory_order_relaxed)},
+        Duration{maxLatency_.load(std::memory_order_relaxed)},
+        Duration{totalLatency_.load(std::memory_order_relaxed)},
+        start && Duration{now - start} > timing_.timeout,
+    };
+}
+
+void Sensor::ReadValue() {
+    using std::chrono::steady_clock;
+    const auto start = steady_clock::now();
+    readStart_.store(start.time_since_epoch().count(), std::memory_order_relaxed);
+    double raw;
+    const bool success = ReadRaw(raw);
+    const int64_t latency = std::chrono::duration_cast<Duration>(steady_clock::now() - start).count();
+    readStart_.store(0, std::memory_order_relaxed);
+
+    reads_.fetch_add(1, std::memory_order_relaxed);
+    lastLatency_.store(latency, std::memory_order_relaxed);
+    totalLatency_.fetch_add(latency, std::memory_order_relaxed);
+    readLatency_.Observe(latency);
+    if(latency > maxLatency_.load(std::memory_order_relaxed)) {
+        maxLatency_.store(latency, std::memory_order_relaxed);
+    }
+    if(!success) {
+        failures_.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+    // A late value is stale already
+    if(Duration{latency} > timing_.timeout) {
+        timeouts_.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+    SetRawValue(raw);
+}
+
+bool Sensor::ReadRaw(double& raw) {
+    if(fd_ < 0) {
+        Open();
+        return false;
+    }
+    const ssize_t length = pread(fd_, buffer_, BUFFER_SIZE, 0);
+    if(length <= 0 || std::from_chars(buffer_, buffer_ + length, raw).ec != std::errc{}) {
+        std::cerr << "Read failed for " << GetName() << "  " << (length < 0 ? strerror(errno) : "bad value") << std::endl;
+        close(fd_);
+        Open();
+        return false;
+    }
+    return true;
 }
 
-SensorHub::SensorHub(const Options& options, BaseWidget& widget) : WidgetWrapper{widget}, sensors_{} {
+void Sensor::SetRawValue(double raw) {
+    const double value = (raw + offset_) * scale_;
+    const time_t now = time(nullptr);
+    history_.Add(now, float(value));
+    if(store_) {
+        store_->Append(storeKey_, now, float(value));
+    }
+    // Only a change of the displayed text counts
+    const UnitFormat& format = UNIT_FORMATS[size_t(GetType())];
+    char text[BUFFER_SIZE];
+    auto [end, error] = std::to_chars(text, text + BUFFER_SIZE - 8, value, std::chars_format::fixed, format.decimals);
+    if(error != std::errc{}) {
+        std::cerr << "Value out of range for " << GetName() << std::endl;
+        return;
+    }
+    *end++ = ' ';
+    for(const char* unit = UNITS[size_t(GetType())]; *unit; ) {
+        *end++ = *unit++;
+    }
+    std::lock_guard lock{mtx_};
+    value_ = value;
+    if(string_view{text, size_t(end - text)} == formattedValue_) {
+        return;
+    }
+    formattedValue_.assign(text, end);
+    version_.fetch_add(1, std::memory_order_release);
+}
+
+namespace {
+
+    constexpr size_t CACHE_CAPACITY = 32 * 1024;
+    // Sprites kept per sensor line, the current value and a few recent ones
+    constexpr size_t CACHED_VALUES = 4;
+    constexpr size_t MAX_LINE_LENGTH = 16;
+
+}
+
+SensorHub::SensorHub(const Options& options, BaseWidget& widget) : WidgetWrapper{widget}, sensors_{},
+    cache_{CACHE_CAPACITY}
+{
     const Node sensorsNode = GetSensorsNode(options);
+    font_ = LoadFont(options, sensorsNode);
+    sensorsRoot_ = GetSensorsRoot(sensorsNode);
+    // The hub wide interval is called period
+    timing_ = GetTiming(sensorsNode, "period", Sensor::Timing{});
     PositionType startPosition = GetPosition(sensorsNode);
-    InitSensors(sensorsNode, startPosition);
-    pollThd_ = std::thread{&SensorHub::PollThread, this};
-    pollThd_.detach();
+    InitSensors(sensorsNode, startPosition, options.GetCache());
+    for(Sensor& sensor : sensors_) {
+        positions_.push_back(sensor.GetPosition());
+        colors_.push_back(sensor.GetColor());
+    }
+    cache_ = SpriteCache{GetCacheCapacity()};
+    restartSettings_ = GetRestartSettings(sensorsNode);
+    if(sensorsNode["stream"].as<bool>(false)) {
+        InitStreams(sensorsNode);
+    }
+    // The history is refilled before Start lets the readers add to it
+    InitStore(options, sensorsNode);
 }
 
-void SensorHub::PollThread() {
-    while(true) {
-        for(auto& sensor : sensors_) {
-            sensor.ReadValue();
+// Sensors of the same interval come due in one wakeup. A read longer than the interval skips the
+// expirations it missed
+void SensorHub::Start(Reactor& reactor) {
+    for(auto& sensor : sensors_) {
+        if(sensor.IsStreamed()) {
+            continue;
         }
+        Reader& reader = readers_.emplace_back(*this, sensor);
+        const string source = string{sensor.GetName()} + "/" + sensor.GetChannel();
+        reactor.AddTimer(source, sensor.GetTiming().interval, [&reader](uint64_t) { reader.Request(); });
+    }
+    for(auto& stream : streams_) {
+        WatchStream(reactor, stream);
+    }
+}
+
+void SensorHub::WatchStream(Reactor& reactor, Stream& stream) {
+    const int fd = stream.buffer.GetFd();
+    const uint32_t opens = stream.buffer.GetOpens();
+    reactor.AddFd(stream.sensors.front()->GetSensorPath().filename().string(), fd, EPOLLIN,
+                  [this, &reactor, &stream, fd, opens](uint32_t events) {
+        const bool updated = ReadStream(stream);
+        if(updated) {
+            RequestUpdate();
+        }
+        // Closing the old fd took it out of the epoll
+        if(stream.buffer.GetOpens() != opens) {
+            WatchStream(reactor, stream);
+        }
+        // A device that went away would keep the fd ready for good, its sensors keep the last values
+        else if(!updated && (events & (EPOLLERR | EPOLLHUP))) {
+            std::cerr << "SensorHub -> Stream of " << stream.sensors.front()->GetName() << " closed" << std::endl;
+            reactor.RemoveFd(fd);
+        }
+    });
+}
+
+void SensorHub::ReadSensor(Sensor& sensor) {
+    const uint32_t version = sensor.GetVersion();
+    sensor.ReadValue();
+    if(sensor.GetVersion() != version) {
         RequestUpdate();
-        std::this_thread::sleep_for(10s);
+    }
+}
+
+SensorHub::Reader::Reader(SensorHub& hub, Sensor& sensor) : hub_{hub}, sensor_{sensor},
+    thread_{&Reader::Run, this}
+{ }
+
+SensorHub::Reader::~Reader() {
+    {
+        std::lock_guard lock{mtx_};
+        stop_ = true;
+    }
+    cv_.notify_one();
+    thread_.join();
+}
+
+void SensorHub::Reader::Request() {
+    {
+        std::lock_guard lock{mtx_};
+        due_ = true;
+    }
+    cv_.notify_one();
+}
+
+void SensorHub::Reader::Run() {
+    std::unique_lock lock{mtx_};
+    while(true) {
+        cv_.wait(lock, [this] { return due_ || stop_; });
+        if(stop_) {
+            return;
+        }
+        due_ = false;
+        lock.unlock();
+        hub_.ReadSensor(sensor_);
+        lock.lock();
+    }
+}
+
+// Scans arrive in batches at the trigger rate, the latest one is shown
+bool SensorHub::ReadStream(Stream& stream) {
+    try {
+        if(!stream.buffer.Read()) {
+            return false;
+        }
+    } catch(const std::exception& e) {
+        std::cerr << e.what() << std::endl;
+        return false;
+    }
+    for(size_t channel = 0; channel < stream.sensors.size(); ++channel) {
+        stream.sensors[channel]->SetRawValue(double(stream.buffer.GetValue(channel)));
+    }
+    return true;
+}
+
+// Devices without a usable buffer stay polled
+void SensorHub::InitStreams(const Node& sensorsNode)
+{
+    const Path devRoot = sensorsNode["dev"].as<string>("/dev");
+    const string trigger = sensorsNode["trigger"].as<string>("");
+    std::map<Path, std::vector<Sensor*>> devices;
+    for(auto& sensor : sensors_) {
+        devices[sensor.GetSensorPath()].push_back(&sensor);
+    }
+    for(auto& [device, sensors] : devices) {
+        std::vector<string> channels;
+        for(Sensor* sensor : sensors) {
+            channels.push_back(sensor->GetChannel());
+        }
+        try {
+            streams_.emplace_back(device, devRoot / device.filename(), channels, trigger, sensors);
+        } catch(const std::exception& e) {
+            std::cerr << "Polling " << device.filename().c_str() << ": " << e.what() << std::endl;
+            continue;
+        }
+        for(Sensor* sensor : sensors) {
+            sensor->SetStreamed();
+        }
     }
 }
 
@@ -75,15 +378,178 @@ SensorHub::Node SensorHub::GetSensorsNode(const Options& options)
     return *optionalNode;
 }
 
-void SensorHub::InitFont(const Options& options, const Node& sensorsNode)
+FontPtr SensorHub::LoadFont(const Options& options, const Node& sensorsNode)
 {
     const string fontFile = sensorsNode["font"].as<string>();
-    Path fontPath = options.GetExecDir() / fontFile;
-    if(!font_.LoadFont(fontPath.c_str())) {
-        throw invalid_argument("Couldn't load font "s + fontPath.c_str());
+    FontPtr font = ::LoadFont(options, fontFile);
+    if(!font) {
+        throw invalid_argument("Couldn't load font "s + fontFile);
+    }
+    return font;
+}
+
+// The working set must fit, otherwise every frame would rasterize again
+size_t SensorHub::GetCacheCapacity() const
+{
+    const size_t lineBytes = size_t(std::max(font_->height(), 1)) * MAX_LINE_LENGTH
+                             * size_t(std::max(font_->CharacterWidth('0'), 1)) * SoftCanvas::BYTES_PER_PIXEL;
+    return std::max(CACHE_CAPACITY, lineBytes * CACHED_VALUES * sensors_.size());
+}
+
+// Everything but the font, the position and the colors, as emitted text
+SensorHub::string SensorHub::GetRestartSettings(const Node& sensorsNode)
+{
+    Node settings{YAML::NodeType::Map};
+    for(const auto& item : sensorsNode) {
+        const string key = item.first.as<string>();
+        if(key == "font" || key == "position" || item.second.IsSequence()) {
+            continue;
+        }
+        if(!item.second.IsMap()) {
+            settings[key] = YAML::Clone(item.second);
+            continue;
+        }
+        Node sensorSettings = YAML::Clone(item.second);
+        sensorSettings.remove("color");
+        settings[key] = sensorSettings;
+    }
+    return YAML::Dump(settings);
+}
+
+// Sensors keep their order and lines, only where and how they are drawn changes
+void SensorHub::Reconfigure(const Options& options)
+{
+    const Node sensorsNode = GetSensorsNode(options);
+    if(GetRestartSettings(sensorsNode) != restartSettings_) {
+        std::cerr << "SensorHub -> Changes to the sensor discovery, timing, streaming or history apply after a restart"
+                  << std::endl;
+    }
+    auto layout = std::make_unique<Layout>();
+    layout->font = LoadFont(options, sensorsNode);
+    PositionType position = GetPosition(sensorsNode);
+    try {
+        for(Sensor& sensor : sensors_) {
+            const Node sensorNode = sensorsNode[string{sensor.GetName()}];
+            Color color = sensor.GetColor();
+            if(sensorNode.IsMap()) {
+                color = sensorNode["color"].as<Color>();
+            }
+            else if(sensorNode.IsDefined()) {
+                color = sensorNode.as<Color>();
+            }
+            layout->positions.push_back(position);
+            layout->colors.push_back(color);
+            position[1] += layout->font->height();
+        }
+    } catch(const YAML::TypedBadConversion<uint32_t>&) {
+        throw invalid_argument{"Error reading color from yaml"};
+    }
+    {
+        std::lock_guard lock{pendingMtx_};
+        pending_ = std::move(layout);
+    }
+    RequestUpdate();
+}
+
+SensorHub::Path SensorHub::GetSensorsRoot(const Node& sensorsNode)
+{
+    try {
+        return sensorsNode["root"].as<string>(string{SENSORS_ROOT});
+    } catch(const YAML::TypedBadConversion<string>&) {
+        throw invalid_argument{"Reading sensors root failed"};
     }
 }
 
+void SensorHub::RegisterMetrics(MetricsRegistry& registry)
+{
+    for(Sensor& sensor : sensors_) {
+        const string labels = "sensor=\"" + string{sensor.GetName()} + '/' + sensor.GetChannel() + '"';
+        registry.AddHistogram("piclock_sensor_read_seconds", "Duration of a sensor read, failed ones included",
+                              labels, sensor.GetReadLatency());
+        registry.AddCounter("piclock_sensor_reads_total", "Sensor reads started", labels, [&sensor] {
+            return double(sensor.GetReadStats().reads);
+        });
+        registry.AddCounter("piclock_sensor_read_failures_total", "Sensor reads that returned no value", labels, [&sensor] {
+            return double(sensor.GetReadStats().failures);
+        });
+        registry.AddCounter("piclock_sensor_read_timeouts_total", "Sensor values dropped for taking longer than the timeout",
+                            labels, [&sensor] {
+            return double(sensor.GetReadStats().timeouts);
+        });
+        registry.AddGauge("piclock_sensor_read_stalled", "1 while a read runs past the timeout", labels, [&sensor] {
+            return double(sensor.GetReadStats().stalled);
+        });
+    }
+}
+
+// Keyed by device and channel, the samples stay with a sensor however the devices get numbered
+void SensorHub::InitStore(const Options& options, const Node& sensorsNode)
+{
+    const Node storeNode = sensorsNode["history"];
+    if(!storeNode) {
+        return;
+    }
+    SampleStore::Config config;
+    try {
+        config.directory = options.GetExecDir() / storeNode["dir"].as<string>("history");
+        config.segmentBytes = storeNode["segment"].as<size_t>(config.segmentBytes / 1024) * 1024;
+        config.maxBytes = storeNode["max_size"].as<size_t>(config.maxBytes / 1024) * 1024;
+    } catch(const YAML::BadConversion&) {
+        throw invalid_argument{"Reading history failed"};
+    }
+    config.flushInterval = GetDuration(storeNode, "flush", config.flushInterval);
+    try {
+        store_ = std::make_unique<SampleStore>(config);
+    } catch(const SampleStore::runtime_error& e) {
+        // The clock is still of use without the history
+        std::cerr << e.what() << std::endl;
+        return;
+    }
+
+    std::map<uint32_t, std::vector<HistorySample>> samples;
+    std::vector<uint32_t> keys;
+    for(Sensor& sensor : sensors_) {
+        keys.push_back(SampleStore::GetKey(string{sensor.GetName()} + '/' + sensor.GetChannel()));
+        samples[keys.back()];
+    }
+    // As far back as the coarsest tier holds
+    const int64_t since = time(nullptr) - SensorHistory::GetPeriod(HistoryTier::HOUR) * int64_t(SensorHistory::CAPACITY);
+    size_t restored = 0;
+    store_->Load(since, [&](uint32_t sensor, int64_t time, float value) {
+        if(auto it = samples.find(sensor); it != samples.end()) {
+            it->second.push_back({time, value});
+            ++restored;
+        }
+    });
+    for(size_t i = 0; i < sensors_.size(); ++i) {
+        sensors_[i].GetHistory().Restore(samples[keys[i]]);
+        sensors_[i].SetStore(store_.get(), keys[i]);
+    }
+    std::cout << "Restored " << restored << " sensor samples from " << config.directory << std::endl;
+}
+
+Sensor::Duration SensorHub::GetDuration(const Node& node, const char* key, Sensor::Duration fallback)
+{
+    if(!node[key]) {
+        return fallback;
+    }
+    try {
+        const double seconds = node[key].as<double>();
+        if(seconds <= 0) {
+            throw invalid_argument{key + " must be positive"s};
+        }
+        return std::chrono::duration_cast<Sensor::Duration>(std::chrono::duration<double>{seconds});
+    } catch(const YAML::TypedBadConversion<double>&) {
+        throw invalid_argument{"Reading "s + key + " failed"};
+    }
+}
+
+// Seconds, fractions allowed
+Sensor::Timing SensorHub::GetTiming(const Node& node, const char* intervalKey, const Sensor::Timing& fallback)
+{
+    return { GetDuration(node, intervalKey, fallback.interval), GetDuration(node, "timeout", fallback.timeout) };
+}
+
 PositionType SensorHub::GetPosition(const Node& sensorsNode)
 {
     try {
@@ -93,18 +559,21 @@ PositionType SensorHub::GetPosition(const Node& sensorsNode)
     }
 }
 
-void SensorHub::InitSensors(const Node& sensorsNode, PositionType position)
+void SensorHub::InitSensors(const Node& sensorsNode, PositionType position, WarmCache* cache)
 {
     try{
-        for(const auto& [name, path] : GetAvailableSensors()) {
+        for(const auto& [name, path] : GetAvailableSensors(cache)) {
             std::cout << name << "   " << path.c_str() << std::endl;
             for(const auto& desc : DESCRIPTORS) {
                 if (desc.sensorName == name) {
-                    Color color = sensorsNode[name].as<Color>();
+                    // Either just the color or a map with the color and the timing
+                    const Node sensorNode = sensorsNode[name];
+                    Color color = sensorNode.IsMap() ? sensorNode["color"].as<Color>() : sensorNode.as<Color>();
+                    const Sensor::Timing timing = sensorNode.IsMap() ? GetTiming(sensorNode, "interval", timing_) : timing_;
                     auto tempDesc = desc;
                     tempDesc.sensorPath = path;
-                    sensors_.emplace_back(tempDesc, position, color);
-                    position[1] += font_.height();
+                    sensors_.emplace_back(tempDesc, position, color, timing);
+                    position[1] += font_->height();
                 }
             }
         }
@@ -113,24 +582,76 @@ void SensorHub::InitSensors(const Node& sensorsNode, PositionType position)
     }
 }
 
-void SensorHub::Draw(rgb_matrix::FrameCanvas* canvas) {
-    static constexpr size_t letterSpacing = 0;
-    for(auto& sensor : sensors_) {
-        auto& [xPos, yPos] = sensor.GetPosition();
-        Color color = sensor.GetColor();
-        string value = sensor.GetFormattedValue();
-        rgb_matrix::DrawText(canvas, font_, xPos, yPos + font_.baseline(),
-                color, nullptr, value.data(), letterSpacing);
+bool SensorHub::Update() {
+    values_.resize(sensors_.size());
+    versions_.resize(sensors_.size());
+    bool changed = false;
+    std::unique_ptr<Layout> layout;
+    {
+        std::lock_guard lock{pendingMtx_};
+        layout = std::move(pending_);
+    }
+    if(layout) {
+        font_ = std::move(layout->font);
+        positions_ = std::move(layout->positions);
+        colors_ = std::move(layout->colors);
+        cache_ = SpriteCache{GetCacheCapacity()};
+        changed = true;
+    }
+    for(size_t i = 0; i < sensors_.size(); ++i) {
+        if(uint32_t version = sensors_[i].GetVersion(); version != versions_[i]) {
+            versions_[i] = version;
+            values_[i] = sensors_[i].GetFormattedValue();
+            changed = true;
+        }
+    }
+    return changed;
+}
+
+void SensorHub::Draw(rgb_matrix::Canvas* canvas) {
+    bounds_ = {};
+    for(size_t i = 0; i < sensors_.size(); ++i) {
+        auto& [xPos, yPos] = positions_[i];
+        const Sprite& sprite = cache_.Get(*font_, values_[i], colors_[i]);
+        sprite.Blit(canvas, xPos, yPos);
+        bounds_ = bounds_.Union({xPos, yPos, sprite.width(), sprite.height()});
     }
 }
 
-SensorHub::PathMap SensorHub::GetAvailableSensors() {
+Rect SensorHub::GetBounds() const {
+    return bounds_;
+}
+
+// Warm, only the name files of the devices found before are read, as long as the root lists the same entries
+SensorHub::PathMap SensorHub::GetAvailableSensors(WarmCache* cache) {
     PathMap result;
-    for(const Path& dir : dir_iterator{SENSORS_ROOT}) {
-        if(string name = GetSensorName(dir); !name.empty()) {
-            result[name] = dir;
+    std::error_code ec;
+    dir_iterator sensorsDir{sensorsRoot_, ec};
+    if(ec) {
+        std::cerr << "No sensors available: " << ec.message() << std::endl;
+        return result;
+    }
+    std::vector<string> entries;
+    for(const Path& dir : sensorsDir) {
+        entries.push_back(dir.filename().string());
+    }
+    std::sort(entries.begin(), entries.end());
+    if(cache) {
+        // IIO device numbers follow the probe order, a renumbered device fails the check
+        const auto cached = cache->GetSensors(sensorsRoot_, entries);
+        if(cached && std::all_of(cached->begin(), cached->end(),
+                                 [this](const auto& sensor) { return GetSensorName(sensor.second) == sensor.first; })) {
+            return *cached;
         }
     }
+    for(const string& entry : entries) {
+        if(string name = GetSensorName(sensorsRoot_ / entry); !name.empty()) {
+            result[name] = sensorsRoot_ / entry;
+        }
+    }
+    if(cache) {
+        cache->SetSensors(sensorsRoot_, entries, result);
+    }
     return result;
 }
 
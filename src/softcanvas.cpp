@@ -0,0 +1,84 @@
+/*
+ * Copyright (c) 2019 Dmytro Shestakov
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "softcanvas.h"
+#include "pixelkernels.h"
+#include <algorithm>
+#include <cstring>
+
+SoftCanvas::SoftCanvas(int width, int height) : width_{width}, height_{height},
+    pixels_(size_t(width) * size_t(height) * BYTES_PER_PIXEL)
+{ }
+
+void SoftCanvas::Clear() {
+    std::fill(pixels_.begin(), pixels_.end(), 0);
+}
+
+void SoftCanvas::Fill(uint8_t red, uint8_t green, uint8_t blue) {
+    pixel::Fill(pixels_.data(), size_t(width_) * size_t(height_), red, green, blue);
+}
+
+void SoftCanvas::Fill(const Rect& rect, uint8_t red, uint8_t green, uint8_t blue) {
+    const Rect area = rect.Intersect(GetRect());
+    if(area.IsEmpty()) {
+        return;
+    }
+    for(int y = area.y; y < area.Bottom(); ++y) {
+        pixel::Fill(&pixels_[(size_t(y) * size_t(width_) + size_t(area.x)) * BYTES_PER_PIXEL], size_t(area.width),
+                    red, green, blue);
+    }
+}
+
+void SoftCanvas::Composite(const SoftCanvas& layer, const Rect& rect) {
+    const Rect area = rect.Intersect(GetRect()).Intersect(layer.GetRect());
+    if(area.IsEmpty()) {
+        return;
+    }
+    for(int y = area.y; y < area.Bottom(); ++y) {
+        pixel::Composite(&pixels_[(size_t(y) * size_t(width_) + size_t(area.x)) * BYTES_PER_PIXEL],
+                         layer.GetPixel(area.x, y), size_t(area.width));
+    }
+}
+
+void SoftCanvas::Copy(const SoftCanvas& source, const Rect& rect) {
+    const Rect area = rect.Intersect(GetRect()).Intersect(source.GetRect());
+    if(area.IsEmpty()) {
+        return;
+    }
+    for(int y = area.y; y < area.Bottom(); ++y) {
+        memcpy(&pixels_[(size_t(y) * size_t(width_) + size_t(area.x)) * BYTES_PER_PIXEL], source.GetPixel(area.x, y),
+               size_t(area.width) * BYTES_PER_PIXEL);
+    }
+}
+
+bool SoftCanvas::Equals(const SoftCanvas& other, const Rect& rect) const {
+    const Rect area = rect.Intersect(GetRect()).Intersect(other.GetRect());
+    if(area.IsEmpty()) {
+        return true;
+    }
+    for(int y = area.y; y < area.Bottom(); ++y) {
+        if(memcmp(GetPixel(area.x, y), other.GetPixel(area.x, y), size_t(area.width) * BYTES_PER_PIXEL)) {
+            return false;
+        }
+    }
+    return true;
+}
@@ -0,0 +1,132 @@
+/*
+ * Copyright (c) 2019 Dmytro Shestakov
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "spritecache.h"
+#include <algorithm>
+#include <cstring>
+
+Sprite::Sprite(const FontFace& font, const std::string& text, const rgb_matrix::Color& color) :
+    width_{std::max(font.TextWidth(text.data()), 0)},
+    height_{std::max(font.height(), 0)}
+{
+    SoftCanvas canvas{width_, height_};
+    font.DrawText(&canvas, 0, font.baseline(), color, text.data());
+    pixels_.assign(canvas.Data(), canvas.Data() + canvas.Size());
+    for(int y = 0; y < height_; ++y) {
+        for(int x = 0; x < width_; ) {
+            const uint8_t* pixel = canvas.GetPixel(x, y);
+            if(!(pixel[0] | pixel[1] | pixel[2])) {
+                ++x;
+                continue;
+            }
+            Run run{uint16_t(y), uint16_t(x), 0};
+            for(; x < width_; ++x, ++run.length) {
+                pixel = canvas.GetPixel(x, y);
+                if(!(pixel[0] | pixel[1] | pixel[2])) {
+                    break;
+                }
+            }
+            runs_.push_back(run);
+        }
+    }
+    runs_.shrink_to_fit();
+}
+
+void Sprite::Blit(rgb_matrix::Canvas* canvas, int x, int y) const {
+    SoftCanvas* softCanvas = dynamic_cast<SoftCanvas*>(canvas);
+    if(softCanvas && x >= 0 && y >= 0 && x + width_ <= softCanvas->width() && y + height_ <= softCanvas->height()) {
+        for(const Run& run : runs_) {
+            const size_t offset = (size_t(run.row) * size_t(width_) + run.x) * SoftCanvas::BYTES_PER_PIXEL;
+            std::memcpy(softCanvas->Data() + size_t(y + run.row) * softCanvas->Stride() + size_t(x + run.x) * SoftCanvas::BYTES_PER_PIXEL,
+                        &pixels_[offset], size_t(run.length) * SoftCanvas::BYTES_PER_PIXEL);
+        }
+        return;
+    }
+    for(const Run& run : runs_) {
+        const uint8_t* pixel = &pixels_[(size_t(run.row) * size_t(width_) + run.x) * SoftCanvas::BYTES_PER_PIXEL];
+        for(int i = 0; i < run.length; ++i, pixel += SoftCanvas::BYTES_PER_PIXEL) {
+            canvas->SetPixel(x + run.x + i, y + run.row, pixel[0], pixel[1], pixel[2]);
+        }
+    }
+}
+
+void Sprite::Blit(rgb_matrix::Canvas* canvas, int x, int y, const Rect& clip) const {
+    SoftCanvas* softCanvas = dynamic_cast<SoftCanvas*>(canvas);
+    const Rect area = clip.Intersect({x, y, width_, height_}).Intersect({0, 0, canvas->width(), canvas->height()});
+    if(area.IsEmpty()) {
+        return;
+    }
+    for(const Run& run : runs_) {
+        const int row = y + run.row;
+        const int left = std::max(x + run.x, area.x);
+        const int right = std::min(x + run.x + run.length, area.Right());
+        if(row < area.y || row >= area.Bottom() || left >= right) {
+            continue;
+        }
+        const uint8_t* pixel = &pixels_[(size_t(run.row) * size_t(width_) + size_t(left - x)) * SoftCanvas::BYTES_PER_PIXEL];
+        if(softCanvas) {
+            std::memcpy(softCanvas->Data() + size_t(row) * softCanvas->Stride() + size_t(left) * SoftCanvas::BYTES_PER_PIXEL,
+                        pixel, size_t(right - left) * SoftCanvas::BYTES_PER_PIXEL);
+            continue;
+        }
+        for(int column = left; column < right; ++column, pixel += SoftCanvas::BYTES_PER_PIXEL) {
+            canvas->SetPixel(column, row, pixel[0], pixel[1], pixel[2]);
+        }
+    }
+}
+
+SpriteCache::SpriteCache(size_t capacityBytes) : capacity_{capacityBytes}
+{ }
+
+const Sprite& SpriteCache::Get(const FontFace& font, const std::string& text, const rgb_matrix::Color& color) {
+    Key key{&font, text, uint32_t(color.r) << 16 | uint32_t(color.g) << 8 | color.b};
+    if(auto it = index_.find(key); it != index_.end()) {
+        ++stats_.hits;
+        entries_.splice(entries_.begin(), entries_, it->second);
+        return it->second->second;
+    }
+    ++stats_.misses;
+    entries_.emplace_front(key, Sprite{font, text, color});
+    index_.emplace(std::move(key), entries_.begin());
+    stats_.bytes += entries_.front().second.GetBytes();
+    Evict();
+    stats_.entries = entries_.size();
+    return entries_.front().second;
+}
+
+void SpriteCache::Clear() {
+    index_.clear();
+    entries_.clear();
+    stats_.entries = 0;
+    stats_.bytes = 0;
+}
+
+// The newest entry is kept even if it alone exceeds the capacity
+void SpriteCache::Evict() {
+    while(stats_.bytes > capacity_ && entries_.size() > 1) {
+        const Entry& entry = entries_.back();
+        stats_.bytes -= entry.second.GetBytes();
+        index_.erase(entry.first);
+        entries_.pop_back();
+        ++stats_.evictions;
+    }
+}
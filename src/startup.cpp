@@ -0,0 +1,110 @@
+/*
+ * Copyright (c) 2019 Dmytro Shestakov
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "startup.h"
+#include <time.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <iterator>
+#include <sstream>
+#include <string>
+
+using std::chrono::duration;
+
+namespace {
+
+    // Loading and relocating the shared libraries happens before main, /proc only has it in clock ticks
+    double GetMillisecondsBeforeMain()
+    {
+        std::ifstream file{"/proc/self/stat"};
+        std::string stat{std::istreambuf_iterator<char>{file}, {}};
+        const size_t commEnd = stat.rfind(')');
+        if(commEnd == std::string::npos) {
+            return -1;
+        }
+        // The fields after the command name start with the third one, the start time is the 22nd
+        std::istringstream fields{stat.substr(commEnd + 1)};
+        std::string field;
+        for(int i = 3; i <= 22 && fields >> field; ++i)
+        { }
+        const long ticksPerSecond = sysconf(_SC_CLK_TCK);
+        timespec now;
+        if(!fields || ticksPerSecond <= 0 || clock_gettime(CLOCK_BOOTTIME, &now)) {
+            return -1;
+        }
+        const double started = double(std::stoull(field)) / double(ticksPerSecond);
+        return std::max((double(now.tv_sec) + double(now.tv_nsec) * 1e-9 - started) * 1e3, 0.0);
+    }
+
+    double ToMilliseconds(StartupProfile::clock::duration time)
+    {
+        return duration<double, std::milli>{time}.count();
+    }
+
+}
+
+StartupProfile::Phase::Phase(StartupProfile& profile, const char* name) : profile_{profile}, name_{name},
+    start_{clock::now()}
+{ }
+
+StartupProfile::Phase::~Phase()
+{
+    profile_.Add(name_, start_, clock::now());
+}
+
+StartupProfile::StartupProfile() : start_{clock::now()}, finished_{}
+{ }
+
+void StartupProfile::Add(const char* name, clock::time_point start, clock::time_point end)
+{
+    std::lock_guard lock{mtx_};
+    entries_.push_back({name, start, end});
+}
+
+void StartupProfile::Finish(std::ostream& out)
+{
+    std::lock_guard lock{mtx_};
+    if(finished_) {
+        return;
+    }
+    finished_ = true;
+    std::sort(entries_.begin(), entries_.end(), [](const Entry& a, const Entry& b) { return a.start < b.start; });
+    clock::time_point end = start_;
+    char line[96];
+    out << "Startup, ms after main:\n";
+    for(const Entry& entry : entries_) {
+        snprintf(line, sizeof(line), "  %-12s %8.1f +%8.1f\n", entry.name, ToMilliseconds(entry.start - start_),
+                 ToMilliseconds(entry.end - entry.start));
+        out << line;
+        end = std::max(end, entry.end);
+    }
+    if(const double beforeMain = GetMillisecondsBeforeMain(); beforeMain >= 0) {
+        // The process age is taken now, the time spent in main so far is not part of it
+        const double inMain = ToMilliseconds(clock::now() - start_);
+        snprintf(line, sizeof(line), "  %-12s %8.0f ms before main\n", "loader", std::max(beforeMain - inMain, 0.0));
+        out << line;
+    }
+    snprintf(line, sizeof(line), "First frame after %.1f ms\n", ToMilliseconds(end - start_));
+    out << line << std::flush;
+}
@@ -0,0 +1,191 @@
+/*
+ * Copyright (c) 2019 Dmytro Shestakov
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "ticker.h"
+
+#include <iostream>
+
+using std::string;
+using namespace std::string_literals;
+
+TickerWidget::TickerWidget(const Options& options, BaseWidget& widget) : TickerWidget{widget, LoadSettings(options)}
+{ }
+
+TickerWidget::TickerWidget(BaseWidget& widget, Settings&& settings) : WidgetWrapper{widget},
+    frameClock_{FrameClock::Config{settings.rate}}
+{
+    Apply(std::move(settings));
+}
+
+TickerWidget::Settings TickerWidget::LoadSettings(const Options& options)
+{
+    Settings settings;
+    try {
+        OptionalNode optionalNode = options.GetNode("ticker");
+        if(!optionalNode) {
+            throw std::invalid_argument("Configuration node not found");
+        }
+        Node tickerNode = *optionalNode;
+        const string fontFile = tickerNode["font"].as<string>();
+        settings.font = LoadFont(options, fontFile);
+        if(!settings.font) {
+            throw invalid_argument("Couldn't load font "s + fontFile);
+        }
+        const auto position = tickerNode["position"].as<PositionType>();
+        settings.rect = {position[0], position[1], tickerNode["width"].as<int>(), settings.font->height()};
+        if(settings.rect.IsEmpty()) {
+            throw std::invalid_argument("Empty ticker area");
+        }
+        settings.color = tickerNode["color"].as<Color>();
+        settings.text = tickerNode["text"].as<string>("");
+        settings.speed = tickerNode["speed"].as<double>(30);
+        settings.gap = tickerNode["gap"].as<int>(24);
+        settings.rate = tickerNode["rate"].as<unsigned>(50);
+        if(settings.speed <= 0 || !settings.rate) {
+            throw std::invalid_argument("Speed and rate must be positive");
+        }
+    } catch(const YAML::TypedBadConversion<string>&) {
+        throw invalid_argument{"Error reading font or text from yaml"};
+    } catch(const YAML::TypedBadConversion<int32_t>&) {
+        throw invalid_argument{"Error reading position, width or gap from yaml"};
+    } catch(const YAML::TypedBadConversion<uint32_t>&) {
+        throw invalid_argument{"Error reading color or rate from yaml"};
+    } catch(const YAML::TypedBadConversion<double>&) {
+        throw invalid_argument{"Error reading speed from yaml"};
+    } catch(const std::invalid_argument& e) {
+        throw invalid_argument{e.what()};
+    }
+    return settings;
+}
+
+void TickerWidget::Apply(Settings&& settings)
+{
+    if(settings.rate != frameClock_.GetRate()) {
+        std::cerr << "The ticker rate applies after a restart" << std::endl;
+    }
+    font_ = std::move(settings.font);
+    rect_ = settings.rect;
+    color_ = settings.color;
+    text_ = std::move(settings.text);
+    speed_ = settings.speed;
+    gap_ = std::max(settings.gap, 0);
+    restart_ = true;
+}
+
+void TickerWidget::Reconfigure(const Options& options)
+{
+    auto settings = std::make_unique<Settings>(LoadSettings(options));
+    {
+        std::lock_guard lock{pendingMtx_};
+        pending_ = std::move(settings);
+    }
+    RequestUpdate();
+}
+
+void TickerWidget::SetText(string text)
+{
+    {
+        std::lock_guard lock{pendingMtx_};
+        pendingText_ = std::move(text);
+    }
+    RequestUpdate();
+}
+
+// Rasterizes the text and schedules the first frame if it doesn't fit
+void TickerWidget::Restart()
+{
+    strip_.reset();
+    if(!text_.empty()) {
+        strip_.emplace(*font_, text_, color_);
+    }
+    offset_ = 0;
+    if(!IsScrolling()) {
+        frameClock_.Stop();
+        return;
+    }
+    frameClock_.Start(FrameClock::clock::now());
+    ScheduleUpdate(frameClock_.GetNextFrame());
+}
+
+bool TickerWidget::Update()
+{
+    std::unique_ptr<Settings> settings;
+    std::optional<string> text;
+    {
+        std::lock_guard lock{pendingMtx_};
+        settings = std::move(pending_);
+        text.swap(pendingText_);
+    }
+    if(settings) {
+        Apply(std::move(*settings));
+    }
+    if(text) {
+        text_ = std::move(*text);
+        restart_ = true;
+    }
+    if(restart_) {
+        restart_ = false;
+        Restart();
+        return true;
+    }
+    if(!frameClock_.IsRunning()) {
+        return false;
+    }
+    const uint64_t ticks = frameClock_.Advance(FrameClock::clock::now());
+    // Also when woken before the slot, a wall clock set forward brings the deadline in early
+    ScheduleUpdate(frameClock_.GetNextFrame());
+    if(!ticks) {
+        return false;
+    }
+    // The offset follows the ticks, late frames jump ahead instead of slowing the text down
+    const int64_t lap = strip_->width() + gap_;
+    const int offset = int(int64_t(double(frameClock_.GetTick()) * speed_ / frameClock_.GetRate()) % lap);
+    if(offset == offset_) {
+        return false;
+    }
+    offset_ = offset;
+    return true;
+}
+
+void TickerWidget::Draw(Canvas* canvas)
+{
+    bounds_ = rect_;
+    if(!strip_) {
+        return;
+    }
+    if(!IsScrolling()) {
+        strip_->Blit(canvas, rect_.x, rect_.y, rect_);
+        return;
+    }
+    const int lap = strip_->width() + gap_;
+    for(int x = rect_.x - offset_; x < rect_.Right(); x += lap) {
+        strip_->Blit(canvas, x, rect_.y, rect_);
+    }
+}
+
+Rect TickerWidget::GetBounds() const
+{
+    return bounds_;
+}
+
+TickerWidget::invalid_argument::invalid_argument(const string& msg) : std::invalid_argument{"TickerWidget -> " + msg}
+{ }
@@ -0,0 +1,430 @@
+/*
+ * Copyright (c) 2019 Dmytro Shestakov
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "warmcache.h"
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+#include <type_traits>
+
+using std::string;
+using std::lock_guard;
+
+namespace {
+
+    constexpr char MAGIC[8] = "PCLKWC1";
+    // Raised with any change of the payload layout, FontTable included
+    constexpr uint32_t VERSION = 1;
+
+    struct Header {
+        char magic[8];
+        uint32_t version;
+        uint32_t size;      // payload bytes following the header
+        uint32_t check;     // FNV-1a of the payload
+        uint32_t reserved;
+    };
+
+    static_assert(sizeof(TableGlyph) == 20, "The cache layout changed, raise VERSION");
+
+    uint32_t Fnv1a(const void* data, size_t size)
+    {
+        uint32_t hash = 2166136261u;
+        for(const uint8_t* byte = static_cast<const uint8_t*>(data); size--; ++byte) {
+            hash = (hash ^ *byte) * 16777619u;
+        }
+        return hash;
+    }
+
+    class Writer {
+    public:
+        template<typename T>
+        void Put(const T& value)
+        {
+            PutArray(&value, 1);
+        }
+
+        template<typename T>
+        void PutArray(const T* values, size_t count)
+        {
+            static_assert(std::is_trivially_copyable_v<T>);
+            const char* bytes = reinterpret_cast<const char*>(values);
+            data_.insert(data_.end(), bytes, bytes + count * sizeof(T));
+        }
+
+        template<typename T>
+        void PutVector(const std::vector<T>& values)
+        {
+            Put(uint32_t(values.size()));
+            PutArray(values.data(), values.size());
+        }
+
+        void PutString(const string& value)
+        {
+            Put(uint32_t(value.size()));
+            PutArray(value.data(), value.size());
+        }
+
+        std::vector<char>& GetData()
+        {
+            return data_;
+        }
+
+    private:
+        std::vector<char> data_;
+    };
+
+    // Reads fail past the end of the payload, a damaged count stops the parsing instead of allocating
+    class Reader {
+    public:
+        Reader(const char* data, size_t size) : pos_{data}, end_{data + size}
+        { }
+
+        template<typename T>
+        bool Get(T& value)
+        {
+            return GetArray(&value, 1);
+        }
+
+        template<typename T>
+        bool GetArray(T* values, size_t count)
+        {
+            static_assert(std::is_trivially_copyable_v<T>);
+            if(count > size_t(end_ - pos_) / sizeof(T)) {
+                return false;
+            }
+            memcpy(values, pos_, count * sizeof(T));
+            pos_ += count * sizeof(T);
+            return true;
+        }
+
+        template<typename T>
+        bool GetVector(std::vector<T>& values)
+        {
+            uint32_t count;
+            if(!Get(count) || count > size_t(end_ - pos_) / sizeof(T)) {
+                return false;
+            }
+            values.resize(count);
+            return GetArray(values.data(), count);
+        }
+
+        bool GetString(string& value)
+        {
+            uint32_t count;
+            if(!Get(count) || count > size_t(end_ - pos_)) {
+                return false;
+            }
+            value.assign(pos_, count);
+            pos_ += count;
+            return true;
+        }
+
+        bool IsEnd() const
+        {
+            return pos_ == end_;
+        }
+
+    private:
+        const char* pos_;
+        const char* end_;
+    };
+
+    template<typename Map>
+    void EraseUnused(Map& map)
+    {
+        for(auto it = map.begin(); it != map.end(); ) {
+            it = it->second.used ? std::next(it) : map.erase(it);
+        }
+    }
+
+    // The renderer trusts the offsets, so a table that passed the checksum is still checked
+    bool IsValid(const FontTable& table)
+    {
+        for(const TableGlyph& glyph : table.glyphs) {
+            const size_t words = size_t(glyph.height) * ((glyph.width + 31u) / 32u);
+            if(glyph.width && size_t(glyph.offset) + words > table.bitmap.size()) {
+                return false;
+            }
+        }
+        const bool sorted = std::is_sorted(table.glyphs.begin(), table.glyphs.end(),
+            [](const TableGlyph& a, const TableGlyph& b) { return a.codepoint < b.codepoint; });
+        return sorted && std::all_of(table.ascii.begin(), table.ascii.end(),
+            [&](int16_t index) { return index < int(table.glyphs.size()); });
+    }
+
+}
+
+WarmCache::WarmCache(const path& file) : fd_{open(file.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644)},
+    dirty_{}, stats_{}
+{
+    if(fd_ < 0) {
+        throw runtime_error{"Couldn't open " + file.string() + ": " + strerror(errno)};
+    }
+    struct stat status;
+    if(fstat(fd_, &status) || !status.st_size) {
+        return;
+    }
+    std::vector<char> data(size_t(status.st_size));
+    size_t done = 0;
+    while(done < data.size()) {
+        const ssize_t result = pread(fd_, data.data() + done, data.size() - done, off_t(done));
+        if(result <= 0) {
+            break;
+        }
+        done += size_t(result);
+    }
+    if(done != data.size() || !Load(data)) {
+        fonts_.clear();
+        sensors_.clear();
+        std::cerr << "WarmCache -> Discarded an outdated or damaged " << file.string() << std::endl;
+    }
+}
+
+WarmCache::~WarmCache()
+{
+    close(fd_);
+}
+
+bool WarmCache::Load(const std::vector<char>& data)
+{
+    Header header;
+    if(data.size() < sizeof(header)) {
+        return false;
+    }
+    memcpy(&header, data.data(), sizeof(header));
+    const char* payload = data.data() + sizeof(header);
+    if(memcmp(header.magic, MAGIC, sizeof(MAGIC)) || header.version != VERSION
+       || header.size != data.size() - sizeof(header) || header.check != Fnv1a(payload, header.size)) {
+        return false;
+    }
+    Reader reader{payload, header.size};
+    uint32_t count;
+    if(!reader.Get(count)) {
+        return false;
+    }
+    for(uint32_t i = 0; i < count; ++i) {
+        string fontPath;
+        FontEntry entry{};
+        auto table = std::make_shared<FontTable>();
+        int32_t height, baseline;
+        if(!reader.GetString(fontPath) || !reader.Get(entry.mtime) || !reader.Get(entry.size)
+           || !reader.Get(height) || !reader.Get(baseline) || !reader.GetVector(table->glyphs)
+           || !reader.GetVector(table->bitmap) || !reader.GetArray(table->ascii.data(), table->ascii.size())) {
+            return false;
+        }
+        table->height = height;
+        table->baseline = baseline;
+        if(!IsValid(*table)) {
+            return false;
+        }
+        entry.table = std::move(table);
+        fonts_[fontPath] = std::move(entry);
+    }
+    if(!reader.Get(count)) {
+        return false;
+    }
+    for(uint32_t i = 0; i < count; ++i) {
+        string root;
+        SensorEntry entry{};
+        uint32_t entries, sensors;
+        if(!reader.GetString(root) || !reader.Get(entries)) {
+            return false;
+        }
+        for(uint32_t j = 0; j < entries; ++j) {
+            if(!reader.GetString(entry.entries.emplace_back())) {
+                return false;
+            }
+        }
+        if(!reader.Get(sensors)) {
+            return false;
+        }
+        for(uint32_t j = 0; j < sensors; ++j) {
+            string name, sensorPath;
+            if(!reader.GetString(name) || !reader.GetString(sensorPath)) {
+                return false;
+            }
+            entry.sensors[name] = sensorPath;
+        }
+        sensors_[root] = std::move(entry);
+    }
+    return reader.IsEnd();
+}
+
+std::vector<char> WarmCache::Serialize() const
+{
+    Writer writer;
+    writer.Put(Header{});
+    writer.Put(uint32_t(std::count_if(fonts_.begin(), fonts_.end(), [](const auto& font) { return font.second.used; })));
+    for(const auto& [fontPath, entry] : fonts_) {
+        if(!entry.used) {
+            continue;
+        }
+        writer.PutString(fontPath);
+        writer.Put(entry.mtime);
+        writer.Put(entry.size);
+        writer.Put(int32_t(entry.table->height));
+        writer.Put(int32_t(entry.table->baseline));
+        writer.PutVector(entry.table->glyphs);
+        writer.PutVector(entry.table->bitmap);
+        writer.PutArray(entry.table->ascii.data(), entry.table->ascii.size());
+    }
+    writer.Put(uint32_t(std::count_if(sensors_.begin(), sensors_.end(), [](const auto& root) { return root.second.used; })));
+    for(const auto& [root, entry] : sensors_) {
+        if(!entry.used) {
+            continue;
+        }
+        writer.PutString(root);
+        writer.Put(uint32_t(entry.entries.size()));
+        for(const string& name : entry.entries) {
+            writer.PutString(name);
+        }
+        writer.Put(uint32_t(entry.sensors.size()));
+        for(const auto& [name, sensorPath] : entry.sensors) {
+            writer.PutString(name);
+            writer.PutString(sensorPath.string());
+        }
+    }
+    std::vector<char>& data = writer.GetData();
+    Header header{};
+    memcpy(header.magic, MAGIC, sizeof(MAGIC));
+    header.version = VERSION;
+    header.size = uint32_t(data.size() - sizeof(header));
+    header.check = Fnv1a(data.data() + sizeof(header), header.size);
+    memcpy(data.data(), &header, sizeof(header));
+    return std::move(data);
+}
+
+// Parsed without the lock, the clock and the sensors load their fonts at the same time
+FontTablePtr WarmCache::GetFont(const path& fontPath)
+{
+    struct stat status;
+    if(stat(fontPath.c_str(), &status)) {
+        return nullptr;
+    }
+    const int64_t mtime = int64_t(status.st_mtim.tv_sec) * 1000000000 + status.st_mtim.tv_nsec;
+    const string key = fontPath.string();
+    {
+        lock_guard lock{mtx_};
+        if(auto it = fonts_.find(key); it != fonts_.end() && it->second.mtime == mtime
+           && it->second.size == uint64_t(status.st_size)) {
+            it->second.used = true;
+            ++stats_.hits;
+            return it->second.table;
+        }
+    }
+    auto table = std::make_shared<FontTable>();
+    if(!table->ParseBdf(fontPath.c_str())) {
+        return nullptr;
+    }
+    lock_guard lock{mtx_};
+    ++stats_.misses;
+    fonts_[key] = {mtime, uint64_t(status.st_size), table, true};
+    dirty_ = true;
+    return table;
+}
+
+std::optional<WarmCache::SensorPaths> WarmCache::GetSensors(const path& root, const std::vector<string>& entries)
+{
+    lock_guard lock{mtx_};
+    if(auto it = sensors_.find(root.string()); it != sensors_.end() && it->second.entries == entries) {
+        it->second.used = true;
+        ++stats_.hits;
+        return it->second.sensors;
+    }
+    ++stats_.misses;
+    return {};
+}
+
+void WarmCache::SetSensors(const path& root, const std::vector<string>& entries, const SensorPaths& sensors)
+{
+    lock_guard lock{mtx_};
+    SensorEntry& entry = sensors_[root.string()];
+    dirty_ = dirty_ || entry.entries != entries || entry.sensors != sensors;
+    entry = {entries, sensors, true};
+}
+
+// Written in place, the open descriptor is all the privileges it needs. A torn write fails the checksum
+bool WarmCache::Save()
+{
+    std::vector<char> data;
+    {
+        lock_guard lock{mtx_};
+        const bool unused = std::any_of(fonts_.begin(), fonts_.end(), [](const auto& font) { return !font.second.used; })
+            || std::any_of(sensors_.begin(), sensors_.end(), [](const auto& root) { return !root.second.used; });
+        if(!dirty_ && !unused) {
+            return true;
+        }
+        data = Serialize();
+        dirty_ = false;
+        EraseUnused(fonts_);
+        EraseUnused(sensors_);
+    }
+    size_t done = 0;
+    while(done < data.size()) {
+        const ssize_t result = pwrite(fd_, data.data() + done, data.size() - done, off_t(done));
+        if(result < 0 && errno == EINTR) {
+            continue;
+        }
+        if(result <= 0) {
+            std::cerr << "WarmCache -> Write failed: " << strerror(errno) << std::endl;
+            return false;
+        }
+        done += size_t(result);
+    }
+    if(ftruncate(fd_, off_t(data.size()))) {
+        std::cerr << "WarmCache -> Truncation failed: " << strerror(errno) << std::endl;
+        return false;
+    }
+    return true;
+}
+
+WarmCache::Stats WarmCache::GetStats() const
+{
+    lock_guard lock{mtx_};
+    return stats_;
+}
+
+WarmCache::runtime_error::runtime_error(const string& msg) : std::runtime_error{"WarmCache -> " + msg}
+{ }
+
+std::shared_ptr<WarmCache> CreateWarmCache(const Options& options)
+{
+    OptionalNode optionalNode = options.GetNode("startup");
+    if(!optionalNode) {
+        return nullptr;
+    }
+    const YAML::Node node = *optionalNode;
+    string file;
+    try {
+        if(!node["cache"]) {
+            return nullptr;
+        }
+        file = node["cache"].as<string>();
+    } catch(const YAML::BadConversion&) {
+        throw std::invalid_argument("WarmCache -> Reading startup failed");
+    }
+    return std::make_shared<WarmCache>(options.GetExecDir() / file);
+}
@@ -0,0 +1,108 @@
+/*
+ * Copyright (c) 2019 Dmytro Shestakov
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "workerpool.h"
+#include <utility>
+
+using std::lock_guard;
+using std::unique_lock;
+
+WorkerPool::WorkerPool(size_t workers)
+{
+    threads_.reserve(workers);
+    for(size_t i = 0; i < workers; ++i) {
+        threads_.emplace_back(&WorkerPool::Worker, this);
+    }
+}
+
+WorkerPool::~WorkerPool()
+{
+    {
+        lock_guard lock{mtx_};
+        stop_ = true;
+    }
+    start_.notify_all();
+    for(auto& thread : threads_) {
+        thread.join();
+    }
+}
+
+void WorkerPool::Begin(size_t count, const void* task, Invoke invoke)
+{
+    {
+        lock_guard lock{mtx_};
+        task_ = task;
+        invoke_ = invoke;
+        count_ = count;
+        next_ = 0;
+        active_ = threads_.size();
+        ++generation_;
+    }
+    start_.notify_all();
+}
+
+void WorkerPool::End(std::exception_ptr error)
+{
+    Execute();
+    unique_lock lock{mtx_};
+    done_.wait(lock, [this] { return active_ == 0; });
+    task_ = nullptr;
+    if(std::exception_ptr first = std::exchange(error_, nullptr); !error) {
+        error = first;
+    }
+    if(error) {
+        std::rethrow_exception(error);
+    }
+}
+
+void WorkerPool::Worker()
+{
+    uint64_t generation = 0;
+    unique_lock lock{mtx_};
+    while(true) {
+        start_.wait(lock, [&] { return stop_ || generation_ != generation; });
+        if(stop_) {
+            return;
+        }
+        generation = generation_;
+        lock.unlock();
+        Execute();
+        lock.lock();
+        if(--active_ == 0) {
+            done_.notify_one();
+        }
+    }
+}
+
+void WorkerPool::Execute()
+{
+    for(size_t i; (i = next_.fetch_add(1, std::memory_order_relaxed)) < count_; ) {
+        try {
+            invoke_(task_, i);
+        } catch(...) {
+            lock_guard lock{mtx_};
+            if(!error_) {
+                error_ = std::current_exception();
+            }
+        }
+    }
+}
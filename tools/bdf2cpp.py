@@ -0,0 +1,184 @@
+#!/usr/bin/env python3
+#
+# Copyright (c) 2019 Dmytro Shestakov
+#
+# Permission is hereby granted, free of charge, to any person obtaining a copy
+# of this software and associated documentation files (the "Software"), to deal
+# in the Software without restriction, including without limitation the rights
+# to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+# copies of the Software, and to permit persons to whom the Software is
+# furnished to do so, subject to the following conditions:
+#
+# The above copyright notice and this permission notice shall be included in all
+# copies or substantial portions of the Software.
+#
+# THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+# IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+# FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+# AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+# LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+# OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+# SOFTWARE.
+
+"""Converts BDF fonts into constant glyph tables compiled into piclock.
+
+Each font is registered under "<directory>/<file>", the same relative path
+the configuration uses, e.g. fonts-aux/hoog36.bdf. Glyphs are cropped the
+way rgb_matrix::Font draws them: columns outside [0, DWIDTH) are dropped.
+"""
+
+import argparse
+import os
+import re
+import sys
+
+WORD_BITS = 32
+
+
+class Glyph:
+    def __init__(self, codepoint, advance, left, top, width, height, rows):
+        self.codepoint = codepoint
+        self.advance = advance
+        self.left = left
+        self.top = top
+        self.width = width
+        self.height = height
+        self.rows = rows
+
+
+def parse_bdf(path):
+    height = baseline = None
+    glyphs = {}
+    with open(path, encoding="latin-1") as bdf:
+        lines = iter(bdf.read().splitlines())
+    for line in lines:
+        fields = line.split()
+        if not fields:
+            continue
+        if fields[0] == "FONTBOUNDINGBOX":
+            height = int(fields[2])
+            baseline = height + int(fields[4])
+        elif fields[0] == "STARTCHAR":
+            glyph = parse_glyph(lines)
+            if glyph is not None:
+                glyphs[glyph.codepoint] = glyph
+    if height is None:
+        raise ValueError(path + ": FONTBOUNDINGBOX is missing")
+    return height, baseline, [glyphs[cp] for cp in sorted(glyphs)]
+
+
+def parse_glyph(lines):
+    codepoint = -1
+    advance = 0
+    bbx = (0, 0, 0, 0)
+    bitmap = []
+    for line in lines:
+        fields = line.split()
+        if not fields:
+            continue
+        if fields[0] == "ENCODING":
+            codepoint = int(fields[1])
+        elif fields[0] == "DWIDTH":
+            advance = int(fields[1])
+        elif fields[0] == "BBX":
+            bbx = tuple(int(f) for f in fields[1:5])
+        elif fields[0] == "BITMAP":
+            for row in lines:
+                if row.startswith("ENDCHAR"):
+                    break
+                bitmap.append(row.strip())
+            break
+    if codepoint < 0:
+        return None
+    width, height, x_offset, y_offset = bbx
+    # Pixel columns relative to the pen position, limited to the advance like rgb_matrix does
+    first = max(0, x_offset)
+    last = min(advance, x_offset + width)
+    crop_width = max(0, last - first)
+    rows = []
+    for hex_row in bitmap[:height]:
+        bits = int(hex_row, 16) if hex_row else 0
+        total_bits = len(hex_row) * 4
+        row = 0
+        for column in range(crop_width):
+            source = first + column - x_offset
+            if bits >> (total_bits - 1 - source) & 1:
+                row |= 1 << (crop_width - 1 - column)
+        rows.append(row)
+    if crop_width == 0 or not any(rows):
+        return Glyph(codepoint, advance, 0, 0, 0, 0, [])
+    return Glyph(codepoint, advance, first, -(height + y_offset), crop_width, len(rows), rows)
+
+
+def identifier(key):
+    return re.sub(r"\W", "_", key)
+
+
+def emit_font(out, key, path):
+    height, baseline, glyphs = parse_bdf(path)
+    name = identifier(key)
+    words = []
+    entries = []
+    for glyph in glyphs:
+        if glyph.width == 0:
+            entries.append("        {{ {}, {}, 0, 0, nullptr, 0 }},".format(glyph.codepoint, glyph.advance))
+            continue
+        offset = len(words)
+        words_per_row = (glyph.width + WORD_BITS - 1) // WORD_BITS
+        for row in glyph.rows:
+            # Leftmost pixel in the most significant bit of the first word
+            row <<= words_per_row * WORD_BITS - glyph.width
+            for word in reversed(range(words_per_row)):
+                words.append(row >> (word * WORD_BITS) & 0xFFFFFFFF)
+        entries.append("        {{ {}, {}, {}, {}, &BlitGlyph<{}, {}>, {} }},".format(
+            glyph.codepoint, glyph.advance, glyph.left, glyph.top, glyph.width, glyph.height, offset))
+    ascii = [-1] * 128
+    for index, glyph in enumerate(glyphs):
+        if glyph.codepoint < 128:
+            ascii[glyph.codepoint] = index
+
+    out.write("    // {}\n".format(os.path.basename(path)))
+    out.write("    const uint32_t {}_bitmap[] = {{".format(name))
+    for i, word in enumerate(words or [0]):
+        out.write(("\n        " if i % 8 == 0 else " ") + "0x{:08x},".format(word))
+    out.write("\n    };\n\n")
+    out.write("    const EmbeddedGlyph {}_glyphs[] = {{\n".format(name))
+    out.write("\n".join(entries))
+    out.write("\n    };\n\n")
+    out.write("    const int16_t {}_ascii[128] = {{".format(name))
+    for i, index in enumerate(ascii):
+        out.write(("\n        " if i % 16 == 0 else " ") + "{},".format(index))
+    out.write("\n    };\n\n")
+    out.write("    const EmbeddedFontData {} = {{\n".format(name))
+    out.write("        \"{}\", {}, {},\n".format(key, height, baseline))
+    out.write("        {0}_glyphs, std::size({0}_glyphs), {0}_bitmap, {0}_ascii\n".format(name))
+    out.write("    };\n\n")
+    return name
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("-o", "--output", required=True, help="generated C++ source")
+    parser.add_argument("fonts", nargs="*", help="BDF files to embed")
+    args = parser.parse_args()
+
+    keys = {}
+    for path in args.fonts:
+        key = "{}/{}".format(os.path.basename(os.path.dirname(os.path.abspath(path))), os.path.basename(path))
+        keys[key] = path
+
+    with open(args.output, "w") as out:
+        out.write("// Generated by tools/bdf2cpp.py, do not edit\n\n")
+        out.write("#include \"fonts.h\"\n\n")
+        out.write("namespace {\n\n")
+        names = [emit_font(out, key, keys[key]) for key in sorted(keys)]
+        out.write("}\n\n")
+        out.write("const EmbeddedFontData* const EMBEDDED_FONTS[] = {\n")
+        for name in names:
+            out.write("    &{},\n".format(name))
+        out.write("    nullptr\n};\n")
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
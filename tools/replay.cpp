@@ -0,0 +1,131 @@
+/*
+ * Copyright (c) 2019 Dmytro Shestakov
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+// Plays a frame recording back through the headless display, for a look at what the panel
+// showed and at how well the frames compress
+
+#include "display.h"
+#include "recorder.h"
+
+#include <getopt.h>
+#include <iomanip>
+#include <iostream>
+#include <optional>
+#include <thread>
+
+using std::string;
+using clock_type = std::chrono::steady_clock;
+
+namespace {
+
+    void Usage(const char* name)
+    {
+        std::cerr << "Usage: " << name << " [-m] [-d dump_prefix] [-f ppm|raw] [-n frames] recording\n"
+                     "  -m  as fast as possible instead of the recorded timing\n"
+                     "  -d  dump the frames with that prefix, nothing is dumped by default\n"
+                     "  -f  dump format, ppm - file per frame, raw - single rgb24 stream\n"
+                     "  -n  stop after that many frames, 0 - all of them\n";
+    }
+
+}
+
+int main(int argc, char* argv[])
+{
+    bool unpaced = false;
+    std::filesystem::path dumpPath;
+    string format = "ppm";
+    uint64_t frameLimit = 0;
+    for(int opt; (opt = getopt(argc, argv, "md:f:n:h")) != -1;) {
+        switch(opt) {
+        case 'm': unpaced = true; break;
+        case 'd': dumpPath = optarg; break;
+        case 'f': format = optarg; break;
+        case 'n': frameLimit = strtoull(optarg, nullptr, 10); break;
+        default:
+            Usage(argv[0]);
+            return 1;
+        }
+    }
+    if(optind != argc - 1 || (format != "ppm" && format != "raw")) {
+        Usage(argv[0]);
+        return 1;
+    }
+
+    try {
+        FrameReader reader{argv[optind]};
+        HeadlessDisplay::Config config{};
+        config.width = reader.width();
+        config.height = reader.height();
+        config.dumpPath = dumpPath;
+        config.format = format == "raw" ? HeadlessDisplay::DumpFormat::RAW : HeadlessDisplay::DumpFormat::PPM;
+        HeadlessDisplay display{config};
+        SoftCanvas canvas{reader.width(), reader.height()};
+
+        uint64_t frames = 0;
+        uint64_t keyframes = 0;
+        uint64_t bytes = 0;
+        uint64_t late = 0;
+        clock_type::duration decodeTime{};
+        std::optional<int64_t> origin;
+        const auto start = clock_type::now();
+        FrameReader::Frame frame{};
+        while(!frameLimit || frames < frameLimit) {
+            const auto decodeStart = clock_type::now();
+            if(!reader.Next(canvas, frame)) {
+                break;
+            }
+            decodeTime += clock_type::now() - decodeStart;
+            // The first frame shown sets the time origin, the recording may start with a rotated file
+            if(!unpaced) {
+                if(!origin) {
+                    origin = frame.time;
+                }
+                const auto due = start + std::chrono::nanoseconds{frame.time - *origin};
+                if(clock_type::now() > due + std::chrono::milliseconds{5}) {
+                    ++late;
+                }
+                std::this_thread::sleep_until(due);
+            }
+            display.Present(canvas, {frame.changed});
+            ++frames;
+            keyframes += frame.keyframe;
+            bytes += frame.bytes;
+        }
+        display.Clear();
+
+        const size_t frameSize = canvas.Size();
+        std::cout << "Frames: " << frames << ", keyframes: " << keyframes << "\n"
+                  << std::fixed << std::setprecision(1)
+                  << "Bytes per frame: " << (frames ? double(bytes) / double(frames) : 0.)
+                  << " of " << frameSize << " raw\n"
+                  << "Decode time per frame: "
+                  << (frames ? std::chrono::duration<double, std::micro>(decodeTime).count() / double(frames) : 0.)
+                  << " us\n";
+        if(!unpaced) {
+            std::cout << "Late frames: " << late << "\n";
+        }
+    } catch(const std::exception& e) {
+        std::cerr << e.what() << std::endl;
+        return 1;
+    }
+    return 0;
+}